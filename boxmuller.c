@@ -12,29 +12,29 @@
 #include <stdlib.h>
 #include "boxmuller.h"
 
-double box_muller(double m, double s)	/* normal random variate generator */
+/* The spare variate lives in the (per thread) generator instead of in
+   static variables so that we may be called from multiple threads */
+double box_muller(struct rng *rng, double m, double s)	/* normal random variate generator */
 {				        /* mean m, standard deviation s */
 	double x1, x2, w, _y1;
-	static double y2;
-	static int use_last = 0;
 
-	if (use_last)		        /* use value from previous call */
+	if (rng->has_spare)		        /* use value from previous call */
 	{
-		_y1 = y2;
-		use_last = 0;
+		_y1 = rng->spare;
+		rng->has_spare = false;
 	}
 	else
 	{
 		do {
-			x1 = 2.0 * drand48() - 1.0;
-			x2 = 2.0 * drand48() - 1.0;
+			x1 = 2.0 * rng_double(rng) - 1.0;
+			x2 = 2.0 * rng_double(rng) - 1.0;
 			w = x1 * x1 + x2 * x2;
-		} while ( w >= 1.0 );
+		} while ( w >= 1.0 || w == 0.0 );
 
 		w = sqrt( (-2.0 * log( w ) ) / w );
 		_y1 = x1 * w;
-		y2 = x2 * w;
-		use_last = 1;
+		rng->spare = x2 * w;
+		rng->has_spare = true;
 	}
 
         double result = ( m + _y1 * s );
@@ -1,6 +1,8 @@
 #ifndef BOX_MULLER_H
 #define BOX_MULLER_H 1
 
-extern double box_muller(double m, double s);
+#include "rng.h"
+
+extern double box_muller(struct rng *rng, double m, double s);
 
 #endif
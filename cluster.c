@@ -0,0 +1,339 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cluster.h"
+
+/** Don't accept messages bigger than this */
+#define CLUSTER_MAX_MESSAGE (64 * 1024 * 1024)
+
+/** The number of seconds to wait for an agent to start listening */
+#define CLUSTER_CONNECT_RETRIES 10
+
+static bool ensure_capacity(struct cluster_buffer *buffer, size_t size) {
+    if (buffer->size + size <= buffer->capacity) {
+        return true;
+    }
+
+    size_t capacity = buffer->capacity ? buffer->capacity : 1024;
+    while (capacity < buffer->size + size) {
+        capacity *= 2;
+    }
+    char *data = realloc(buffer->data, capacity);
+    if (data == NULL) {
+        buffer->error = true;
+        return false;
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return true;
+}
+
+void cluster_buffer_destroy(struct cluster_buffer *buffer) {
+    free(buffer->data);
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+void cluster_put_u32(struct cluster_buffer *buffer, uint32_t value) {
+    if (ensure_capacity(buffer, sizeof(value))) {
+        value = htonl(value);
+        memcpy(buffer->data + buffer->size, &value, sizeof(value));
+        buffer->size += sizeof(value);
+    }
+}
+
+void cluster_put_u64(struct cluster_buffer *buffer, uint64_t value) {
+    cluster_put_u32(buffer, (uint32_t)(value >> 32));
+    cluster_put_u32(buffer, (uint32_t)value);
+}
+
+void cluster_put_string(struct cluster_buffer *buffer, const char *str) {
+    size_t len = strlen(str);
+    cluster_put_u32(buffer, (uint32_t)len);
+    if (ensure_capacity(buffer, len)) {
+        memcpy(buffer->data + buffer->size, str, len);
+        buffer->size += len;
+    }
+}
+
+void cluster_put_histogram(struct cluster_buffer *buffer,
+                           const struct histogram *histogram) {
+    uint32_t used = 0;
+    for (int ii = 0; ii < HISTOGRAM_BUCKETS; ++ii) {
+        if (histogram->buckets[ii] != 0) {
+            ++used;
+        }
+    }
+
+    cluster_put_u64(buffer, histogram->count);
+    cluster_put_u64(buffer, histogram->min);
+    cluster_put_u64(buffer, histogram->max);
+    cluster_put_u64(buffer, histogram->total);
+    /* Most of the buckets are empty, so only send the used ones */
+    cluster_put_u32(buffer, used);
+    for (int ii = 0; ii < HISTOGRAM_BUCKETS; ++ii) {
+        if (histogram->buckets[ii] != 0) {
+            cluster_put_u32(buffer, (uint32_t)ii);
+            cluster_put_u64(buffer, histogram->buckets[ii]);
+        }
+    }
+}
+
+uint32_t cluster_get_u32(struct cluster_buffer *buffer) {
+    uint32_t value;
+    if (buffer->offset + sizeof(value) > buffer->size) {
+        buffer->error = true;
+        return 0;
+    }
+    memcpy(&value, buffer->data + buffer->offset, sizeof(value));
+    buffer->offset += sizeof(value);
+    return ntohl(value);
+}
+
+uint64_t cluster_get_u64(struct cluster_buffer *buffer) {
+    uint64_t value = (uint64_t)cluster_get_u32(buffer) << 32;
+    return value | cluster_get_u32(buffer);
+}
+
+char *cluster_get_string(struct cluster_buffer *buffer) {
+    uint32_t len = cluster_get_u32(buffer);
+    if (buffer->error || buffer->offset + len > buffer->size) {
+        buffer->error = true;
+        return NULL;
+    }
+
+    char *ret = malloc(len + 1);
+    if (ret == NULL) {
+        buffer->error = true;
+        return NULL;
+    }
+    memcpy(ret, buffer->data + buffer->offset, len);
+    ret[len] = '\0';
+    buffer->offset += len;
+    return ret;
+}
+
+bool cluster_get_histogram(struct cluster_buffer *buffer,
+                           struct histogram *histogram) {
+    memset(histogram, 0, sizeof(*histogram));
+    histogram->count = cluster_get_u64(buffer);
+    histogram->min = cluster_get_u64(buffer);
+    histogram->max = cluster_get_u64(buffer);
+    histogram->total = cluster_get_u64(buffer);
+
+    uint32_t used = cluster_get_u32(buffer);
+    for (uint32_t ii = 0; ii < used && !buffer->error; ++ii) {
+        uint32_t idx = cluster_get_u32(buffer);
+        uint64_t count = cluster_get_u64(buffer);
+        if (idx >= HISTOGRAM_BUCKETS) {
+            buffer->error = true;
+        } else {
+            histogram->buckets[idx] = count;
+        }
+    }
+
+    return !buffer->error;
+}
+
+/**
+ * Split [host:]port and look it up
+ */
+static struct addrinfo *lookup_address(const char *address, bool passive) {
+    char host[NI_MAXHOST];
+    const char *port = strrchr(address, ':');
+    struct addrinfo *ai = NULL;
+    struct addrinfo hints = {
+        .ai_flags = passive ? AI_PASSIVE : 0,
+        .ai_family = AF_UNSPEC,
+        .ai_protocol = IPPROTO_TCP,
+        .ai_socktype = SOCK_STREAM };
+
+    if (port == NULL) {
+        port = address;
+        host[0] = '\0';
+    } else {
+        size_t len = port - address;
+        if (len >= sizeof(host)) {
+            fprintf(stderr, "Invalid address: %s\n", address);
+            return NULL;
+        }
+        memcpy(host, address, len);
+        host[len] = '\0';
+        ++port;
+    }
+
+    int error = getaddrinfo(host[0] ? host : NULL, port, &hints, &ai);
+    if (error != 0) {
+        fprintf(stderr, "getaddrinfo(%s): %s\n", address,
+                error == EAI_SYSTEM ? strerror(errno) : gai_strerror(error));
+        return NULL;
+    }
+    return ai;
+}
+
+int cluster_listen(const char *address) {
+    struct addrinfo *ai = lookup_address(address, true);
+    int flag = 1;
+    int sock;
+
+    if (ai == NULL) {
+        return -1;
+    }
+
+    if ((sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) == -1) {
+        fprintf(stderr, "Failed to create socket: %s\n", strerror(errno));
+    } else if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR,
+                          &flag, sizeof(flag)) == -1 ||
+               bind(sock, ai->ai_addr, ai->ai_addrlen) == -1 ||
+               listen(sock, 16) == -1) {
+        fprintf(stderr, "Failed to listen on %s: %s\n", address,
+                strerror(errno));
+        close(sock);
+        sock = -1;
+    }
+
+    freeaddrinfo(ai);
+    return sock;
+}
+
+int cluster_connect(const char *address) {
+    struct addrinfo *ai = lookup_address(address, false);
+    int flag = 1;
+    int sock = -1;
+
+    if (ai == NULL) {
+        return -1;
+    }
+
+    for (int ii = 0; ii < CLUSTER_CONNECT_RETRIES && sock == -1; ++ii) {
+        if ((sock = socket(ai->ai_family, ai->ai_socktype,
+                           ai->ai_protocol)) == -1) {
+            fprintf(stderr, "Failed to create socket: %s\n", strerror(errno));
+            break;
+        }
+
+        if (connect(sock, ai->ai_addr, ai->ai_addrlen) == -1) {
+            if (ii + 1 == CLUSTER_CONNECT_RETRIES) {
+                fprintf(stderr, "Failed to connect to agent %s: %s\n",
+                        address, strerror(errno));
+            }
+            close(sock);
+            sock = -1;
+            sleep(1);
+        }
+    }
+
+    if (sock != -1) {
+        (void)setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    }
+
+    freeaddrinfo(ai);
+    return sock;
+}
+
+static bool send_all(int sock, const void *data, size_t len) {
+    const char *ptr = data;
+    while (len > 0) {
+        ssize_t nw = send(sock, ptr, len, 0);
+        if (nw == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Failed to send data: %s\n", strerror(errno));
+            return false;
+        }
+        ptr += nw;
+        len -= nw;
+    }
+    return true;
+}
+
+static bool receive_all(int sock, void *data, size_t len) {
+    char *ptr = data;
+    while (len > 0) {
+        ssize_t nr = recv(sock, ptr, len, 0);
+        if (nr == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Failed to read data: %s\n", strerror(errno));
+            return false;
+        } else if (nr == 0) {
+            fprintf(stderr, "Lost contact with the other side\n");
+            return false;
+        }
+        ptr += nr;
+        len -= nr;
+    }
+    return true;
+}
+
+bool cluster_send(int sock, enum ClusterMessage type,
+                  const struct cluster_buffer *payload) {
+    uint32_t header[2];
+    size_t size = payload ? payload->size : 0;
+
+    if (payload != NULL && payload->error) {
+        fprintf(stderr, "Failed to build message\n");
+        return false;
+    }
+
+    header[0] = htonl((uint32_t)type);
+    header[1] = htonl((uint32_t)size);
+    return send_all(sock, header, sizeof(header)) &&
+        (size == 0 || send_all(sock, payload->data, size));
+}
+
+bool cluster_receive(int sock, enum ClusterMessage *type,
+                     struct cluster_buffer *payload) {
+    uint32_t header[2];
+
+    if (!receive_all(sock, header, sizeof(header))) {
+        return false;
+    }
+
+    *type = (enum ClusterMessage)ntohl(header[0]);
+    size_t size = ntohl(header[1]);
+    if (size > CLUSTER_MAX_MESSAGE) {
+        fprintf(stderr, "Message too big (%lu bytes)\n", (unsigned long)size);
+        return false;
+    }
+
+    payload->size = payload->offset = 0;
+    payload->error = false;
+    if (!ensure_capacity(payload, size)) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return false;
+    }
+    payload->size = size;
+    return size == 0 || receive_all(sock, payload->data, size);
+}
@@ -0,0 +1,107 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "metrics.h"
+
+#ifdef __cplusplus
+extern "C"  {
+#endif
+
+    /*
+     * The messages between the coordinator and the agents. Every message
+     * is a 32 bit type and a 32 bit length (network byte order) followed
+     * by the payload:
+     *
+     *   CONFIG  coordinator -> agent: agent index, populate flag and the
+     *           command line to run
+     *   READY   agent -> coordinator: populated and connected
+     *   START   coordinator -> agent: sent to all agents at once when
+     *           every agent is ready
+     *   RESULT  agent -> coordinator: counters and histograms
+     *   ERROR   agent -> coordinator: the reason the agent gave up
+     */
+    enum ClusterMessage {
+        CLUSTER_CONFIG = 1,
+        CLUSTER_READY,
+        CLUSTER_START,
+        CLUSTER_RESULT,
+        CLUSTER_ERROR
+    };
+
+    /**
+     * A growing buffer to build or parse the payload of a message
+     */
+    struct cluster_buffer {
+        char *data;
+        size_t size;
+        size_t capacity;
+        /** The read position */
+        size_t offset;
+        /** Set if we tried to read past the end or failed to grow */
+        bool error;
+    };
+
+    void cluster_buffer_destroy(struct cluster_buffer *buffer);
+    void cluster_put_u32(struct cluster_buffer *buffer, uint32_t value);
+    void cluster_put_u64(struct cluster_buffer *buffer, uint64_t value);
+    void cluster_put_string(struct cluster_buffer *buffer, const char *str);
+    void cluster_put_histogram(struct cluster_buffer *buffer,
+                               const struct histogram *histogram);
+    uint32_t cluster_get_u32(struct cluster_buffer *buffer);
+    uint64_t cluster_get_u64(struct cluster_buffer *buffer);
+    /** The string is allocated with malloc (NULL on error) */
+    char *cluster_get_string(struct cluster_buffer *buffer);
+    bool cluster_get_histogram(struct cluster_buffer *buffer,
+                               struct histogram *histogram);
+
+    /**
+     * Listen for the coordinator on [host:]port
+     * @return the socket or -1 on error
+     */
+    int cluster_listen(const char *address);
+
+    /**
+     * Connect to the agent listening on host:port (retrying for a few
+     * seconds while the agent starts)
+     * @return the socket or -1 on error
+     */
+    int cluster_connect(const char *address);
+
+    bool cluster_send(int sock, enum ClusterMessage type,
+                      const struct cluster_buffer *payload);
+
+    /**
+     * Receive the next message (the payload replaces the contents of the
+     * buffer)
+     */
+    bool cluster_receive(int sock, enum ClusterMessage *type,
+                         struct cluster_buffer *payload);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,232 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "keydist.h"
+
+/**
+ * Calculate the generalized harmonic number sum(1/i^theta) for
+ * i = 1..n. Summing a hundred million terms takes a couple of seconds,
+ * so we only add up the first terms and use the Euler-Maclaurin formula
+ * for the rest of the series (the error is way below what matters for
+ * picking keys).
+ */
+static double zeta(uint64_t n, double theta) {
+    const uint64_t exact = 1000000;
+    double sum = 0;
+    uint64_t limit = n < exact ? n : exact;
+
+    for (uint64_t ii = 1; ii <= limit; ++ii) {
+        sum += pow((double)ii, -theta);
+    }
+
+    if (n > exact) {
+        double m = (double)exact;
+        double x = (double)n;
+        sum += (pow(x, 1 - theta) - pow(m, 1 - theta)) / (1 - theta);
+        sum += (pow(x, -theta) - pow(m, -theta)) / 2;
+        sum += (-theta * pow(x, -theta - 1) + theta * pow(m, -theta - 1)) / 12;
+    }
+
+    return sum;
+}
+
+/**
+ * FNV-1a over the 8 bytes of the number, used to scatter the popular
+ * items of the zipfian distribution over the entire keyspace.
+ */
+static uint64_t fnv1a64(uint64_t val) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int ii = 0; ii < 8; ++ii) {
+        hash ^= val & 0xff;
+        hash *= 0x100000001b3ULL;
+        val >>= 8;
+    }
+    return hash;
+}
+
+bool keydist_parse(struct keydist *dist, const char *spec) {
+    char name[32];
+    const char *args = strchr(spec, ':');
+    size_t len = args ? (size_t)(args - spec) : strlen(spec);
+
+    if (len >= sizeof(name)) {
+        return false;
+    }
+    memcpy(name, spec, len);
+    name[len] = '\0';
+
+    memset(dist, 0, sizeof(*dist));
+    dist->theta = 0.99;
+    dist->hot_set_fraction = 0.2;
+    dist->hot_opn_fraction = 0.8;
+    dist->shape = 1.16;
+
+    if (strcmp(name, "uniform") == 0) {
+        dist->type = KD_UNIFORM;
+    } else if (strcmp(name, "zipf") == 0 || strcmp(name, "scrambled") == 0) {
+        dist->type = (name[0] == 'z') ? KD_ZIPF : KD_SCRAMBLED_ZIPF;
+        if (args != NULL) {
+            dist->theta = atof(args + 1);
+        }
+        if (dist->theta <= 0.0 || dist->theta >= 1.0) {
+            fprintf(stderr, "The zipfian constant must be in (0, 1)\n");
+            return false;
+        }
+    } else if (strcmp(name, "hotspot") == 0) {
+        dist->type = KD_HOTSPOT;
+        if (args != NULL) {
+            char *end;
+            dist->hot_set_fraction = strtod(args + 1, &end);
+            if (*end == ':') {
+                dist->hot_opn_fraction = atof(end + 1);
+            }
+        }
+        if (dist->hot_set_fraction <= 0.0 || dist->hot_set_fraction > 1.0 ||
+            dist->hot_opn_fraction < 0.0 || dist->hot_opn_fraction > 1.0) {
+            fprintf(stderr, "The hotspot fractions must be in (0, 1]\n");
+            return false;
+        }
+    } else if (strcmp(name, "pareto") == 0) {
+        dist->type = KD_PARETO;
+        if (args != NULL) {
+            dist->shape = atof(args + 1);
+        }
+        if (dist->shape <= 0.0) {
+            fprintf(stderr, "The pareto shape must be positive\n");
+            return false;
+        }
+    } else {
+        fprintf(stderr, "Unknown key distribution: %s\n", name);
+        return false;
+    }
+
+    return true;
+}
+
+bool keydist_init(struct keydist *dist, uint64_t items) {
+    if (items == 0) {
+        return false;
+    }
+    dist->items = items;
+
+    switch (dist->type) {
+    case KD_ZIPF:
+    case KD_SCRAMBLED_ZIPF:
+        {
+            double zeta2 = zeta(2, dist->theta);
+            dist->zetan = zeta(items, dist->theta);
+            dist->alpha = 1.0 / (1.0 - dist->theta);
+            dist->half_pow_theta = 1.0 + pow(0.5, dist->theta);
+            dist->eta = (1 - pow(2.0 / items, 1 - dist->theta)) /
+                (1 - zeta2 / dist->zetan);
+        }
+        break;
+    case KD_HOTSPOT:
+        dist->hot_items = (uint64_t)(dist->hot_set_fraction * items);
+        if (dist->hot_items == 0) {
+            dist->hot_items = 1;
+        }
+        break;
+    case KD_PARETO:
+        /* Bounded pareto on [1, items + 1) */
+        dist->pareto_c = 1.0 - pow((double)items + 1, -dist->shape);
+        break;
+    case KD_UNIFORM:
+        break;
+    }
+
+    return true;
+}
+
+/**
+ * Draw from the zipfian distribution with the method from Gray et al,
+ * "Quickly generating billion-record synthetic databases" (which is what
+ * YCSB use as well).
+ */
+static uint64_t zipf_next(const struct keydist *dist, struct rng *rng) {
+    double u = rng_double(rng);
+    double uz = u * dist->zetan;
+
+    if (uz < 1.0) {
+        return 0;
+    }
+    if (uz < dist->half_pow_theta) {
+        return 1;
+    }
+
+    uint64_t ret = (uint64_t)(dist->items *
+                              pow(dist->eta * u - dist->eta + 1, dist->alpha));
+    return ret < dist->items ? ret : dist->items - 1;
+}
+
+uint64_t keydist_next(const struct keydist *dist, struct rng *rng) {
+    switch (dist->type) {
+    case KD_ZIPF:
+        return zipf_next(dist, rng);
+    case KD_SCRAMBLED_ZIPF:
+        return fnv1a64(zipf_next(dist, rng)) % dist->items;
+    case KD_HOTSPOT:
+        if (dist->hot_items == dist->items ||
+            rng_double(rng) < dist->hot_opn_fraction) {
+            return rng_range(rng, dist->hot_items);
+        }
+        return dist->hot_items + rng_range(rng, dist->items - dist->hot_items);
+    case KD_PARETO:
+        {
+            double x = pow(1.0 - rng_double(rng) * dist->pareto_c,
+                           -1.0 / dist->shape);
+            uint64_t ret = (uint64_t)x - 1;
+            return ret < dist->items ? ret : dist->items - 1;
+        }
+    case KD_UNIFORM:
+    default:
+        return rng_range(rng, dist->items);
+    }
+}
+
+uint64_t keydist_rank(const struct keydist *dist, uint64_t rank) {
+    if (dist->type == KD_SCRAMBLED_ZIPF) {
+        return fnv1a64(rank) % dist->items;
+    }
+    /* The other distributions favour the low indexes */
+    return rank;
+}
+
+const char *keydist_name(const struct keydist *dist) {
+    switch (dist->type) {
+    case KD_ZIPF:
+        return "zipf";
+    case KD_SCRAMBLED_ZIPF:
+        return "scrambled zipf";
+    case KD_HOTSPOT:
+        return "hotspot";
+    case KD_PARETO:
+        return "pareto";
+    case KD_UNIFORM:
+    default:
+        return "uniform";
+    }
+}
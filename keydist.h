@@ -0,0 +1,104 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#ifndef KEYDIST_H
+#define KEYDIST_H 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "rng.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+    /**
+     * The key popularity distributions we know how to generate
+     */
+    enum KeyDistribution {
+        KD_UNIFORM,
+        KD_ZIPF,
+        KD_SCRAMBLED_ZIPF,
+        KD_HOTSPOT,
+        KD_PARETO
+    };
+
+    /**
+     * A key distribution. All of the expensive math is done up front
+     * by keydist_init so that keydist_next is O(1).
+     */
+    struct keydist {
+        enum KeyDistribution type;
+        /** The number of keys to pick from */
+        uint64_t items;
+
+        /** Zipfian constant (zipf / scrambled) */
+        double theta;
+        double alpha;
+        double zetan;
+        double eta;
+        double half_pow_theta;
+
+        /** Fraction of the keyspace that is hot (hotspot) */
+        double hot_set_fraction;
+        /** Fraction of the operations going to the hot set (hotspot) */
+        double hot_opn_fraction;
+        uint64_t hot_items;
+
+        /** Shape parameter (pareto) */
+        double shape;
+        double pareto_c;
+    };
+
+    /**
+     * Parse a distribution specification like "zipf:0.99",
+     * "scrambled:0.99", "hotspot:0.2:0.8" or "pareto:1.16".
+     * @return true on success, false if the spec is invalid
+     */
+    bool keydist_parse(struct keydist *dist, const char *spec);
+
+    /**
+     * Precompute the constants for the distribution over the given
+     * number of items.
+     */
+    bool keydist_init(struct keydist *dist, uint64_t items);
+
+    /**
+     * Get the next key index in the range [0, items)
+     * @param dist the distribution to draw from
+     * @param rng the (thread local) generator to use
+     */
+    uint64_t keydist_next(const struct keydist *dist, struct rng *rng);
+
+    /**
+     * Get the index of the rank'th most popular key (every key is as
+     * popular as the next with the uniform distribution)
+     * @param dist the distribution
+     * @param rank the popularity rank in the range [0, items)
+     */
+    uint64_t keydist_rank(const struct keydist *dist, uint64_t rank);
+
+    const char *keydist_name(const struct keydist *dist);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
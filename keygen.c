@@ -0,0 +1,201 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "keygen.h"
+
+static const char digits2[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const char padding[KEYGEN_MAX_KEY + 1] =
+    "__________________________________________________"
+    "__________________________________________________"
+    "__________________________________________________"
+    "__________________________________________________"
+    "__________________________________________________";
+
+static size_t count_digits(uint64_t val) {
+    size_t ret = 1;
+    for (;;) {
+        if (val < 10) {
+            return ret;
+        }
+        if (val < 100) {
+            return ret + 1;
+        }
+        if (val < 1000) {
+            return ret + 2;
+        }
+        if (val < 10000) {
+            return ret + 3;
+        }
+        val /= 10000;
+        ret += 4;
+    }
+}
+
+/**
+ * Format the number in decimal two digits at a time
+ * @return the number of characters written
+ */
+static size_t u64toa(uint64_t val, char *dest) {
+    size_t len = count_digits(val);
+    char *p = dest + len;
+
+    while (val >= 100) {
+        unsigned int ii = (unsigned int)(val % 100) * 2;
+        val /= 100;
+        *--p = digits2[ii + 1];
+        *--p = digits2[ii];
+    }
+
+    if (val < 10) {
+        *--p = (char)('0' + val);
+    } else {
+        *--p = digits2[val * 2 + 1];
+        *--p = digits2[val * 2];
+    }
+
+    return len;
+}
+
+/**
+ * Get the length the key should be padded to. Each key gets its own
+ * (but always the same) length so that the population of keys have
+ * lengths uniformly distributed between min_len and max_len
+ */
+static size_t padded_length(const struct keygen *gen, uint64_t idx) {
+    if (gen->max_len == gen->min_len) {
+        return gen->min_len;
+    }
+
+    uint64_t hash = idx * 0x9e3779b97f4a7c15ULL;
+    hash ^= hash >> 32;
+    return gen->min_len + (size_t)(hash % (gen->max_len - gen->min_len + 1));
+}
+
+static size_t format_key(const struct keygen *gen, uint64_t idx, char *dest) {
+    size_t len = gen->nprefix;
+    memcpy(dest, gen->prefix, len);
+    len += u64toa(idx, dest + len);
+
+    size_t wanted = padded_length(gen, idx);
+    if (wanted > len) {
+        memcpy(dest + len, padding, wanted - len);
+        len = wanted;
+    }
+    dest[len] = '\0';
+
+    return len;
+}
+
+bool keygen_parse_length(struct keygen *gen, const char *spec) {
+    char *end;
+    long min = strtol(spec, &end, 10);
+    long max = min;
+
+    if (*end == ':') {
+        max = strtol(end + 1, &end, 10);
+    }
+
+    if (*end != '\0' || min < 0 || max < min || max > KEYGEN_MAX_KEY) {
+        fprintf(stderr, "Invalid key length: %s\n", spec);
+        return false;
+    }
+
+    gen->min_len = (size_t)min;
+    gen->max_len = (size_t)max;
+    return true;
+}
+
+bool keygen_init(struct keygen *gen, const char *prefix, uint64_t items) {
+    gen->prefix = prefix;
+    gen->nprefix = strlen(prefix);
+    gen->items = items;
+    gen->arena = NULL;
+    gen->offset = NULL;
+
+    if (gen->nprefix + count_digits(items) > KEYGEN_MAX_KEY) {
+        fprintf(stderr, "The keys would be longer than %d bytes\n",
+                KEYGEN_MAX_KEY);
+        return false;
+    }
+
+    uint64_t total = 0;
+    for (uint64_t ii = 0; ii < items && total <= KEYGEN_ARENA_LIMIT; ++ii) {
+        size_t len = gen->nprefix + count_digits(ii);
+        size_t wanted = padded_length(gen, ii);
+        total += ((wanted > len) ? wanted : len) + 1;
+    }
+    total += (items + 1) * sizeof(uint64_t);
+
+    if (total > KEYGEN_ARENA_LIMIT) {
+        /* format the keys on the fly */
+        return true;
+    }
+
+    gen->offset = malloc((items + 1) * sizeof(uint64_t));
+    gen->arena = malloc(total - (items + 1) * sizeof(uint64_t));
+    if (gen->offset == NULL || gen->arena == NULL) {
+        fprintf(stderr, "Failed to allocate memory for the keys\n");
+        keygen_destroy(gen);
+        return false;
+    }
+
+    uint64_t offset = 0;
+    for (uint64_t ii = 0; ii < items; ++ii) {
+        gen->offset[ii] = offset;
+        offset += format_key(gen, ii, gen->arena + offset) + 1;
+    }
+    gen->offset[items] = offset;
+
+    return true;
+}
+
+void keygen_destroy(struct keygen *gen) {
+    free(gen->arena);
+    free(gen->offset);
+    gen->arena = NULL;
+    gen->offset = NULL;
+}
+
+const char *keygen_key(const struct keygen *gen, uint64_t idx,
+                       char *buffer, size_t *nkey) {
+    if (gen->arena != NULL && idx < gen->items) {
+        *nkey = gen->offset[idx + 1] - gen->offset[idx] - 1;
+        return gen->arena + gen->offset[idx];
+    }
+
+    *nkey = format_key(gen, idx, buffer);
+    return buffer;
+}
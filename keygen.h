@@ -0,0 +1,89 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#ifndef KEYGEN_H
+#define KEYGEN_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/** The longest key memcached accepts */
+#define KEYGEN_MAX_KEY 250
+
+/** Don't build an arena bigger than this (in bytes) */
+#define KEYGEN_ARENA_LIMIT (512 * 1024 * 1024)
+
+    /**
+     * The key generator. A key is the prefix followed by the key index
+     * in decimal, optionally padded up to a length picked (per key)
+     * between min_len and max_len.
+     */
+    struct keygen {
+        const char *prefix;
+        size_t nprefix;
+        uint64_t items;
+        size_t min_len;
+        size_t max_len;
+        /**
+         * All of the keys (nul terminated) back to back. offset[ii] is
+         * where key ii starts and offset[ii + 1] - offset[ii] - 1 is its
+         * length. NULL if the keyspace is too big to store
+         */
+        char *arena;
+        uint64_t *offset;
+    };
+
+    /**
+     * Parse a key length specification: "len" or "min:max"
+     * @return true on success, false if the spec is invalid
+     */
+    bool keygen_parse_length(struct keygen *gen, const char *spec);
+
+    /**
+     * Initialize the key generator and build the arena if it fits
+     * within KEYGEN_ARENA_LIMIT
+     * @return true on success, false if the parameters are invalid or
+     *         we failed to allocate memory
+     */
+    bool keygen_init(struct keygen *gen, const char *prefix, uint64_t items);
+
+    void keygen_destroy(struct keygen *gen);
+
+    /**
+     * Get the key for a given index
+     * @param gen the key generator
+     * @param idx the key index
+     * @param buffer where to format the key if it isn't in the arena
+     *               (must be at least KEYGEN_MAX_KEY + 1 bytes)
+     * @param nkey where to store the length of the key
+     * @return the (nul terminated) key
+     */
+    const char *keygen_key(const struct keygen *gen, uint64_t idx,
+                           char *buffer, size_t *nkey);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
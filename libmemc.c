@@ -40,6 +40,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <ctype.h>
 #include <assert.h>
 #include <sys/uio.h>
 #include <math.h>
@@ -53,7 +54,9 @@ struct Server {
     size_t buffersize;
 };
 
-enum StoreCommand {add, set, replace};
+enum StoreCommand {add, set, replace, append, prepend, cas};
+enum RetrieveCommand {get, get_cas, get_touch};
+enum KeyCommand {delete_key, incr, decr, touch};
 
 struct Memcache {
     struct Server** servers;
@@ -65,13 +68,32 @@ static struct Server* server_create(const char *name, in_port_t port);
 static void server_destroy(struct Server *server);
 static int textual_store(struct Server* server, enum StoreCommand cmd,
                          const struct Item *item);
-static int textual_get(struct Server* server, struct Item* item);
+static int textual_get(struct Server* server, enum RetrieveCommand cmd,
+                       struct Item* item);
+static int textual_key_command(struct Server* server, enum KeyCommand cmd,
+                               const char *key, size_t nkey, uint64_t delta,
+                               uint32_t exptime, uint64_t *value);
 static int binary_store(struct Server* server, enum StoreCommand cmd,
                         const struct Item *item);
-static int binary_get(struct Server* server, struct Item* item);
+static int binary_get(struct Server* server, enum RetrieveCommand cmd,
+                      struct Item* item);
+static int binary_key_command(struct Server* server, enum KeyCommand cmd,
+                              const char *key, size_t nkey, uint64_t delta,
+                              uint32_t exptime, uint64_t *value);
+static int binary_mset(struct Server* server, const struct Item *items,
+                       const size_t *idx, size_t num, uint16_t *status);
+static int textual_mset(struct Server* server, const struct Item *items,
+                        const size_t *idx, size_t num, uint16_t *status);
+static uint16_t textual_response_status(const char *line);
 static int libmemc_store(struct Memcache* handle, enum StoreCommand cmd, const struct Item *item);
 static int libmemc_store_backoff(struct Memcache* handle, enum StoreCommand cmd, const struct Item *item, int backoff);
 static struct Server *get_server(struct Memcache *handle, const char *key);
+static struct Server *connected_server(struct Memcache *handle, const char *key);
+static int libmemc_retrieve(struct Memcache *handle, enum RetrieveCommand cmd,
+                            struct Item *item);
+static int libmemc_key_command(struct Memcache *handle, enum KeyCommand cmd,
+                               const char *key, size_t nkey, uint64_t delta,
+                               uint32_t exptime, uint64_t *value);
 static int server_connect(struct Server *server);
 
 
@@ -105,11 +127,12 @@ char *libmemc_get_error(struct Memcache *handle) {
         }
     }
 
-    if (len > 0) {
-        ret[len - 1] = '\0';
+    if (len == 0) {
+        return NULL;
     }
 
-    return ret;
+    ret[len - 1] = '\0';
+    return strdup(ret);
 }
 
 
@@ -148,25 +171,82 @@ int libmemc_replace(struct Memcache *handle, const struct Item *item) {
     return libmemc_store(handle, replace, item);
 }
 
+int libmemc_append(struct Memcache *handle, const struct Item *item) {
+    return libmemc_store(handle, append, item);
+}
+
+int libmemc_prepend(struct Memcache *handle, const struct Item *item) {
+    return libmemc_store(handle, prepend, item);
+}
+
+int libmemc_cas(struct Memcache *handle, const struct Item *item) {
+    return libmemc_store(handle, cas, item);
+}
+
 int libmemc_get(struct Memcache *handle, struct Item *item) {
-    struct Server* server = get_server(handle, item->key);
-    if (server == NULL) {
+    return libmemc_retrieve(handle, get, item);
+}
+
+int libmemc_gets(struct Memcache *handle, struct Item *item) {
+    return libmemc_retrieve(handle, get_cas, item);
+}
+
+int libmemc_gat(struct Memcache *handle, struct Item *item) {
+    return libmemc_retrieve(handle, get_touch, item);
+}
+
+int libmemc_delete(struct Memcache *handle, const char *key, size_t nkey) {
+    return libmemc_key_command(handle, delete_key, key, nkey, 0, 0, NULL);
+}
+
+int libmemc_incr(struct Memcache *handle, const char *key, size_t nkey,
+                 uint64_t delta, uint64_t *value) {
+    return libmemc_key_command(handle, incr, key, nkey, delta, 0, value);
+}
+
+int libmemc_decr(struct Memcache *handle, const char *key, size_t nkey,
+                 uint64_t delta, uint64_t *value) {
+    return libmemc_key_command(handle, decr, key, nkey, delta, 0, value);
+}
+
+int libmemc_touch(struct Memcache *handle, const char *key, size_t nkey,
+                  uint32_t exptime) {
+    return libmemc_key_command(handle, touch, key, nkey, 0, exptime, NULL);
+}
+
+int libmemc_mset(struct Memcache *handle, const struct Item *items,
+                 size_t num, uint16_t *status) {
+    size_t *idx = malloc(num * sizeof(size_t));
+    int ret = 0;
+
+    if (idx == NULL) {
         return -1;
-    } else {
-        if (server->sock == -1) {
-            if (server_connect(server) == -1) {
-                fprintf(stderr, "%s\n", server->errmsg);
-                fflush(stderr);
-                return -1;
+    }
+
+    for (int ii = 0; ii < handle->no_servers && ret == 0; ++ii) {
+        struct Server *server = handle->servers[ii];
+        size_t count = 0;
+        for (size_t jj = 0; jj < num; ++jj) {
+            if (get_server(handle, items[jj].key) == server) {
+                idx[count++] = jj;
             }
         }
 
-        if (handle->protocol == Binary) {
-            return binary_get(server, item);
+        if (count == 0) {
+            continue;
+        }
+
+        if (server->sock == -1 && server_connect(server) == -1) {
+            ret = -1;
+        } else if (handle->protocol == Binary) {
+            ret = binary_mset(server, items, idx, count, status);
         } else {
-            return textual_get(server, item);
+            ret = textual_mset(server, items, idx, count, status);
         }
     }
+
+    free(idx);
+    return ret;
 }
 
 static struct addrinfo *lookuphost(const char *hostname, in_port_t port)
@@ -217,28 +297,69 @@ int libmemc_connect_server(const char *hostname, in_port_t port)
 /**
  * Internal functions used by both protocols
  */
-static uint32_t simplehash(const char *key) {
-    if (key == 0) {
+static uint32_t simplehash(const char *key, size_t nkey) {
+    if (nkey == 0) {
         return 0;
     }
     uint32_t ret = 0;
-    for (ret = *key; *key != 0; ++key) {
+    for (ret = *key; nkey > 0; ++key, --nkey) {
         ret = (ret << 4) + *key;
     }
     return ret;
 }
 
+int libmemc_server(const char *key, size_t nkey, int no_servers) {
+    if (no_servers <= 1) {
+        return 0;
+    }
+    return simplehash(key, nkey) % no_servers;
+}
+
 static struct Server *get_server(struct Memcache *handle, const char *key) {
-    if (handle->no_servers == 1) {
-        return handle->servers[0];
-    } else if (handle->no_servers > 0) {
-        int idx = simplehash(key) % handle->no_servers;
-        return handle->servers[idx];
+    if (handle->no_servers > 0) {
+        size_t nkey = key ? strlen(key) : 0;
+        return handle->servers[libmemc_server(key, nkey, handle->no_servers)];
     } else {
         return NULL;
     }
 }
 
+static struct Server *connected_server(struct Memcache *handle, const char *key) {
+    struct Server* server = get_server(handle, key);
+    if (server != NULL && server->sock == -1 && server_connect(server) == -1) {
+        return NULL;
+    }
+    return server;
+}
+
+static int libmemc_retrieve(struct Memcache *handle, enum RetrieveCommand cmd,
+                            struct Item *item) {
+    struct Server* server = connected_server(handle, item->key);
+    if (server == NULL) {
+        return -1;
+    } else if (handle->protocol == Binary) {
+        return binary_get(server, cmd, item);
+    } else {
+        return textual_get(server, cmd, item);
+    }
+}
+
+static int libmemc_key_command(struct Memcache *handle, enum KeyCommand cmd,
+                               const char *key, size_t nkey, uint64_t delta,
+                               uint32_t exptime, uint64_t *value) {
+    struct Server* server = connected_server(handle, key);
+    int ret;
+    if (server == NULL) {
+        return -1;
+    } else if (handle->protocol == Binary) {
+        ret = binary_key_command(server, cmd, key, nkey, delta, exptime, value);
+    } else {
+        ret = textual_key_command(server, cmd, key, nkey, delta, exptime, value);
+    }
+    /* Only the storage commands back off on temporary failures */
+    return ret == -2 ? -1 : ret;
+}
+
 static int libmemc_store(struct Memcache* handle, enum StoreCommand cmd,
                          const struct Item *item) {
     struct Server* server = get_server(handle, item->key);
@@ -318,6 +439,7 @@ static int libmemc_store_backoff(struct Memcache* handle, enum StoreCommand cmd,
 
 static size_t server_receive(struct Server* server, char* data, size_t size, int line);
 static int server_sendv(struct Server* server, struct iovec *iov, int iovcnt);
+static int server_sendv_all(struct Server* server, struct iovec *iov, int iovcnt);
 static void server_disconnect(struct Server *server);
 
 void server_destroy(struct Server *server) {
@@ -441,6 +563,21 @@ static int server_sendv(struct Server* server, struct iovec *iov, int iovcnt) {
     return 0;
 }
 
+/**
+ * writev may only send IOV_MAX vectors at a time, so send the requests
+ * of a pipeline in slices
+ */
+static int server_sendv_all(struct Server* server, struct iovec *iov, int iovcnt) {
+    static const int max_iov = 512;
+    for (int ii = 0; ii < iovcnt; ii += max_iov) {
+        int num = iovcnt - ii < max_iov ? iovcnt - ii : max_iov;
+        if (server_sendv(server, iov + ii, num) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
 static size_t server_receive(struct Server* server, char* data, size_t size, int line) {
     size_t offset = 0;
     int stop = 0;
@@ -493,129 +630,201 @@ static int64_t swap64(int64_t in) {
 }
 #endif
 
+static const char * const response_texts[0xffff] = {
+    [STATUS_SUCCESS] = "success",
+    [STATUS_KEY_ENOENT] = "ENOENT",
+    [STATUS_KEY_EEXISTS] = "EEXISTS",
+    [STATUS_E2BIG] = "E2BIG",
+    [STATUS_EINVAL] = "EINVAL",
+    [STATUS_NOT_STORED] = "not stored",
+    [STATUS_DELTA_BADVAL] = "delta badval",
+    [STATUS_NOT_MY_VBUCKET] = "not my vbucket",
+    [STATUS_AUTH_ERROR] = "auth error",
+    [STATUS_AUTH_CONTINUE] = "auth continue",
+    [STATUS_UNKNOWN_COMMAND] = "unknown command",
+    [STATUS_ENOMEM] = "ENOMEM",
+    [STATUS_NOT_SUPPORTED] = "ENOTSUP",
+    [STATUS_EINTERNAL] = "EINTERNAL",
+    [STATUS_EBUSY] = "EBUSY",
+    [STATUS_ETMPFAIL] = "ETMPFAIL"
+};
+
+/**
+ * Map the status of a response to the return value of the operations
+ * @param server the server that sent the response
+ * @param status the status (the textual responses are mapped to the
+ *               binary status codes)
+ * @param cmd the name of the command (for the error message)
+ * @return 0 on success, 1 if the item doesn't exist, wasn't stored or
+ *         doesn't hold a number, -2 on temporary failures and -1 on
+ *         other errors
+ */
+static int response_status(struct Server *server, uint16_t status,
+                           const char *cmd) {
+    switch (status) {
+    case STATUS_SUCCESS:
+        return 0;
+    case STATUS_KEY_ENOENT:
+    case STATUS_KEY_EEXISTS:
+    case STATUS_NOT_STORED:
+    case STATUS_DELTA_BADVAL:
+        return 1;
+    case STATUS_ETMPFAIL:
+        return -2;
+    default:
+        {
+            char errmsg[128];
+            snprintf(errmsg, sizeof(errmsg), "%s failed: %0x (%s)", cmd,
+                     status, response_texts[status] == NULL ? "unknown" :
+                     response_texts[status]);
+            free(server->errmsg);
+            server->errmsg = strdup(errmsg);
+        }
+        return -1;
+    }
+}
+
 /**
  * Implementation of the Binary protocol
  */
-static int binary_get(struct Server* server, struct Item* item)
+#ifdef HAVE_MEMCACHED_PROTOCOL_BINARY_H
+/**
+ * Send a request and read the header of the response (the body of the
+ * response is left on the socket)
+ * @return 0 on success, -1 if we lost the connection
+ */
+static int binary_request(struct Server* server, uint8_t opcode,
+                          const char *key, uint16_t keylen,
+                          const void *extras, uint8_t extlen,
+                          const void *data, size_t size, uint64_t cas,
+                          protocol_binary_response_header *response)
 {
-#ifndef HAVE_MEMCACHED_PROTOCOL_BINARY_H
-    (void)server;
-    (void)item;
-    fprintf(stderr, "Compiled without support for binary protocol\n");
-    return -1;
-#else
-    uint16_t keylen = item->keylen;
-    uint32_t bodylen = keylen;
-
-    protocol_binary_request_get request = {
-        .message.header.request = {
+    protocol_binary_request_header request = {
+        .request = {
             .magic = PROTOCOL_BINARY_REQ,
-            .opcode = PROTOCOL_BINARY_CMD_GET,
+            .opcode = opcode,
             .keylen = htons(keylen),
+            .extlen = extlen,
             .datatype = PROTOCOL_BINARY_RAW_BYTES,
-            .vbucket = htons(get_vbucket(item->key, keylen)),
-            .bodylen = htonl(bodylen),
-            .opaque = 0
+            .vbucket = htons(get_vbucket(key, keylen)),
+            .bodylen = htonl(extlen + keylen + size),
+            .opaque = 0,
+            .cas = swap64(cas)
         }
     };
 
-    struct iovec iovec[2];
+    struct iovec iovec[4];
     iovec[0].iov_base = (void*)&request;
     iovec[0].iov_len = sizeof(request);
-    iovec[1].iov_base = (void*)item->key;
-    iovec[1].iov_len = keylen;
+    iovec[1].iov_base = (void*)extras;
+    iovec[1].iov_len = extlen;
+    iovec[2].iov_base = (void*)key;
+    iovec[2].iov_len = keylen;
+    iovec[3].iov_base = (void*)data;
+    iovec[3].iov_len = size;
 
-    server_sendv(server, iovec, 2);
+    if (server_sendv(server, iovec, 4) != 0) {
+        return -1;
+    }
 
-    protocol_binary_response_set response;
-    size_t nread = server_receive(server, (char*)response.bytes,
-                                  sizeof(response.bytes), 0);
-    if (nread != sizeof(response)) {
+    size_t nread = server_receive(server, (char*)response->bytes,
+                                  sizeof(response->bytes), 0);
+    if (nread != sizeof(response->bytes)) {
+        free(server->errmsg);
         server->errmsg = strdup("Protocol error");
         server_disconnect(server);
         return -1;
     }
 
-    bodylen = ntohl(response.message.header.response.bodylen);
-    if (response.message.header.response.status == 0) {
-        if (item->data != NULL) {
-            if ((bodylen-response.message.header.response.extlen) > item->size) {
-                free(item->data);
-                item->data = NULL;
-            }
-        }
+    return 0;
+}
 
-        if (item->data == NULL) {
-            item->size = bodylen - response.message.header.response.extlen;
-            item->data = malloc(item->size);
-            if (item->data == NULL) {
-                server->errmsg = strdup("failed to allocate memory\n");
-                server_disconnect(server);
-                return -1;
-            }
+/**
+ * Read the body of a response into the server buffer (the part that
+ * doesn't fit in the buffer is dropped)
+ * @return 0 on success, -1 if we lost the connection
+ */
+static int binary_read_body(struct Server* server, uint32_t bodylen) {
+    while (bodylen > 0) {
+        size_t chunk = bodylen < server->buffersize ? bodylen : server->buffersize;
+        if (server_receive(server, server->buffer, chunk, 0) != chunk) {
+            free(server->errmsg);
+            server->errmsg = strdup("Protocol error");
+            server_disconnect(server);
+            return -1;
         }
+        bodylen -= chunk;
+    }
+    return 0;
+}
+#endif
 
-        if (response.message.header.response.extlen != 0) {
-            assert(response.message.header.response.extlen == 4);
-            uint32_t flags;
-            struct iovec iov[2];
-            iov[0].iov_base = (void*)&flags;
-            iov[0].iov_len = sizeof(flags);
-            iov[1].iov_base = item->data;
-            iov[1].iov_len = item->size;
-
-            nread = readv(server->sock, iovec, 2);
-            if (nread < bodylen) {
-                // partial read.. read the rest!
-                nread -= 4;
-                size_t left = item->size - nread;
-                if (server_receive(server, (char*)(item->data) + nread, left, 0) != left) {
-                    abort();
-                }
-            }
-        } else {
-            nread = server_receive(server, item->data, item->size, 0);
-            assert(nread == item->size);
+static int binary_get(struct Server* server, enum RetrieveCommand cmd,
+                      struct Item* item)
+{
+#ifndef HAVE_MEMCACHED_PROTOCOL_BINARY_H
+    (void)server;
+    (void)cmd;
+    (void)item;
+    fprintf(stderr, "Compiled without support for binary protocol\n");
+    return -1;
+#else
+    /* The binary get always returns the cas value */
+    uint32_t exptime = htonl(item->exptime);
+    protocol_binary_response_header response;
+    if (binary_request(server,
+                       cmd == get_touch ? PROTOCOL_BINARY_CMD_GAT :
+                       PROTOCOL_BINARY_CMD_GET,
+                       item->key, item->keylen,
+                       &exptime, cmd == get_touch ? sizeof(exptime) : 0,
+                       NULL, 0, 0, &response) != 0) {
+        return -1;
+    }
+
+    uint32_t bodylen = ntohl(response.response.bodylen);
+    uint16_t status = ntohs(response.response.status);
+    if (status != PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+        if (binary_read_body(server, bodylen) != 0) {
+            return -1;
         }
+        return response_status(server, status, "binary_get");
+    }
 
-        item->cas_id = swap64(response.message.header.response.cas);
-    } else {
-        char *buffer = malloc(bodylen + 1);
-        if (buffer == NULL) {
+    /* Skip the flags (and the key) in front of the value */
+    uint32_t skip = response.response.extlen + ntohs(response.response.keylen);
+    if (skip > bodylen || binary_read_body(server, skip) != 0) {
+        server->errmsg = strdup("Protocol error");
+        server_disconnect(server);
+        return -1;
+    }
+
+    size_t size = bodylen - skip;
+    if (item->data != NULL && size > item->size) {
+        free(item->data);
+        item->data = NULL;
+    }
+
+    if (item->data == NULL) {
+        item->data = malloc(size > 0 ? size : 1);
+        if (item->data == NULL) {
             server->errmsg = strdup("failed to allocate memory\n");
             server_disconnect(server);
             return -1;
         }
-        buffer[bodylen] = '\0';
-        server_receive(server, buffer, bodylen, 0);
-        server->errmsg = buffer;
+    }
 
+    item->size = size;
+    if (size > 0 && server_receive(server, item->data, size, 0) != size) {
+        server->errmsg = strdup("Protocol error");
+        server_disconnect(server);
         return -1;
     }
+    item->cas_id = swap64(response.response.cas);
 
     return 0;
 #endif
 }
 
-static const char * const response_texts[0xffff] = {
-    [PROTOCOL_BINARY_RESPONSE_SUCCESS] = "success",
-    [PROTOCOL_BINARY_RESPONSE_KEY_ENOENT] = "ENOENT",
-    [PROTOCOL_BINARY_RESPONSE_KEY_EEXISTS] = "EEXISTS",
-    [PROTOCOL_BINARY_RESPONSE_E2BIG] = "E2BIG",
-    [PROTOCOL_BINARY_RESPONSE_EINVAL] = "EINVAL",
-    [PROTOCOL_BINARY_RESPONSE_NOT_STORED] = "not stored",
-    [PROTOCOL_BINARY_RESPONSE_DELTA_BADVAL] = "delta badval",
-    [PROTOCOL_BINARY_RESPONSE_NOT_MY_VBUCKET] = "not my vbucket",
-    [PROTOCOL_BINARY_RESPONSE_AUTH_ERROR] = "auth error",
-    [PROTOCOL_BINARY_RESPONSE_AUTH_CONTINUE] = "auth continue",
-    [PROTOCOL_BINARY_RESPONSE_UNKNOWN_COMMAND] = "unknown command",
-    [PROTOCOL_BINARY_RESPONSE_ENOMEM] = "ENOMEM",
-    [PROTOCOL_BINARY_RESPONSE_NOT_SUPPORTED] = "ENOTSUP",
-    [PROTOCOL_BINARY_RESPONSE_EINTERNAL] = "EINTERNAL",
-    [PROTOCOL_BINARY_RESPONSE_EBUSY] = "EBUSY",
-    [PROTOCOL_BINARY_RESPONSE_ETMPFAIL] = "ETMPFAIL"
-};
-
 static int binary_store(struct Server* server,
                         enum StoreCommand cmd,
                         const struct Item *item)
@@ -627,92 +836,204 @@ static int binary_store(struct Server* server,
     fprintf(stderr, "Compiled without support for binary protocol\n");
     return -1;
 #else
-    uint16_t keylen = item->keylen;
     uint8_t opcode;
 
     switch (cmd) {
     case add :
         opcode = PROTOCOL_BINARY_CMD_ADD; break;
     case set :
+    case cas :
         opcode = PROTOCOL_BINARY_CMD_SET; break;
     case replace :
         opcode = PROTOCOL_BINARY_CMD_REPLACE; break;
+    case append :
+        opcode = PROTOCOL_BINARY_CMD_APPEND; break;
+    case prepend :
+        opcode = PROTOCOL_BINARY_CMD_PREPEND; break;
     default:
         abort();
     }
 
+    /* append and prepend don't have the flags and the expiry time */
+    int extras = cmd != append && cmd != prepend;
     protocol_binary_request_set request = {
-        .message.header.request = {
-            .magic = PROTOCOL_BINARY_REQ,
-            .opcode = opcode,
-            .keylen = htons(keylen),
-            .extlen = 8,
-            .datatype = 0,
-            .vbucket = htons(get_vbucket(item->key, keylen)),
-            .bodylen = htonl(keylen + item->size + 8),
-            .opaque = 0,
-            .cas = swap64(item->cas_id)
-        },
         .message.body = {
             .flags = 0,
             .expiration = htonl(item->exptime)
         }
     };
+    protocol_binary_response_header response;
+    if (binary_request(server, opcode, item->key, item->keylen,
+                       &request.message.body,
+                       extras ? sizeof(request.message.body) : 0,
+                       item->data, item->size, item->cas_id,
+                       &response) != 0 ||
+        binary_read_body(server, ntohl(response.response.bodylen)) != 0) {
+        return -1;
+    }
 
-    struct iovec iovec[3];
-    iovec[0].iov_base = (void*)&request;
-    iovec[0].iov_len = sizeof(request);
-    iovec[1].iov_base = (void*)item->key;
-    iovec[1].iov_len = keylen;
-    iovec[2].iov_base = item->data;
-    iovec[2].iov_len = item->size;
+    return response_status(server, ntohs(response.response.status),
+                           "binary_store");
+#endif
+}
 
-    server_sendv(server, iovec, 3);
+static int binary_key_command(struct Server* server, enum KeyCommand cmd,
+                              const char *key, size_t nkey, uint64_t delta,
+                              uint32_t exptime, uint64_t *value)
+{
+#ifndef HAVE_MEMCACHED_PROTOCOL_BINARY_H
+    (void)server;
+    (void)cmd;
+    (void)key;
+    (void)nkey;
+    (void)delta;
+    (void)exptime;
+    (void)value;
+    fprintf(stderr, "Compiled without support for binary protocol\n");
+    return -1;
+#else
+    protocol_binary_request_incr incr_request = {
+        .message.body = {
+            .delta = swap64(delta),
+            .initial = 0,
+            /* Don't create the counter if it doesn't exist */
+            .expiration = 0xffffffff
+        }
+    };
+    protocol_binary_request_touch touch_request = {
+        .message.body = {
+            .expiration = htonl(exptime)
+        }
+    };
+    protocol_binary_response_header response;
+    const void *extras = NULL;
+    uint8_t extlen = 0;
+    uint8_t opcode;
 
-    protocol_binary_response_set response;
-    size_t nread = server_receive(server, (char*)response.bytes,
-                                  sizeof(response.bytes), 0);
-    if (nread != sizeof(response)) {
-        server->errmsg = strdup("Protocol error");
-        server_disconnect(server);
+    switch (cmd) {
+    case delete_key:
+        opcode = PROTOCOL_BINARY_CMD_DELETE;
+        break;
+    case incr:
+    case decr:
+        opcode = cmd == incr ? PROTOCOL_BINARY_CMD_INCREMENT :
+            PROTOCOL_BINARY_CMD_DECREMENT;
+        extras = &incr_request.message.body;
+        /* The body struct is padded, the extras are 20 bytes */
+        extlen = sizeof(incr_request.bytes) - sizeof(incr_request.message.header);
+        break;
+    case touch:
+        opcode = PROTOCOL_BINARY_CMD_TOUCH;
+        extras = &touch_request.message.body;
+        extlen = sizeof(touch_request.message.body);
+        break;
+    default:
+        abort();
+    }
+
+    uint32_t bodylen;
+    if (binary_request(server, opcode, key, (uint16_t)nkey, extras, extlen,
+                       NULL, 0, 0, &response) != 0 ||
+        binary_read_body(server,
+                         (bodylen = ntohl(response.response.bodylen))) != 0) {
         return -1;
     }
 
-    if (response.message.header.response.status == 0 &&
-        response.message.header.response.bodylen != 0) {
-        server->errmsg = strdup("Unexpected data returned\n");
-        server_disconnect(server);
+    int ret = response_status(server, ntohs(response.response.status),
+                              "binary_key_command");
+    if (ret == 0 && value != NULL && bodylen == sizeof(uint64_t)) {
+        uint64_t val;
+        memcpy(&val, server->buffer, sizeof(val));
+        *value = swap64(val);
+    }
+    return ret;
+#endif
+}
+
+static int binary_mset(struct Server* server, const struct Item *items,
+                       const size_t *idx, size_t num, uint16_t *status)
+{
+#ifndef HAVE_MEMCACHED_PROTOCOL_BINARY_H
+    (void)server;
+    (void)items;
+    (void)idx;
+    (void)num;
+    (void)status;
+    fprintf(stderr, "Compiled without support for binary protocol\n");
+    return -1;
+#else
+    protocol_binary_request_set *requests = calloc(num, sizeof(*requests));
+    struct iovec *iovec = calloc(num * 3 + 1, sizeof(struct iovec));
+    if (requests == NULL || iovec == NULL) {
+        free(requests);
+        free(iovec);
+        server->errmsg = strdup("failed to allocate memory");
         return -1;
-    } else if (response.message.header.response.bodylen != 0) {
-        uint32_t len = ntohl(response.message.header.response.bodylen);
-        char* buffer = malloc(len);
-        if (buffer == 0) {
-            server->errmsg = strdup("failed to allocate memory\n");
-            server_disconnect(server);
-            return -1;
+    }
+
+    /* The opaque field tells us which item a (failure) response is for */
+    int iovcnt = 0;
+    for (size_t ii = 0; ii < num; ++ii) {
+        const struct Item *item = &items[idx[ii]];
+        uint16_t keylen = item->keylen;
+        requests[ii].message.header.request.magic = PROTOCOL_BINARY_REQ;
+        requests[ii].message.header.request.opcode = PROTOCOL_BINARY_CMD_SETQ;
+        requests[ii].message.header.request.keylen = htons(keylen);
+        requests[ii].message.header.request.extlen = 8;
+        requests[ii].message.header.request.vbucket =
+            htons(get_vbucket(item->key, keylen));
+        requests[ii].message.header.request.bodylen =
+            htonl(keylen + item->size + 8);
+        requests[ii].message.header.request.opaque = (uint32_t)ii;
+        requests[ii].message.body.expiration = htonl(item->exptime);
+
+        iovec[iovcnt].iov_base = (void*)&requests[ii];
+        iovec[iovcnt++].iov_len = sizeof(requests[ii]);
+        iovec[iovcnt].iov_base = (void*)item->key;
+        iovec[iovcnt++].iov_len = keylen;
+        iovec[iovcnt].iov_base = item->data;
+        iovec[iovcnt++].iov_len = item->size;
+        status[idx[ii]] = PROTOCOL_BINARY_RESPONSE_SUCCESS;
+    }
+
+    protocol_binary_request_noop noop = {
+        .message.header.request = {
+            .magic = PROTOCOL_BINARY_REQ,
+            .opcode = PROTOCOL_BINARY_CMD_NOOP,
+            .datatype = PROTOCOL_BINARY_RAW_BYTES,
+            .opaque = (uint32_t)num
         }
+    };
+    iovec[iovcnt].iov_base = (void*)&noop;
+    iovec[iovcnt++].iov_len = sizeof(noop);
 
-        nread = server_receive(server, buffer, len, 0);
-        free(buffer);
+    int ret = server_sendv_all(server, iovec, iovcnt);
+    free(iovec);
+    free(requests);
+    if (ret != 0) {
+        return -1;
     }
 
-    const char *textual = response_texts[ntohs(response.message.header.response.status)];
-    switch (ntohs(response.message.header.response.status)) {
-    case PROTOCOL_BINARY_RESPONSE_SUCCESS:
-        return 0;
-    case PROTOCOL_BINARY_RESPONSE_ETMPFAIL:
-        return -2; // meaning tempfail
-    default:
-        {
-            char errmsg[128];
-            snprintf(errmsg, sizeof(errmsg),
-                     "binary_store failed: %0x (%s)",
-                     ntohs(response.message.header.response.status),
-                     textual == NULL ? "unknown" : textual);
-            server->errmsg = strdup(errmsg);
+    /* The quiet sets only respond on failure, the noop ends the batch */
+    for (;;) {
+        protocol_binary_response_header response;
+        size_t nread = server_receive(server, (char*)response.bytes,
+                                      sizeof(response.bytes), 0);
+        if (nread != sizeof(response.bytes)) {
+            server->errmsg = strdup("Protocol error");
             server_disconnect(server);
+            return -1;
+        }
+
+        if (binary_read_body(server, ntohl(response.response.bodylen)) != 0) {
+            return -1;
+        }
+
+        if (response.response.opcode == PROTOCOL_BINARY_CMD_NOOP) {
+            return 0;
+        } else if (response.response.opaque < num) {
+            status[idx[response.response.opaque]] = ntohs(response.response.status);
         }
-        return -1;
     }
 #endif
 }
@@ -720,7 +1041,8 @@ static int binary_store(struct Server* server,
 /**
  * Implementation of the Textual protocol
  */
-static int parse_value_line(char *header, uint32_t* flag, size_t* size, char** data) {
+static int parse_value_line(char *header, uint32_t* flag, size_t* size,
+                            uint64_t *cas, char** data) {
     char *end = strchr(header, ' ');
     if (end == 0) {
         return -1;
@@ -735,6 +1057,17 @@ static int parse_value_line(char *header, uint32_t* flag, size_t* size, char** d
     if (start == end) {
         return -1;
     }
+    if (*end == ' ') {
+        /* gets returns the cas value as well */
+        start = end + 1;
+        uint64_t val = strtoull(start, &end, 10);
+        if (start == end) {
+            return -1;
+        }
+        if (cas != NULL) {
+            *cas = val;
+        }
+    }
     if (strstr(end, "\r\n") != end) {
         return -1;
     }
@@ -743,26 +1076,43 @@ static int parse_value_line(char *header, uint32_t* flag, size_t* size, char** d
     return 0;
 }
 
-static int textual_get(struct Server* server, struct Item* item) {
+static int textual_get(struct Server* server, enum RetrieveCommand cmd,
+                       struct Item* item) {
     uint32_t flag;
+    char command[32];
+    int len;
+
+    if (cmd == get_touch) {
+        len = snprintf(command, sizeof(command), "gat %lu ",
+                       (unsigned long)item->exptime);
+    } else {
+        len = snprintf(command, sizeof(command), "%s ",
+                       cmd == get_cas ? "gets" : "get");
+    }
 
     struct iovec iovec[3];
-    iovec[0].iov_base = (char*)"get ";
-    iovec[0].iov_len = 4;
+    iovec[0].iov_base = command;
+    iovec[0].iov_len = len;
     iovec[1].iov_base = (char*)item->key;
     iovec[1].iov_len = item->keylen;
     iovec[2].iov_base = (char*)"\r\n";
     iovec[2].iov_len = 2;
-    server_sendv(server, iovec, 3);
+    if (server_sendv(server, iovec, 3) != 0) {
+        return -1;
+    }
 
     size_t nread = server_receive(server, server->buffer,server->buffersize, 1);
+    if (nread == (size_t)-1) {
+        return -1;
+    }
 
     // Split the header line
     if (strstr(server->buffer, "VALUE ") == server->buffer) {
         size_t elemsize;
         char *ptr;
 
-        if (parse_value_line(server->buffer + 6, &flag, &elemsize, &ptr) == -1){
+        if (parse_value_line(server->buffer + 6, &flag, &elemsize,
+                             &item->cas_id, &ptr) == -1) {
             server->errmsg = strdup("Protocol error");
             server_disconnect(server);
             return -1;
@@ -780,37 +1130,120 @@ static int textual_get(struct Server* server, struct Item* item) {
         }
 
         void *result = ptr;
-        if (elemsize > item->size) {
-            if (item->data != 0) {
-                free(item->data);
-            }
-            item->size = elemsize;
-            item->data = malloc(item->size);
+        if (item->data == NULL || elemsize > item->size) {
+            free(item->data);
+            item->data = malloc(elemsize > 0 ? elemsize : 1);
             if (item->data == 0) {
                 item->size = 0;
                 return -1;
             }
         }
 
+        item->size = elemsize;
         memcpy(item->data, result, item->size);
         return 0;
     } else if (strstr(server->buffer, "END") == server->buffer) {
-        return -1;
+        return 1;
     }
 
-    abort();
+    /* gat isn't supported by older servers */
+    server->buffer[strcspn(server->buffer, "\r")] = '\0';
+    return response_status(server, textual_response_status(server->buffer),
+                           "textual_get");
+}
+
+/**
+ * Map a response line to a status code
+ */
+static uint16_t textual_response_status(const char *line) {
+    if (strncmp(line, "STORED", 6) == 0 ||
+        strncmp(line, "DELETED", 7) == 0 ||
+        strncmp(line, "TOUCHED", 7) == 0 ||
+        isdigit((unsigned char)line[0])) {
+        return STATUS_SUCCESS;
+    } else if (strncmp(line, "NOT_STORED", 10) == 0) {
+        return STATUS_NOT_STORED;
+    } else if (strncmp(line, "EXISTS", 6) == 0) {
+        return STATUS_KEY_EEXISTS;
+    } else if (strncmp(line, "NOT_FOUND", 9) == 0) {
+        return STATUS_KEY_ENOENT;
+    } else if (strncmp(line, "SERVER_ERROR out of memory", 26) == 0) {
+        return STATUS_ENOMEM;
+    } else if (strncmp(line, "SERVER_ERROR temporary failure", 30) == 0) {
+        return STATUS_ETMPFAIL;
+    } else if (strncmp(line, "SERVER_ERROR", 12) == 0) {
+        return STATUS_EINTERNAL;
+    } else if (strstr(line, "non-numeric value") != NULL) {
+        return STATUS_DELTA_BADVAL;
+    } else if (strncmp(line, "CLIENT_ERROR", 12) == 0) {
+        return STATUS_EINVAL;
+    }
+    return STATUS_UNKNOWN_COMMAND;
+}
+
+/**
+ * Read a response line into the server buffer
+ * @return the length of the line (nul terminated without the \r\n) or
+ *         -1 on error
+ */
+static ssize_t textual_read_line(struct Server* server) {
+    size_t offset = 0;
+
+    for (;;) {
+        char *eol = memchr(server->buffer, '\n', offset);
+        if (eol != NULL) {
+            if (eol > server->buffer && eol[-1] == '\r') {
+                --eol;
+            }
+            *eol = '\0';
+            return eol - server->buffer;
+        }
+
+        if (offset == server->buffersize) {
+            server->errmsg = strdup("Out of sync with server...");
+            server_disconnect(server);
+            return -1;
+        }
+
+        ssize_t len = recv(server->sock, server->buffer + offset,
+                           server->buffersize - offset, 0);
+        if (len == -1) {
+            if (errno != EINTR) {
+                char errmsg[1024];
+                sprintf(errmsg, "Failed to receive data from server: %s",
+                        strerror(errno));
+                server->errmsg = strdup(errmsg);
+                server_disconnect(server);
+                return -1;
+            }
+        } else if (len == 0) {
+            server->errmsg = strdup("Lost contact with server");
+            server_disconnect(server);
+            return -1;
+        } else {
+            offset += len;
+        }
+    }
 }
 
 static int textual_store(struct Server* server,
                          enum StoreCommand cmd,
                          const struct Item *item)  {
-    static const char* const commands[] = { "add ", "set ", "replace " };
+    static const char* const commands[] = { "add ", "set ", "replace ",
+                                            "append ", "prepend ", "cas " };
 
     uint32_t flags = 0;
     const void *dta = item->data;
     size_t size = item->size;
-    ssize_t len = sprintf(server->buffer, " %d %ld %ld\r\n",
-                          flags, (long)item->exptime, (long)item->size);
+    ssize_t len;
+    if (cmd == cas) {
+        len = sprintf(server->buffer, " %d %ld %ld %llu\r\n", flags,
+                      (long)item->exptime, (long)item->size,
+                      (unsigned long long)item->cas_id);
+    } else {
+        len = sprintf(server->buffer, " %d %ld %ld\r\n",
+                      flags, (long)item->exptime, (long)item->size);
+    }
 
     struct iovec iovec[5];
     iovec[0].iov_base = (char*)commands[cmd];
@@ -823,13 +1256,118 @@ static int textual_store(struct Server* server,
     iovec[3].iov_len = size;
     iovec[4].iov_base = (char*)"\r\n";
     iovec[4].iov_len = 2;
-    server_sendv(server, iovec, 5);
+    if (server_sendv(server, iovec, 5) != 0 || textual_read_line(server) == -1) {
+        return -1;
+    }
+
+    return response_status(server, textual_response_status(server->buffer),
+                           "textual_store");
+}
+
+static int textual_key_command(struct Server* server, enum KeyCommand cmd,
+                               const char *key, size_t nkey, uint64_t delta,
+                               uint32_t exptime, uint64_t *value) {
+    struct iovec iovec;
+    int len;
+
+    switch (cmd) {
+    case delete_key:
+        len = snprintf(server->buffer, server->buffersize, "delete %.*s\r\n",
+                       (int)nkey, key);
+        break;
+    case incr:
+    case decr:
+        len = snprintf(server->buffer, server->buffersize, "%s %.*s %llu\r\n",
+                       cmd == incr ? "incr" : "decr", (int)nkey, key,
+                       (unsigned long long)delta);
+        break;
+    case touch:
+        len = snprintf(server->buffer, server->buffersize, "touch %.*s %u\r\n",
+                       (int)nkey, key, exptime);
+        break;
+    default:
+        abort();
+    }
+
+    iovec.iov_base = server->buffer;
+    iovec.iov_len = len;
+    if (server_sendv(server, &iovec, 1) != 0 || textual_read_line(server) == -1) {
+        return -1;
+    }
+
+    /* incr and decr return the new value */
+    if (isdigit((unsigned char)server->buffer[0])) {
+        if (value != NULL) {
+            *value = strtoull(server->buffer, NULL, 10);
+        }
+        return 0;
+    }
+
+    return response_status(server, textual_response_status(server->buffer),
+                           "textual_key_command");
+}
 
+static int textual_mset(struct Server* server, const struct Item *items,
+                        const size_t *idx, size_t num, uint16_t *status) {
+    static const size_t header_size = 64;
+    char *headers = malloc(num * header_size);
+    struct iovec *iovec = calloc(num * 5, sizeof(struct iovec));
+    if (headers == NULL || iovec == NULL) {
+        free(headers);
+        free(iovec);
+        server->errmsg = strdup("failed to allocate memory");
+        return -1;
+    }
+
+    int iovcnt = 0;
+    for (size_t ii = 0; ii < num; ++ii) {
+        const struct Item *item = &items[idx[ii]];
+        char *header = headers + ii * header_size;
+        int len = snprintf(header, header_size, " 0 %ld %ld\r\n",
+                           (long)item->exptime, (long)item->size);
+
+        iovec[iovcnt].iov_base = (char*)"set ";
+        iovec[iovcnt++].iov_len = 4;
+        iovec[iovcnt].iov_base = (char*)item->key;
+        iovec[iovcnt++].iov_len = item->keylen;
+        iovec[iovcnt].iov_base = header;
+        iovec[iovcnt++].iov_len = len;
+        iovec[iovcnt].iov_base = item->data;
+        iovec[iovcnt++].iov_len = item->size;
+        iovec[iovcnt].iov_base = (char*)"\r\n";
+        iovec[iovcnt++].iov_len = 2;
+    }
+
+    int ret = server_sendv_all(server, iovec, iovcnt);
+    free(iovec);
+    free(headers);
+    if (ret != 0) {
+        return -1;
+    }
+
+    /* One response line for each of the sets */
     size_t offset = 0;
-    do {
-        len = recv(server->sock, (void*)(server->buffer + offset),
-                   server->buffersize - offset, 0);
-        if (len == -1) {
+    size_t done = 0;
+    while (done < num) {
+        char *eol = memchr(server->buffer, '\n', offset);
+        if (eol != NULL) {
+            *eol = '\0';
+            status[idx[done++]] = textual_response_status(server->buffer);
+            size_t used = eol - server->buffer + 1;
+            memmove(server->buffer, eol + 1, offset - used);
+            offset -= used;
+            continue;
+        }
+
+        if (offset == server->buffersize) {
+            server->errmsg = strdup("Protocol error");
+            server_disconnect(server);
+            return -1;
+        }
+
+        ssize_t nread = recv(server->sock, server->buffer + offset,
+                             server->buffersize - offset, 0);
+        if (nread == -1) {
             if (errno != EINTR) {
                 char errmsg[1024];
                 sprintf(errmsg, "Failed to receive data from server: %s",
@@ -838,34 +1376,362 @@ static int textual_store(struct Server* server,
                 server_disconnect(server);
                 return -1;
             }
-        } else if (len == 0) {
+        } else if (nread == 0) {
             server->errmsg = strdup("Lost contact with server");
             server_disconnect(server);
             return -1;
         } else {
-            offset += len;
-            if (strchr(server->buffer, '\r') != 0) {
-                if (strstr(server->buffer, "STORED\r\n") == server->buffer) {
-                    return 0;
-                } else if (strstr(server->buffer,
-                                  "NOT_STORED\r\n") == server->buffer) {
-                    server->errmsg = strdup("Item NOT stored");
-                    return -1;
-                } else if (strstr(server->buffer, "SERVER_ERROR temporary failure") == server->buffer) {
-                    server->errmsg = strdup("textual_store SERVER_ERROR");
-                    return -2; //indicating temp fail
-                } else if (strstr(server->buffer, "SERVER_ERROR ") == server->buffer) {
-                    server->errmsg = strdup("textual_store SERVER_ERROR");
-                    return -1;
-                } else {
-                    assert("Unexepcted reply from server.");
-                }
-            }
+            offset += nread;
         }
-        if (offset == server->buffersize) {
-            server->errmsg = strdup("Out of sync with server...");
-            server_disconnect(server);
+    }
+
+    return 0;
+}
+
+/**
+ * Parsing of captured traffic
+ */
+
+/* The longest textual command line we'll try to parse */
+#define MAX_LINE 2048
+
+/**
+ * Copy the line into a nul terminated buffer and split it into tokens
+ * @return the length of the line including \r\n, 0 if we don't have the
+ *         entire line or -1 if it is too long
+ */
+static ssize_t tokenize_line(const char *buf, size_t len, char *line,
+                             char **tokens, int *ntokens) {
+    const char *eol = memchr(buf, '\n', len < MAX_LINE ? len : MAX_LINE);
+    if (eol == NULL) {
+        return len < MAX_LINE ? 0 : -1;
+    }
+
+    size_t linelen = eol - buf + 1;
+    memcpy(line, buf, linelen);
+    line[linelen] = '\0';
+
+    int max = *ntokens;
+    char *ptr = line;
+    *ntokens = 0;
+    while (*ntokens < max) {
+        while (*ptr == ' ') {
+            ++ptr;
+        }
+        if (*ptr == '\r' || *ptr == '\n' || *ptr == '\0') {
+            break;
+        }
+        tokens[(*ntokens)++] = ptr;
+        while (*ptr != ' ' && *ptr != '\r' && *ptr != '\n' && *ptr != '\0') {
+            ++ptr;
+        }
+        if (*ptr != '\0') {
+            *ptr++ = '\0';
+        }
+    }
+
+    return (ssize_t)linelen;
+}
+
+static ssize_t textual_parse_request(const char *buf, size_t len,
+                                     struct Packet *packet) {
+    static const struct {
+        const char *name;
+        enum Command command;
+    } commands[] = {
+        { "get", CMD_GET }, { "gets", CMD_GET },
+        { "gat", CMD_GAT }, { "gats", CMD_GAT },
+        { "set", CMD_SET }, { "add", CMD_ADD }, { "replace", CMD_REPLACE },
+        { "append", CMD_APPEND }, { "prepend", CMD_PREPEND },
+        { "cas", CMD_CAS }, { "delete", CMD_DELETE },
+        { "incr", CMD_INCR }, { "decr", CMD_DECR },
+        { "touch", CMD_TOUCH }
+    };
+    char line[MAX_LINE + 1];
+    char *tokens[8];
+    int ntokens = 8;
+    ssize_t linelen = tokenize_line(buf, len, line, tokens, &ntokens);
+
+    if (linelen <= 0) {
+        return linelen;
+    }
+
+    memset(packet, 0, sizeof(*packet));
+    packet->protocol = Textual;
+    packet->command = CMD_OTHER;
+    if (ntokens == 0) {
+        return linelen;
+    }
+
+    for (size_t ii = 0; ii < sizeof(commands) / sizeof(commands[0]); ++ii) {
+        if (strcmp(tokens[0], commands[ii].name) == 0) {
+            packet->command = commands[ii].command;
+            break;
+        }
+    }
+
+    if (packet->command == CMD_OTHER) {
+        return linelen;
+    }
+
+    int keyidx = (packet->command == CMD_GAT) ? 2 : 1;
+    if (ntokens <= keyidx) {
+        return -1;
+    }
+
+    packet->key = buf + (tokens[keyidx] - line);
+    packet->keylen = strlen(tokens[keyidx]);
+    packet->quiet = strcmp(tokens[ntokens - 1], "noreply") == 0;
+
+    switch (packet->command) {
+    case CMD_GET:
+    case CMD_GAT:
+        /* Include all of the keys */
+        packet->keylen = (buf + linelen - 2) - packet->key;
+        if (packet->command == CMD_GAT) {
+            packet->exptime = (uint32_t)strtoul(tokens[1], NULL, 10);
+        }
+        packet->quiet = 0;
+        return linelen;
+    case CMD_TOUCH:
+        if (ntokens < 3) {
+            return -1;
+        }
+        packet->exptime = (uint32_t)strtoul(tokens[2], NULL, 10);
+        return linelen;
+    case CMD_DELETE:
+    case CMD_INCR:
+    case CMD_DECR:
+        return linelen;
+    default:
+        break;
+    }
+
+    /* The storage commands have data following the line */
+    if (ntokens < 5) {
+        return -1;
+    }
+    packet->exptime = (uint32_t)strtoul(tokens[3], NULL, 10);
+    packet->size = (size_t)strtoul(tokens[4], NULL, 10);
+    if (len < linelen + packet->size + 2) {
+        return 0;
+    }
+
+    return linelen + packet->size + 2;
+}
+
+static ssize_t textual_parse_response(const char *buf, size_t len,
+                                      struct Packet *packet) {
+    static const struct {
+        const char *name;
+        uint16_t status;
+    } responses[] = {
+        { "STORED", 0x00 }, { "DELETED", 0x00 }, { "TOUCHED", 0x00 },
+        { "OK", 0x00 }, { "NOT_FOUND", 0x01 }, { "EXISTS", 0x02 },
+        { "NOT_STORED", 0x05 }, { "ERROR", 0x81 },
+        { "CLIENT_ERROR", 0x04 }, { "SERVER_ERROR", 0x84 }
+    };
+    char line[MAX_LINE + 1];
+    char *tokens[2];
+    int ntokens = 2;
+    ssize_t linelen = tokenize_line(buf, len, line, tokens, &ntokens);
+
+    if (linelen <= 0) {
+        return linelen;
+    }
+
+    memset(packet, 0, sizeof(*packet));
+    packet->protocol = Textual;
+    packet->command = CMD_OTHER;
+    if (ntokens == 0) {
+        return linelen;
+    }
+
+    if (strcmp(tokens[0], "VALUE") == 0) {
+        uint32_t flags;
+        char *data;
+
+        /* parse_value_line wants the entire line */
+        memcpy(line, buf, linelen);
+        line[linelen] = '\0';
+        if (parse_value_line(line + 6, &flags, &packet->size,
+                             NULL, &data) == -1) {
             return -1;
         }
-    } while (1);
+        packet->command = CMD_GET;
+        packet->key = buf + 6;
+        packet->keylen = strcspn(line + 6, " ");
+        if (len < linelen + packet->size + 2) {
+            return 0;
+        }
+        return linelen + packet->size + 2;
+    } else if (strcmp(tokens[0], "END") == 0) {
+        packet->command = CMD_GET;
+        packet->end = 1;
+        return linelen;
+    } else if (isdigit((unsigned char)tokens[0][0])) {
+        /* result of incr / decr */
+        packet->command = CMD_INCR;
+        return linelen;
+    }
+
+    for (size_t ii = 0; ii < sizeof(responses) / sizeof(responses[0]); ++ii) {
+        if (strcmp(tokens[0], responses[ii].name) == 0) {
+            packet->status = responses[ii].status;
+            break;
+        }
+    }
+
+    return linelen;
+}
+
+#ifdef HAVE_MEMCACHED_PROTOCOL_BINARY_H
+static ssize_t binary_parse_packet(const char *buf, size_t len,
+                                   struct Packet *packet, uint8_t magic) {
+    protocol_binary_request_header header;
+
+    if (len < sizeof(header.bytes)) {
+        return 0;
+    }
+    memcpy(header.bytes, buf, sizeof(header.bytes));
+    if (header.request.magic != magic) {
+        return -1;
+    }
+
+    uint32_t bodylen = ntohl(header.request.bodylen);
+    uint16_t keylen = ntohs(header.request.keylen);
+    uint8_t extlen = header.request.extlen;
+    if ((uint32_t)keylen + extlen > bodylen) {
+        return -1;
+    }
+    if (len < sizeof(header.bytes) + bodylen) {
+        return 0;
+    }
+
+    memset(packet, 0, sizeof(*packet));
+    packet->protocol = Binary;
+    packet->opaque = header.request.opaque;
+    packet->key = buf + sizeof(header.bytes) + extlen;
+    packet->keylen = keylen;
+    packet->size = bodylen - keylen - extlen;
+    if (magic == PROTOCOL_BINARY_RES) {
+        protocol_binary_response_header *res = (void*)&header;
+        packet->status = ntohs(res->response.status);
+    }
+
+    const char *ext = buf + sizeof(header.bytes);
+    switch (header.request.opcode) {
+    case PROTOCOL_BINARY_CMD_GETQ:
+    case PROTOCOL_BINARY_CMD_GETKQ:
+        packet->quiet = 1;
+        /* FALLTHROUGH */
+    case PROTOCOL_BINARY_CMD_GET:
+    case PROTOCOL_BINARY_CMD_GETK:
+        packet->command = CMD_GET;
+        break;
+    case PROTOCOL_BINARY_CMD_SETQ:
+        packet->quiet = 1;
+        /* FALLTHROUGH */
+    case PROTOCOL_BINARY_CMD_SET:
+        packet->command = header.request.cas ? CMD_CAS : CMD_SET;
+        break;
+    case PROTOCOL_BINARY_CMD_ADDQ:
+        packet->quiet = 1;
+        /* FALLTHROUGH */
+    case PROTOCOL_BINARY_CMD_ADD:
+        packet->command = CMD_ADD;
+        break;
+    case PROTOCOL_BINARY_CMD_REPLACEQ:
+        packet->quiet = 1;
+        /* FALLTHROUGH */
+    case PROTOCOL_BINARY_CMD_REPLACE:
+        packet->command = header.request.cas ? CMD_CAS : CMD_REPLACE;
+        break;
+    case PROTOCOL_BINARY_CMD_APPENDQ:
+        packet->quiet = 1;
+        /* FALLTHROUGH */
+    case PROTOCOL_BINARY_CMD_APPEND:
+        packet->command = CMD_APPEND;
+        break;
+    case PROTOCOL_BINARY_CMD_PREPENDQ:
+        packet->quiet = 1;
+        /* FALLTHROUGH */
+    case PROTOCOL_BINARY_CMD_PREPEND:
+        packet->command = CMD_PREPEND;
+        break;
+    case PROTOCOL_BINARY_CMD_DELETEQ:
+        packet->quiet = 1;
+        /* FALLTHROUGH */
+    case PROTOCOL_BINARY_CMD_DELETE:
+        packet->command = CMD_DELETE;
+        break;
+    case PROTOCOL_BINARY_CMD_INCREMENTQ:
+        packet->quiet = 1;
+        /* FALLTHROUGH */
+    case PROTOCOL_BINARY_CMD_INCREMENT:
+        packet->command = CMD_INCR;
+        break;
+    case PROTOCOL_BINARY_CMD_DECREMENTQ:
+        packet->quiet = 1;
+        /* FALLTHROUGH */
+    case PROTOCOL_BINARY_CMD_DECREMENT:
+        packet->command = CMD_DECR;
+        break;
+    case PROTOCOL_BINARY_CMD_TOUCH:
+        packet->command = CMD_TOUCH;
+        break;
+    case PROTOCOL_BINARY_CMD_GATQ:
+        packet->quiet = 1;
+        /* FALLTHROUGH */
+    case PROTOCOL_BINARY_CMD_GAT:
+        packet->command = CMD_GAT;
+        break;
+    case PROTOCOL_BINARY_CMD_NOOP:
+        packet->command = CMD_NOOP;
+        break;
+    default:
+        packet->command = CMD_OTHER;
+    }
+
+    if (magic == PROTOCOL_BINARY_REQ) {
+        uint32_t exptime;
+        if (extlen == 8 || extlen == 4) {
+            /* flags + expiry for the storage commands, expiry for touch */
+            memcpy(&exptime, ext + extlen - 4, 4);
+            packet->exptime = ntohl(exptime);
+        } else if (extlen == 20) {
+            /* delta + initial + expiry for incr / decr */
+            memcpy(&exptime, ext + 16, 4);
+            packet->exptime = ntohl(exptime);
+        }
+    }
+
+    return sizeof(header.bytes) + bodylen;
+}
+#endif
+
+ssize_t libmemc_parse_request(const char *buf, size_t len,
+                              struct Packet *packet) {
+    if (len == 0) {
+        return 0;
+    }
+#ifdef HAVE_MEMCACHED_PROTOCOL_BINARY_H
+    if ((uint8_t)buf[0] == PROTOCOL_BINARY_REQ) {
+        return binary_parse_packet(buf, len, packet, PROTOCOL_BINARY_REQ);
+    }
+#endif
+    return textual_parse_request(buf, len, packet);
+}
+
+ssize_t libmemc_parse_response(const char *buf, size_t len,
+                               struct Packet *packet) {
+    if (len == 0) {
+        return 0;
+    }
+#ifdef HAVE_MEMCACHED_PROTOCOL_BINARY_H
+    if ((uint8_t)buf[0] == PROTOCOL_BINARY_RES) {
+        return binary_parse_packet(buf, len, packet, PROTOCOL_BINARY_RES);
+    }
+#endif
+    return textual_parse_response(buf, len, packet);
 }
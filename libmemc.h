@@ -42,17 +42,138 @@ extern "C"  {
 
     enum Protocol { Binary = 1, Textual = 2 };
 
+    /**
+     * The status codes from the binary protocol (the textual responses
+     * are mapped to the same values)
+     */
+    enum ResponseStatus {
+        STATUS_SUCCESS = 0x00,
+        STATUS_KEY_ENOENT = 0x01,
+        STATUS_KEY_EEXISTS = 0x02,
+        STATUS_E2BIG = 0x03,
+        STATUS_EINVAL = 0x04,
+        STATUS_NOT_STORED = 0x05,
+        STATUS_DELTA_BADVAL = 0x06,
+        STATUS_NOT_MY_VBUCKET = 0x07,
+        STATUS_AUTH_ERROR = 0x20,
+        STATUS_AUTH_CONTINUE = 0x21,
+        STATUS_UNKNOWN_COMMAND = 0x81,
+        STATUS_ENOMEM = 0x82,
+        STATUS_NOT_SUPPORTED = 0x83,
+        STATUS_EINTERNAL = 0x84,
+        STATUS_EBUSY = 0x85,
+        STATUS_ETMPFAIL = 0x86
+    };
+
+    enum Command {
+        CMD_GET, CMD_SET, CMD_ADD, CMD_REPLACE, CMD_APPEND, CMD_PREPEND,
+        CMD_CAS, CMD_DELETE, CMD_INCR, CMD_DECR, CMD_TOUCH, CMD_GAT,
+        CMD_NOOP, CMD_OTHER
+    };
+
+    /**
+     * A request or a response parsed out of a buffer (used to analyze
+     * captured traffic). Status codes use the values from the binary
+     * protocol for both protocols (0 means success)
+     */
+    struct Packet {
+        enum Protocol protocol;
+        enum Command command;
+        /** The key. A textual get may contain multiple keys separated by space */
+        const char *key;
+        size_t keylen;
+        /** The number of bytes of value data in the packet */
+        size_t size;
+        uint32_t exptime;
+        uint32_t opaque;
+        uint16_t status;
+        /** Set for the binary quiet commands and textual noreply */
+        int quiet;
+        /** Set for the textual END terminating a get */
+        int end;
+    };
+
     struct Memcache* libmemc_create(enum Protocol protocol);
     void libmemc_destroy(struct Memcache* handle);
     int libmemc_add_server(struct Memcache *handle, const char *host,
                            in_port_t port);
+    /**
+     * Get the server a key belongs to
+     * @return the index of the server (in the order they were added)
+     */
+    int libmemc_server(const char *key, size_t nkey, int no_servers);
+
+    /*
+     * The operations below return 0 on success, 1 if the item doesn't
+     * exist, wasn't stored (or the cas value didn't match) or doesn't
+     * hold a number (incr / decr), and -1 on errors (see
+     * libmemc_get_error)
+     */
     int libmemc_add(struct Memcache *handle, const struct Item *item);
     int libmemc_set(struct Memcache *handle, const struct Item *item);
     int libmemc_replace(struct Memcache *handle, const struct Item *item);
+    int libmemc_append(struct Memcache *handle, const struct Item *item);
+    int libmemc_prepend(struct Memcache *handle, const struct Item *item);
+    /** Store the item unless it changed since item->cas_id was read */
+    int libmemc_cas(struct Memcache *handle, const struct Item *item);
+    /**
+     * Get the item. item->data is reallocated if it's too small for the
+     * value (the caller frees it)
+     */
     int libmemc_get(struct Memcache *handle, struct Item *item);
+    /** Get the item and its cas value */
+    int libmemc_gets(struct Memcache *handle, struct Item *item);
+    /** Get the item and set its expiry time to item->exptime */
+    int libmemc_gat(struct Memcache *handle, struct Item *item);
+    int libmemc_delete(struct Memcache *handle, const char *key, size_t nkey);
+    /**
+     * Add delta to the counter (the counter isn't created if it doesn't
+     * exist)
+     * @param value where to store the new value (may be NULL)
+     */
+    int libmemc_incr(struct Memcache *handle, const char *key, size_t nkey,
+                     uint64_t delta, uint64_t *value);
+    int libmemc_decr(struct Memcache *handle, const char *key, size_t nkey,
+                     uint64_t delta, uint64_t *value);
+    int libmemc_touch(struct Memcache *handle, const char *key, size_t nkey,
+                      uint32_t exptime);
+
+    /**
+     * Store multiple items with one round trip per server. The binary
+     * protocol sends quiet sets followed by a noop, the textual protocol
+     * pipelines the sets and reads all of the responses afterwards.
+     * @param items the items to store
+     * @param num the number of items
+     * @param status where to store the status of each item
+     * @return 0 if we got the status for all items, -1 if we lost the
+     *         connection to a server
+     */
+    int libmemc_mset(struct Memcache *handle, const struct Item *items,
+                     size_t num, uint16_t *status);
     int libmemc_connect_server(const char *hostname, in_port_t port);
+    /**
+     * Get (and clear) the error messages from the servers
+     * @return the message (allocated with malloc) or NULL if there is
+     *         no error
+     */
     char *libmemc_get_error(struct Memcache *handle);
 
+    /**
+     * Parse a request from a buffer
+     * @return the number of bytes used, 0 if the buffer doesn't contain
+     *         the entire packet or -1 if it doesn't look like a request
+     */
+    ssize_t libmemc_parse_request(const char *buf, size_t len,
+                                  struct Packet *packet);
+
+    /**
+     * Parse a response from a buffer
+     * @return the number of bytes used, 0 if the buffer doesn't contain
+     *         the entire packet or -1 if it doesn't look like a response
+     */
+    ssize_t libmemc_parse_response(const char *buf, size_t len,
+                                   struct Packet *packet);
+
 #ifdef __cplusplus
 }
 #endif
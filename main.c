@@ -40,6 +40,10 @@
 #include <sys/resource.h>
 #include <assert.h>
 #include <string.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
 
 #ifdef HAVE_LIBMEMCACHED
 #include "libmemcached/memcached.h"
@@ -57,7 +61,17 @@
 #include "metrics.h"
 #include "memcachetest.h"
 #include "boxmuller.h"
+#include "cluster.h"
+#include "keydist.h"
+#include "opmix.h"
+#include "scenario.h"
+#include "sizedist.h"
+#include "stats.h"
+#include "sweep.h"
+#include "trace.h"
+#include "value.h"
 #include "vbucket.h"
+#include "vclient.h"
 
 #ifndef MAXINT
 /* MAXINT doesn't seem to exist on MacOS */
@@ -72,12 +86,8 @@ struct host {
 
 
 /**
- * The set of data to operate on
- */
-size_t *dataset;
-
-/**
- * The datablock to operate with
+ * The datablock to operate with. The client groups have their own
+ * datablock, the global one holds the sizes from the command line.
  */
 struct datablock {
     /**
@@ -100,10 +110,18 @@ struct datablock {
 
 const char *prefix = "";
 
+/** The generator for the keys (lengths may be overridden with -k) */
+struct keygen keygen;
+
 /**
- * Set to one if you would like fixed block sizes
+ * The distribution of the value sizes (see -F and -z)
  */
-int use_fixed_block_size = 0;
+struct sizedist sizedist = { .type = SD_UNIFORM };
+
+/**
+ * Set to one if you would like to see the histogram of the value sizes
+ */
+int print_sizes = 0;
 
 /**
  * Set to 1 if you would like the memcached client to connect to multiple
@@ -115,12 +133,75 @@ int use_multiple_servers = 1;
 long no_items = 10000;
 /** The number of operations (pr thread) to execute (may be overridden with -c */
 long long no_iterations = 10000;
+/** Run for this many seconds instead of -c iterations (see -d) */
+double run_duration = 0;
+/** Discard the samples from the first seconds of the run (see --warmup) */
+double warmup = 0;
+/**
+ * Start measuring when the throughput and latency of the last intervals
+ * are within this fraction of their mean (0 disables the detection, see
+ * --steady-state)
+ */
+double steady_state = 0;
+
+/** The number of one second intervals that must be stable */
+#define STEADY_STATE_WINDOW 5
+/** Give up waiting for the steady state after this many seconds */
+#define STEADY_STATE_TIMEOUT 120
+
+#define HRTIME_MAX ((hrtime_t)-1)
+
+/**
+ * Search for the highest throughput where the latency percentile stays
+ * below the target (see --slo). 0 is no search.
+ */
+static hrtime_t slo_latency = 0;
+static double slo_percentile = 99.0;
+/** The number of seconds to measure every rate */
+static double search_step = 2;
+/** The rate the threads should offer during the search (0 is unlimited) */
+static uint64_t search_rate = 0;
+/** Stop when the rates that pass and fail are this close */
+#define SEARCH_RESOLUTION 0.02
+/** The most rates to try */
+#define SEARCH_MAX_STEPS 16
+
+/** Set if any of the above needs the threads to watch the clock */
+static bool timed_run = false;
+/** When the measured window begins (set by the controller) */
+static hrtime_t measure_begin;
+/** When the threads should stop */
+static hrtime_t run_end;
+/** The number of test threads that haven't finished yet */
+static int running_threads;
+
 /** If we should verify the data received. May be overridden with -V */
 int verify_data = 0;
 
+/** The distribution used to pick the keys (may be overridden with -D) */
+struct keydist keydist = { .type = KD_UNIFORM };
+
+/** The seed for the random generators (may be overridden with -s) */
+uint64_t seed = 1;
+
+/** The next random stream to hand out to a thread */
+static uint64_t next_stream = 0;
+
 /** The probaility for a set operation */
 int setprc = 33;
 
+/** The operations to run (see -O, defaults to gets and -P sets) */
+static struct opmix opmix;
+static bool opmix_given = false;
+
+/** The scenario file with the client groups (see --scenario) */
+static const char *scenario_file = NULL;
+
+/** The parameters to sweep over (see --sweep) */
+static struct sweep sweep;
+/** Where to write the table of the sweep (see --sweep-output) */
+static const char *sweep_output = "-";
+
 int verbose = 0;
 
 /** TODO: get rid of these after testing */
@@ -145,6 +226,10 @@ enum Libraries {
 struct memcachelib {
     int type;
     void *handle;
+#ifdef HAVE_LIBMEMCACHED
+    /** The result the fetches of a multi-get reuse (see --mget) */
+    memcached_result_st *result;
+#endif
 };
 
 /**
@@ -157,11 +242,157 @@ int current_memcached_library = LIBMEMC_TEXTUAL;
  */
 static int progress = 0;
 
+/** The number of seconds between the progress reports (see --interval) */
+static double progress_interval = 1;
+
+/** The number of threads to load the data with (0 uses the -t threads) */
+static int load_threads = 0;
+/** The number of sets the loader sends to a server in one batch */
+static int load_batch = 100;
+/** Where the loader records how far it got (see --checkpoint) */
+static const char *checkpoint_file = NULL;
+
+/** The number of keys the read-modify-write transactions update */
+static int hot_keys = 1;
+/** Give up a read-modify-write transaction after this many retries */
+#define RMW_MAX_RETRIES 1000
+
+/** The percentage of the gets that look for keys nobody stores */
+static double miss_ratio = 0;
+
+/** memcached treats longer expiry times as an absolute time */
+#define TTL_MAX (30 * 24 * 3600)
+/** The range of the expiry times of the items in seconds (see --ttl) */
+static uint32_t ttl_min = 0;
+static uint32_t ttl_max = 0;
+/** Set the items the gets missed again (see --refill) */
+static bool refill = false;
+/** How long it takes to fetch an item from the backing store (in us) */
+static useconds_t fetch_time = 0;
+
+/**
+ * Pick an expiry time from the --ttl range
+ * @param random a random number
+ */
+static uint32_t pick_ttl(uint64_t random) {
+    return ttl_min + (uint32_t)(random % (ttl_max - ttl_min + 1));
+}
+
+/**
+ * Pick an expiry time for an operation. The generator is only used if
+ * --ttl gave a range, so the key sequence doesn't depend on the option.
+ */
+static uint32_t draw_ttl(struct rng *rng) {
+    return ttl_max > ttl_min ? pick_ttl(rng_next(rng)) : ttl_min;
+}
+
+/**
+ * The hot_keys most popular items of every group expire at the same
+ * moment, and the threads that miss them race to set them again (see
+ * --stampede)
+ */
+struct stampede {
+    /** The number of seconds into the run the hot keys expire (0 is off) */
+    uint32_t expire;
+    /** When the hot keys expire (wall clock, an absolute exptime) */
+    time_t deadline;
+    /** The key indexes of the hot keys (hot_keys per group, sorted) */
+    uint64_t *hot;
+    /** Set when a hot key was set again (hot_keys per group) */
+    bool *refilled;
+    /** The number of hot keys nobody has set again */
+    int left;
+    uint64_t refills;
+    uint64_t duplicates;
+    /** The storm lasts from the first miss until all are set again */
+    hrtime_t begin;
+    hrtime_t end;
+};
+
+static struct stampede stampede;
+
+/**
+ * How the working set moves through the key universe (see --drift).
+ * The keys picked by the key distribution are offsets into a window
+ * of no_items keys: slide moves the window a few keys at a time, phase
+ * jumps to the next window every few seconds.
+ */
+enum DriftMode { DRIFT_NONE, DRIFT_SLIDE, DRIFT_PHASE };
+static enum DriftMode drift_mode = DRIFT_NONE;
+/** Keys per second for slide, seconds per window for phase */
+static double drift_rate = 0;
+/** The number of keys the window moves through (0 is 10 windows) */
+static uint64_t key_universe = 0;
+/** When the window started to move */
+static hrtime_t drift_begin;
+
+/** Back off from 1ms up to 1s while the server is out of memory or busy */
+#define LOAD_MIN_BACKOFF 1000
+#define LOAD_MAX_BACKOFF 1000000
+/** Give up after this many rounds where the server didn't store anything */
+#define LOAD_MAX_STALLS 20
+
 struct connection {
     pthread_mutex_t mutex;
     void *handle;
 };
 
+/**
+ * The versions of the values of a key (see -V). A get may not return a
+ * version the server must have overwritten: one that was stored before
+ * a store that finished before the get began.
+ */
+struct key_version {
+    /** The last version handed out */
+    uint32_t issued;
+    /** The number of stores in flight */
+    uint32_t inflight;
+    /** The versions up to this one are all done */
+    uint32_t quiet;
+    /** The oldest version a get may return */
+    uint32_t floor;
+    bool lock;
+};
+
+/**
+ * A store of a new version of a key (see version_begin)
+ */
+struct version_ticket {
+    uint32_t version;
+    /** The quiet version when the store began */
+    uint32_t quiet;
+    bool active;
+};
+
+/**
+ * A population of clients with its own library, operation mix, keys and
+ * value sizes (see --scenario). Without a scenario file all of the
+ * threads belong to one group configured from the command line.
+ */
+struct client_group {
+    struct scenario_group config;
+    struct keygen keygen;
+    /** The size of every item */
+    size_t *dataset;
+    struct datablock datablock;
+    /**
+     * Cleared if the mix contains operations that delete the items or
+     * change their size, so the gets can't expect to find the dataset
+     */
+    bool expect_dataset;
+    struct connection *pool;
+    size_t pool_size;
+    /** The number of the groups first thread */
+    int first_thread;
+    /** The number of keys the window moves through (see --drift) */
+    uint64_t universe;
+    /** The versions of every key in the universe (with -V) */
+    struct key_version *versions;
+};
+
+static struct client_group *groups = NULL;
+static int no_groups = 0;
+
 
 #ifdef HAVE_LIBCOUCHBASE
 struct libcouchbase_callback {
@@ -203,37 +434,99 @@ static void get_callback(libcouchbase_t instance,
 }
 #endif
 
+/** The largest batch of a multi-get */
+#define MGET_MAX 128
+
+/** The number of gets to send in one multi-get (see --mget) */
+static int mget_batch = 0;
+
+#ifdef HAVE_LIBMEMCACHED
+/**
+ * The libmemcached behaviors we know how to turn on (see --libmemcached)
+ */
+static const struct {
+    const char *name;
+    memcached_behavior behavior;
+} libmemcached_behaviors[] = {
+    { "no-block", MEMCACHED_BEHAVIOR_NO_BLOCK },
+    { "buffer", MEMCACHED_BEHAVIOR_BUFFER_REQUESTS },
+    { "noreply", MEMCACHED_BEHAVIOR_NOREPLY },
+    { "ketama", MEMCACHED_BEHAVIOR_KETAMA },
+    { "nodelay", MEMCACHED_BEHAVIOR_TCP_NODELAY },
+#if defined(LIBMEMCACHED_VERSION_HEX) && LIBMEMCACHED_VERSION_HEX >= 0x00047000
+    { "keepalive", MEMCACHED_BEHAVIOR_TCP_KEEPALIVE },
+#endif
+};
+
+#define NO_LIBMEMCACHED_BEHAVIORS \
+    (sizeof(libmemcached_behaviors) / sizeof(libmemcached_behaviors[0]))
+
+/** The behaviors to turn on, one bit per entry in libmemcached_behaviors */
+static uint32_t libmemcached_flags = 0;
+
+/**
+ * Parse the comma separated list of behaviors
+ * @return true on success
+ */
+static bool libmemcached_parse(const char *spec) {
+    while (*spec != '\0') {
+        size_t len = strcspn(spec, ",");
+        size_t ii = 0;
+        while (ii < NO_LIBMEMCACHED_BEHAVIORS &&
+               (strlen(libmemcached_behaviors[ii].name) != len ||
+                strncmp(libmemcached_behaviors[ii].name, spec, len) != 0)) {
+            ++ii;
+        }
+        if (ii == NO_LIBMEMCACHED_BEHAVIORS) {
+            fprintf(stderr, "Unknown libmemcached behavior: %.*s\n",
+                    (int)len, spec);
+            return false;
+        }
+        libmemcached_flags |= 1U << ii;
+        spec += len;
+        if (*spec == ',') {
+            ++spec;
+        }
+    }
+    return true;
+}
+#endif
+
 /**
  * Create a handle to a memcached library
  */
-static void *create_memcached_handle(void) {
-    struct memcachelib* ret = malloc(sizeof(*ret));
-    ret->type = current_memcached_library;
+static void *create_memcached_handle(int library) {
+    struct memcachelib* ret = calloc(1, sizeof(*ret));
+    ret->type = library;
 
-    switch (current_memcached_library) {
+    switch (library) {
 #ifdef HAVE_LIBMEMCACHED
     case LIBMEMCACHED_TEXTUAL:
+    case LIBMEMCACHED_BINARY:
         {
             memcached_st *memc = memcached_create(NULL);
-            for (struct host *host = hosts; host != NULL; host = host->next) {
-                memcached_server_add(memc, host->hostname, host->port);
-                if (!use_multiple_servers) {
-                    break;
+            if (library == LIBMEMCACHED_BINARY) {
+                memcached_behavior_set(memc, MEMCACHED_BEHAVIOR_BINARY_PROTOCOL, 1);
+            }
+            memcached_behavior_set(memc, MEMCACHED_BEHAVIOR_SUPPORT_CAS, 1);
+            for (size_t ii = 0; ii < NO_LIBMEMCACHED_BEHAVIORS; ++ii) {
+                if (libmemcached_flags & (1U << ii)) {
+                    memcached_behavior_set(memc,
+                                           libmemcached_behaviors[ii].behavior,
+                                           1);
                 }
             }
-            ret->handle = memc;
-        }
-        break;
-    case LIBMEMCACHED_BINARY:
-        {
-            memcached_st *memc = memcached_create(NULL);
-            memcached_behavior_set(memc, MEMCACHED_BEHAVIOR_BINARY_PROTOCOL, 1);
             for (struct host *host = hosts; host != NULL; host = host->next) {
                 memcached_server_add(memc, host->hostname, host->port);
                 if (!use_multiple_servers) {
                     break;
                 }
             }
+            if (mget_batch > 1 &&
+                (ret->result = memcached_result_create(memc, NULL)) == NULL) {
+                fprintf(stderr, "Failed to allocate memory\n");
+                exit(1);
+            }
             ret->handle = memc;
         }
         break;
@@ -315,6 +608,9 @@ static void release_memcached_handle(void *handle) {
     case LIBMEMCACHED_TEXTUAL:
         {
             memcached_st *memc = lib->handle;
+            if (lib->result != NULL) {
+                memcached_result_free(lib->result);
+            }
             memcached_free(memc);
         }
         break;
@@ -344,19 +640,22 @@ static void release_memcached_handle(void *handle) {
  * @param nkey The length of the key
  * @param data The data to set
  * @param The size of the data to set
+ * @param exptime The expiry time of the item
  * @return 0 on success -1 otherwise
  */
 static inline int memcached_set_wrapper(struct connection *connection,
                                         const char *key, int nkey,
-                                        const void *data, int size) {
+                                        const void *data, int size,
+                                        uint32_t exptime) {
     struct memcachelib* lib = (struct memcachelib*)connection->handle;
     switch (lib->type) {
 #ifdef HAVE_LIBMEMCACHED
     case LIBMEMCACHED_BINARY: /* FALLTHROUGH */
     case LIBMEMCACHED_TEXTUAL:
         {
-            int rc = memcached_set(lib->handle, key, nkey, data, size, 0, 0);
-            if (rc != MEMCACHED_SUCCESS) {
+            int rc = memcached_set(lib->handle, key, nkey, data, size,
+                                   exptime, 0);
+            if (rc != MEMCACHED_SUCCESS && rc != MEMCACHED_BUFFERED) {
                 return -1;
             }
         }
@@ -370,7 +669,7 @@ static inline int memcached_set_wrapper(struct connection *connection,
             libcouchbase_error_t e;
             struct libcouchbase_callback cb;
             e = libcouchbase_store(instance, &cb, LIBCOUCHBASE_SET, key,
-                                   nkey, data, size, 0, 0, 0);
+                                   nkey, data, size, 0, exptime, 0);
             assert(e == LIBCOUCHBASE_SUCCESS);
             libcouchbase_execute(instance);
             if (cb.error != LIBCOUCHBASE_SUCCESS) {
@@ -388,7 +687,8 @@ static inline int memcached_set_wrapper(struct connection *connection,
                 .keylen = nkey,
                 /* Set will not modify data */
                 .data = (void*)data,
-                .size = size
+                .size = size,
+                .exptime = exptime
             };
             if (libmemc_set(lib->handle, &mitem) != 0) {
                 return -1;
@@ -477,6 +777,379 @@ static inline bool memcached_get_wrapper(struct connection* connection,
     return true;
 }
 
+
+/**
+ * Get many keys with a single request
+ * @param connection the connection to use
+ * @param keys the keys
+ * @param nkeys the length of the keys
+ * @param num the number of keys
+ * @param found called for every item the server returns (in the order
+ *              they arrive)
+ * @param arg passed on to found
+ * @return true if the request went out
+ */
+static bool memcached_mget_wrapper(struct connection *connection,
+                                   const char * const *keys,
+                                   const size_t *nkeys, size_t num,
+                                   void (*found)(void *arg,
+                                                 const char *key, size_t nkey,
+                                                 const void *data,
+                                                 size_t size),
+                                   void *arg) {
+    struct memcachelib* lib = (struct memcachelib*)connection->handle;
+    switch (lib->type) {
+#ifdef HAVE_LIBMEMCACHED
+    case LIBMEMCACHED_BINARY: /* FALLTHROUGH */
+    case LIBMEMCACHED_TEXTUAL:
+        {
+            memcached_st *memc = lib->handle;
+            memcached_return rc = memcached_mget(memc, keys, nkeys, num);
+            if (rc != MEMCACHED_SUCCESS) {
+                return false;
+            }
+
+            /* Fetch into the same result so we don't malloc for every item */
+            memcached_result_st *result;
+            while ((result = memcached_fetch_result(memc, lib->result,
+                                                    &rc)) != NULL) {
+                found(arg, memcached_result_key_value(result),
+                      memcached_result_key_length(result),
+                      memcached_result_value(result),
+                      memcached_result_length(result));
+            }
+            if (rc != MEMCACHED_END && rc != MEMCACHED_NOTFOUND) {
+                return false;
+            }
+        }
+        break;
+#endif
+
+    default:
+        /* check_opmix only allows --mget with libmemcached */
+        (void)keys;
+        (void)nkeys;
+        (void)num;
+        (void)found;
+        (void)arg;
+        abort();
+    }
+
+    return true;
+}
+
+/**
+ * The outcome of an operation
+ */
+enum OpResult {
+    OP_SUCCESS,
+    /** The item didn't exist, wasn't stored or didn't hold a number */
+    OP_FAILED,
+    OP_ERROR
+};
+
+#ifdef HAVE_LIBMEMCACHED
+/**
+ * Get the cas value of an item
+ * @return MEMCACHED_SUCCESS if the item exists
+ */
+static memcached_return memcached_gets_cas(memcached_st *memc, const char *key,
+                                           size_t nkey, uint64_t *cas,
+                                           void **data, size_t *size) {
+    const char *keys[1] = { key };
+    size_t nkeys[1] = { nkey };
+    memcached_return rc = memcached_mget(memc, keys, nkeys, 1);
+    if (rc != MEMCACHED_SUCCESS) {
+        return rc;
+    }
+
+    memcached_result_st *result;
+    rc = MEMCACHED_NOTFOUND;
+    while ((result = memcached_fetch_result(memc, NULL, &rc)) != NULL) {
+        *cas = memcached_result_cas(result);
+        if (data != NULL && *data == NULL) {
+            *size = memcached_result_length(result);
+            if ((*data = malloc(*size + 1)) != NULL) {
+                memcpy(*data, memcached_result_value(result), *size);
+            }
+        }
+        memcached_result_free(result);
+        rc = MEMCACHED_SUCCESS;
+    }
+    return *cas != 0 ? MEMCACHED_SUCCESS : MEMCACHED_NOTFOUND;
+}
+#endif
+
+/**
+ * Run any of the operations except get on the server. incr and decr add
+ * one to the counter, cas gets the cas value of the item and stores the
+ * item with it.
+ * @param connection the connection to use
+ * @param op the operation
+ * @param key the items key
+ * @param nkey the length of the key
+ * @param data the data to store (or append / prepend)
+ * @param size the size of the data
+ * @param exptime the expiry time for the storage commands, touch and gat
+ * @return the outcome of the operation
+ */
+static enum OpResult memcached_op_wrapper(struct connection *connection,
+                                          enum TxnType op, const char *key,
+                                          int nkey, const void *data,
+                                          size_t size, uint32_t exptime) {
+    struct memcachelib* lib = (struct memcachelib*)connection->handle;
+    switch (lib->type) {
+#ifdef HAVE_LIBMEMCACHED
+    case LIBMEMCACHED_BINARY: /* FALLTHROUGH */
+    case LIBMEMCACHED_TEXTUAL:
+        {
+            memcached_st *memc = lib->handle;
+            memcached_return rc;
+            uint64_t value = 0;
+
+            switch (op) {
+            case TX_SET:
+                rc = memcached_set(memc, key, nkey, data, size, exptime, 0);
+                break;
+            case TX_ADD:
+                rc = memcached_add(memc, key, nkey, data, size, exptime, 0);
+                break;
+            case TX_REPLACE:
+                rc = memcached_replace(memc, key, nkey, data, size, exptime, 0);
+                break;
+            case TX_APPEND:
+                rc = memcached_append(memc, key, nkey, data, size, exptime, 0);
+                break;
+            case TX_PREPEND:
+                rc = memcached_prepend(memc, key, nkey, data, size, exptime, 0);
+                break;
+            case TX_CAS:
+                rc = memcached_gets_cas(memc, key, nkey, &value, NULL, NULL);
+                if (rc == MEMCACHED_SUCCESS) {
+                    rc = memcached_cas(memc, key, nkey, data, size, exptime,
+                                       0, value);
+                }
+                break;
+            case TX_DELETE:
+                rc = memcached_delete(memc, key, nkey, 0);
+                break;
+            case TX_INCR:
+                rc = memcached_increment(memc, key, nkey, 1, &value);
+                break;
+            case TX_DECR:
+                rc = memcached_decrement(memc, key, nkey, 1, &value);
+                break;
+#if defined(LIBMEMCACHED_VERSION_HEX) && LIBMEMCACHED_VERSION_HEX >= 0x01000000
+            case TX_TOUCH:
+                rc = memcached_touch(memc, key, nkey, exptime);
+                break;
+#endif
+            default:
+                /* gat (and touch in older versions) */
+                rc = MEMCACHED_NOT_SUPPORTED;
+                break;
+            }
+
+            switch (rc) {
+            case MEMCACHED_SUCCESS:
+            case MEMCACHED_STORED:
+            case MEMCACHED_DELETED:
+            case MEMCACHED_BUFFERED:
+                return OP_SUCCESS;
+            case MEMCACHED_NOTFOUND:
+            case MEMCACHED_NOTSTORED:
+            case MEMCACHED_DATA_EXISTS:
+                return OP_FAILED;
+            default:
+                return OP_ERROR;
+            }
+        }
+#endif
+
+#ifdef HAVE_LIBCOUCHBASE
+    case LIBCOUCHBASE:
+        if (op != TX_SET) {
+            return OP_ERROR;
+        }
+        return memcached_set_wrapper(connection, key, nkey, data, size,
+                                     exptime) == 0 ? OP_SUCCESS : OP_ERROR;
+#endif
+
+    case LIBMEMC_BINARY:
+    case LIBMEMC_TEXTUAL:
+        {
+            struct Memcache *memc = lib->handle;
+            struct Item mitem = {
+                .key = key,
+                .keylen = nkey,
+                /* The storage commands will not modify data */
+                .data = (void*)data,
+                .size = size,
+                .exptime = exptime
+            };
+            int ret;
+
+            switch (op) {
+            case TX_SET:
+                ret = libmemc_set(memc, &mitem);
+                break;
+            case TX_ADD:
+                ret = libmemc_add(memc, &mitem);
+                break;
+            case TX_REPLACE:
+                ret = libmemc_replace(memc, &mitem);
+                break;
+            case TX_APPEND:
+                ret = libmemc_append(memc, &mitem);
+                break;
+            case TX_PREPEND:
+                ret = libmemc_prepend(memc, &mitem);
+                break;
+            case TX_CAS:
+                {
+                    struct Item current = { .key = key, .keylen = nkey };
+                    ret = libmemc_gets(memc, &current);
+                    free(current.data);
+                    if (ret == 0) {
+                        mitem.cas_id = current.cas_id;
+                        ret = libmemc_cas(memc, &mitem);
+                    }
+                }
+                break;
+            case TX_DELETE:
+                ret = libmemc_delete(memc, key, nkey);
+                break;
+            case TX_INCR:
+                ret = libmemc_incr(memc, key, nkey, 1, NULL);
+                break;
+            case TX_DECR:
+                ret = libmemc_decr(memc, key, nkey, 1, NULL);
+                break;
+            case TX_TOUCH:
+                ret = libmemc_touch(memc, key, nkey, exptime);
+                break;
+            case TX_GAT:
+                mitem.data = NULL;
+                mitem.size = 0;
+                ret = libmemc_gat(memc, &mitem);
+                free(mitem.data);
+                break;
+            default:
+                abort();
+            }
+
+            if (ret == -1) {
+                /* Don't let the error messages pile up */
+                free(libmemc_get_error(memc));
+                return OP_ERROR;
+            }
+            return ret == 0 ? OP_SUCCESS : OP_FAILED;
+        }
+
+    default:
+        abort();
+    }
+}
+
+/**
+ * Get an item along with its cas value
+ * @param data where to store the value (allocated with malloc)
+ * @return OP_FAILED if the item doesn't exist
+ */
+static enum OpResult memcached_gets_wrapper(struct connection *connection,
+                                            const char *key, int nkey,
+                                            void **data, size_t *size,
+                                            uint64_t *cas) {
+    struct memcachelib* lib = (struct memcachelib*)connection->handle;
+    *data = NULL;
+    *size = 0;
+    *cas = 0;
+
+    switch (lib->type) {
+#ifdef HAVE_LIBMEMCACHED
+    case LIBMEMCACHED_BINARY: /* FALLTHROUGH */
+    case LIBMEMCACHED_TEXTUAL:
+        switch (memcached_gets_cas(lib->handle, key, nkey, cas, data, size)) {
+        case MEMCACHED_SUCCESS:
+            return *data != NULL ? OP_SUCCESS : OP_ERROR;
+        case MEMCACHED_NOTFOUND:
+            return OP_FAILED;
+        default:
+            return OP_ERROR;
+        }
+#endif
+
+    case LIBMEMC_BINARY:
+    case LIBMEMC_TEXTUAL:
+        {
+            struct Item item = { .key = key, .keylen = nkey };
+            int ret = libmemc_gets(lib->handle, &item);
+            if (ret == -1) {
+                free(libmemc_get_error(lib->handle));
+                return OP_ERROR;
+            } else if (ret == 1) {
+                return OP_FAILED;
+            }
+            *data = item.data;
+            *size = item.size;
+            *cas = item.cas_id;
+            return OP_SUCCESS;
+        }
+
+    default:
+        /* Rejected when we checked the operation mix */
+        return OP_ERROR;
+    }
+}
+
+/**
+ * Store an item if its cas value didn't change
+ * @return OP_FAILED if the item changed or doesn't exist any more
+ */
+static enum OpResult memcached_cas_wrapper(struct connection *connection,
+                                           const char *key, int nkey,
+                                           const void *data, size_t size,
+                                           uint64_t cas) {
+    struct memcachelib* lib = (struct memcachelib*)connection->handle;
+    switch (lib->type) {
+#ifdef HAVE_LIBMEMCACHED
+    case LIBMEMCACHED_BINARY: /* FALLTHROUGH */
+    case LIBMEMCACHED_TEXTUAL:
+        switch (memcached_cas(lib->handle, key, nkey, data, size, 0, 0, cas)) {
+        case MEMCACHED_SUCCESS:
+        case MEMCACHED_STORED:
+            return OP_SUCCESS;
+        case MEMCACHED_NOTFOUND:
+        case MEMCACHED_DATA_EXISTS:
+            return OP_FAILED;
+        default:
+            return OP_ERROR;
+        }
+#endif
+
+    case LIBMEMC_BINARY:
+    case LIBMEMC_TEXTUAL:
+        {
+            struct Item item = {
+                .key = key,
+                .keylen = nkey,
+                .data = (void*)data,
+                .size = size,
+                .cas_id = cas
+            };
+            int ret = libmemc_cas(lib->handle, &item);
+            if (ret == -1) {
+                free(libmemc_get_error(lib->handle));
+                return OP_ERROR;
+            }
+            return ret == 0 ? OP_SUCCESS : OP_FAILED;
+        }
+
+    default:
+        return OP_ERROR;
+    }
+}
+
 static char *get_error_msg(struct connection* connection) {
     struct memcachelib* lib = (struct memcachelib*)connection->handle;
     char *ret = NULL;
@@ -501,56 +1174,95 @@ static char *get_error_msg(struct connection* connection) {
     return ret;
 }
 
-static struct connection* connectionpool;
+/** The minimum number of connections in a groups pool (see -W) */
 static size_t connection_pool_size = 1;
 static int thread_bind_connection = 0;
 
-static int create_connection_pool(void) {
-    connectionpool = calloc(connection_pool_size, sizeof(struct connection));
-    if (connectionpool == NULL) {
+static int create_connection_pool(struct client_group *group) {
+    group->pool = calloc(group->pool_size, sizeof(struct connection));
+    if (group->pool == NULL) {
         return -1;
     }
 
-    for (size_t ii = 0; ii < connection_pool_size; ++ii) {
-        if (pthread_mutex_init(&connectionpool[ii].mutex, NULL) != 0) {
+    for (size_t ii = 0; ii < group->pool_size; ++ii) {
+        if (pthread_mutex_init(&group->pool[ii].mutex, NULL) != 0) {
             abort();
         }
-        if ((connectionpool[ii].handle = create_memcached_handle()) == NULL) {
+        group->pool[ii].handle = create_memcached_handle(group->config.library);
+        if (group->pool[ii].handle == NULL) {
             abort();
         }
     }
     return 0;
 }
 
-static void destroy_connection_pool(void) {
-    for (size_t ii = 0; ii < connection_pool_size; ++ii) {
-        pthread_mutex_destroy(&connectionpool[ii].mutex);
-        release_memcached_handle(connectionpool[ii].handle);
+static void destroy_connection_pool(struct client_group *group) {
+    if (group->pool == NULL) {
+        return;
+    }
+    for (size_t ii = 0; ii < group->pool_size; ++ii) {
+        pthread_mutex_destroy(&group->pool[ii].mutex);
+        release_memcached_handle(group->pool[ii].handle);
+    }
+
+    free(group->pool);
+    group->pool = NULL;
+}
+
+/**
+ * Give the thread its own slice of the connection pool of its group so
+ * that it never needs to lock a connection (used in shared-nothing mode)
+ * @param ctx the thread to assign the connections to
+ * @param thread the thread number within the group
+ * @param no_threads the number of threads in the group
+ */
+static void assign_connections(struct thread_context *ctx, int thread,
+                               int no_threads) {
+    if (!thread_bind_connection) {
+        return;
     }
 
-    free(connectionpool);
-    connectionpool = NULL;
+    size_t pool_size = ctx->group->pool_size;
+    size_t per_thread = pool_size / no_threads;
+    size_t rest = pool_size % no_threads;
+    size_t start = thread * per_thread;
+
+    start += ((size_t)thread < rest) ? (size_t)thread : rest;
+    ctx->connections = &ctx->group->pool[start];
+    ctx->no_connections = per_thread + (((size_t)thread < rest) ? 1 : 0);
+    ctx->next_connection = 0;
 }
 
-static struct connection *get_connection(void) {
+static struct connection *get_connection(struct thread_context *ctx) {
     if (thread_bind_connection) {
-#ifdef __sun
-        return &connectionpool[pthread_self()];
-#else
-        return &connectionpool[0];
-#endif
+        struct connection *ret = &ctx->connections[ctx->next_connection];
+        if (++ctx->next_connection == ctx->no_connections) {
+            ctx->next_connection = 0;
+        }
+        return ret;
     } else {
-        int idx;
+        struct connection *pool = ctx->group->pool;
+        size_t pool_size = ctx->group->pool_size;
+        int idx = rng_range(&ctx->rng, pool_size);
+        if (pthread_mutex_trylock(&pool[idx].mutex) == 0) {
+            return &pool[idx];
+        }
+
+        hrtime_t start = gethrtime();
         do {
-            idx = random() % connection_pool_size;
-        } while (pthread_mutex_trylock(&connectionpool[idx].mutex) != 0);
+            idx = rng_range(&ctx->rng, pool_size);
+        } while (pthread_mutex_trylock(&pool[idx].mutex) != 0);
 
-        return &connectionpool[idx];
+        ctx->lock_wait_time += gethrtime() - start;
+        ++ctx->lock_waits;
+        return &pool[idx];
     }
 }
 
 static void release_connection(struct connection *connection) {
-    pthread_mutex_unlock(&connection->mutex);
+    if (!thread_bind_connection) {
+        pthread_mutex_unlock(&connection->mutex);
+    }
 }
 
 /**
@@ -568,59 +1280,191 @@ static const char* timeval2text(struct timeval* val, char *buffer, size_t size)
 }
 
 /**
- * Initialize the dataset to work on
+ * Convert the seconds the server reports (see get_server_usage) like
+ * timeval2text
+ */
+static const char* seconds2text(double val, char *buffer, size_t size) {
+    long usec = (long)(val * 1000000 + 0.5);
+    struct timeval tv = {
+        .tv_sec = usec / 1000000, .tv_usec = usec % 1000000
+    };
+    return timeval2text(&tv, buffer, size);
+}
+
+/**
+ * Initialize the dataset the group works on
  * @return 0 if success, -1 if memory allocation fails
  */
-static int initialize_dataset(void) {
+static int initialize_dataset(struct client_group *group) {
+    struct datablock *block = &group->datablock;
+    long items = group->config.items;
     uint64_t total = 0;
+    struct rng rng;
 
-    if (datablock.data != NULL) {
-        free(datablock.data);
-    }
+    rng_seed(&rng, seed, next_stream++);
 
-    datablock.data = malloc(datablock.size);
-    if (datablock.data == NULL) {
+    free(block->data);
+    block->data = malloc(block->size + (verify_data ? VALUE_PATTERN_SLACK : 0));
+    if (block->data == NULL) {
         fprintf(stderr, "Failed to allocate memory for the datablock\n");
         return -1;
     }
 
-    memset(datablock.data, 0xff, datablock.size);
-
-    if (dataset != NULL) {
-        free(dataset);
+    if (verify_data) {
+        /* The values are sliced from a random pattern */
+        value_fill_pattern(block->data, block->size + VALUE_PATTERN_SLACK,
+                           seed);
+    } else {
+        memset(block->data, 0xff, block->size);
     }
 
-    dataset = calloc(no_items, sizeof(size_t));
-    if (dataset == NULL) {
+    free(group->dataset);
+    group->dataset = calloc(items, sizeof(size_t));
+    if (group->dataset == NULL) {
         fprintf(stderr, "Failed to allocate memory for the dataset\n");
         return -1;
     }
 
-    for (long ii = 0; ii < no_items; ++ii) {
-        if (use_fixed_block_size) {
-            dataset[ii] = datablock.size;
-        } else {
-            dataset[ii] = datablock.min_size +
-                (random() % (datablock.size - datablock.min_size));
-            assert(dataset[ii] >= datablock.min_size);
-            assert(dataset[ii] <= datablock.size);
-        }
+    for (long ii = 0; ii < items; ++ii) {
+        group->dataset[ii] = sizedist_next(&group->config.sizedist, &rng,
+                                           block->min_size, block->size);
+        assert(group->dataset[ii] >= block->min_size);
+        assert(group->dataset[ii] <= block->size);
 
-        total += dataset[ii];
+        total += group->dataset[ii];
     }
 
-    datablock.avg = (size_t)(total / no_items);
+    block->avg = (size_t)(total / items);
+    if (print_sizes || verbose) {
+        if (no_groups > 1) {
+            fprintf(stdout, "Group %s: ", group->config.name);
+        }
+        fprintf(stdout, "Using %s value sizes (average %zu bytes)\n",
+                sizedist_name(&group->config.sizedist), block->avg);
+        print_size_histogram(group->dataset, items);
+    }
     return 0;
 }
 
+/**
+ * The size of an item. The keys outside the first window reuse the
+ * sizes of the dataset, so a key always has the same size.
+ */
+static size_t item_size(const struct client_group *group, uint64_t idx) {
+    return group->dataset[idx % group->config.items];
+}
+
+/**
+ * The key a value is built for: the key index with the group in the top
+ * bits, so a value from another group is caught too
+ */
+static uint64_t value_key(const struct client_group *group, uint64_t idx) {
+    return ((uint64_t)(group - groups) << 48) | idx;
+}
+
+static void version_lock(struct key_version *kv) {
+    while (__atomic_test_and_set(&kv->lock, __ATOMIC_ACQUIRE)) {
+        /* spin, nobody holds it for long */
+    }
+}
+
+static void version_unlock(struct key_version *kv) {
+    __atomic_clear(&kv->lock, __ATOMIC_RELEASE);
+}
+
+/**
+ * Hand out the next version of a key to store
+ * @param ticket where to store the version (pass it to version_end)
+ * @return the version
+ */
+static uint32_t version_begin(const struct client_group *group, uint64_t idx,
+                              struct version_ticket *ticket) {
+    ticket->active = false;
+    if (group->versions == NULL) {
+        return 0;
+    }
+    struct key_version *kv = &group->versions[idx];
+    version_lock(kv);
+    ticket->version = ++kv->issued;
+    ticket->quiet = kv->quiet;
+    ++kv->inflight;
+    version_unlock(kv);
+    ticket->active = true;
+    return ticket->version;
+}
+
+/**
+ * The store of a version is done. A successful store overwrites all of
+ * the versions that were done when it began. We don't know if a store
+ * that failed with an error reached the server, so it stays in flight
+ * (and the key stops advancing its quiet version).
+ */
+static void version_end(const struct client_group *group, uint64_t idx,
+                        const struct version_ticket *ticket,
+                        enum OpResult res) {
+    if (!ticket->active || res == OP_ERROR) {
+        return;
+    }
+    struct key_version *kv = &group->versions[idx];
+    version_lock(kv);
+    if (res == OP_SUCCESS && ticket->quiet + 1 > kv->floor) {
+        kv->floor = ticket->quiet + 1;
+    }
+    if (--kv->inflight == 0) {
+        kv->quiet = kv->issued;
+    }
+    version_unlock(kv);
+}
+
+/**
+ * The oldest version a get of the key that begins now may return
+ */
+static uint32_t version_floor(const struct client_group *group, uint64_t idx) {
+    if (group->versions == NULL) {
+        return 0;
+    }
+    return __atomic_load_n(&group->versions[idx].floor, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * The value to store for an item. With -V every key gets its own
+ * checksummed value (see value.h), built in the buffer.
+ */
+static const void *build_value(const struct client_group *group,
+                               void *buffer, uint64_t idx, uint32_t version) {
+    if (!verify_data) {
+        return group->datablock.data;
+    }
+    value_build(buffer, item_size(group, idx), group->datablock.data,
+                value_key(group, idx), version);
+    return buffer;
+}
+
+/**
+ * The value the thread should store for an item (see build_value)
+ * @param ticket where to store the version (pass it to version_end), or
+ *               NULL to store version 0 if nobody compares the versions
+ */
+static const void *item_value(struct thread_context *ctx, uint64_t idx,
+                              struct version_ticket *ticket) {
+    if (verify_data && ctx->value == NULL &&
+        (ctx->value = malloc(ctx->group->datablock.size)) == NULL) {
+        fprintf(stderr, "Failed to allocate memory for the values\n");
+        abort();
+    }
+    return build_value(ctx->group, ctx->value, idx,
+                       ticket ? version_begin(ctx->group, idx, ticket) : 0);
+}
+
 /**
  * Populate the dataset to the server
  * @return 0 if success, -1 if an error occurs
  */
 static int populate_dataset(struct thread_context *ctx) {
-    struct connection* connection = get_connection();
+    struct client_group *group = ctx->group;
+    struct connection* connection = get_connection(ctx);
     int end = ctx->offset + ctx->total;
-    char key[256];
+    const char *key;
     size_t nkey;
     int sres = -1;
 
@@ -629,9 +1473,13 @@ static int populate_dataset(struct thread_context *ctx) {
         fprintf(stderr, "Populating from %d to %d\n", ctx->offset, end);
     }
     for (int ii = ctx->offset; ii < end; ++ii) {
-        nkey = snprintf(key, sizeof(key), "%s%d", prefix, ii);
+        struct version_ticket ticket;
+        key = keygen_key(&group->keygen, ii, ctx->key, &nkey);
         sres = memcached_set_wrapper(connection, key, nkey,
-                                     datablock.data, dataset[ii]);
+                                     item_value(ctx, ii, &ticket),
+                                     group->dataset[ii],
+                                     pick_ttl(ii * 0x9e3779b97f4a7c15ULL));
+        version_end(group, ii, &ticket, sres == 0 ? OP_SUCCESS : OP_ERROR);
         if (sres != 0) {
             char *msg = get_error_msg(connection);
             fprintf(stderr, "Failed to set [%s]: %s!\n", key,
@@ -661,16 +1509,17 @@ static void *populate_thread_main(void* arg) {
 }
 
 /**
- * Populate the data on the servers
+ * Populate the data of the group on the servers
+ * @param group the group to populate the data for
  * @param no_threads the number of theads to use
  * @return 0 if success, -1 otherwise
  */
-static int populate_data(int no_threads) {
+static int populate_data(struct client_group *group, int no_threads) {
     int ret = 0;
     pthread_t *threads = calloc(sizeof(pthread_t), no_threads);
     struct thread_context *ctx = calloc(sizeof(struct thread_context), no_threads);
-    int perThread = no_items / no_threads;
-    int rest = no_items % no_threads;
+    int perThread = group->config.items / no_threads;
+    int rest = group->config.items % no_threads;
     size_t offset = 0;
     int ii;
 
@@ -687,6 +1536,9 @@ static int populate_data(int no_threads) {
                                    (rest > 0) ? perThread + 1 : perThread)) {
             abort();
         }
+        rng_seed(&ctxi->rng, seed, next_stream++);
+        ctxi->group = group;
+        assign_connections(ctxi, ii, no_threads);
         offset += perThread;
         if (rest > 0) {
             --rest;
@@ -704,6 +1556,9 @@ static int populate_data(int no_threads) {
             ret = -1;
         }
     }
+    for (ii = 0; ii < no_threads; ++ii) {
+        free(ctx[ii].value);
+    }
     free(threads);
     free(ctx);
 
@@ -711,319 +1566,4063 @@ static int populate_data(int no_threads) {
 }
 
 
-static int get_setval(void) {
-    return random() % no_items;
+/**
+ * The state shared by the bulk loader threads. The items from the
+ * checkpoint and up are split in chunks of load_batch items that the
+ * threads claim one at a time, so a slow connection doesn't hold back
+ * the others.
+ */
+struct bulk_loader {
+    struct client_group *group;
+    /** The first item to load */
+    long first;
+    size_t no_chunks;
+    /** The next chunk to hand out */
+    size_t next_chunk;
+    /** Set when all of the items in the chunk are stored */
+    bool *done;
+    /** The number of threads still loading */
+    int active;
+    uint64_t items;
+    uint64_t bytes;
+    uint64_t retries;
+    bool failed;
+};
+
+/**
+ * Read the checkpoint left by an earlier (interrupted) load
+ * @return the number of items already loaded
+ */
+static long read_checkpoint(const struct client_group *group) {
+    FILE *fp = fopen(checkpoint_file, "r");
+    char line[512];
+    long items = -1;
+    long loaded = 0;
+    unsigned long long cseed = 0;
+    bool same_prefix = false;
+
+    if (fp == NULL) {
+        if (errno != ENOENT) {
+            fprintf(stderr, "Failed to open %s: %s\n", checkpoint_file,
+                    strerror(errno));
+        }
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *ptr = strchr(line, '\n');
+        if (ptr != NULL) {
+            *ptr = '\0';
+        }
+
+        if (strncmp(line, "prefix ", 7) == 0) {
+            same_prefix = strcmp(line + 7, group->config.prefix) == 0;
+        } else {
+            (void)(sscanf(line, "items %ld", &items) == 1 ||
+                   sscanf(line, "seed %llu", &cseed) == 1 ||
+                   sscanf(line, "loaded %ld", &loaded) == 1);
+        }
+    }
+    fclose(fp);
+
+    if (items != group->config.items || cseed != seed || !same_prefix ||
+        loaded < 0 || loaded > group->config.items) {
+        fprintf(stderr, "WARNING: %s is for a different dataset, "
+                "loading all of the items\n", checkpoint_file);
+        return 0;
+    }
+
+    return loaded;
+}
+
+/**
+ * Record the number of items loaded (the file is replaced atomically so
+ * a crash never leaves a partial checkpoint behind)
+ * @param loaded the number of items stored in order from the first
+ */
+static void write_checkpoint(const struct client_group *group, long loaded) {
+    char tmpfile[PATH_MAX];
+    FILE *fp;
+
+    snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", checkpoint_file);
+    if ((fp = fopen(tmpfile, "w")) == NULL) {
+        fprintf(stderr, "Failed to create %s: %s\n", tmpfile, strerror(errno));
+        return;
+    }
+
+    fprintf(fp, "items %ld\nseed %llu\nprefix %s\nloaded %ld\n",
+            group->config.items, (unsigned long long)seed,
+            group->config.prefix, loaded);
+    if (fclose(fp) != 0 || rename(tmpfile, checkpoint_file) != 0) {
+        fprintf(stderr, "Failed to write %s: %s\n", checkpoint_file,
+                strerror(errno));
+    }
 }
 
 /**
- * Test the server and library
- * @param rep Where to store the result of the test
+ * Store the items, backing off and retrying the ones the server is
+ * out of memory or too busy to store right now
  * @return 0 on success, -1 otherwise
  */
-static int test(struct thread_context *ctx) {
-    int ret = 0;
-    struct connection* connection;
-    char key[256];
-    size_t nkey;
-    for (int ii = 0; ii < ctx->total; ++ii) {
-        connection = get_connection();
-        int idx = get_setval();
-        nkey = snprintf(key, sizeof(key), "%s%d", prefix, idx);
+static int bulk_store(struct bulk_loader *loader, struct Memcache *memc,
+                      struct Item *items, size_t num, uint16_t *status) {
+    useconds_t backoff = LOAD_MIN_BACKOFF;
+    int stalls = 0;
 
-        if (setprc > 0 && (random() % 100) < setprc) {
-            hrtime_t delta;
-            hrtime_t start = gethrtime();
-            memcached_set_wrapper(connection, key, nkey,
-                                  datablock.data, dataset[idx]);
-            delta = gethrtime() - start;
-            record_tx(TX_SET, delta, ctx);
-        } else {
-            /* go set it from random data */
-            if (verbose) {
-                fprintf(stderr, "CMD: get %s\n", key);
-            }
-            hrtime_t delta;
-            size_t size = 0;
-            hrtime_t start = gethrtime();
-            void *data;
-            bool found = memcached_get_wrapper(connection, key, nkey, &size,
-                                               &data);
+    while (num > 0) {
+        if (libmemc_mset(memc, items, num, status) != 0) {
+            char *msg = libmemc_get_error(memc);
+            fprintf(stderr, "Failed to load the data: %s\n",
+                    msg == NULL ? "unknown reason" : msg);
+            free(msg);
+            return -1;
+        }
 
-            delta = gethrtime() - start;
-            if (found) {
-                if (size != dataset[idx]) {
-                    fprintf(stderr,
-                            "Incorrect length returned for <%s>. "
-                            "Stored %ld got %ld\n",
-                            key, dataset[idx], (long)size);
-                } else if (verify_data &&
-                           memcmp(datablock.data, data, size) != 0) {
-                    fprintf(stderr, "Garbled data for <%s>\n", key);
-                }
-                record_tx(TX_GET, delta, ctx);
-                free(data);
-            } else {
-                fprintf(stderr, "<%s> isn't there anymore\n", key);
+        size_t failed = 0;
+        for (size_t ii = 0; ii < num; ++ii) {
+            if (status[ii] == STATUS_ENOMEM || status[ii] == STATUS_ETMPFAIL) {
+                items[failed++] = items[ii];
+            } else if (status[ii] != STATUS_SUCCESS) {
+                fprintf(stderr, "Failed to set [%s]: status 0x%02x\n",
+                        items[ii].key, status[ii]);
+                return -1;
             }
         }
-        release_connection(connection);
+
+        if (failed == num && ++stalls == LOAD_MAX_STALLS) {
+            fprintf(stderr, "Giving up: the server keeps refusing to store "
+                    "the items (status 0x%02x)\n", status[0]);
+            return -1;
+        } else if (failed < num) {
+            stalls = 0;
+        }
+
+        if (failed > 0) {
+            __atomic_fetch_add(&loader->retries, failed, __ATOMIC_RELAXED);
+            usleep(backoff);
+            backoff = backoff * 2 < LOAD_MAX_BACKOFF ? backoff * 2 : LOAD_MAX_BACKOFF;
+        }
+        num = failed;
     }
 
-    return ret;
+    return 0;
 }
 
 /**
- * The threads entry function
- * @param arg this should be a pointer to where this thread should report
- *            the result
- * @return arg
+ * The bulk loader threads entry function. Each thread has its own
+ * connection to every server.
+ * @param arg the bulk loader
+ * @return arg on success, NULL otherwise
  */
-void *test_thread_main(void* arg) {
-    test((struct thread_context*)arg);
-    return arg;
+static void *bulk_load_thread_main(void *arg) {
+    struct bulk_loader *loader = arg;
+    struct client_group *group = loader->group;
+    long no_items = group->config.items;
+    struct memcachelib *lib = create_memcached_handle(group->config.library);
+    struct Item *items = calloc(load_batch, sizeof(struct Item));
+    uint16_t *status = calloc(load_batch, sizeof(uint16_t));
+    char *keys = malloc(load_batch * (KEYGEN_MAX_KEY + 1));
+    struct version_ticket *tickets = calloc(load_batch,
+                                            sizeof(struct version_ticket));
+    /* Every item in the batch needs its own value with -V */
+    char *values = NULL;
+    void *ret = arg;
+
+    if (verify_data) {
+        values = malloc(load_batch * group->datablock.size);
+    }
+    if (items == NULL || status == NULL || keys == NULL || tickets == NULL ||
+        (verify_data && values == NULL)) {
+        fprintf(stderr, "Failed to allocate memory for the loader\n");
+        ret = NULL;
+    }
+
+    while (ret != NULL && !__atomic_load_n(&loader->failed, __ATOMIC_RELAXED)) {
+        size_t chunk = __atomic_fetch_add(&loader->next_chunk, 1,
+                                          __ATOMIC_RELAXED);
+        if (chunk >= loader->no_chunks) {
+            break;
+        }
+
+        long begin = loader->first + (long)chunk * load_batch;
+        long end = begin + load_batch < no_items ? begin + load_batch : no_items;
+        uint64_t bytes = 0;
+        size_t num = 0;
+        for (long ii = begin; ii < end; ++ii, ++num) {
+            size_t nkey;
+            items[num].key = keygen_key(&group->keygen, ii,
+                                        keys + num * (KEYGEN_MAX_KEY + 1),
+                                        &nkey);
+            items[num].keylen = (int)nkey;
+            uint32_t version = version_begin(group, ii, &tickets[num]);
+            items[num].data = (void *)build_value(group,
+                                                  values + num * group->datablock.size,
+                                                  ii, version);
+            items[num].size = group->dataset[ii];
+            items[num].exptime = pick_ttl(ii * 0x9e3779b97f4a7c15ULL);
+            bytes += group->dataset[ii];
+        }
+
+        /* bulk_store only succeeds if it stored all of the items */
+        int rc = bulk_store(loader, lib->handle, items, num, status);
+        for (size_t jj = 0; jj < num; ++jj) {
+            version_end(group, begin + jj, &tickets[jj],
+                        rc == 0 ? OP_SUCCESS : OP_ERROR);
+        }
+        if (rc != 0) {
+            __atomic_store_n(&loader->failed, true, __ATOMIC_RELAXED);
+            ret = NULL;
+        } else {
+            __atomic_fetch_add(&loader->items, num, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&loader->bytes, bytes, __ATOMIC_RELAXED);
+            __atomic_store_n(&loader->done[chunk], true, __ATOMIC_RELEASE);
+        }
+    }
+
+    free(values);
+    free(tickets);
+    free(keys);
+    free(status);
+    free(items);
+    release_memcached_handle(lib);
+    __atomic_sub_fetch(&loader->active, 1, __ATOMIC_RELEASE);
+    return ret;
 }
 
 /**
- * Add a host into the list of memcached servers to use
- * @param hostname the hostname:port to connect to
+ * Print the progress of the load
+ * @param loader the bulk loader
+ * @param elapsed the number of seconds since the load started
+ * @param final set for the summary at the end
  */
-static void add_host(const char *hostname) {
-    struct host *entry = malloc(sizeof(struct host));
-    if (entry == 0) {
-        fprintf(stderr, "Failed to allocate memory for <%s>. Host ignored\n",
-                hostname);
-        fflush(stderr);
-        return;
-    }
-    entry->next = hosts;
-    hosts = entry;
-    entry->hostname = strdup(hostname);
-    char *ptr = strchr(entry->hostname, ':');
-    if (ptr != NULL) {
-        *ptr = '\0';
-        entry->port = atoi(ptr + 1);
+static void print_load_progress(struct bulk_loader *loader, double elapsed,
+                                bool final) {
+    uint64_t items = __atomic_load_n(&loader->items, __ATOMIC_RELAXED);
+    uint64_t bytes = __atomic_load_n(&loader->bytes, __ATOMIC_RELAXED);
+    double rate = elapsed > 0 ? items / elapsed : 0;
+    double mbrate = elapsed > 0 ? bytes / elapsed / (1024 * 1024) : 0;
+    uint64_t total = loader->group->config.items - loader->first;
+
+    if (final) {
+        fprintf(stdout, "Loaded %" PRIu64 " items (%.1f MB) in %.1f s: "
+                "%.0f items/s, %.1f MB/s", items, bytes / (1024.0 * 1024),
+                elapsed, rate, mbrate);
+        uint64_t retries = __atomic_load_n(&loader->retries, __ATOMIC_RELAXED);
+        if (retries > 0) {
+            fprintf(stdout, " (%" PRIu64 " retries)", retries);
+        }
+        fprintf(stdout, "\n");
     } else {
-        entry->port = 11211;
+        fprintf(stdout, "[%8.1f s] loaded %10" PRIu64 " of %" PRIu64
+                " items (%5.1f%%) %10.0f items/s %8.1f MB/s",
+                elapsed, items, total, items * 100.0 / total, rate, mbrate);
+        if (rate > 0) {
+            fprintf(stdout, "  ETA %.0f s", (total - items) / rate);
+        }
+        fprintf(stdout, "\n");
     }
+    fflush(stdout);
 }
 
-static struct addrinfo *lookuphost(const char *hostname, in_port_t port) {
-    struct addrinfo *ai = 0;
-    struct addrinfo hints = {
-        .ai_flags = AI_PASSIVE|AI_ADDRCONFIG,
-        .ai_family = AF_UNSPEC,
-        .ai_protocol = IPPROTO_TCP,
-        .ai_socktype = SOCK_STREAM };
-    char service[NI_MAXSERV];
-    int error;
+/**
+ * Load the data of the group with pipelined sets over multiple
+ * connections to each server, reporting the progress every second. With
+ * --checkpoint the load continues where an interrupted load stopped.
+ * @param group the group to load the data for
+ * @param no_threads the number of threads in the group (used unless
+ *                   --load-threads is set)
+ * @return 0 if success, -1 otherwise
+ */
+static int bulk_load(struct client_group *group, int no_threads) {
+    long no_items = group->config.items;
 
-    (void)snprintf(service, NI_MAXSERV, "%d", port);
-    if ((error = getaddrinfo(hostname, service, &hints, &ai)) != 0) {
-        if (error != EAI_SYSTEM) {
-            fprintf(stderr, "getaddrinfo(): %s\n", gai_strerror(error));
-        } else {
-            perror("getaddrinfo()");
+    if (no_groups > 1) {
+        fprintf(stdout, "Loading the data for group %s\n", group->config.name);
+    }
+    if (group->config.library != LIBMEMC_TEXTUAL &&
+        group->config.library != LIBMEMC_BINARY) {
+        if (checkpoint_file != NULL) {
+            fprintf(stderr, "WARNING: The checkpoint is only supported with "
+                    "the libmemc libraries\n");
         }
+        return populate_data(group, no_threads);
     }
 
-    return ai;
-}
+    struct bulk_loader loader = { .group = group, .first = 0 };
+    if (checkpoint_file != NULL &&
+        (loader.first = read_checkpoint(group)) > 0) {
+        if (loader.first == no_items) {
+            fprintf(stdout, "All of the items are loaded according to %s\n",
+                    checkpoint_file);
+            return 0;
+        }
+        fprintf(stdout, "Resuming the load at item %ld\n", loader.first);
+    }
 
-static int get_server_rusage(const struct host *entry, struct rusage *rusage) {
-    int ret = -1;
-    switch (current_memcached_library) {
-    case LIBMEMC_TEXTUAL:
-        {
-            int sock;
-            char buffer[8192];
-            struct addrinfo* addrinfo = lookuphost(entry->hostname, entry->port);
-            if (addrinfo == NULL) {
-                return -1;
-            }
+    int nthreads = load_threads > 0 ? load_threads : no_threads;
+    loader.no_chunks = (no_items - loader.first + load_batch - 1) / load_batch;
+    loader.done = calloc(loader.no_chunks, sizeof(bool));
+    pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+    if (loader.done == NULL || threads == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        free(loader.done);
+        free(threads);
+        return -1;
+    }
 
-            memset(rusage, 0, sizeof(*rusage));
-
-            if ((sock = socket(addrinfo->ai_family,
-                               addrinfo->ai_socktype,
-                               addrinfo->ai_protocol)) != -1) {
-                if (connect(sock, addrinfo->ai_addr, addrinfo->ai_addrlen) != -1) {
-                    if (send(sock, "stats\r\n", 7, 0) > 0) {
-                        if (recv(sock, buffer, sizeof(buffer), 0) > 0) {
-                            char *ptr = strstr(buffer, "rusage_user");
-                            if (ptr != NULL) {
-                                rusage->ru_utime.tv_sec = atoi(ptr + 12);
-                                ptr = strchr(ptr, '.');
-                                if (ptr != NULL) {
-                                    rusage->ru_utime.tv_usec = atoi(ptr + 1);
-                                }
-                            }
-
-                            ptr = strstr(buffer, "rusage_system");
-                            if (ptr != NULL) {
-                                rusage->ru_stime.tv_sec = atoi(ptr + 14);
-
-                                ptr = strchr(ptr, '.');
-                                if (ptr != NULL) {
-                                    rusage->ru_stime.tv_usec = atoi(ptr + 1);
-                                }
-                            }
-                            ret = 0;
-                        } else {
-                            fprintf(stderr, "Failed to read data: %s\n", strerror(errno));
-                        }
-                    } else {
-                        fprintf(stderr, "Failed to send data: %s\n", strerror(errno));
-                    }
-                } else {
-                    fprintf(stderr, "Failed to connect socket: %s\n", strerror(errno));
-                }
+    hrtime_t begin = gethrtime();
+    hrtime_t last = begin;
+    size_t watermark = 0;
+    loader.active = nthreads;
+    for (int ii = 0; ii < nthreads; ++ii) {
+        pthread_create(&threads[ii], 0, bulk_load_thread_main, &loader);
+    }
 
-                close(sock);
-            } else {
-                fprintf(stderr, "Failed to create socket: %s\n", strerror(errno));
+    /* The checkpoint is the first item after the chunks stored in order */
+    while (__atomic_load_n(&loader.active, __ATOMIC_ACQUIRE) > 0) {
+        usleep(100000);
+        hrtime_t now = gethrtime();
+        if (now - last < 1000000000) {
+            continue;
+        }
+        last = now;
+
+        print_load_progress(&loader, (now - begin) / 1000000000.0, false);
+        if (checkpoint_file != NULL) {
+            while (watermark < loader.no_chunks &&
+                   __atomic_load_n(&loader.done[watermark], __ATOMIC_ACQUIRE)) {
+                ++watermark;
             }
+            long loaded = loader.first + (long)watermark * load_batch;
+            write_checkpoint(group, loaded < no_items ? loaded : no_items);
+        }
+    }
+
+    int ret = 0;
+    for (int ii = 0; ii < nthreads; ++ii) {
+        void *threadret;
+        pthread_join(threads[ii], &threadret);
+        if (threadret == NULL) {
+            ret = -1;
+        }
+    }
+
+    if (checkpoint_file != NULL) {
+        while (watermark < loader.no_chunks && loader.done[watermark]) {
+            ++watermark;
+        }
+        long loaded = loader.first + (long)watermark * load_batch;
+        write_checkpoint(group, loaded < no_items ? loaded : no_items);
+    }
+    print_load_progress(&loader, (gethrtime() - begin) / 1000000000.0, true);
+
+    free(threads);
+    free(loader.done);
+    return ret;
+}
+
+
+/**
+ * Add the operation to the threads trace stream
+ * @param ctx the thread
+ * @param start when the operation started
+ * @param op the operation
+ * @param idx the key index
+ */
+static void record_op(struct thread_context *ctx, hrtime_t start,
+                      enum TxnType op, uint64_t idx) {
+    uint32_t delta = 0;
+    if (ctx->last_op != 0) {
+        delta = (uint32_t)((start - ctx->last_op) / 1000);
+    }
+    ctx->last_op = start;
+
+    if (!trace_stream_append(ctx->record, delta, op, idx, NULL, 0,
+                             item_size(ctx->group, idx), 0)) {
+        fprintf(stderr, "Failed to allocate memory for the trace\n");
+        ctx->record = NULL;
+    }
+}
 
-            freeaddrinfo(addrinfo);
+/**
+ * Check if the thread should do another operation, and whether the
+ * operation belongs to the measured window
+ * @param ctx the thread context
+ * @param more set if the thread has more work to do
+ * @return true if the thread should continue
+ */
+static bool keep_running(struct thread_context *ctx, bool more) {
+    if (more && timed_run) {
+        hrtime_t now = gethrtime();
+        if (now >= __atomic_load_n(&run_end, __ATOMIC_RELAXED)) {
+            return false;
         }
+        ctx->measuring = now >= __atomic_load_n(&measure_begin,
+                                                __ATOMIC_RELAXED);
+    }
+    return more;
+}
+
+/**
+ * Where the window starts in the key universe
+ * @param group the group the window belongs to
+ * @param now the current time
+ */
+static uint64_t window_start(const struct client_group *group, hrtime_t now) {
+    double elapsed = now > drift_begin ? (now - drift_begin) / 1000000000.0 : 0;
+    uint64_t start = 0;
+
+    switch (drift_mode) {
+    case DRIFT_SLIDE:
+        start = (uint64_t)(elapsed * drift_rate);
         break;
-    default:
+    case DRIFT_PHASE:
+        start = (uint64_t)(elapsed / drift_rate) * group->config.items;
+        break;
+    case DRIFT_NONE:
         break;
     }
-    return ret;
+
+    return start % group->universe;
+}
+
+static uint64_t get_setval(struct thread_context *ctx) {
+    uint64_t idx = keydist_next(&ctx->group->config.keydist, &ctx->rng);
+    if (drift_mode != DRIFT_NONE) {
+        idx = (window_start(ctx->group, gethrtime()) + idx) %
+            ctx->group->universe;
+    }
+    return idx;
 }
 
 /**
- * Program entry point
- * @param argc argument count
- * @param argv argument vector
- * @return 0 on success, 1 otherwise
+ * The size of the data appended or prepended to an item (the items would
+ * grow too fast if we used the size from the dataset)
  */
-int main(int argc, char **argv) {
-    int cmd;
-    int no_threads = 1;
-    int populate = 1;
-    int loop = 0;
-    struct rusage rusage;
-    struct rusage server_start;
-    struct timeval starttime = {.tv_sec = 0};
-    int size;
-    gettimeofday(&starttime, NULL);
+static size_t append_size(const struct client_group *group) {
+    return group->datablock.size < 16 ? group->datablock.size : 16;
+}
 
-    while ((cmd = getopt(argc, argv, "K:QW:M:pL:P:Fm:t:h:i:s:c:VlSvC:")) != EOF) {
-        switch (cmd) {
-        case 'K':
-            if (strlen(prefix) > 240) {
-                fprintf(stderr, "Prefix too long\n");
-                return 1;
-            }
-            prefix = optarg;
-            break;
-        case 'p':
-            progress = 1;
-            break;
-        case 'P':
-            setprc = atoi(optarg);
+/**
+ * Aim some of the gets at keys outside the dataset (see --miss-ratio)
+ * @param ctx the thread context
+ * @param idx the key the get would have used
+ * @param key where to store the key to look for instead
+ * @param nkey where to store the length of the key
+ * @return true if the get should look for the returned key
+ */
+static bool negative_lookup(struct thread_context *ctx, uint64_t idx,
+                            const char **key, size_t *nkey) {
+    if (miss_ratio <= 0 || rng_double(&ctx->rng) * 100 >= miss_ratio) {
+        return false;
+    }
+
+    int len = snprintf(ctx->key, sizeof(ctx->key), "%smiss:%"PRIu64,
+                       ctx->group->config.prefix, idx);
+    *nkey = len < (int)sizeof(ctx->key) ? (size_t)len : sizeof(ctx->key) - 1;
+    *key = ctx->key;
+    return true;
+}
+
+/**
+ * Check the value a get returned for an item in the dataset
+ * @param group the group the item belongs to
+ * @param key the items key
+ * @param idx the key index
+ * @param data the value
+ * @param size the size of the value
+ * @param floor the oldest version the get may return (see version_floor)
+ */
+static void check_value(const struct client_group *group, const char *key,
+                        uint64_t idx, const void *data, size_t size,
+                        uint32_t floor) {
+    enum ValueCheck check = VALUE_OK;
+    uint32_t version = 0;
+    if (!group->expect_dataset) {
+        /* The value may have been appended to or replaced by a counter */
+    } else if (verify_data &&
+               (check = value_verify(data, size, value_key(group, idx),
+                                     &version)) == VALUE_WRONG_KEY) {
+        fprintf(stderr, "Got the value of another key for <%s>\n", key);
+    } else if (size != item_size(group, idx)) {
+        fprintf(stderr,
+                "Incorrect length returned for <%s>. Stored %ld got %ld\n",
+                key, (long)item_size(group, idx), (long)size);
+    } else if (check == VALUE_CORRUPT) {
+        fprintf(stderr, "Garbled data for <%s> (version %u)\n",
+                key, version);
+    } else if (verify_data && size >= VALUE_HEADER_SIZE && version < floor) {
+        fprintf(stderr,
+                "Got a stale value for <%s> (version %u, expected %u or newer)\n",
+                key, version, floor);
+    }
+}
+
+/**
+ * Run an operation other than get and record it. Counters that don't
+ * exist (or hold the value from a set) are reset to 0 so the next incr
+ * or decr finds a number.
+ */
+static enum OpResult run_op(struct thread_context *ctx,
+                            struct connection *connection,
+                            enum TxnType op, const char *key, size_t nkey,
+                            const void *data, size_t size, uint32_t exptime) {
+    hrtime_t start = gethrtime();
+    enum OpResult res = memcached_op_wrapper(connection, op, key, nkey,
+                                             data, size, exptime);
+    if (res != OP_ERROR) {
+        record_tx(op, gethrtime() - start, ctx);
+    }
+    if (res != OP_SUCCESS) {
+        record_failure(op, ctx);
+        if ((op == TX_INCR || op == TX_DECR) && res == OP_FAILED) {
+            (void)memcached_set_wrapper(connection, key, nkey, "0", 1, 0);
+        }
+    }
+    return res;
+}
+
+/**
+ * Check if the get of a hot key is part of a stampede
+ */
+static bool in_storm(void) {
+    return __atomic_load_n(&stampede.begin, __ATOMIC_RELAXED) != 0 &&
+        __atomic_load_n(&stampede.end, __ATOMIC_RELAXED) == 0;
+}
+
+/**
+ * A get missed a hot key, so the stampede begins (if it hasn't already)
+ */
+static void stampede_miss(void) {
+    hrtime_t expected = 0;
+    (void)__atomic_compare_exchange_n(&stampede.begin, &expected, gethrtime(),
+                                      false, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED);
+}
+
+/**
+ * qsort callback ordering key indexes
+ */
+static int compare_index(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Find the hot key in the stampede
+ * @param group the group the key belongs to
+ * @param idx the key index
+ * @return the slot of the hot key, -1 if it isn't one of them
+ */
+static int hot_slot(const struct client_group *group, uint64_t idx) {
+    const uint64_t *hot = stampede.hot + (group - groups) * hot_keys;
+    int low = 0;
+    int high = hot_keys;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (hot[mid] < idx) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low < hot_keys && hot[low] == idx) {
+        return (int)(hot - stampede.hot) + low;
+    }
+    return -1;
+}
+
+/**
+ * Count the set of a hot key after the stampede began. Everyone but the
+ * first to set the key did it in vain.
+ * @param slot the slot of the hot key
+ */
+static void stampede_refilled(int slot) {
+    __atomic_fetch_add(&stampede.refills, 1, __ATOMIC_RELAXED);
+    if (__atomic_exchange_n(&stampede.refilled[slot], true, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&stampede.duplicates, 1, __ATOMIC_RELAXED);
+    } else if (__atomic_sub_fetch(&stampede.left, 1, __ATOMIC_RELAXED) == 0) {
+        __atomic_store_n(&stampede.end, gethrtime(), __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Fetch the item the get missed from the backing store and set it again
+ * (see --refill)
+ */
+static void refill_item(struct thread_context *ctx,
+                        struct connection *connection,
+                        const char *key, size_t nkey, uint64_t idx) {
+    if (fetch_time > 0) {
+        usleep(fetch_time);
+    }
+    struct version_ticket ticket;
+    const void *data = item_value(ctx, idx, &ticket);
+    enum OpResult res = run_op(ctx, connection, TX_SET, key, nkey, data,
+                               item_size(ctx->group, idx),
+                               draw_ttl(&ctx->rng));
+    version_end(ctx->group, idx, &ticket, res);
+    int slot;
+    if (stampede.expire > 0 && (slot = hot_slot(ctx->group, idx)) != -1) {
+        stampede_refilled(slot);
+    }
+}
+
+/**
+ * Add one to the counter in an item with gets and cas, and start over
+ * when someone else updated the item after we read it
+ * @param retries where to store the number of times we started over
+ * @return OP_FAILED if we gave up
+ */
+static enum OpResult rmw_transaction(struct connection *connection,
+                                     const char *key, size_t nkey,
+                                     int *retries) {
+    char buffer[32];
+
+    for (*retries = 0; *retries <= RMW_MAX_RETRIES; ++*retries) {
+        void *data;
+        size_t size;
+        uint64_t cas;
+        uint64_t counter = 0;
+        enum OpResult res = memcached_gets_wrapper(connection, key, nkey,
+                                                   &data, &size, &cas);
+        if (res == OP_ERROR) {
+            return res;
+        } else if (res == OP_SUCCESS) {
+            size_t len = size < sizeof(buffer) - 1 ? size : sizeof(buffer) - 1;
+            memcpy(buffer, data, len);
+            buffer[len] = '\0';
+            counter = strtoull(buffer, NULL, 10);
+            free(data);
+        }
+
+        int len = snprintf(buffer, sizeof(buffer), "%"PRIu64, counter + 1);
+        if (res == OP_SUCCESS) {
+            res = memcached_cas_wrapper(connection, key, nkey, buffer, len,
+                                        cas);
+        } else {
+            /* The first one to update the key creates it */
+            res = memcached_op_wrapper(connection, TX_ADD, key, nkey,
+                                       buffer, len, 0);
+        }
+        if (res != OP_FAILED) {
+            return res;
+        }
+    }
+
+    return OP_FAILED;
+}
+
+/**
+ * Run a read-modify-write transaction on one of the hot keys and record
+ * the latency of the entire transaction
+ */
+static void run_rmw(struct thread_context *ctx, struct connection *connection) {
+    int hot = (int)rng_range(&ctx->rng, hot_keys);
+    int nkey = snprintf(ctx->key, sizeof(ctx->key), "%shot:%d",
+                        ctx->group->config.prefix, hot);
+    if (nkey >= (int)sizeof(ctx->key)) {
+        nkey = sizeof(ctx->key) - 1;
+    }
+
+    int retries;
+    hrtime_t start = gethrtime();
+    enum OpResult res = rmw_transaction(connection, ctx->key, nkey, &retries);
+    if (res != OP_ERROR) {
+        record_tx(TX_RMW, gethrtime() - start, ctx);
+    }
+    if (res == OP_SUCCESS) {
+        record_rmw_retries(retries, ctx);
+    } else {
+        record_failure(TX_RMW, ctx);
+    }
+}
+
+/**
+ * Run an operation other than get
+ * @param ctx the thread context
+ * @param connection the connection to use
+ * @param op the operation
+ * @param idx the key index
+ * @param key the items key
+ * @param nkey the length of the key
+ */
+static void run_update(struct thread_context *ctx,
+                       struct connection *connection, enum TxnType op,
+                       uint64_t idx, const char *key, size_t nkey) {
+    struct client_group *group = ctx->group;
+
+    if (op == TX_RMW) {
+        /* The hot keys aren't in the dataset, so we don't record them */
+        run_rmw(ctx, connection);
+        return;
+    }
+
+    if (ctx->record) {
+        record_op(ctx, gethrtime(), op, idx);
+    }
+    const void *data = group->datablock.data;
+    size_t size = append_size(group);
+    struct version_ticket ticket = { .active = false };
+    if (op != TX_APPEND && op != TX_PREPEND) {
+        size = item_size(group, idx);
+        if (op == TX_SET || op == TX_ADD || op == TX_REPLACE || op == TX_CAS) {
+            /* Only a store makes a new version */
+            data = item_value(ctx, idx, &ticket);
+        }
+    }
+    uint32_t ttl = draw_ttl(&ctx->rng);
+    int slot = stampede.expire > 0 ? hot_slot(group, idx) : -1;
+    if (slot != -1 &&
+        __atomic_load_n(&stampede.begin, __ATOMIC_RELAXED) == 0) {
+        /* Keep the hot keys expiring together until the storm begins. An
+         * absolute time doesn't move the expiry every time we set it. */
+        ttl = (uint32_t)stampede.deadline;
+    }
+    enum OpResult res = run_op(ctx, connection, op, key, nkey, data, size,
+                               ttl);
+    version_end(group, idx, &ticket, res);
+    if (slot != -1 && in_storm() && op == TX_SET) {
+        stampede_refilled(slot);
+    }
+}
+
+/**
+ * Record the outcome of a get: check the value of a hit, and count a
+ * miss (or set the item again, see --refill)
+ * @param ctx the thread context
+ * @param connection the connection to refill the item with
+ * @param key the key the get looked for
+ * @param nkey the length of the key
+ * @param idx the key index
+ * @param negative set if the key isn't in the dataset (see --miss-ratio)
+ * @param found set if the server returned the item
+ * @param data the value of the item
+ * @param size the size of the value
+ * @param floor the oldest version the get may return
+ * @param delta the latency of the get
+ */
+static void finish_get(struct thread_context *ctx,
+                       struct connection *connection,
+                       const char *key, size_t nkey, uint64_t idx,
+                       bool negative, bool found,
+                       const void *data, size_t size, uint32_t floor,
+                       hrtime_t delta) {
+    if (stampede.expire > 0 && !negative) {
+        if (!found && hot_slot(ctx->group, idx) != -1) {
+            stampede_miss();
+        }
+        if (in_storm()) {
+            histogram_record(&ctx->storm, delta);
+        }
+    }
+
+    if (found) {
+        if (!negative) {
+            check_value(ctx->group, key, idx, data, size, floor);
+        }
+        record_tx(TX_GET, delta, ctx);
+        __atomic_store_n(&ctx->hits, ctx->hits + 1, __ATOMIC_RELAXED);
+    } else {
+        record_miss(delta, ctx);
+        if (negative) {
+            /* There is nothing to fill it with */
+        } else if (refill) {
+            /* Fill the miss like a cache in front of a database */
+            refill_item(ctx, connection, key, nkey, idx);
+        } else if (ctx->group->expect_dataset && ctx->measuring) {
+            ++ctx->lost;
+        }
+    }
+}
+
+/**
+ * The gets of a multi-get, and the thread waiting for them
+ */
+struct mget_request {
+    struct thread_context *ctx;
+    struct connection *connection;
+    hrtime_t start;
+    int num;
+    const char *keys[MGET_MAX];
+    size_t nkeys[MGET_MAX];
+    uint64_t idx[MGET_MAX];
+    uint32_t floor[MGET_MAX];
+    bool negative[MGET_MAX];
+    bool answered[MGET_MAX];
+    char buffer[MGET_MAX][KEYGEN_MAX_KEY + 1];
+};
+
+static void mget_add(struct mget_request *req, uint64_t idx,
+                     const char *key, size_t nkey) {
+    struct thread_context *ctx = req->ctx;
+    int jj = req->num++;
+
+    req->negative[jj] = negative_lookup(ctx, idx, &key, &nkey);
+    if (ctx->record && !req->negative[jj]) {
+        record_op(ctx, gethrtime(), TX_GET, idx);
+    }
+    memcpy(req->buffer[jj], key, nkey);
+    req->buffer[jj][nkey] = '\0';
+    req->keys[jj] = req->buffer[jj];
+    req->nkeys[jj] = nkey;
+    req->idx[jj] = idx;
+    req->answered[jj] = false;
+}
+
+static void mget_found(void *arg, const char *key, size_t nkey,
+                       const void *data, size_t size) {
+    struct mget_request *req = arg;
+    hrtime_t delta = gethrtime() - req->start;
+
+    int jj = 0;
+    while (jj < req->num &&
+           (req->answered[jj] || req->nkeys[jj] != nkey ||
+            memcmp(req->keys[jj], key, nkey) != 0)) {
+        ++jj;
+    }
+    if (jj == req->num) {
+        fprintf(stderr, "Got a response for a key we didn't ask for\n");
+        return;
+    }
+
+    req->answered[jj] = true;
+    finish_get(req->ctx, req->connection, req->keys[jj], nkey,
+               req->idx[jj], req->negative[jj], true, data, size,
+               req->floor[jj], delta);
+}
+
+/**
+ * Collect the get and the gets that follow it in a multi-get (see
+ * --mget). The other operations drawn while the batch fills up run right
+ * away, so the mix stays the same.
+ * @param ctx the thread context
+ * @param connection the connection to use
+ * @param idx the key index of the first get
+ * @param key the key of the first get
+ * @param nkey the length of the key
+ * @param left the number of operations the thread has left to do
+ * @return the number of operations the batch used
+ */
+static size_t run_mget(struct thread_context *ctx,
+                       struct connection *connection,
+                       uint64_t idx, const char *key, size_t nkey,
+                       size_t left) {
+    struct client_group *group = ctx->group;
+    struct mget_request req = { .ctx = ctx, .connection = connection };
+    size_t used = 1;
+
+    mget_add(&req, idx, key, nkey);
+    while (req.num < mget_batch && used < left && keep_running(ctx, true)) {
+        idx = get_setval(ctx);
+        key = keygen_key(&group->keygen, idx, ctx->key, &nkey);
+        enum TxnType op = opmix_next(&group->config.opmix, &ctx->rng);
+        if (op == TX_GET) {
+            mget_add(&req, idx, key, nkey);
+        } else {
+            run_update(ctx, connection, op, idx, key, nkey);
+        }
+        ++used;
+    }
+
+    for (int jj = 0; jj < req.num; ++jj) {
+        req.floor[jj] = version_floor(group, req.idx[jj]);
+    }
+    req.start = gethrtime();
+    bool ok = memcached_mget_wrapper(connection, req.keys, req.nkeys, req.num,
+                                     mget_found, &req);
+    /* The misses are the keys the server didn't return (if it answered) */
+    hrtime_t delta = gethrtime() - req.start;
+    for (int jj = 0; jj < req.num; ++jj) {
+        if (req.answered[jj]) {
+            continue;
+        } else if (!ok) {
+            record_failure(TX_GET, ctx);
+        } else {
+            finish_get(ctx, connection, req.keys[jj], req.nkeys[jj],
+                       req.idx[jj], req.negative[jj], false, NULL, 0, 0,
+                       delta);
+        }
+    }
+
+    return used;
+}
+
+/**
+ * The time between the operations of a thread. The threads of a group
+ * share its rate evenly, and during a search all of the threads share
+ * the offered rate.
+ */
+static hrtime_t pacing_interval(const struct thread_context *ctx) {
+    if (slo_latency > 0) {
+        uint64_t rate = __atomic_load_n(&search_rate, __ATOMIC_RELAXED);
+        return rate > 0 ? (hrtime_t)(ctx->no_threads * 1000000000.0 / rate) : 0;
+    }
+    if (ctx->group->config.rate > 0) {
+        return (hrtime_t)(ctx->group->config.threads * 1000000000.0 /
+                          ctx->group->config.rate);
+    }
+    return 0;
+}
+
+/**
+ * Test the server and library
+ * @param rep Where to store the result of the test
+ * @return 0 on success, -1 otherwise
+ */
+static int test(struct thread_context *ctx) {
+    struct client_group *group = ctx->group;
+    int ret = 0;
+    struct connection* connection;
+    const char *key;
+    size_t nkey;
+
+    hrtime_t interval = 0;
+    hrtime_t next = gethrtime();
+
+    for (size_t ii = 0;
+         keep_running(ctx, run_duration > 0 || slo_latency > 0 ||
+                      ii < ctx->total); ++ii) {
+        hrtime_t current = pacing_interval(ctx);
+        if (current != interval) {
+            /* Don't make up for the operations at the old rate */
+            interval = current;
+            next = gethrtime();
+        }
+        if (interval > 0) {
+            hrtime_t now = gethrtime();
+            if (next > now + 50000) {
+                usleep((useconds_t)((next - now) / 1000));
+            }
+            next += interval;
+        }
+
+        connection = get_connection(ctx);
+        uint64_t idx = get_setval(ctx);
+        key = keygen_key(&group->keygen, idx, ctx->key, &nkey);
+
+        enum TxnType op = opmix_next(&group->config.opmix, &ctx->rng);
+        if (op != TX_GET) {
+            run_update(ctx, connection, op, idx, key, nkey);
+        } else if (mget_batch > 1) {
+            size_t left = SIZE_MAX;
+            if (run_duration <= 0 && slo_latency <= 0) {
+                left = ctx->total - ii;
+            }
+            size_t used = run_mget(ctx, connection, idx, key, nkey, left);
+            /* The batch counts as that many iterations */
+            ii += used - 1;
+            if (interval > 0) {
+                next += interval * (used - 1);
+            }
+        } else {
+            /* go set it from random data */
+            bool negative = negative_lookup(ctx, idx, &key, &nkey);
+            if (verbose) {
+                fprintf(stderr, "CMD: get %s\n", key);
+            }
+            size_t size = 0;
+            uint32_t floor = version_floor(group, idx);
+            hrtime_t start = gethrtime();
+            void *data;
+            if (ctx->record && !negative) {
+                /* The traces can only hold the keys of the dataset */
+                record_op(ctx, start, TX_GET, idx);
+            }
+            bool found = memcached_get_wrapper(connection, key, nkey, &size,
+                                               &data);
+            finish_get(ctx, connection, key, nkey, idx, negative,
+                       found, data, size, floor, gethrtime() - start);
+            if (found) {
+                free(data);
+            }
+        }
+        release_connection(connection);
+    }
+
+    return ret;
+}
+
+/**
+ * The number of virtual clients to run (see --vclients)
+ */
+static int no_vclients = 0;
+
+/**
+ * The configuration of the virtual clients
+ */
+static struct vclient_config vclient_config = {
+    .think = { .type = TT_EXPONENTIAL, .mean = 0 }
+};
+
+static bool vclient_running(struct thread_context *ctx, size_t issued) {
+    return keep_running(ctx, run_duration > 0 || issued < ctx->total);
+}
+
+static void vclient_next_op(struct thread_context *ctx, struct vclient_op *op) {
+    struct client_group *group = ctx->group;
+    uint64_t idx = get_setval(ctx);
+    op->key = keygen_key(&group->keygen, idx, ctx->key, &op->nkey);
+    op->op = opmix_next(&group->config.opmix, &ctx->rng);
+    if (op->op == TX_GET) {
+        (void)negative_lookup(ctx, idx, &op->key, &op->nkey);
+    }
+    op->data = group->datablock.data;
+    op->size = item_size(group, idx);
+    if (op->op != TX_APPEND && op->op != TX_PREPEND) {
+        /* run_test doesn't let the virtual clients verify the data */
+        op->data = item_value(ctx, idx, NULL);
+    }
+    op->exptime = draw_ttl(&ctx->rng);
+    if (op->op == TX_APPEND || op->op == TX_PREPEND) {
+        op->size = append_size(group);
+    }
+}
+
+/**
+ * The virtual client threads entry function. The clients are spread
+ * evenly over the threads.
+ * @param arg this should be a pointer to where this thread should report
+ *            the result
+ * @return arg
+ */
+static void *vclient_thread_main(void *arg) {
+    struct thread_context *ctx = arg;
+    int num = no_vclients / ctx->no_threads;
+    int rest = no_vclients % ctx->no_threads;
+    int first = ctx->id * num + (ctx->id < rest ? ctx->id : rest);
+    if (ctx->id < rest) {
+        ++num;
+    }
+
+    vclient_run(ctx, &vclient_config, first, num);
+    __atomic_sub_fetch(&running_threads, 1, __ATOMIC_RELEASE);
+    return arg;
+}
+
+#ifdef HAVE_LIBCOUCHBASE
+/**
+ * The number of requests the asynchronous driver keeps scheduled on
+ * every libcouchbase instance (see --lcb-window). 0 runs one operation
+ * at a time through libcouchbase_execute.
+ */
+static int lcb_window = 0;
+
+/** The number of operations in one request (see --lcb-batch) */
+static int lcb_batch = 16;
+
+struct lcb_driver;
+
+/**
+ * A request is lcb_batch operations scheduled at the same time: the gets
+ * go out in a single libcouchbase_mget and the sets as separate stores,
+ * all with the request as the cookie. The latency of an operation is the
+ * time from when the request was scheduled until its callback.
+ */
+struct lcb_request {
+    struct lcb_driver *driver;
+    hrtime_t start;
+    /** The number of operations still waiting for a response */
+    int pending;
+    /** The number of gets in the request */
+    int no_gets;
+    /** The key index, key and state of every get */
+    uint64_t *idx;
+    const void **keys;
+    size_t *nkeys;
+    bool *negative;
+    bool *answered;
+    /** Where the keys of the gets are stored */
+    char *key_buffer;
+};
+
+/**
+ * The state of the asynchronous driver of a thread
+ */
+struct lcb_driver {
+    struct thread_context *ctx;
+    libcouchbase_t instance;
+    struct lcb_request *requests;
+    /** The number of operations the thread scheduled */
+    size_t issued;
+    /** The number of requests waiting for responses */
+    int outstanding;
+};
+
+static bool lcb_request_init(struct lcb_request *req,
+                             struct lcb_driver *driver) {
+    req->driver = driver;
+    req->idx = calloc(lcb_batch, sizeof(*req->idx));
+    req->keys = calloc(lcb_batch, sizeof(*req->keys));
+    req->nkeys = calloc(lcb_batch, sizeof(*req->nkeys));
+    req->negative = calloc(lcb_batch, sizeof(*req->negative));
+    req->answered = calloc(lcb_batch, sizeof(*req->answered));
+    req->key_buffer = malloc(lcb_batch * (KEYGEN_MAX_KEY + 1));
+    return req->idx != NULL && req->keys != NULL && req->nkeys != NULL &&
+        req->negative != NULL && req->answered != NULL &&
+        req->key_buffer != NULL;
+}
+
+static void lcb_request_destroy(struct lcb_request *req) {
+    free(req->idx);
+    free(req->keys);
+    free(req->nkeys);
+    free(req->negative);
+    free(req->answered);
+    free(req->key_buffer);
+}
+
+/**
+ * Fill the request with the next operations and schedule them
+ * @return false if the thread has no more operations to run
+ */
+static bool lcb_schedule(struct lcb_request *req) {
+    struct lcb_driver *driver = req->driver;
+    struct thread_context *ctx = driver->ctx;
+    struct client_group *group = ctx->group;
+
+    req->start = gethrtime();
+    req->pending = 0;
+    req->no_gets = 0;
+    for (int ii = 0;
+         ii < lcb_batch &&
+             keep_running(ctx, run_duration > 0 || driver->issued < ctx->total);
+         ++ii) {
+        uint64_t idx = get_setval(ctx);
+        const char *key;
+        size_t nkey;
+
+        ++driver->issued;
+        key = keygen_key(&group->keygen, idx, ctx->key, &nkey);
+        if (opmix_next(&group->config.opmix, &ctx->rng) == TX_SET) {
+            if (ctx->record) {
+                record_op(ctx, req->start, TX_SET, idx);
+            }
+            if (libcouchbase_store(driver->instance, req, LIBCOUCHBASE_SET,
+                                   key, nkey, item_value(ctx, idx, NULL),
+                                   item_size(group, idx), 0,
+                                   draw_ttl(&ctx->rng),
+                                   0) == LIBCOUCHBASE_SUCCESS) {
+                ++req->pending;
+            } else {
+                record_failure(TX_SET, ctx);
+            }
+        } else {
+            int jj = req->no_gets++;
+            char *buffer = req->key_buffer + jj * (KEYGEN_MAX_KEY + 1);
+
+            req->negative[jj] = negative_lookup(ctx, idx, &key, &nkey);
+            if (ctx->record && !req->negative[jj]) {
+                record_op(ctx, req->start, TX_GET, idx);
+            }
+            memcpy(buffer, key, nkey);
+            buffer[nkey] = '\0';
+            req->idx[jj] = idx;
+            req->keys[jj] = buffer;
+            req->nkeys[jj] = nkey;
+            req->answered[jj] = false;
+        }
+    }
+
+    if (req->no_gets > 0) {
+        if (libcouchbase_mget(driver->instance, req, req->no_gets,
+                              req->keys, req->nkeys,
+                              NULL) == LIBCOUCHBASE_SUCCESS) {
+            req->pending += req->no_gets;
+        } else {
+            for (int ii = 0; ii < req->no_gets; ++ii) {
+                record_failure(TX_GET, ctx);
+            }
+        }
+    }
+
+    if (req->pending == 0) {
+        return false;
+    }
+    ++driver->outstanding;
+    return true;
+}
+
+/**
+ * Count the response, and schedule the request again when it was the
+ * last one it waited for
+ */
+static void lcb_complete(struct lcb_request *req) {
+    if (--req->pending == 0) {
+        --req->driver->outstanding;
+        (void)lcb_schedule(req);
+    }
+}
+
+static void lcb_storage_callback(libcouchbase_t instance,
+                                 const void *cookie,
+                                 libcouchbase_storage_t operation,
+                                 libcouchbase_error_t error,
+                                 const void *key, size_t nkey,
+                                 uint64_t cas)
+{
+    (void)instance; (void)operation; (void)key;
+    (void)nkey; (void)cas;
+    struct lcb_request *req = (struct lcb_request *)cookie;
+    struct thread_context *ctx = req->driver->ctx;
+
+    /* Like run_op, a store that failed doesn't count as an operation */
+    if (error == LIBCOUCHBASE_SUCCESS) {
+        record_tx(TX_SET, gethrtime() - req->start, ctx);
+    } else {
+        record_failure(TX_SET, ctx);
+    }
+    lcb_complete(req);
+}
+
+static void lcb_get_callback(libcouchbase_t instance,
+                             const void *cookie,
+                             libcouchbase_error_t error,
+                             const void *key, size_t nkey,
+                             const void *bytes, size_t nbytes,
+                             uint32_t flags, uint64_t cas)
+{
+    (void)instance; (void)flags; (void)cas;
+    struct lcb_request *req = (struct lcb_request *)cookie;
+    struct thread_context *ctx = req->driver->ctx;
+    hrtime_t delta = gethrtime() - req->start;
+
+    /* The responses from the different servers may come in any order */
+    int jj = 0;
+    while (jj < req->no_gets &&
+           (req->answered[jj] || req->nkeys[jj] != nkey ||
+            memcmp(req->keys[jj], key, nkey) != 0)) {
+        ++jj;
+    }
+    if (jj == req->no_gets) {
+        fprintf(stderr, "Got a response for a key we didn't ask for\n");
+        return;
+    }
+    req->answered[jj] = true;
+
+    /* Only a key that doesn't exist is a miss, the rest are errors */
+    if (error == LIBCOUCHBASE_SUCCESS || error == LIBCOUCHBASE_KEY_ENOENT) {
+        finish_get(ctx, NULL, req->keys[jj], nkey, req->idx[jj],
+                   req->negative[jj], error == LIBCOUCHBASE_SUCCESS,
+                   bytes, nbytes, 0, delta);
+    } else {
+        record_failure(TX_GET, ctx);
+    }
+    lcb_complete(req);
+}
+
+/**
+ * The entry function of the threads that drive libcouchbase
+ * asynchronously. The thread keeps its connection for the whole run,
+ * and libcouchbase_execute runs the event loop until the callbacks stop
+ * scheduling the requests again.
+ * @param arg this should be a pointer to where this thread should report
+ *            the result
+ * @return arg
+ */
+static void *lcb_thread_main(void *arg) {
+    struct thread_context *ctx = arg;
+    struct connection *connection = get_connection(ctx);
+    struct memcachelib *lib = connection->handle;
+    struct lcb_driver driver = {
+        .ctx = ctx,
+        .instance = lib->handle,
+        .requests = calloc(lcb_window, sizeof(struct lcb_request))
+    };
+    bool ok = driver.requests != NULL;
+
+    for (int ii = 0; ok && ii < lcb_window; ++ii) {
+        ok = lcb_request_init(&driver.requests[ii], &driver);
+    }
+
+    if (ok) {
+        /* Put back the callbacks of the synchronous wrappers when done */
+        libcouchbase_get_callback old_get =
+            libcouchbase_set_get_callback(driver.instance, lcb_get_callback);
+        libcouchbase_storage_callback old_storage =
+            libcouchbase_set_storage_callback(driver.instance,
+                                              lcb_storage_callback);
+
+        for (int ii = 0; ii < lcb_window; ++ii) {
+            if (!lcb_schedule(&driver.requests[ii])) {
+                break;
+            }
+        }
+        while (driver.outstanding > 0) {
+            libcouchbase_execute(driver.instance);
+        }
+
+        (void)libcouchbase_set_get_callback(driver.instance, old_get);
+        (void)libcouchbase_set_storage_callback(driver.instance, old_storage);
+    } else {
+        fprintf(stderr, "Failed to allocate memory\n");
+    }
+
+    if (driver.requests != NULL) {
+        for (int ii = 0; ii < lcb_window; ++ii) {
+            lcb_request_destroy(&driver.requests[ii]);
+        }
+        free(driver.requests);
+    }
+    release_connection(connection);
+    __atomic_sub_fetch(&running_threads, 1, __ATOMIC_RELEASE);
+    return arg;
+}
+#endif
+
+/**
+ * The trace to replay (see -T)
+ */
+static struct trace *trace = NULL;
+
+/**
+ * Record the operations to this file (see -R)
+ */
+static const char *record_file = NULL;
+
+/**
+ * Set to 1 to replay the trace with the recorded timing (see -e)
+ */
+static int trace_timing = 0;
+
+/**
+ * Replay the streams of the trace that belongs to this thread (stream
+ * ii belongs to thread ii % no_threads). If the thread owns multiple
+ * streams we merge them in time order.
+ * @param ctx the thread context
+ * @return 0 on success, -1 otherwise
+ */
+static int replay(struct thread_context *ctx) {
+    struct cursor {
+        const struct trace_record *rec;
+        uint64_t left;
+        uint64_t due;
+    } *cursors;
+    uint32_t no_streams = trace->header->no_streams;
+    uint32_t num = 0;
+
+    cursors = calloc(no_streams / ctx->no_threads + 1, sizeof(*cursors));
+    if (cursors == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return -1;
+    }
+
+    for (uint32_t ii = ctx->id; ii < no_streams; ii += ctx->no_threads) {
+        if (trace->streams[ii].no_records > 0) {
+            cursors[num].rec = trace_first(trace, ii);
+            cursors[num].left = trace->streams[ii].no_records;
+            cursors[num].due = cursors[num].rec->delta;
+            ++num;
+        }
+    }
+
+    hrtime_t begin = gethrtime();
+    while (keep_running(ctx, num > 0)) {
+        uint32_t next = 0;
+        for (uint32_t ii = 1; ii < num; ++ii) {
+            if (cursors[ii].due < cursors[next].due) {
+                next = ii;
+            }
+        }
+
+        struct cursor *cursor = &cursors[next];
+        const struct trace_record *rec = cursor->rec;
+
+        if (trace_timing) {
+            hrtime_t now = gethrtime();
+            hrtime_t due = begin + cursor->due * 1000;
+            if (due > now + 50000) {
+                usleep((useconds_t)((due - now) / 1000));
+            }
+        }
+
+        const char *key;
+        size_t nkey;
+        if (rec->flags & TRACE_KEY_BYTES) {
+            nkey = rec->keylen < KEYGEN_MAX_KEY ? rec->keylen : KEYGEN_MAX_KEY;
+            memcpy(ctx->key, trace_key(rec), nkey);
+            ctx->key[nkey] = '\0';
+            key = ctx->key;
+        } else {
+            key = keygen_key(&ctx->group->keygen, rec->key, ctx->key, &nkey);
+        }
+
+        struct connection *connection = get_connection(ctx);
+        hrtime_t start = gethrtime();
+        if (rec->op == TX_GET) {
+            size_t size;
+            void *data;
+            if (memcached_get_wrapper(connection, key, nkey, &size, &data)) {
+                record_tx(TX_GET, gethrtime() - start, ctx);
+                __atomic_store_n(&ctx->hits, ctx->hits + 1, __ATOMIC_RELAXED);
+                free(data);
+            } else {
+                record_miss(gethrtime() - start, ctx);
+            }
+        } else {
+            size_t max = ctx->group->datablock.size;
+            size_t size = rec->size < max ? rec->size : max;
+            /* trace_open checked the operations */
+            enum TxnType op = (enum TxnType)rec->op;
+            run_op(ctx, connection, op, key, nkey, ctx->group->datablock.data,
+                   size, rec->ttl);
+        }
+        release_connection(connection);
+
+        if (--cursor->left == 0) {
+            *cursor = cursors[--num];
+        } else {
+            cursor->rec = trace_next(rec);
+            cursor->due += cursor->rec->delta;
+        }
+    }
+
+    free(cursors);
+    return 0;
+}
+
+/**
+ * The replay threads entry function
+ * @param arg this should be a pointer to where this thread should report
+ *            the result
+ * @return arg
+ */
+static void *replay_thread_main(void* arg) {
+    replay((struct thread_context*)arg);
+    __atomic_sub_fetch(&running_threads, 1, __ATOMIC_RELEASE);
+    return arg;
+}
+
+/**
+ * The threads entry function
+ * @param arg this should be a pointer to where this thread should report
+ *            the result
+ * @return arg
+ */
+void *test_thread_main(void* arg) {
+    test((struct thread_context*)arg);
+    __atomic_sub_fetch(&running_threads, 1, __ATOMIC_RELEASE);
+    return arg;
+}
+
+/**
+ * Check if all of the samples are within the tolerance of their mean
+ * @param samples the samples
+ * @param num the number of samples
+ * @return true if the samples are stable
+ */
+static bool is_stable(const double *samples, int num) {
+    double mean = 0;
+    for (int ii = 0; ii < num; ++ii) {
+        mean += samples[ii];
+    }
+    mean /= num;
+
+    if (mean <= 0) {
+        return false;
+    }
+
+    for (int ii = 0; ii < num; ++ii) {
+        double deviation = samples[ii] - mean;
+        if (deviation < 0) {
+            deviation = -deviation;
+        }
+        if (deviation > steady_state * mean) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * The result of running at one rate during the search
+ */
+struct search_step {
+    /** The rate the threads offered (0 is as fast as they can) */
+    uint64_t offered;
+    double achieved;
+    hrtime_t p50;
+    hrtime_t p99;
+    hrtime_t p999;
+    /** The percentile the SLO is about */
+    hrtime_t latency;
+    bool pass;
+};
+
+/**
+ * Sleep until the time, unless the threads finish first
+ * @return false if the threads finished
+ */
+static bool search_sleep_until(hrtime_t until) {
+    while (__atomic_load_n(&running_threads, __ATOMIC_ACQUIRE) > 0) {
+        hrtime_t now = gethrtime();
+        if (now >= until) {
+            return true;
+        }
+        hrtime_t wait = until - now;
+        usleep((useconds_t)((wait < 100000000 ? wait : 100000000) / 1000));
+    }
+    return false;
+}
+
+/**
+ * Offer the rate for a while and measure the throughput and latency. The
+ * first quarter of the step lets the threads settle.
+ * @return false if the threads finished
+ */
+static bool search_measure(struct thread_context *ctx, int num,
+                           struct histogram *snapshot,
+                           struct histogram *delta,
+                           struct search_step *step) {
+    hrtime_t period = (hrtime_t)(search_step * 1000000000);
+
+    __atomic_store_n(&search_rate, step->offered, __ATOMIC_RELAXED);
+    if (!search_sleep_until(gethrtime() + period / 4)) {
+        return false;
+    }
+
+    memset(snapshot, 0, sizeof(*snapshot));
+    for (int ii = 0; ii < num; ++ii) {
+        histogram_merge(snapshot, &ctx[ii].progress);
+    }
+    hrtime_t begin = gethrtime();
+    if (!search_sleep_until(begin + period)) {
+        return false;
+    }
+
+    memset(delta, 0, sizeof(*delta));
+    for (int ii = 0; ii < num; ++ii) {
+        histogram_merge(delta, &ctx[ii].progress);
+    }
+    histogram_delta(delta, delta, snapshot);
+    double elapsed = (gethrtime() - begin) / 1000000000.0;
+
+    step->achieved = delta->count / elapsed;
+    step->p50 = histogram_percentile(delta, 50.0);
+    step->p99 = histogram_percentile(delta, 99.0);
+    step->p999 = histogram_percentile(delta, 99.9);
+    step->latency = histogram_percentile(delta, slo_percentile);
+    /* The server must keep up with the rate, not just answer quickly */
+    step->pass = delta->count > 0 && step->latency <= slo_latency &&
+        (step->offered == 0 || step->achieved >= step->offered * 0.9);
+
+    if (step->offered == 0) {
+        fprintf(stdout, "%12s", "unlimited");
+    } else {
+        fprintf(stdout, "%12"PRIu64, step->offered);
+    }
+    fprintf(stdout, "%12.0f%12.1f%12.1f%12.1f  %s\n", step->achieved,
+            step->p50 / 1000.0, step->p99 / 1000.0, step->p999 / 1000.0,
+            step->pass ? "ok" : "over");
+    fflush(stdout);
+    return true;
+}
+
+/**
+ * Find the highest throughput where the latency percentile stays below
+ * the target. The first step runs as fast as the threads can, and the
+ * rest bisect the rate between the best rate that passed and the lowest
+ * that failed. Once the knee is found the threads keep offering it for
+ * the measured window (--duration), or stop.
+ * @param ctx the thread contexts
+ * @param num the number of thread contexts
+ */
+static void search_capacity(struct thread_context *ctx, int num) {
+    struct histogram *snapshot = calloc(1, sizeof(*snapshot));
+    struct histogram *delta = calloc(1, sizeof(*delta));
+    struct search_step steps[SEARCH_MAX_STEPS];
+    int nsteps = 0;
+    int knee = -1;
+
+    if (snapshot == NULL || delta == NULL) {
+        fprintf(stderr, "Failed to allocate memory for the search\n");
+        __atomic_store_n(&run_end, gethrtime(), __ATOMIC_RELAXED);
+        free(snapshot);
+        free(delta);
+        return;
+    }
+
+    fprintf(stdout, "Searching for the highest throughput with p%g below "
+            "%.1f us\n", slo_percentile, slo_latency / 1000.0);
+    fprintf(stdout, "%12s%12s%12s%12s%12s\n", "offered", "achieved",
+            "p50 us", "p99 us", "p99.9 us");
+
+    double low = 0;
+    double high = 0;
+    while (nsteps < SEARCH_MAX_STEPS) {
+        struct search_step *step = &steps[nsteps];
+        memset(step, 0, sizeof(*step));
+        if (nsteps > 0) {
+            step->offered = (uint64_t)((low + high) / 2);
+        }
+        if (!search_measure(ctx, num, snapshot, delta, step)) {
+            break;
+        }
+        ++nsteps;
+
+        if (step->pass && (knee == -1 ||
+                           step->achieved > steps[knee].achieved)) {
+            knee = nsteps - 1;
+        }
+        if (step->offered == 0) {
+            if (step->pass) {
+                /* Even the fastest rate meets the target */
+                break;
+            }
+            high = step->achieved;
+        } else if (step->pass) {
+            low = step->offered;
+        } else {
+            high = step->offered;
+        }
+        if (high - low < high * SEARCH_RESOLUTION || high < 1) {
+            break;
+        }
+    }
+
+    if (knee == -1) {
+        fprintf(stdout, "No rate met the target\n\n");
+    } else {
+        fprintf(stdout, "Knee: %.0f ops/s with p%g %.1f us (offered ",
+                steps[knee].achieved, slo_percentile,
+                steps[knee].latency / 1000.0);
+        if (steps[knee].offered == 0) {
+            fprintf(stdout, "unlimited)\n\n");
+        } else {
+            fprintf(stdout, "%"PRIu64" ops/s)\n\n", steps[knee].offered);
+        }
+    }
+    fflush(stdout);
+
+    hrtime_t now = gethrtime();
+    if (knee != -1 && run_duration > 0) {
+        __atomic_store_n(&search_rate, steps[knee].offered, __ATOMIC_RELAXED);
+        __atomic_store_n(&run_end, now + (hrtime_t)(run_duration * 1000000000),
+                         __ATOMIC_RELAXED);
+        __atomic_store_n(&measure_begin, now, __ATOMIC_RELAXED);
+    } else {
+        __atomic_store_n(&run_end, now, __ATOMIC_RELAXED);
+    }
+
+    free(snapshot);
+    free(delta);
+}
+
+/**
+ * Watch the throughput and latency of the threads every second, and
+ * start the measured window once they have been stable for
+ * STEADY_STATE_WINDOW intervals (after the warmup)
+ * @param ctx the thread contexts
+ * @param num the number of thread contexts
+ * @param begin when the threads were started
+ */
+static void detect_steady_state(struct thread_context *ctx, int num,
+                                hrtime_t begin) {
+    double throughput[STEADY_STATE_WINDOW];
+    double latency[STEADY_STATE_WINDOW];
+    uint64_t prev_ops = 0;
+    hrtime_t prev_time = 0;
+    hrtime_t next = begin + 1000000000;
+    int intervals = 0;
+
+    while (__atomic_load_n(&running_threads, __ATOMIC_ACQUIRE) > 0) {
+        hrtime_t now = gethrtime();
+        if (now < next) {
+            hrtime_t wait = next - now;
+            usleep((useconds_t)((wait < 100000000 ? wait : 100000000) / 1000));
+            continue;
+        }
+
+        uint64_t ops = 0;
+        hrtime_t time = 0;
+        for (int ii = 0; ii < num; ++ii) {
+            ops += __atomic_load_n(&ctx[ii].progress.count, __ATOMIC_RELAXED);
+            time += __atomic_load_n(&ctx[ii].progress.total, __ATOMIC_RELAXED);
+        }
+
+        int slot = intervals++ % STEADY_STATE_WINDOW;
+        throughput[slot] = (double)(ops - prev_ops);
+        latency[slot] = ops > prev_ops ?
+            (double)(time - prev_time) / (ops - prev_ops) : 0;
+        prev_ops = ops;
+        prev_time = time;
+        next += 1000000000;
+
+        double elapsed = (now - begin) / 1000000000.0;
+        bool stable = elapsed >= warmup &&
+            intervals >= STEADY_STATE_WINDOW &&
+            is_stable(throughput, STEADY_STATE_WINDOW) &&
+            is_stable(latency, STEADY_STATE_WINDOW);
+
+        if (stable || elapsed >= STEADY_STATE_TIMEOUT) {
+            if (stable) {
+                fprintf(stdout, "Steady state after %.1f s: %.0f ops/s, "
+                        "%.1f us avg\n", elapsed, throughput[slot],
+                        latency[slot] / 1000);
+            } else {
+                fprintf(stdout, "WARNING: No steady state after %d s, "
+                        "measuring anyway\n", STEADY_STATE_TIMEOUT);
+            }
+            fflush(stdout);
+            if (run_duration > 0) {
+                __atomic_store_n(&run_end,
+                                 now + (hrtime_t)(run_duration * 1000000000),
+                                 __ATOMIC_RELAXED);
+            }
+            __atomic_store_n(&measure_begin, now, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    fprintf(stderr, "WARNING: The threads finished before reaching a "
+            "steady state (no samples)\n");
+}
+
+struct progress_reporter {
+    struct thread_context *ctx;
+    int num;
+    hrtime_t begin;
+};
+
+/**
+ * Print the throughput, hit ratio and latency percentiles for the last
+ * interval. The numbers are the difference between two snapshots of the
+ * histograms and counters of the threads, so the threads never wait for
+ * the reporter.
+ * @param arg the progress reporter
+ * @return NULL
+ */
+static void *progress_thread_main(void *arg) {
+    struct progress_reporter *reporter = arg;
+    struct histogram *prev = calloc(1, sizeof(*prev));
+    struct histogram *cur = calloc(1, sizeof(*cur));
+    struct histogram *interval = calloc(1, sizeof(*interval));
+    uint64_t prev_hits = 0;
+    uint64_t prev_misses = 0;
+    hrtime_t period = (hrtime_t)(progress_interval * 1000000000);
+    hrtime_t last = reporter->begin;
+    bool done = false;
+
+    if (prev == NULL || cur == NULL || interval == NULL) {
+        fprintf(stderr, "Failed to allocate memory for the progress reporter\n");
+        free(prev);
+        free(cur);
+        free(interval);
+        return NULL;
+    }
+
+    while (!done) {
+        hrtime_t now = gethrtime();
+        done = __atomic_load_n(&running_threads, __ATOMIC_ACQUIRE) == 0;
+        if (!done && now < last + period) {
+            hrtime_t wait = last + period - now;
+            usleep((useconds_t)((wait < 100000000 ? wait : 100000000) / 1000));
+            continue;
+        }
+
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        memset(cur, 0, sizeof(*cur));
+        for (int ii = 0; ii < reporter->num; ++ii) {
+            histogram_merge(cur, &reporter->ctx[ii].progress);
+            hits += __atomic_load_n(&reporter->ctx[ii].hits, __ATOMIC_RELAXED);
+            misses += __atomic_load_n(&reporter->ctx[ii].misses,
+                                      __ATOMIC_RELAXED);
+        }
+        histogram_delta(interval, cur, prev);
+
+        double elapsed = (now - last) / 1000000000.0;
+        if (interval->count > 0 && elapsed > 0) {
+            uint64_t gets = (hits - prev_hits) + (misses - prev_misses);
+            fprintf(stdout, "[%8.1f s] %10.0f ops/s",
+                    (now - reporter->begin) / 1000000000.0,
+                    interval->count / elapsed);
+            if (gets > 0) {
+                fprintf(stdout, "  hit %5.1f%%",
+                        (hits - prev_hits) * 100.0 / gets);
+            }
+            fprintf(stdout, "  p50 %8.1f us  p99 %8.1f us  p99.9 %8.1f us",
+                    histogram_percentile(interval, 50.0) / 1000.0,
+                    histogram_percentile(interval, 99.0) / 1000.0,
+                    histogram_percentile(interval, 99.9) / 1000.0);
+            if (drift_mode != DRIFT_NONE) {
+                fprintf(stdout, "  window @%"PRIu64,
+                        window_start(reporter->ctx[0].group, now));
+            }
+            fprintf(stdout, "\n");
+            fflush(stdout);
+        }
+
+        struct histogram *tmp = prev;
+        prev = cur;
+        cur = tmp;
+        prev_hits = hits;
+        prev_misses = misses;
+        last = now;
+    }
+
+    free(prev);
+    free(cur);
+    free(interval);
+    return NULL;
+}
+
+/**
+ * Store the throughput and latency of the run in the sweep point
+ * @param ctx the thread contexts
+ * @param num the number of thread contexts
+ * @param begin when the threads were started
+ * @param end when the threads finished
+ */
+static void fill_sweep_point(struct thread_context *ctx, int num,
+                             hrtime_t begin, hrtime_t end,
+                             struct sweep_point *point) {
+    struct histogram *get = calloc(1, sizeof(*get));
+    struct histogram *set = calloc(1, sizeof(*set));
+
+    if (get == NULL || set == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        free(get);
+        free(set);
+        return;
+    }
+
+    if (timed_run) {
+        begin = measure_begin;
+        if (run_end < end) {
+            end = run_end;
+        }
+    }
+
+    for (int ii = 0; ii < num; ++ii) {
+        for (int jj = 0; jj < TX_MAX; ++jj) {
+            point->ops += ctx[ii].tx[jj].count;
+        }
+        point->ops += ctx[ii].get_miss.count;
+        histogram_merge(get, &ctx[ii].tx[TX_GET]);
+        histogram_merge(set, &ctx[ii].tx[TX_SET]);
+    }
+
+    if (end > begin) {
+        point->throughput = point->ops / ((end - begin) / 1000000000.0);
+    }
+    if (get->count > 0) {
+        point->get_p50 = histogram_percentile(get, 50.0);
+        point->get_p99 = histogram_percentile(get, 99.0);
+        point->get_p999 = histogram_percentile(get, 99.9);
+    }
+    if (set->count > 0) {
+        point->set_p50 = histogram_percentile(set, 50.0);
+        point->set_p99 = histogram_percentile(set, 99.0);
+        point->set_p999 = histogram_percentile(set, 99.9);
+    }
+
+    free(get);
+    free(set);
+}
+
+/**
+ * Print the throughput in the measured window
+ * @param ctx the thread contexts
+ * @param num the number of thread contexts
+ * @param end when the threads finished
+ */
+static void print_measured_window(struct thread_context *ctx, int num,
+                                  hrtime_t end) {
+    if (run_end < end) {
+        end = run_end;
+    }
+    if (measure_begin >= end) {
+        return;
+    }
+
+    uint64_t ops = 0;
+    for (int ii = 0; ii < num; ++ii) {
+        for (int jj = 0; jj < TX_MAX; ++jj) {
+            ops += ctx[ii].tx[jj].count;
+        }
+        ops += ctx[ii].get_miss.count;
+    }
+
+    double elapsed = (end - measure_begin) / 1000000000.0;
+    fprintf(stdout, "Measured window: %.1f s, %"PRIu64" ops, %.0f ops/s\n\n",
+            elapsed, ops, ops / elapsed);
+}
+
+/**
+ * Print the number of successful read-modify-write transactions per
+ * second in the measured window
+ * @param ctx the thread contexts
+ * @param num the number of thread contexts
+ * @param end when the threads finished
+ */
+static void print_update_rate(struct thread_context *ctx, int num,
+                              hrtime_t end) {
+    if (run_end < end) {
+        end = run_end;
+    }
+
+    uint64_t updates = 0;
+    for (int ii = 0; ii < num; ++ii) {
+        for (int jj = 0; jj < RMW_RETRY_BUCKETS; ++jj) {
+            updates += ctx[ii].rmw_retries[jj];
+        }
+    }
+
+    if (updates > 0 && measure_begin < end) {
+        double elapsed = (end - measure_begin) / 1000000000.0;
+        fprintf(stdout, "Read-modify-write: %"PRIu64" updates, "
+                "%.0f updates/s\n\n", updates, updates / elapsed);
+    }
+}
+
+/**
+ * Store the hot keys of every group so they all expire stampede.expire
+ * seconds from now
+ * @return 0 on success, -1 otherwise
+ */
+static int arm_stampede(void) {
+    char buffer[KEYGEN_MAX_KEY + 1];
+    void *value = NULL;
+
+    free(stampede.refilled);
+    free(stampede.hot);
+    stampede.refilled = calloc((size_t)no_groups * hot_keys, sizeof(bool));
+    stampede.hot = calloc((size_t)no_groups * hot_keys, sizeof(uint64_t));
+    if (stampede.refilled == NULL || stampede.hot == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return -1;
+    }
+    stampede.left = no_groups * hot_keys;
+    stampede.refills = stampede.duplicates = 0;
+    stampede.begin = stampede.end = 0;
+    stampede.deadline = time(NULL) + stampede.expire;
+
+    /* The most popular keys of the distribution (skipping the ranks the
+     * scrambled distribution hashes onto a key we already picked) */
+    for (int ii = 0; ii < no_groups; ++ii) {
+        struct client_group *group = &groups[ii];
+        uint64_t *hot = stampede.hot + (size_t)ii * hot_keys;
+        uint64_t rank = 0;
+        for (int jj = 0; jj < hot_keys; ++jj) {
+            bool found = false;
+            while (!found && rank < (uint64_t)group->config.items) {
+                uint64_t idx = keydist_rank(&group->config.keydist, rank++);
+                int kk;
+                for (kk = 0; kk < jj && hot[kk] != idx; ++kk) {
+                    /* empty */
+                }
+                if (kk == jj) {
+                    hot[jj] = idx;
+                    found = true;
+                }
+            }
+            if (!found) {
+                fprintf(stderr, "Group %s: The distribution only has %d "
+                        "distinct hot keys\n", group->config.name, jj);
+                return -1;
+            }
+        }
+        qsort(hot, hot_keys, sizeof(uint64_t), compare_index);
+    }
+
+    int ret = 0;
+    for (int ii = 0; ii < no_groups && ret == 0; ++ii) {
+        struct client_group *group = &groups[ii];
+        free(value);
+        if (verify_data && (value = malloc(group->datablock.size)) == NULL) {
+            fprintf(stderr, "Failed to allocate memory\n");
+            return -1;
+        }
+        const uint64_t *hot = stampede.hot + (size_t)ii * hot_keys;
+        for (int jj = 0; jj < hot_keys && ret == 0; ++jj) {
+            size_t nkey;
+            const char *key = keygen_key(&group->keygen, hot[jj], buffer, &nkey);
+            struct version_ticket ticket;
+            uint32_t version = version_begin(group, hot[jj], &ticket);
+            enum OpResult res;
+            res = memcached_op_wrapper(&group->pool[0], TX_SET, key, nkey,
+                                       build_value(group, value, hot[jj],
+                                                   version),
+                                       group->dataset[hot[jj]],
+                                       stampede.expire);
+            version_end(group, hot[jj], &ticket, res);
+            if (res != OP_SUCCESS) {
+                fprintf(stderr, "Failed to store the hot key <%s>\n", key);
+                ret = -1;
+            }
+        }
+    }
+    free(value);
+    return ret;
+}
+
+/**
+ * Print how long it took to set the hot keys again after they expired,
+ * and the latency of the gets in the meantime
+ * @param ctx the thread contexts
+ * @param num the number of thread contexts
+ * @param end when the threads finished
+ */
+static void print_stampede(struct thread_context *ctx, int num, hrtime_t end) {
+    if (stampede.begin == 0) {
+        fprintf(stdout, "Stampede: The hot keys didn't expire during the run\n\n");
+        return;
+    }
+
+    struct histogram *storm = calloc(1, sizeof(*storm));
+    if (storm == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return;
+    }
+    for (int ii = 0; ii < num; ++ii) {
+        histogram_merge(storm, &ctx[ii].storm);
+    }
+
+    if (stampede.end != 0) {
+        end = stampede.end;
+    }
+    double elapsed = (end - stampede.begin) / 1000000000.0;
+    fprintf(stdout, "Stampede: %d hot keys expired after %u s\n",
+            no_groups * hot_keys, stampede.expire);
+    if (stampede.left > 0) {
+        fprintf(stdout, "    %d of them weren't set again before the end\n",
+                stampede.left);
+    }
+    fprintf(stdout, "    The storm lasted %.1f ms\n", elapsed * 1000.0);
+    fprintf(stdout, "    %"PRIu64" sets of the hot keys (%"PRIu64" duplicates)",
+            stampede.refills, stampede.duplicates);
+    if (elapsed > 0) {
+        fprintf(stdout, ", %.0f sets/s", stampede.refills / elapsed);
+    }
+    fprintf(stdout, "\n");
+    if (storm->count > 0) {
+        fprintf(stdout, "    %"PRIu64" gets during the storm: p50 %.1f us, "
+                "p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+                storm->count,
+                histogram_percentile(storm, 50.0) / 1000.0,
+                histogram_percentile(storm, 99.0) / 1000.0,
+                histogram_percentile(storm, 99.9) / 1000.0,
+                storm->max / 1000.0);
+    }
+    fprintf(stdout, "\n");
+    free(storm);
+}
+
+/**
+ * Print the time the threads spent waiting for a connection from the
+ * shared pool
+ * @param ctx the thread contexts
+ * @param num the number of thread contexts
+ */
+static void print_lock_wait(struct thread_context *ctx, int num) {
+    uint64_t waits = 0;
+    hrtime_t total = 0;
+
+    for (int ii = 0; ii < num; ++ii) {
+        waits += ctx[ii].lock_waits;
+        total += ctx[ii].lock_wait_time;
+    }
+
+    fprintf(stdout, "Connection pool: %"PRIu64" waits, %.3f ms total",
+            waits, (double)total / 1000000.0);
+    if (waits > 0) {
+        fprintf(stdout, ", %"PRIu64" ns avg", (uint64_t)(total / waits));
+    }
+    fprintf(stdout, "\n\n");
+}
+
+/**
+ * Add a host into the list of memcached servers to use
+ * @param hostname the hostname:port to connect to
+ */
+static void add_host(const char *hostname) {
+    struct host *entry = malloc(sizeof(struct host));
+    if (entry == 0) {
+        fprintf(stderr, "Failed to allocate memory for <%s>. Host ignored\n",
+                hostname);
+        fflush(stderr);
+        return;
+    }
+    entry->next = hosts;
+    hosts = entry;
+    entry->hostname = strdup(hostname);
+    char *ptr = strchr(entry->hostname, ':');
+    if (ptr != NULL) {
+        *ptr = '\0';
+        entry->port = atoi(ptr + 1);
+    } else {
+        entry->port = 11211;
+    }
+}
+
+static struct addrinfo *lookuphost(const char *hostname, in_port_t port) {
+    struct addrinfo *ai = 0;
+    struct addrinfo hints = {
+        .ai_flags = AI_PASSIVE|AI_ADDRCONFIG,
+        .ai_family = AF_UNSPEC,
+        .ai_protocol = IPPROTO_TCP,
+        .ai_socktype = SOCK_STREAM };
+    char service[NI_MAXSERV];
+    int error;
+
+    (void)snprintf(service, NI_MAXSERV, "%d", port);
+    if ((error = getaddrinfo(hostname, service, &hints, &ai)) != 0) {
+        if (error != EAI_SYSTEM) {
+            fprintf(stderr, "getaddrinfo(): %s\n", gai_strerror(error));
+        } else {
+            perror("getaddrinfo()");
+        }
+    }
+
+    return ai;
+}
+
+/**
+ * Resolve the servers for the virtual clients
+ * @return 0 on success, -1 otherwise
+ */
+static int initialize_vclients(void) {
+    int num = 0;
+    for (struct host *host = hosts; host != NULL; host = host->next) {
+        ++num;
+    }
+
+    vclient_config.servers = calloc(num, sizeof(struct addrinfo *));
+    if (vclient_config.servers == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return -1;
+    }
+
+    for (struct host *host = hosts; host != NULL; host = host->next) {
+        struct addrinfo *ai = lookuphost(host->hostname, host->port);
+        if (ai == NULL) {
+            return -1;
+        }
+        vclient_config.servers[vclient_config.no_servers++] = ai;
+        if (!use_multiple_servers) {
+            break;
+        }
+    }
+
+    switch (groups[0].config.library) {
+    case LIBMEMC_TEXTUAL:
+#ifdef HAVE_LIBMEMCACHED
+    case LIBMEMCACHED_TEXTUAL:
+#endif
+        vclient_config.protocol = Textual;
+        break;
+    case LIBMEMC_BINARY:
+#ifdef HAVE_LIBMEMCACHED
+    case LIBMEMCACHED_BINARY:
+#endif
+        vclient_config.protocol = Binary;
+        break;
+    default:
+        fprintf(stderr, "The virtual clients only speak the memcached protocol\n");
+        return -1;
+    }
+
+    vclient_config.running = vclient_running;
+    vclient_config.next_op = vclient_next_op;
+    return 0;
+}
+
+/**
+ * The collector of the server stats (see --server-stats)
+ */
+static struct stats_collector stats_collector = {
+    .interval = 0,
+    .slabs = false
+};
+
+/**
+ * The protocol to ask the servers for their stats in
+ */
+static enum Protocol stats_protocol(void) {
+    switch (groups[0].config.library) {
+    case LIBMEMC_BINARY:
+#ifdef HAVE_LIBMEMCACHED
+    case LIBMEMCACHED_BINARY:
+#endif
+        return Binary;
+    default:
+        return Textual;
+    }
+}
+
+/**
+ * Add all of the servers to the stats collector
+ * @return 0 on success, -1 otherwise
+ */
+static int initialize_stats_collector(void) {
+    stats_collector.protocol = stats_protocol();
+    for (struct host *host = hosts; host != NULL; host = host->next) {
+        char name[NI_MAXHOST + NI_MAXSERV];
+        struct addrinfo *ai = lookuphost(host->hostname, host->port);
+        if (ai == NULL) {
+            return -1;
+        }
+        snprintf(name, sizeof(name), "%s:%d", host->hostname, host->port);
+        if (!stats_collector_add(&stats_collector, name, ai)) {
+            fprintf(stderr, "Failed to allocate memory\n");
+            freeaddrinfo(ai);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * The time the servers spent and the operations they ran
+ */
+struct server_usage {
+    double user;
+    double system;
+    double ops;
+};
+
+/**
+ * Sum the usage of all of the servers
+ * @return 0 on success, -1 otherwise
+ */
+static int get_server_usage(struct server_usage *usage) {
+    struct stats stats = { .num = 0 };
+    int ret = 0;
+
+    memset(usage, 0, sizeof(*usage));
+    for (struct host *host = hosts; host != NULL && ret == 0; host = host->next) {
+        struct addrinfo *ai = lookuphost(host->hostname, host->port);
+        int sock;
+        if (ai == NULL || (sock = stats_connect(ai)) == -1) {
+            ret = -1;
+        } else {
+            if (stats_fetch(sock, stats_protocol(), NULL, &stats)) {
+                usage->user += stats_number(&stats, "rusage_user");
+                usage->system += stats_number(&stats, "rusage_system");
+                usage->ops += stats_ops(&stats);
+            } else {
+                ret = -1;
+            }
+            close(sock);
+        }
+        if (ai != NULL) {
+            freeaddrinfo(ai);
+        }
+    }
+
+    stats_destroy(&stats);
+    return ret;
+}
+
+/**
+ * Print how well the servers pack the dataset after the populate, and
+ * project the memory needed for this number of items (see
+ * --memory-report). 0 skips the projection.
+ */
+static int64_t memory_report = -1;
+
+/** The largest slab class id we keep track of */
+#define MAX_SLAB_CLASS 256
+
+/**
+ * A slab class summed over all of the servers
+ */
+struct slab_class {
+    double chunk_size;
+    double chunks_per_page;
+    double pages;
+    double used_chunks;
+    /** The bytes the items in the class asked for (if the server says) */
+    double requested;
+    double items;
+};
+
+/**
+ * Compare the bytes we stored with the memory the servers use for them:
+ * the overhead, how full the chunks of every slab class are, and how
+ * many items fit in a GB
+ */
+static void print_memory_report(void) {
+    struct slab_class *classes = calloc(MAX_SLAB_CLASS, sizeof(*classes));
+    struct stats stats = { .num = 0 };
+    double server_items = 0;
+    double allocated = 0;
+    double limit = 0;
+    bool requested = false;
+
+    if (classes == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return;
+    }
+
+    /* The exact bytes we stored */
+    uint64_t items = 0;
+    uint64_t key_bytes = 0;
+    uint64_t value_bytes = 0;
+    for (int ii = 0; ii < no_groups; ++ii) {
+        struct client_group *group = &groups[ii];
+        char buffer[KEYGEN_MAX_KEY + 1];
+        for (uint64_t idx = 0; idx < (uint64_t)group->config.items; ++idx) {
+            size_t nkey;
+            (void)keygen_key(&group->keygen, idx, buffer, &nkey);
+            key_bytes += nkey;
+            value_bytes += item_size(group, idx);
+        }
+        items += group->config.items;
+    }
+
+    for (struct host *host = hosts; host != NULL; host = host->next) {
+        struct addrinfo *ai = lookuphost(host->hostname, host->port);
+        int sock;
+        if (ai == NULL || (sock = stats_connect(ai)) == -1) {
+            if (ai != NULL) {
+                freeaddrinfo(ai);
+            }
+            free(classes);
+            return;
+        }
+
+        enum Protocol protocol = stats_protocol();
+        bool ok = stats_fetch(sock, protocol, NULL, &stats);
+        if (ok) {
+            server_items += stats_number(&stats, "curr_items");
+            limit += stats_number(&stats, "limit_maxbytes");
+            ok = stats_fetch(sock, protocol, "items", &stats);
+        }
+        for (int ii = 0; ok && ii < stats.num; ++ii) {
+            int id;
+            char field[64];
+            if (sscanf(stats.names[ii], "items:%d:%63s", &id, field) == 2 &&
+                id >= 0 && id < MAX_SLAB_CLASS && strcmp(field, "number") == 0) {
+                classes[id].items += atof(stats.values[ii]);
+            }
+        }
+        if (ok) {
+            ok = stats_fetch(sock, protocol, "slabs", &stats);
+            allocated += stats_number(&stats, "total_malloced");
+        }
+        for (int ii = 0; ok && ii < stats.num; ++ii) {
+            int id;
+            char field[64];
+            if (sscanf(stats.names[ii], "%d:%63s", &id, field) != 2 ||
+                id < 0 || id >= MAX_SLAB_CLASS) {
+                continue;
+            }
+            double value = atof(stats.values[ii]);
+            struct slab_class *slab = &classes[id];
+            if (strcmp(field, "chunk_size") == 0) {
+                slab->chunk_size = value;
+            } else if (strcmp(field, "chunks_per_page") == 0) {
+                slab->chunks_per_page = value;
+            } else if (strcmp(field, "total_pages") == 0) {
+                slab->pages += value;
+            } else if (strcmp(field, "used_chunks") == 0) {
+                slab->used_chunks += value;
+            } else if (strcmp(field, "mem_requested") == 0) {
+                slab->requested += value;
+                requested = true;
+            }
+        }
+        close(sock);
+        freeaddrinfo(ai);
+        if (!ok) {
+            fprintf(stderr, "Failed to get the stats from %s:%d\n",
+                    host->hostname, host->port);
+            stats_destroy(&stats);
+            free(classes);
+            return;
+        }
+    }
+    stats_destroy(&stats);
+
+    double in_chunks = 0;
+    double pages = 0;
+    for (int id = 0; id < MAX_SLAB_CLASS; ++id) {
+        in_chunks += classes[id].used_chunks * classes[id].chunk_size;
+        pages += classes[id].pages * classes[id].chunks_per_page *
+            classes[id].chunk_size;
+    }
+    if (allocated == 0) {
+        /* Older servers don't report total_malloced */
+        allocated = pages;
+    }
+
+    double stored = (double)(key_bytes + value_bytes);
+    const double mb = 1024.0 * 1024.0;
+    fprintf(stdout, "Memory efficiency:\n");
+    fprintf(stdout, "Stored: %"PRIu64" items, %.1f MB keys, %.1f MB values "
+            "(%.0f bytes per item)\n", items, key_bytes / mb,
+            value_bytes / mb, items ? stored / items : 0);
+    fprintf(stdout, "Server: %.0f items, %.1f MB in chunks, %.1f MB "
+            "allocated of %.1f MB\n", server_items, in_chunks / mb,
+            allocated / mb, limit / mb);
+    if (server_items != (double)items) {
+        fprintf(stdout, "Note: the servers hold %.0f items, not the %"PRIu64
+                " we stored (evictions or other data)\n",
+                server_items, items);
+    }
+    if (stored > 0 && server_items > 0) {
+        /* Per item, so other data on the servers skews it less */
+        double per_item = stored / items;
+        fprintf(stdout, "Overhead: %.2fx in chunks, %.2fx allocated "
+                "(%.0f bytes per item in chunks)\n",
+                in_chunks / server_items / per_item,
+                allocated / server_items / per_item,
+                in_chunks / server_items - per_item);
+        fprintf(stdout, "Items per GB: %.0f\n",
+                server_items * 1024 * mb / allocated);
+    }
+
+    fprintf(stdout, "%10s %10s %10s %10s %8s %8s %10s\n", "Slab class",
+            "Chunk size", "Items", "Chunks", "Pages", "Fill", "Wasted");
+    for (int id = 0; id < MAX_SLAB_CLASS; ++id) {
+        const struct slab_class *slab = &classes[id];
+        if (slab->used_chunks == 0) {
+            continue;
+        }
+        double used = slab->used_chunks * slab->chunk_size;
+        fprintf(stdout, "%10d %10.0f %10.0f %10.0f %8.0f", id,
+                slab->chunk_size, slab->items, slab->used_chunks,
+                slab->pages);
+        if (requested) {
+            fprintf(stdout, " %7.1f%% %7.1f MB\n",
+                    slab->requested * 100 / used,
+                    (used - slab->requested) / mb);
+        } else {
+            /* Newer servers don't report what the items asked for */
+            fprintf(stdout, " %8s %10s\n", "-", "-");
+        }
+    }
+
+    if (memory_report > 0 && server_items > 0) {
+        /*
+         * Spread the items over the slab classes like the dataset, and
+         * round every class up to whole pages
+         */
+        double projected = 0;
+        for (int id = 0; id < MAX_SLAB_CLASS; ++id) {
+            const struct slab_class *slab = &classes[id];
+            if (slab->used_chunks == 0 || slab->chunks_per_page == 0) {
+                continue;
+            }
+            double chunks = memory_report * slab->used_chunks / server_items;
+            projected += ceil(chunks / slab->chunks_per_page) *
+                slab->chunks_per_page * slab->chunk_size;
+        }
+        fprintf(stdout, "Projected memory for %"PRId64" items: %.1f MB "
+                "(-m %.0f)\n", memory_report, projected / mb,
+                ceil(projected / mb));
+    }
+
+    free(classes);
+}
+
+/** Wait for a coordinator on this [host:]port (see --agent) */
+static const char *agent_address = NULL;
+
+/** The agents to coordinate (host:port,..., see --agents) */
+static const char *agent_list = NULL;
+
+/** The connection to the coordinator when we're running as an agent */
+static int coordinator_sock = -1;
+
+/** The number the coordinator gave this agent */
+static uint32_t agent_index = 0;
+
+/**
+ * Parse the --slo specification: latency in us, optionally followed by
+ * @percentile (default: 99)
+ * @return true on success
+ */
+static bool slo_parse(const char *spec) {
+    char *end;
+    double latency = strtod(spec, &end);
+
+    if (*end == '@') {
+        slo_percentile = strtod(end + 1, &end);
+    }
+    if (*end != '\0' || latency <= 0 || slo_percentile <= 0 ||
+        slo_percentile >= 100) {
+        fprintf(stderr, "Invalid SLO: %s\n", spec);
+        return false;
+    }
+
+    slo_latency = (hrtime_t)(latency * 1000);
+    return true;
+}
+
+/**
+ * Parse the --ttl specification: seconds or min:max
+ * @return true on success
+ */
+static bool ttl_parse(const char *spec) {
+    char *end;
+    long min = strtol(spec, &end, 10);
+    long max = min;
+
+    if (*end == ':') {
+        max = strtol(end + 1, &end, 10);
+    }
+
+    if (*end != '\0' || min < 0 || max < min || max > TTL_MAX) {
+        fprintf(stderr, "Invalid ttl: %s\n", spec);
+        return false;
+    }
+
+    ttl_min = (uint32_t)min;
+    ttl_max = (uint32_t)max;
+    return true;
+}
+
+/**
+ * Parse the --drift specification: slide:keys_per_second or
+ * phase:seconds_per_window
+ * @return true on success
+ */
+static bool drift_parse(const char *spec) {
+    const char *rate = strchr(spec, ':');
+    char *end = NULL;
+
+    if (rate != NULL) {
+        drift_rate = strtod(rate + 1, &end);
+    }
+    if (rate == NULL || *end != '\0' || drift_rate <= 0) {
+        fprintf(stderr, "Invalid drift: %s\n", spec);
+        return false;
+    }
+
+    size_t len = rate - spec;
+    if (len == 5 && strncmp(spec, "slide", len) == 0) {
+        drift_mode = DRIFT_SLIDE;
+    } else if (len == 5 && strncmp(spec, "phase", len) == 0) {
+        drift_mode = DRIFT_PHASE;
+    } else {
+        fprintf(stderr, "Invalid drift: %s\n", spec);
+        return false;
+    }
+    return true;
+}
+
+enum {
+    OPT_WARMUP = 256,
+    OPT_STEADY_STATE,
+    OPT_INTERVAL,
+    OPT_VCLIENTS,
+    OPT_THINK_TIME,
+    OPT_AGENT,
+    OPT_AGENTS,
+    OPT_LOAD_THREADS,
+    OPT_LOAD_BATCH,
+    OPT_CHECKPOINT,
+    OPT_HOT_KEYS,
+    OPT_SCENARIO,
+    OPT_DRIFT,
+    OPT_UNIVERSE,
+    OPT_MISS_RATIO,
+    OPT_TTL,
+    OPT_REFILL,
+    OPT_STAMPEDE,
+    OPT_SLO,
+    OPT_SEARCH_STEP,
+    OPT_SWEEP,
+    OPT_SWEEP_OUTPUT,
+    OPT_LCB_WINDOW,
+    OPT_LCB_BATCH,
+    OPT_MGET,
+    OPT_LIBMEMCACHED,
+    OPT_SERVER_STATS,
+    OPT_SLAB_STATS,
+    OPT_MEMORY_REPORT
+};
+
+static const struct option long_options[] = {
+    { "duration", required_argument, NULL, 'd' },
+    { "mix", required_argument, NULL, 'O' },
+    { "warmup", required_argument, NULL, OPT_WARMUP },
+    { "steady-state", optional_argument, NULL, OPT_STEADY_STATE },
+    { "progress", no_argument, NULL, 'p' },
+    { "interval", required_argument, NULL, OPT_INTERVAL },
+    { "vclients", required_argument, NULL, OPT_VCLIENTS },
+    { "think-time", required_argument, NULL, OPT_THINK_TIME },
+    { "agent", required_argument, NULL, OPT_AGENT },
+    { "agents", required_argument, NULL, OPT_AGENTS },
+    { "load-threads", required_argument, NULL, OPT_LOAD_THREADS },
+    { "load-batch", required_argument, NULL, OPT_LOAD_BATCH },
+    { "checkpoint", required_argument, NULL, OPT_CHECKPOINT },
+    { "hot-keys", required_argument, NULL, OPT_HOT_KEYS },
+    { "scenario", required_argument, NULL, OPT_SCENARIO },
+    { "drift", required_argument, NULL, OPT_DRIFT },
+    { "universe", required_argument, NULL, OPT_UNIVERSE },
+    { "miss-ratio", required_argument, NULL, OPT_MISS_RATIO },
+    { "ttl", required_argument, NULL, OPT_TTL },
+    { "refill", optional_argument, NULL, OPT_REFILL },
+    { "stampede", required_argument, NULL, OPT_STAMPEDE },
+    { "slo", required_argument, NULL, OPT_SLO },
+    { "search-step", required_argument, NULL, OPT_SEARCH_STEP },
+    { "sweep", required_argument, NULL, OPT_SWEEP },
+    { "sweep-output", required_argument, NULL, OPT_SWEEP_OUTPUT },
+    { "lcb-window", required_argument, NULL, OPT_LCB_WINDOW },
+    { "lcb-batch", required_argument, NULL, OPT_LCB_BATCH },
+    { "mget", required_argument, NULL, OPT_MGET },
+    { "libmemcached", required_argument, NULL, OPT_LIBMEMCACHED },
+    { "server-stats", optional_argument, NULL, OPT_SERVER_STATS },
+    { "slab-stats", no_argument, NULL, OPT_SLAB_STATS },
+    { "memory-report", optional_argument, NULL, OPT_MEMORY_REPORT },
+    { NULL, 0, NULL, 0 }
+};
+
+/**
+ * The options that control the run itself
+ */
+struct run_options {
+    int no_threads;
+    int populate;
+    int loop;
+};
+
+/**
+ * Parse the command line (the agents parse the command line they get
+ * from the coordinator the same way)
+ * @param argc argument count
+ * @param argv argument vector
+ * @param opts where to store the options for the run
+ * @return 0 on success, -1 otherwise
+ */
+static int parse_options(int argc, char **argv, struct run_options *opts) {
+    int cmd;
+    int size;
+
+    while ((cmd = getopt_long(argc, argv,
+                              "K:QW:M:pL:P:Fm:t:h:i:s:c:VlSvC:D:k:z:T:R:ed:O:",
+                              long_options, NULL)) != EOF) {
+        switch (cmd) {
+        case 'K':
+            if (strlen(optarg) > 240) {
+                fprintf(stderr, "Prefix too long\n");
+                return -1;
+            }
+            prefix = optarg;
+            break;
+        case 'p':
+            progress = 1;
+            break;
+        case OPT_INTERVAL:
+            progress_interval = atof(optarg);
+            if (progress_interval <= 0) {
+                fprintf(stderr, "Invalid progress interval\n");
+                return -1;
+            }
+            progress = 1;
+            break;
+        case 'P':
+            setprc = atoi(optarg);
             if (setprc > 100) {
                 setprc = 100;
             } else if (setprc < 0) {
                 setprc = 0;
             }
-            break;
-        case 't':
-            no_threads = atoi(optarg);
-            break;
-        case 'L':
-            current_memcached_library = atoi(optarg);
-            break;
-        case 'M':
-            size = atoi(optarg);
-            if (size > 1024 * 1024 *20) {
-                fprintf(stderr, "WARNING: Too big block size %d\n", size);
-            } else {
-                datablock.size = size;
+            break;
+        case 'O':
+            if (!opmix_parse(&opmix, optarg)) {
+                return -1;
+            }
+            opmix_given = true;
+            break;
+        case 't':
+            opts->no_threads = atoi(optarg);
+            break;
+        case 'L':
+            current_memcached_library = atoi(optarg);
+            break;
+        case 'M':
+            size = atoi(optarg);
+            if (size > 1024 * 1024 *20) {
+                fprintf(stderr, "WARNING: Too big block size %d\n", size);
+            } else {
+                datablock.size = size;
+            }
+            break;
+        case 'F': sizedist.type = SD_FIXED;
+            break;
+        case 'z':
+            if (!sizedist_parse(&sizedist, optarg)) {
+                return -1;
+            }
+            print_sizes = 1;
+            break;
+        case 'h': add_host(optarg);
+            break;
+        case 'i': no_items = atoi(optarg);
+            break;
+        case 's': seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'c': no_iterations = atoll(optarg);
+            break;
+        case 'd': run_duration = atof(optarg);
+            break;
+        case OPT_WARMUP: warmup = atof(optarg);
+            break;
+        case OPT_STEADY_STATE:
+            steady_state = (optarg ? atof(optarg) : 5.0) / 100.0;
+            if (steady_state <= 0) {
+                fprintf(stderr, "Invalid steady state tolerance\n");
+                return -1;
+            }
+            break;
+        case 'V': verify_data = 1;
+            break;
+        case OPT_VCLIENTS: no_vclients = atoi(optarg);
+            break;
+        case OPT_AGENT: agent_address = optarg;
+            break;
+        case OPT_AGENTS: agent_list = optarg;
+            break;
+        case OPT_LOAD_THREADS: load_threads = atoi(optarg);
+            break;
+        case OPT_LOAD_BATCH:
+            load_batch = atoi(optarg);
+            if (load_batch < 1) {
+                fprintf(stderr, "Invalid load batch size\n");
+                return -1;
+            }
+            break;
+        case OPT_CHECKPOINT: checkpoint_file = optarg;
+            break;
+        case OPT_SCENARIO: scenario_file = optarg;
+            break;
+        case OPT_HOT_KEYS:
+            hot_keys = atoi(optarg);
+            if (hot_keys < 1) {
+                fprintf(stderr, "Invalid number of hot keys\n");
+                return -1;
+            }
+            break;
+        case OPT_DRIFT:
+            if (!drift_parse(optarg)) {
+                return -1;
+            }
+            break;
+        case OPT_UNIVERSE:
+            key_universe = strtoull(optarg, NULL, 10);
+            if (key_universe == 0) {
+                fprintf(stderr, "Invalid key universe\n");
+                return -1;
+            }
+            break;
+        case OPT_MISS_RATIO:
+            miss_ratio = atof(optarg);
+            if (miss_ratio < 0 || miss_ratio > 100) {
+                fprintf(stderr, "Invalid miss ratio\n");
+                return -1;
+            }
+            break;
+        case OPT_TTL:
+            if (!ttl_parse(optarg)) {
+                return -1;
+            }
+            break;
+        case OPT_REFILL:
+            refill = true;
+            if (optarg != NULL) {
+                double ms = atof(optarg);
+                if (ms < 0) {
+                    fprintf(stderr, "Invalid fetch time\n");
+                    return -1;
+                }
+                fetch_time = (useconds_t)(ms * 1000);
+            }
+            break;
+        case OPT_STAMPEDE:
+            stampede.expire = (uint32_t)atoi(optarg);
+            if (atoi(optarg) < 1 || stampede.expire > TTL_MAX) {
+                fprintf(stderr, "Invalid stampede time\n");
+                return -1;
+            }
+            break;
+        case OPT_SLO:
+            if (!slo_parse(optarg)) {
+                return -1;
+            }
+            break;
+        case OPT_SEARCH_STEP:
+            search_step = atof(optarg);
+            if (search_step <= 0) {
+                fprintf(stderr, "Invalid search step\n");
+                return -1;
+            }
+            break;
+        case OPT_SWEEP:
+            if (!sweep_parse(&sweep, optarg)) {
+                return -1;
+            }
+            break;
+        case OPT_SWEEP_OUTPUT: sweep_output = optarg;
+            break;
+        case OPT_THINK_TIME:
+            if (!thinktime_parse(&vclient_config.think, optarg)) {
+                return -1;
+            }
+            break;
+        case 'l': opts->loop = 1;
+            break;
+        case 'S': opts->populate = 0;
+            break;
+        case 'v': verbose = 1;
+            break;
+        case 'W': connection_pool_size = atoi(optarg);
+            break;
+        case 'Q': thread_bind_connection = 1;
+            break;
+        case 'm':
+            {
+                size = atoi(optarg);
+                if (size > 1024 * 1024) {
+                    fprintf(stderr, "WARNING: Too big block size %d\n", size);
+                } else {
+                    datablock.min_size = size;
+                }
+            }
+            break;
+        case 'k':
+            if (!keygen_parse_length(&keygen, optarg)) {
+                return -1;
+            }
+            break;
+        case 'T':
+            if ((trace = trace_open(optarg)) == NULL) {
+                return -1;
+            }
+            break;
+        case 'R':
+            record_file = optarg;
+            break;
+        case 'e':
+            trace_timing = 1;
+            break;
+        case 'D':
+            if (!keydist_parse(&keydist, optarg)) {
+                return -1;
+            }
+            break;
+        case OPT_SERVER_STATS:
+            stats_collector.interval = optarg ? atof(optarg) : 1.0;
+            if (stats_collector.interval <= 0) {
+                fprintf(stderr, "Invalid stats interval\n");
+                return -1;
+            }
+            break;
+        case OPT_SLAB_STATS:
+            stats_collector.slabs = true;
+            if (stats_collector.interval <= 0) {
+                stats_collector.interval = 1.0;
+            }
+            break;
+        case OPT_MEMORY_REPORT:
+            memory_report = optarg ? atoll(optarg) : 0;
+            if (memory_report < 0) {
+                fprintf(stderr, "Invalid number of items to project\n");
+                return -1;
+            }
+            break;
+        case OPT_MGET:
+            mget_batch = atoi(optarg);
+            if (mget_batch < 1 || mget_batch > MGET_MAX) {
+                fprintf(stderr, "The multi-get batch must be between 1 and %d\n",
+                        MGET_MAX);
+                return -1;
+            }
+            break;
+        case OPT_LIBMEMCACHED:
+#ifndef HAVE_LIBMEMCACHED
+            fprintf(stderr, "You need to rebuild memcachetest with libmemcached\n");
+            return -1;
+#else
+            if (!libmemcached_parse(optarg)) {
+                return -1;
+            }
+#endif
+            break;
+        case OPT_LCB_WINDOW:
+        case OPT_LCB_BATCH:
+#ifndef HAVE_LIBCOUCHBASE
+            fprintf(stderr, "You need to rebuild memcachetest with libcouchbase\n");
+            return -1;
+#else
+            if (atoi(optarg) < 1) {
+                fprintf(stderr, "Invalid %s\n", cmd == OPT_LCB_WINDOW ?
+                        "libcouchbase window" : "libcouchbase batch size");
+                return -1;
+            }
+            if (cmd == OPT_LCB_WINDOW) {
+                lcb_window = atoi(optarg);
+            } else {
+                lcb_batch = atoi(optarg);
+            }
+#endif
+            break;
+        case 'C':
+#ifndef HAVE_LIBVBUCKET
+            fprintf(stderr, "You need to rebuild memcachetest with libvbucket\n");
+            return -1;
+#else
+            if (!initialize_vbuckets(optarg)) {
+                return -1;
+            }
+#endif
+            break;
+        default:
+            fprintf(stderr, "Usage: test [-h host[:port]] [-t #threads]");
+            fprintf(stderr, " [-T] [-i #items] [-c #iterations]\n");
+            fprintf(stderr, "            [-v] [-V] [-f dir] [-s seed] [-W size] [-C vbucketconfig]\n");
+            fprintf(stderr, "            [-D distribution] [-k keylen] [-z sizes]\n");
+            fprintf(stderr, "            [-O mix [--hot-keys num]] [--scenario file]\n");
+            fprintf(stderr, "            [--drift slide:keys/s|phase:seconds [--universe num]]\n");
+            fprintf(stderr, "            [--miss-ratio percent] [--ttl seconds[:max]]\n");
+            fprintf(stderr, "            [--refill[=ms]] [--stampede seconds]\n");
+            fprintf(stderr, "            [--slo us[@percentile] [--search-step seconds]]\n");
+            fprintf(stderr, "            [--sweep param=value,... [--sweep-output file]]\n");
+            fprintf(stderr, "            [-T trace [-e]] [-R trace] [-d seconds]\n");
+            fprintf(stderr, "            [--warmup seconds] [--steady-state[=tolerance]]\n");
+            fprintf(stderr, "            [-p [--interval seconds]]\n");
+            fprintf(stderr, "            [--server-stats[=seconds] [--slab-stats]]\n");
+            fprintf(stderr, "            [--memory-report[=items]]\n");
+            fprintf(stderr, "            [--vclients num [--think-time ms[:distribution]]]\n");
+            fprintf(stderr, "            [--agent [host:]port | --agents host:port,...]\n");
+            fprintf(stderr, "            [--load-threads num] [--load-batch num] [--checkpoint file]\n");
+            fprintf(stderr, "            [--lcb-window num [--lcb-batch num]]\n");
+            fprintf(stderr, "            [--mget num] [--libmemcached behavior,...]\n");
+            fprintf(stderr, "\t-h The hostname:port where the memcached server is running\n");
+            fprintf(stderr, "\t   (use mulitple -h args for multiple servers)\n");
+            fprintf(stderr, "\t-t The number of threads to use\n");
+            fprintf(stderr, "\t-i The number of items to operate with\n");
+            fprintf(stderr, "\t-c The number of iteratons each thread should do\n");
+            fprintf(stderr, "\t-d --duration Run for the number of seconds instead of -c\n");
+            fprintf(stderr, "\t   iterations (not counting the warmup)\n");
+            fprintf(stderr, "\t--warmup Discard the samples from the first seconds of the run\n");
+            fprintf(stderr, "\t--steady-state Start measuring when the throughput and latency\n");
+            fprintf(stderr, "\t   of the last %d seconds stay within the tolerance (in %%,\n", STEADY_STATE_WINDOW);
+            fprintf(stderr, "\t   default 5) of their mean\n");
+            fprintf(stderr, "\t-l Loop and repeat the test, but print out information for each run\n");
+            fprintf(stderr, "\t-m The minimum object size to use during testing\n");
+            fprintf(stderr, "\t-M The maximum object size to use during testing\n");
+            fprintf(stderr, "\t-F Use fixed message size, specified by -M\n");
+            fprintf(stderr, "\t-z The value size distribution (between -m and -M):\n");
+            fprintf(stderr, "\t   uniform (default), normal:mean:stddev, lognormal:median:sigma,\n");
+            fprintf(stderr, "\t   pareto:min:shape or file:name (lines of \"size [weight]\")\n");
+            fprintf(stderr, "\t-V Verify the retrieved data. Every key gets its own value\n");
+            fprintf(stderr, "\t   with a checksum, so values for the wrong key are caught.\n");
+            fprintf(stderr, "\t   The test threads also report a value older than the last\n");
+            fprintf(stderr, "\t   set of the key that was acknowledged before the get\n");
+            fprintf(stderr, "\t-v Verbose output\n");
+            fprintf(stderr, "\t-L Use the specified memcached client library\n");
+            fprintf(stderr, "\t-W connection pool size\n");
+            fprintf(stderr, "\t--mget Send the gets in multi-gets of the number of keys\n");
+            fprintf(stderr, "\t   (libmemcached only). The other operations run while a\n");
+            fprintf(stderr, "\t   batch fills up\n");
+            fprintf(stderr, "\t--libmemcached Turn on the libmemcached behaviors: no-block,\n");
+            fprintf(stderr, "\t   buffer (buffered writes), noreply, ketama (consistent\n");
+            fprintf(stderr, "\t   distribution), nodelay and keepalive\n");
+            fprintf(stderr, "\t--lcb-window Drive libcouchbase asynchronously with the number\n");
+            fprintf(stderr, "\t   of requests scheduled on every instance\n");
+            fprintf(stderr, "\t--lcb-batch The number of operations in a request. The gets\n");
+            fprintf(stderr, "\t   of a request go out in one mget (default: 16)\n");
+            fprintf(stderr, "\t--vclients Run the number of virtual clients (spread over the\n");
+            fprintf(stderr, "\t   threads), each with its own non-blocking connection to\n");
+            fprintf(stderr, "\t   every server\n");
+            fprintf(stderr, "\t--think-time The time a virtual client waits between its\n");
+            fprintf(stderr, "\t   operations: mean ms followed by :exponential (default),\n");
+            fprintf(stderr, "\t   :fixed or :uniform\n");
+            fprintf(stderr, "\t-Q Bind the connections to the threads (shared-nothing mode).\n");
+            fprintf(stderr, "\t   Each thread uses its own slice of the pool without locking\n");
+            fprintf(stderr, "\t-s Use the specified seed to initialize the random generator\n");
+            fprintf(stderr, "\t   (each thread gets its own reproducible stream)\n");
+            fprintf(stderr, "\t-S Skip the populate of the data\n");
+            fprintf(stderr, "\t--load-threads The number of threads (each with its own\n");
+            fprintf(stderr, "\t   connections) to populate the data with (default: -t)\n");
+            fprintf(stderr, "\t--load-batch The number of sets to pipeline to a server\n");
+            fprintf(stderr, "\t   while populating the data (default: 100)\n");
+            fprintf(stderr, "\t--memory-report Compare the bytes stored by the populate with\n");
+            fprintf(stderr, "\t   the memory the servers use: the overhead, the fill and waste\n");
+            fprintf(stderr, "\t   of the slab classes and the items per GB. With a number of\n");
+            fprintf(stderr, "\t   items, also project the memory they need\n");
+            fprintf(stderr, "\t--checkpoint Record how far the populate got in the file, and\n");
+            fprintf(stderr, "\t   continue from there if the file exists\n");
+            fprintf(stderr, "\t-p --progress Print the throughput, hit ratio and latency\n");
+            fprintf(stderr, "\t   percentiles every second while the test runs\n");
+            fprintf(stderr, "\t--interval The number of seconds between the progress reports\n");
+            fprintf(stderr, "\t--server-stats Sample the stats of every server at the interval\n");
+            fprintf(stderr, "\t   (default 1 second) and print the rates, memory, connections\n");
+            fprintf(stderr, "\t   and server time per operation next to the progress\n");
+            fprintf(stderr, "\t--slab-stats Also print the slab classes in use (implies\n");
+            fprintf(stderr, "\t   --server-stats)\n");
+            fprintf(stderr, "\t-P The probability for a set operation\n");
+            fprintf(stderr, "\t   (default: 33 meaning set 33%% of the time)\n");
+            fprintf(stderr, "\t-O --mix The operations to run and their weights, for example\n");
+            fprintf(stderr, "\t   get=80,set=10,delete=5,incr=5 (overrides -P). The operations\n");
+            fprintf(stderr, "\t   are get, set, add, replace, append, prepend, cas (gets and\n");
+            fprintf(stderr, "\t   cas), delete, incr, decr, touch, gat and rmw (a gets / cas\n");
+            fprintf(stderr, "\t   loop updating a counter in one of the hot keys, retried\n");
+            fprintf(stderr, "\t   when someone else updated it first)\n");
+            fprintf(stderr, "\t--hot-keys The number of keys the rmw transactions share,\n");
+            fprintf(stderr, "\t   or that expire in a stampede (default: 1)\n");
+            fprintf(stderr, "\t--scenario Run the client groups in the file at the same time.\n");
+            fprintf(stderr, "\t   \"group name\" starts a group, followed by \"setting value\"\n");
+            fprintf(stderr, "\t   lines for threads, library (-L), mix (-O), prefix, items,\n");
+            fprintf(stderr, "\t   distribution (-D), sizes (-z or fixed), min-size, max-size\n");
+            fprintf(stderr, "\t   and rate (ops/s). The rest comes from the command line,\n");
+            fprintf(stderr, "\t   and the prefix defaults to -K followed by \"name:\"\n");
+            fprintf(stderr, "\t--drift Move the window of -i keys through a bigger key\n");
+            fprintf(stderr, "\t   universe: slide:n moves it n keys per second, phase:n\n");
+            fprintf(stderr, "\t   jumps to the next window every n seconds. The gets that\n");
+            fprintf(stderr, "\t   miss set the item. Implies -p\n");
+            fprintf(stderr, "\t--universe The number of keys the window moves through\n");
+            fprintf(stderr, "\t   (default: 10 times the number of items)\n");
+            fprintf(stderr, "\t--miss-ratio The percentage of the gets that look for keys\n");
+            fprintf(stderr, "\t   outside the dataset. The hits and misses are reported\n");
+            fprintf(stderr, "\t   separately\n");
+            fprintf(stderr, "\t--ttl The expiry time of the items in seconds, or a range\n");
+            fprintf(stderr, "\t   to pick them from uniformly (default: 0, never expire)\n");
+            fprintf(stderr, "\t--refill Set the items the gets miss again, after waiting\n");
+            fprintf(stderr, "\t   the given number of ms to fetch them from the backing store\n");
+            fprintf(stderr, "\t--stampede Make the --hot-keys most popular items (see -D)\n");
+            fprintf(stderr, "\t   expire at the same moment the given number of seconds into\n");
+            fprintf(stderr, "\t   the run (the sets of the mix keep that expiry), and report\n");
+            fprintf(stderr, "\t   how the threads race to set them again. Implies --refill\n");
+            fprintf(stderr, "\t--slo Search for the highest throughput where the latency\n");
+            fprintf(stderr, "\t   percentile (default: 99) stays below the given number of\n");
+            fprintf(stderr, "\t   us, by bisecting the rate the threads offer. With -d the\n");
+            fprintf(stderr, "\t   threads then run at the knee for the measured window\n");
+            fprintf(stderr, "\t--search-step The number of seconds to run every rate\n");
+            fprintf(stderr, "\t   (default: 2)\n");
+            fprintf(stderr, "\t--sweep Run the test for every combination of the values\n");
+            fprintf(stderr, "\t   of -t, -M, -P and -L, for example --sweep t=1,4,16\n");
+            fprintf(stderr, "\t   --sweep M=100,10000. The data is loaded and the connections\n");
+            fprintf(stderr, "\t   are created once per max size and library\n");
+            fprintf(stderr, "\t--sweep-output Where to write the table of the throughput\n");
+            fprintf(stderr, "\t   and latency of every point: CSV, or JSON if the name ends\n");
+            fprintf(stderr, "\t   in .json (default: CSV on stdout)\n");
+            fprintf(stderr, "\t-K specify a prefix that is added to all of the keys\n");
+            fprintf(stderr, "\t-k Pad the keys to the given length, or to a length\n");
+            fprintf(stderr, "\t   between min and max (specified as min:max)\n");
+            fprintf(stderr, "\t-C Read vbucket data from host:port specified\n");
+            fprintf(stderr, "\t-T Replay the operations in the trace file (stream n is\n");
+            fprintf(stderr, "\t   replayed by thread n %% #threads)\n");
+            fprintf(stderr, "\t-e Replay the trace with the recorded timing\n");
+            fprintf(stderr, "\t   (default: as fast as possible)\n");
+            fprintf(stderr, "\t-R Record the operations to the trace file\n");
+            fprintf(stderr, "\t--agent Run as an agent: wait for a coordinator to connect to\n");
+            fprintf(stderr, "\t   the port and run the command line it sends\n");
+            fprintf(stderr, "\t--agents Coordinate the agents: send them the rest of the\n");
+            fprintf(stderr, "\t   command line, start them at the same time and merge their\n");
+            fprintf(stderr, "\t   results (only the first agent populates the data)\n");
+            fprintf(stderr, "\t-D The key distribution to use:\n");
+            fprintf(stderr, "\t   uniform (default), zipf[:theta], scrambled[:theta],\n");
+            fprintf(stderr, "\t   hotspot[:hot set fraction[:hot op fraction]] or pareto[:shape]\n");
+            fprintf(stderr, "\nVersion: %s\n\n", VERSION);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Tell the coordinator why the agent gave up
+ * @param msg the reason
+ */
+static void agent_error(const char *msg) {
+    struct cluster_buffer buffer = { .data = NULL };
+    cluster_put_string(&buffer, msg);
+    (void)cluster_send(coordinator_sock, CLUSTER_ERROR, &buffer);
+    cluster_buffer_destroy(&buffer);
+}
+
+/**
+ * Tell the coordinator that we're ready and wait for the other agents
+ * @return 0 on success, -1 otherwise
+ */
+static int agent_wait_for_start(void) {
+    struct cluster_buffer buffer = { .data = NULL };
+    enum ClusterMessage type;
+    int ret = 0;
+
+    if (!cluster_send(coordinator_sock, CLUSTER_READY, NULL) ||
+        !cluster_receive(coordinator_sock, &type, &buffer) ||
+        type != CLUSTER_START) {
+        fprintf(stderr, "Didn't get the start signal from the coordinator\n");
+        ret = -1;
+    }
+    cluster_buffer_destroy(&buffer);
+
+    /* Don't use the same random streams as the other agents */
+    next_stream = ((uint64_t)agent_index + 1) << 10;
+    return ret;
+}
+
+/**
+ * Send the counters and the histograms to the coordinator
+ * @param ctx the thread contexts
+ * @param num the number of thread contexts
+ * @param end when the threads finished
+ * @return 0 on success, -1 otherwise
+ */
+static int agent_send_result(struct thread_context *ctx, int num,
+                             hrtime_t end) {
+    struct cluster_buffer buffer = { .data = NULL };
+    struct histogram *histogram = malloc(sizeof(*histogram));
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    if (histogram == NULL) {
+        agent_error("Failed to allocate memory");
+        return -1;
+    }
+
+    if (run_end < end) {
+        end = run_end;
+    }
+    for (int ii = 0; ii < num; ++ii) {
+        hits += ctx[ii].hits;
+        misses += ctx[ii].misses;
+    }
+
+    cluster_put_u64(&buffer, end > measure_begin ? end - measure_begin : 0);
+    cluster_put_u64(&buffer, hits);
+    cluster_put_u64(&buffer, misses);
+    cluster_put_u32(&buffer, TX_MAX);
+    for (int jj = 0; jj < TX_MAX; ++jj) {
+        uint64_t failures = 0;
+        memset(histogram, 0, sizeof(*histogram));
+        for (int ii = 0; ii < num; ++ii) {
+            histogram_merge(histogram, &ctx[ii].tx[jj]);
+            failures += ctx[ii].failures[jj];
+        }
+        cluster_put_histogram(&buffer, histogram);
+        cluster_put_u64(&buffer, failures);
+    }
+    cluster_put_u32(&buffer, RMW_RETRY_BUCKETS);
+    for (int jj = 0; jj < RMW_RETRY_BUCKETS; ++jj) {
+        uint64_t count = 0;
+        for (int ii = 0; ii < num; ++ii) {
+            count += ctx[ii].rmw_retries[jj];
+        }
+        cluster_put_u64(&buffer, count);
+    }
+    uint64_t lost = 0;
+    memset(histogram, 0, sizeof(*histogram));
+    for (int ii = 0; ii < num; ++ii) {
+        histogram_merge(histogram, &ctx[ii].get_miss);
+        lost += ctx[ii].lost;
+    }
+    cluster_put_histogram(&buffer, histogram);
+    cluster_put_u64(&buffer, lost);
+
+    int ret = cluster_send(coordinator_sock, CLUSTER_RESULT, &buffer) ? 0 : -1;
+    cluster_buffer_destroy(&buffer);
+    free(histogram);
+    return ret;
+}
+
+static int run_test(const struct run_options *opts);
+
+/**
+ * Wait for a coordinator, and run the command line it sends us
+ * @param opts the options for the run
+ * @return 0 on success, 1 otherwise
+ */
+static int agent_main(struct run_options *opts) {
+    int sock = cluster_listen(agent_address);
+    if (sock == -1) {
+        return 1;
+    }
+
+    fprintf(stdout, "Waiting for the coordinator on %s\n", agent_address);
+    fflush(stdout);
+    while ((coordinator_sock = accept(sock, NULL, NULL)) == -1 &&
+           errno == EINTR) {
+        /* try again */
+    }
+    close(sock);
+    if (coordinator_sock == -1) {
+        fprintf(stderr, "Failed to accept the coordinator: %s\n",
+                strerror(errno));
+        return 1;
+    }
+
+    struct cluster_buffer buffer = { .data = NULL };
+    enum ClusterMessage type;
+    if (!cluster_receive(coordinator_sock, &type, &buffer) ||
+        type != CLUSTER_CONFIG) {
+        fprintf(stderr, "Didn't get the configuration from the coordinator\n");
+        return 1;
+    }
+
+    agent_index = cluster_get_u32(&buffer);
+    int populate = (int)cluster_get_u32(&buffer);
+    int argc = (int)cluster_get_u32(&buffer);
+    char **argv = calloc(argc + 1, sizeof(char *));
+    if (argv == NULL) {
+        agent_error("Failed to allocate memory");
+        return 1;
+    }
+    for (int ii = 0; ii < argc && !buffer.error; ++ii) {
+        argv[ii] = cluster_get_string(&buffer);
+    }
+    if (buffer.error || argc < 1) {
+        agent_error("Invalid configuration");
+        return 1;
+    }
+    cluster_buffer_destroy(&buffer);
+
+    /* The options point into argv, so we never release it */
+#ifdef __GLIBC__
+    optind = 0;
+#else
+    optind = 1;
+    optreset = 1;
+#endif
+    if (parse_options(argc, argv, opts) != 0) {
+        agent_error("Invalid command line");
+        return 1;
+    }
+    opts->populate = populate;
+    if (opts->loop) {
+        agent_error("The agents can't loop (-l)");
+        return 1;
+    }
+
+    int ret = run_test(opts);
+    if (ret != 0) {
+        agent_error("The test failed");
+    }
+    close(coordinator_sock);
+    return ret;
+}
+
+/**
+ * Run the test on the agents and print the merged result
+ * @param argc argument count
+ * @param argv argument vector (sent to the agents without --agents)
+ * @param opts the options for the run
+ * @return 0 on success, 1 otherwise
+ */
+static int coordinator_main(int argc, char **argv,
+                            const struct run_options *opts) {
+    if (opts->loop) {
+        fprintf(stderr, "The agents can't loop (-l)\n");
+        return 1;
+    }
+
+    char *list = strdup(agent_list);
+    int num = 1;
+    for (const char *ptr = agent_list; *ptr != '\0'; ++ptr) {
+        if (*ptr == ',') {
+            ++num;
+        }
+    }
+    char **agents = calloc(num, sizeof(char *));
+    int *socks = calloc(num, sizeof(int));
+    struct thread_context *merged = calloc(1, sizeof(*merged));
+    struct histogram *histogram = malloc(sizeof(*histogram));
+    if (list == NULL || agents == NULL || socks == NULL || merged == NULL ||
+        histogram == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return 1;
+    }
+
+    num = 0;
+    for (char *ptr = strtok(list, ","); ptr != NULL; ptr = strtok(NULL, ",")) {
+        socks[num] = -1;
+        agents[num++] = ptr;
+    }
+
+    /* Send the command line without our own option */
+    int nargs = 0;
+    for (int ii = 0; ii < argc; ++ii) {
+        if (strcmp(argv[ii], "--agents") == 0) {
+            ++ii;
+        } else if (strncmp(argv[ii], "--agents=", 9) != 0) {
+            ++nargs;
+        }
+    }
+
+    int ret = 0;
+    struct cluster_buffer buffer = { .data = NULL };
+    enum ClusterMessage type;
+    for (int ii = 0; ii < num && ret == 0; ++ii) {
+        if ((socks[ii] = cluster_connect(agents[ii])) == -1) {
+            ret = 1;
+            break;
+        }
+
+        buffer.size = 0;
+        cluster_put_u32(&buffer, (uint32_t)ii);
+        cluster_put_u32(&buffer, ii == 0 ? opts->populate : 0);
+        cluster_put_u32(&buffer, (uint32_t)nargs);
+        for (int jj = 0; jj < argc; ++jj) {
+            if (strcmp(argv[jj], "--agents") == 0) {
+                ++jj;
+            } else if (strncmp(argv[jj], "--agents=", 9) != 0) {
+                cluster_put_string(&buffer, argv[jj]);
+            }
+        }
+        if (!cluster_send(socks[ii], CLUSTER_CONFIG, &buffer)) {
+            ret = 1;
+        }
+    }
+
+    /* The barrier: wait for everyone to be ready before starting any */
+    for (int ii = 0; ii < num && ret == 0; ++ii) {
+        if (!cluster_receive(socks[ii], &type, &buffer)) {
+            ret = 1;
+        } else if (type != CLUSTER_READY) {
+            char *msg = cluster_get_string(&buffer);
+            fprintf(stderr, "Agent %s: %s\n", agents[ii],
+                    msg ? msg : "unknown error");
+            free(msg);
+            ret = 1;
+        }
+    }
+
+    for (int ii = 0; ii < num && ret == 0; ++ii) {
+        if (!cluster_send(socks[ii], CLUSTER_START, NULL)) {
+            ret = 1;
+        }
+    }
+
+    if (ret == 0) {
+        fprintf(stdout, "Started %d agents\n", num);
+        fflush(stdout);
+    }
+
+    uint64_t ops = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    double throughput = 0;
+    double update_rate = 0;
+    for (int ii = 0; ii < num && ret == 0; ++ii) {
+        if (!cluster_receive(socks[ii], &type, &buffer)) {
+            ret = 1;
+            break;
+        } else if (type != CLUSTER_RESULT) {
+            char *msg = cluster_get_string(&buffer);
+            fprintf(stderr, "Agent %s: %s\n", agents[ii],
+                    msg ? msg : "unknown error");
+            free(msg);
+            ret = 1;
+            break;
+        }
+
+        hrtime_t elapsed = cluster_get_u64(&buffer);
+        hits += cluster_get_u64(&buffer);
+        misses += cluster_get_u64(&buffer);
+        uint32_t ntx = cluster_get_u32(&buffer);
+        uint64_t agent_ops = 0;
+        for (uint32_t jj = 0; jj < ntx && ret == 0; ++jj) {
+            bool valid = cluster_get_histogram(&buffer, histogram);
+            uint64_t failures = cluster_get_u64(&buffer);
+            if (!valid || buffer.error) {
+                fprintf(stderr, "Agent %s: Invalid result\n", agents[ii]);
+                ret = 1;
+            } else if (jj < TX_MAX) {
+                histogram_merge(&merged->tx[jj], histogram);
+                merged->failures[jj] += failures;
+                agent_ops += histogram->count;
+            }
+        }
+        uint32_t nretry = cluster_get_u32(&buffer);
+        uint64_t updates = 0;
+        for (uint32_t jj = 0; jj < nretry && ret == 0; ++jj) {
+            uint64_t count = cluster_get_u64(&buffer);
+            if (buffer.error) {
+                fprintf(stderr, "Agent %s: Invalid result\n", agents[ii]);
+                ret = 1;
+            } else {
+                /* The last bucket counts everything above */
+                int bucket = jj < RMW_RETRY_BUCKETS ? (int)jj : RMW_RETRY_BUCKETS - 1;
+                merged->rmw_retries[bucket] += count;
+                updates += count;
+            }
+        }
+        if (ret == 0) {
+            bool valid = cluster_get_histogram(&buffer, histogram);
+            uint64_t lost = cluster_get_u64(&buffer);
+            if (!valid || buffer.error) {
+                fprintf(stderr, "Agent %s: Invalid result\n", agents[ii]);
+                ret = 1;
+            } else {
+                histogram_merge(&merged->get_miss, histogram);
+                merged->lost += lost;
+                agent_ops += histogram->count;
+            }
+        }
+        ops += agent_ops;
+        if (elapsed > 0) {
+            throughput += agent_ops / (elapsed / 1000000000.0);
+            update_rate += updates / (elapsed / 1000000000.0);
+        }
+    }
+
+    if (ret == 0) {
+        fprintf(stdout, "Aggregate of %d agents: %"PRIu64" ops, %.0f ops/s",
+                num, ops, throughput);
+        if (hits + misses > 0) {
+            fprintf(stdout, ", %.2f%% get hits",
+                    hits * 100.0 / (hits + misses));
+        }
+        if (update_rate > 0) {
+            fprintf(stdout, ", %.0f updates/s", update_rate);
+        }
+        fprintf(stdout, "\n\nAverage with %d agents\n", num);
+        print_metrics(merged);
+    }
+
+    for (int ii = 0; ii < num; ++ii) {
+        if (socks[ii] != -1) {
+            close(socks[ii]);
+        }
+    }
+    cluster_buffer_destroy(&buffer);
+    free(histogram);
+    free(merged);
+    free(socks);
+    free(agents);
+    free(list);
+    return ret;
+}
+
+/**
+ * Make sure the library supports all of the operations in the mix
+ * @return true if it does
+ */
+static bool check_opmix(struct client_group *group) {
+    const struct opmix *mix = &group->config.opmix;
+
+    group->expect_dataset = true;
+    for (int ii = 0; ii < mix->num; ++ii) {
+        enum TxnType op = mix->ops[ii];
+        bool supported = true;
+
+        switch (group->config.library) {
+#ifdef HAVE_LIBMEMCACHED
+        case LIBMEMCACHED_TEXTUAL:
+        case LIBMEMCACHED_BINARY:
+            supported = op != TX_GAT;
+#if !defined(LIBMEMCACHED_VERSION_HEX) || LIBMEMCACHED_VERSION_HEX < 0x01000000
+            supported = supported && op != TX_TOUCH;
+#endif
+            break;
+#endif
+#ifdef HAVE_LIBCOUCHBASE
+        case LIBCOUCHBASE:
+            supported = op == TX_GET || op == TX_SET;
+            break;
+#endif
+        default:
+            break;
+        }
+
+        if (!supported) {
+            if (no_groups > 1) {
+                fprintf(stderr, "Group %s: ", group->config.name);
+            }
+            fprintf(stderr, "The library doesn't support %s\n", txn_name(op));
+            return false;
+        }
+
+        if (op == TX_GET && mget_batch > 1) {
+#ifdef HAVE_LIBMEMCACHED
+            supported = group->config.library == LIBMEMCACHED_TEXTUAL ||
+                group->config.library == LIBMEMCACHED_BINARY;
+#else
+            supported = false;
+#endif
+            if (!supported) {
+                if (no_groups > 1) {
+                    fprintf(stderr, "Group %s: ", group->config.name);
+                }
+                fprintf(stderr, "Only libmemcached can batch the gets\n");
+                return false;
+            }
+        }
+        /* The virtual clients can't get the cas value, or reset a
+         * counter that doesn't hold a number */
+        if ((op == TX_RMW || op == TX_CAS || op == TX_INCR ||
+             op == TX_DECR) && no_vclients > 0) {
+            fprintf(stderr, "The virtual clients don't support %s\n",
+                    txn_name(op));
+            return false;
+        }
+
+        if (op == TX_DELETE || op == TX_APPEND || op == TX_PREPEND ||
+            op == TX_INCR || op == TX_DECR) {
+            group->expect_dataset = false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Create the client groups from the scenario file, or a single group
+ * from the command line
+ * @param no_threads the number of threads (without a scenario file)
+ * @return the total number of threads in the groups, -1 on error
+ */
+static int create_groups(int no_threads) {
+    struct scenario_group defaults = {
+        .threads = no_threads,
+        .library = current_memcached_library,
+        .opmix = opmix,
+        .prefix = (char*)prefix,
+        .items = no_items,
+        .keydist = keydist,
+        .sizedist = sizedist,
+        .min_size = datablock.min_size,
+        .max_size = datablock.size
+    };
+    struct scenario_group *configs;
+
+    if (scenario_file != NULL) {
+        configs = scenario_load(scenario_file, &defaults, &no_groups);
+        if (configs == NULL) {
+            return -1;
+        }
+    } else {
+        configs = malloc(sizeof(*configs));
+        if (configs == NULL) {
+            fprintf(stderr, "Failed to allocate memory\n");
+            return -1;
+        }
+        *configs = defaults;
+        configs->name = strdup("default");
+        configs->prefix = strdup(prefix);
+        no_groups = 1;
+    }
+
+    groups = calloc(no_groups, sizeof(*groups));
+    if (groups == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        free(configs);
+        return -1;
+    }
+
+    int total = 0;
+    for (int ii = 0; ii < no_groups; ++ii) {
+        struct client_group *group = &groups[ii];
+        group->config = configs[ii];
+        group->keygen = keygen;
+        group->datablock.min_size = group->config.min_size;
+        group->datablock.size = group->config.max_size;
+        group->first_thread = total;
+        group->pool_size = connection_pool_size;
+        if (group->pool_size < (size_t)group->config.threads) {
+            group->pool_size = group->config.threads;
+        }
+        total += group->config.threads;
+    }
+    free(configs);
+
+    return total;
+}
+
+/**
+ * Check the settings of the groups and build their keys, dataset and
+ * connections
+ * @return 0 on success, -1 otherwise
+ */
+static int initialize_groups(void) {
+    for (int ii = 0; ii < no_groups; ++ii) {
+        struct client_group *group = &groups[ii];
+        if (group->config.library < LIBMEMC_TEXTUAL ||
+            group->config.library >= INVALID_LIBRARY) {
+            fprintf(stderr, "Group %s: Invalid library %d\n",
+                    group->config.name, group->config.library);
+            return -1;
+        }
+        if (!check_opmix(group)) {
+            return -1;
+        }
+        if (!keydist_init(&group->config.keydist, group->config.items)) {
+            fprintf(stderr, "Failed to initialize the key distribution\n");
+            return -1;
+        }
+        group->universe = group->config.items;
+        if (drift_mode != DRIFT_NONE) {
+            group->universe = key_universe ? key_universe :
+                (uint64_t)group->config.items * 10;
+            if (group->universe < (uint64_t)group->config.items) {
+                fprintf(stderr, "Group %s: The key universe is smaller "
+                        "than the %ld items\n", group->config.name,
+                        group->config.items);
+                return -1;
+            }
+        }
+        if (!keygen_init(&group->keygen, group->config.prefix,
+                         group->universe)) {
+            return -1;
+        }
+        if (verify_data && agent_address == NULL) {
+            /* The agents share the keys, but not the versions */
+            group->versions = calloc(group->universe,
+                                     sizeof(struct key_version));
+            if (group->versions == NULL) {
+                fprintf(stderr, "Failed to allocate memory for the "
+                        "versions\n");
+                return -1;
+            }
+        }
+        if (initialize_dataset(group) == -1 ||
+            create_connection_pool(group) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void destroy_groups(void) {
+    for (int ii = 0; ii < no_groups; ++ii) {
+        destroy_connection_pool(&groups[ii]);
+        keygen_destroy(&groups[ii].keygen);
+        free(groups[ii].dataset);
+        free(groups[ii].versions);
+        free(groups[ii].datablock.data);
+        scenario_destroy(&groups[ii].config);
+    }
+    free(groups);
+    groups = NULL;
+    no_groups = 0;
+    free(stampede.refilled);
+    stampede.refilled = NULL;
+    free(stampede.hot);
+    stampede.hot = NULL;
+}
+
+/**
+ * Find the group a thread belongs to
+ * @param thread the thread number
+ */
+static struct client_group *thread_group(int thread) {
+    int ii = 0;
+    while (ii + 1 < no_groups && thread >= groups[ii + 1].first_thread) {
+        ++ii;
+    }
+    return &groups[ii];
+}
+
+/**
+ * Print the metrics of each of the client groups
+ * @param ctx the thread contexts
+ * @param end when the threads finished
+ */
+static void print_group_metrics(struct thread_context *ctx, hrtime_t end) {
+    for (int ii = 0; ii < no_groups; ++ii) {
+        struct client_group *group = &groups[ii];
+        struct thread_context *first = &ctx[group->first_thread];
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+
+        for (int jj = 0; jj < group->config.threads; ++jj) {
+            hits += first[jj].hits;
+            misses += first[jj].misses;
+        }
+
+        fprintf(stdout, "Group %s: %d threads, library %d",
+                group->config.name, group->config.threads,
+                group->config.library);
+        if (hits + misses > 0) {
+            fprintf(stdout, ", %.2f%% get hits",
+                    hits * 100.0 / (hits + misses));
+        }
+        fprintf(stdout, "\n");
+        if (timed_run && end != 0) {
+            print_measured_window(first, group->config.threads, end);
+        }
+        print_aggregated_metrics(first, group->config.threads);
+    }
+}
+
+/**
+ * Run the threads once and print the result
+ * @param no_threads the number of threads to run
+ * @param point where to store the result of a sweep point (may be NULL)
+ * @return 0 on success, -1 otherwise
+ */
+static int run_once(int no_threads, struct sweep_point *point) {
+    pthread_t *threads = calloc(sizeof(pthread_t), no_threads);
+    struct thread_context *ctx = calloc(sizeof(struct thread_context), no_threads);
+    struct trace_stream *streams = NULL;
+    hrtime_t begin = 0;
+    hrtime_t finished = 0;
+    int ii;
+
+    if (record_file != NULL) {
+        streams = calloc(no_threads, sizeof(struct trace_stream));
+        if (streams == NULL) {
+            fprintf(stderr, "Failed to allocate memory\n");
+            free(threads);
+            free(ctx);
+            return -1;
+        }
+    }
+
+    if (no_iterations > 0 || trace != NULL || run_duration > 0 ||
+        slo_latency > 0) {
+        int perThread = no_iterations / no_threads;
+        int rest = no_iterations % no_threads;
+        if (stampede.expire > 0 && arm_stampede() != 0) {
+            free(streams);
+            free(threads);
+            free(ctx);
+            return -1;
+        }
+        begin = gethrtime();
+
+        measure_begin = begin + (hrtime_t)(warmup * 1000000000);
+        if (steady_state > 0 || slo_latency > 0) {
+            measure_begin = HRTIME_MAX;
+        }
+        run_end = HRTIME_MAX;
+        if (run_duration > 0 && steady_state == 0 && slo_latency == 0) {
+            run_end = measure_begin + (hrtime_t)(run_duration * 1000000000);
+        }
+        running_threads = no_threads;
+        drift_begin = begin;
+        search_rate = 0;
+
+        for (ii = 0; ii < no_threads; ++ii) {
+            struct thread_context *ctxi = &ctx[ii];
+            size_t total = (rest > 0) ? perThread + 1 : perThread;
+            if (trace != NULL) {
+                total = 0;
+                for (uint32_t jj = ii; jj < trace->header->no_streams;
+                     jj += no_threads) {
+                    total += trace->streams[jj].no_records;
+                }
+            }
+
+            if (!initialize_thread_ctx(ctxi, 0, total)) {
+                abort();
             }
-            break;
-        case 'F': use_fixed_block_size = 1;
-            break;
-        case 'h': add_host(optarg);
-            break;
-        case 'i': no_items = atoi(optarg);
-            break;
-        case 's': srand(atoi(optarg));
-            break;
-        case 'c': no_iterations = atoll(optarg);
-            break;
-        case 'V': verify_data = 1;
-            break;
-        case 'l': loop = 1;
-            break;
-        case 'S': populate = 0;
-            break;
-        case 'v': verbose = 1;
-            break;
-        case 'W': connection_pool_size = atoi(optarg);
-            break;
-        case 'Q': thread_bind_connection = 1;
-            break;
-        case 'm':
-            {
-                size = atoi(optarg);
-                if (size > 1024 * 1024) {
-                    fprintf(stderr, "WARNING: Too big block size %d\n", size);
-                } else {
-                    datablock.min_size = size;
-                }
+            ctxi->id = ii;
+            ctxi->no_threads = no_threads;
+            ctxi->measuring = !timed_run;
+            rng_seed(&ctxi->rng, seed, next_stream++);
+            ctxi->group = thread_group(ii);
+            assign_connections(ctxi, ii - ctxi->group->first_thread,
+                               ctxi->group->config.threads);
+            if (streams != NULL) {
+                ctxi->record = &streams[ii];
             }
-            break;
-        case 'C':
-#ifndef HAVE_LIBVBUCKET
-            fprintf(stderr, "You need to rebuild memcachetest with libvbucket\n");
-            return 1;
-#else
-            if (!initialize_vbuckets(optarg)) {
-                return -1;
+
+            if (rest > 0) {
+                --rest;
+            }
+            void *(*thread_main)(void *) = test_thread_main;
+            if (trace != NULL) {
+                thread_main = replay_thread_main;
+            } else if (no_vclients > 0) {
+                thread_main = vclient_thread_main;
+            }
+#ifdef HAVE_LIBCOUCHBASE
+            if (lcb_window > 0 &&
+                ctxi->group->config.library == LIBCOUCHBASE) {
+                thread_main = lcb_thread_main;
             }
 #endif
+            pthread_create(&threads[ii], 0, thread_main, &ctx[ii]);
+        }
+
+        pthread_t reporter_thread;
+        struct progress_reporter reporter = {
+            .ctx = ctx, .num = no_threads, .begin = begin
+        };
+        if (progress) {
+            pthread_create(&reporter_thread, 0, progress_thread_main,
+                           &reporter);
+        }
+        bool collecting = stats_collector.interval > 0 &&
+            stats_collector_start(&stats_collector, begin);
+
+        if (steady_state > 0) {
+            detect_steady_state(ctx, no_threads, begin);
+        } else if (slo_latency > 0) {
+            search_capacity(ctx, no_threads);
+        }
+
+        for (ii = 0; ii < no_threads; ++ii) {
+            void *ret;
+            pthread_join(threads[ii], &ret);
+            assert(ret == (void*)&ctx[ii]);
+            if (verbose) {
+                fprintf(stdout, "Details from thread %d\n", ii);
+                print_metrics(&ctx[ii]);
+            }
+        }
+        finished = gethrtime();
+        if (progress) {
+            pthread_join(reporter_thread, NULL);
+        }
+        if (collecting) {
+            stats_collector_stop(&stats_collector);
+        }
+    }
+
+    if (streams != NULL) {
+        (void)trace_write(record_file, streams, no_threads);
+        for (ii = 0; ii < no_threads; ++ii) {
+            trace_stream_destroy(&streams[ii]);
+        }
+        free(streams);
+    }
+
+    if (timed_run && finished != 0) {
+        print_measured_window(ctx, no_threads, finished);
+    }
+    if (finished != 0) {
+        print_update_rate(ctx, no_threads, finished);
+    }
+    if (finished != 0 && stampede.expire > 0) {
+        print_stampede(ctx, no_threads, finished);
+    }
+    fprintf(stdout, "Average with %d threads\n", no_threads);
+    print_aggregated_metrics(ctx, no_threads);
+    if (no_groups > 1) {
+        print_group_metrics(ctx, finished);
+    }
+    if (!thread_bind_connection) {
+        print_lock_wait(ctx, no_threads);
+    }
+    if (coordinator_sock != -1 && finished != 0 &&
+        agent_send_result(ctx, no_threads, finished) != 0) {
+        fprintf(stderr, "Failed to send the result to the coordinator\n");
+    }
+    if (point != NULL && finished != 0) {
+        fill_sweep_point(ctx, no_threads, begin, finished, point);
+    }
+    for (ii = 0; ii < no_threads; ++ii) {
+        free(ctx[ii].value);
+    }
+    free(threads);
+    free(ctx);
+    return 0;
+}
+
+/**
+ * Run every point of the sweep with the group from the command line. The
+ * data is only loaded again when the max size changes, and the
+ * connections are only created again when the library changes.
+ * @return 0 on success, -1 otherwise
+ */
+static int run_sweep(const struct run_options *opts) {
+    struct client_group *group = &groups[0];
+    int num = sweep_points(&sweep);
+    struct sweep_point *points = calloc(num, sizeof(*points));
+    const long defaults[SWEEP_PARAMS] = {
+        [SWEEP_THREADS] = group->config.threads,
+        [SWEEP_MAX_SIZE] = (long)group->datablock.size,
+        [SWEEP_SETPRC] = setprc,
+        [SWEEP_LIBRARY] = group->config.library
+    };
+
+    if (points == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return -1;
+    }
+
+    int ret = 0;
+    for (int ii = 0; ii < num && ret == 0; ++ii) {
+        struct sweep_point *point = &points[ii];
+        sweep_point(&sweep, ii, defaults, point);
+        const long *params = point->params;
+
+        fprintf(stdout, "Sweep point %d of %d: %ld threads, max size %ld, "
+                "%ld%% sets, library %ld\n", ii + 1, num,
+                params[SWEEP_THREADS], params[SWEEP_MAX_SIZE],
+                params[SWEEP_SETPRC], params[SWEEP_LIBRARY]);
+        fflush(stdout);
+
+        if (params[SWEEP_MAX_SIZE] != (long)group->datablock.size) {
+            group->config.max_size = (size_t)params[SWEEP_MAX_SIZE];
+            group->datablock.size = group->config.max_size;
+            if (initialize_dataset(group) != 0 ||
+                (opts->populate &&
+                 bulk_load(group, (int)params[SWEEP_THREADS]) != 0)) {
+                ret = -1;
+                break;
+            }
+        }
+        if (params[SWEEP_LIBRARY] != group->config.library) {
+            destroy_connection_pool(group);
+            group->config.library = (int)params[SWEEP_LIBRARY];
+            if (create_connection_pool(group) != 0) {
+                fprintf(stderr, "Failed to create the connections\n");
+                ret = -1;
+                break;
+            }
+        }
+        group->config.threads = (int)params[SWEEP_THREADS];
+        /* A mix from -O stays (run_test doesn't let the sweep change
+         * the sets with it) */
+        if (!opmix_given) {
+            opmix_init(&group->config.opmix, (int)params[SWEEP_SETPRC]);
+        }
+        /* The library may have changed, and expect_dataset follows the
+         * mix */
+        if (!check_opmix(group)) {
+            ret = -1;
             break;
-        default:
-            fprintf(stderr, "Usage: test [-h host[:port]] [-t #threads]");
-            fprintf(stderr, " [-T] [-i #items] [-c #iterations]\n");
-            fprintf(stderr, "            [-v] [-V] [-f dir] [-s seed] [-W size] [-C vbucketconfig]\n");
-            fprintf(stderr, "\t-h The hostname:port where the memcached server is running\n");
-            fprintf(stderr, "\t   (use mulitple -h args for multiple servers)\n");
-            fprintf(stderr, "\t-t The number of threads to use\n");
-            fprintf(stderr, "\t-i The number of items to operate with\n");
-            fprintf(stderr, "\t-c The number of iteratons each thread should do\n");
-            fprintf(stderr, "\t-l Loop and repeat the test, but print out information for each run\n");
-            fprintf(stderr, "\t-m The minimum object size to use during testing\n");
-            fprintf(stderr, "\t-M The maximum object size to use during testing\n");
-            fprintf(stderr, "\t-F Use fixed message size, specified by -M\n");
-            fprintf(stderr, "\t-V Verify the retrieved data\n");
-            fprintf(stderr, "\t-v Verbose output\n");
-            fprintf(stderr, "\t-L Use the specified memcached client library\n");
-            fprintf(stderr, "\t-W connection pool size\n");
-            fprintf(stderr, "\t-s Use the specified seed to initialize the random generator\n");
-            fprintf(stderr, "\t-S Skip the populate of the data\n");
-            fprintf(stderr, "\t-P The probability for a set operation\n");
-            fprintf(stderr, "\t   (default: 33 meaning set 33%% of the time)\n");
-            fprintf(stderr, "\t-K specify a prefix that is added to all of the keys\n");
-            fprintf(stderr, "\t-C Read vbucket data from host:port specified\n");
-            fprintf(stderr, "\nVersion: %s\n\n", VERSION);
+        }
+
+        ret = run_once(group->config.threads, point);
+        fprintf(stdout, "\n");
+    }
+
+    if (ret == 0 && !sweep_write(sweep_output, points, num)) {
+        ret = -1;
+    }
+    free(points);
+    return ret;
+}
+
+/**
+ * Run the test
+ * @param opts the options for the run
+ * @return 0 on success, 1 otherwise
+ */
+static int run_test(const struct run_options *opts) {
+    int no_threads = opts->no_threads;
+    struct rusage rusage;
+    struct server_usage server_start;
+    struct timeval starttime = {.tv_sec = 0};
+    gettimeofday(&starttime, NULL);
+
+    timed_run = run_duration > 0 || warmup > 0 || steady_state > 0 ||
+        slo_latency > 0;
+
+    if (no_vclients > 0) {
+        if (trace != NULL) {
+            fprintf(stderr, "Virtual clients can't replay a trace\n");
+            return 1;
+        }
+        if (no_vclients < no_threads) {
+            no_threads = no_vclients;
+        }
+    }
+
+    if (drift_mode != DRIFT_NONE) {
+        if (trace != NULL || no_vclients > 0) {
+            fprintf(stderr, "The window can't drift with a trace or "
+                    "virtual clients\n");
+            return 1;
+        }
+        /* The point is to watch the hit ratio and latency over time */
+        progress = 1;
+        refill = true;
+    }
+
+    if (stampede.expire > 0) {
+        refill = true;
+    }
+    if (slo_latency > 0 && (trace != NULL || no_vclients > 0 ||
+                            steady_state > 0)) {
+        fprintf(stderr, "The search can't be combined with a trace, virtual "
+                "clients or the steady state detection\n");
+        return 1;
+    }
+
+#ifdef HAVE_LIBCOUCHBASE
+    if (lcb_window > 0 && (trace != NULL || no_vclients > 0 ||
+                           slo_latency > 0 || refill)) {
+        fprintf(stderr, "The asynchronous libcouchbase driver can't be "
+                "combined with a trace, virtual clients, a search or "
+                "refills\n");
+        return 1;
+    }
+#endif
+
+    if (mget_batch > 1 && (trace != NULL || no_vclients > 0)) {
+        fprintf(stderr, "Only the test threads can batch the gets\n");
+        return 1;
+    }
+
+    if (verify_data && no_vclients > 0) {
+        fprintf(stderr, "Only the test threads can verify the data\n");
+        return 1;
+    }
+
+    if (refill && (trace != NULL || no_vclients > 0)) {
+        fprintf(stderr, "Only the test threads can set the missing items "
+                "again\n");
+        return 1;
+    }
+
+    if (scenario_file != NULL && (trace != NULL || no_vclients > 0 ||
+                                  checkpoint_file != NULL)) {
+        fprintf(stderr, "A scenario can't be combined with a trace, "
+                "virtual clients or a checkpoint\n");
+        return 1;
+    }
+
+    if (sweep_points(&sweep) > 1) {
+        if (scenario_file != NULL || trace != NULL || no_vclients > 0 ||
+            slo_latency > 0 || coordinator_sock != -1 ||
+            (opmix_given && sweep.values[SWEEP_SETPRC] != NULL)) {
+            fprintf(stderr, "A sweep can't be combined with a scenario, a "
+                    "trace, virtual clients, a search, agents or a mix\n");
             return 1;
         }
+
+        /* Start with the first point, and make room for the most threads */
+        const long defaults[SWEEP_PARAMS] = {
+            [SWEEP_THREADS] = no_threads,
+            [SWEEP_MAX_SIZE] = (long)datablock.size,
+            [SWEEP_SETPRC] = setprc,
+            [SWEEP_LIBRARY] = current_memcached_library
+        };
+        struct sweep_point first;
+        sweep_point(&sweep, 0, defaults, &first);
+        no_threads = (int)first.params[SWEEP_THREADS];
+        datablock.size = (size_t)first.params[SWEEP_MAX_SIZE];
+        setprc = (int)first.params[SWEEP_SETPRC];
+        current_memcached_library = (int)first.params[SWEEP_LIBRARY];
+        for (int ii = 0; ii < sweep.num[SWEEP_THREADS]; ++ii) {
+            if ((size_t)sweep.values[SWEEP_THREADS][ii] > connection_pool_size) {
+                connection_pool_size = (size_t)sweep.values[SWEEP_THREADS][ii];
+            }
+        }
+        for (int ii = 0; ii < sweep.num[SWEEP_MAX_SIZE]; ++ii) {
+            if ((size_t)sweep.values[SWEEP_MAX_SIZE][ii] < datablock.min_size) {
+                fprintf(stderr, "The max size in the sweep is below the "
+                        "min size\n");
+                return 1;
+            }
+        }
+        for (int ii = 0; ii < sweep.num[SWEEP_LIBRARY]; ++ii) {
+            if (sweep.values[SWEEP_LIBRARY][ii] >= INVALID_LIBRARY) {
+                fprintf(stderr, "Invalid library %ld in the sweep\n",
+                        sweep.values[SWEEP_LIBRARY][ii]);
+                return 1;
+            }
+        }
     }
 
-    if (connection_pool_size < (size_t)no_threads) {
-        connection_pool_size = no_threads;
+    if (!opmix_given) {
+        opmix_init(&opmix, setprc);
+    }
+    if ((no_threads = create_groups(no_threads)) == -1) {
+        return 1;
     }
 
     {
-        size_t maxthreads = no_threads;
+        size_t maxthreads = 0;
         struct rlimit rlim;
 
-        if (maxthreads < connection_pool_size) {
-            maxthreads = connection_pool_size;
+        for (int ii = 0; ii < no_groups; ++ii) {
+            maxthreads += groups[ii].pool_size;
         }
+        maxthreads += no_vclients + load_threads * no_groups;
 
         if (getrlimit(RLIMIT_NOFILE, &rlim) == 0) {
             if (rlim.rlim_cur < (maxthreads + 10)) {
@@ -1045,63 +5644,79 @@ int main(int argc, char **argv) {
         add_host("localhost");
     }
 
-    if (initialize_dataset() == -1) {
+    if (trace != NULL && trace->header->no_streams < (uint32_t)no_threads) {
+        fprintf(stderr, "WARNING: The trace only contains %u streams\n",
+                trace->header->no_streams);
+    }
+
+    if (initialize_groups() == -1) {
         return 1;
     }
 
-    if (create_connection_pool() == -1) {
+    /* The sweep switches the library between the points */
+    for (int ii = 0; ii < sweep.num[SWEEP_LIBRARY]; ++ii) {
+        int library = groups[0].config.library;
+        groups[0].config.library = (int)sweep.values[SWEEP_LIBRARY][ii];
+        bool supported = check_opmix(&groups[0]);
+        groups[0].config.library = library;
+        if (!supported) {
+            fprintf(stderr, "Invalid library %ld in the sweep\n",
+                    sweep.values[SWEEP_LIBRARY][ii]);
+            return 1;
+        }
+    }
+
+    for (int ii = 0; ii < no_groups && stampede.expire > 0; ++ii) {
+        if (groups[ii].config.items < hot_keys) {
+            fprintf(stderr, "Group %s: There are more hot keys than items\n",
+                    groups[ii].config.name);
+            return 1;
+        }
+    }
+
+    if (no_vclients > 0 && initialize_vclients() == -1) {
         return 1;
     }
 
-    if (populate && populate_data(no_threads) != 0) {
+    if (stats_collector.interval > 0 && initialize_stats_collector() == -1) {
         return 1;
     }
 
-    if (get_server_rusage(hosts, &server_start) == -1) {
-        fprintf(stderr, "Failed to get server stats\n");
+    for (int ii = 0; ii < no_groups && opts->populate; ++ii) {
+        if (bulk_load(&groups[ii], groups[ii].config.threads) != 0) {
+            return 1;
+        }
     }
 
+    if (memory_report >= 0) {
+        print_memory_report();
+    }
 
-    size_t nget = 0;
-    size_t nset = populate ? no_items : 0;
-    do {
-        pthread_t *threads = calloc(sizeof(pthread_t), no_threads);
-        struct thread_context *ctx = calloc(sizeof(struct thread_context), no_threads);
-        int ii;
-
-        if (no_iterations > 0) {
-            int perThread = no_iterations / no_threads;
-            int rest = no_iterations % no_threads;
-
-            for (ii = 0; ii < no_threads; ++ii) {
-                struct thread_context *ctxi = &ctx[ii];
-                if (!initialize_thread_ctx(ctxi, 0,
-                                           (rest > 0) ? perThread + 1 : perThread)) {
-                    abort();
-                }
+    if (get_server_usage(&server_start) == -1) {
+        fprintf(stderr, "Failed to get server stats\n");
+    }
 
-                if (rest > 0) {
-                    --rest;
-                }
-                pthread_create(&threads[ii], 0, test_thread_main, &ctx[ii]);
-            }
 
-            for (ii = 0; ii < no_threads; ++ii) {
-                void *ret;
-                pthread_join(threads[ii], &ret);
-                assert(ret == (void*)&ctx[ii]);
-                if (verbose) {
-                    fprintf(stdout, "Details from thread %d\n", ii);
-                    print_metrics(&ctx[ii]);
-                }
-            }
-        }
+    if (coordinator_sock != -1 && agent_wait_for_start() != 0) {
+        return 1;
+    }
 
-        fprintf(stdout, "Average with %d threads\n", no_threads);
-        print_aggregated_metrics(ctx, no_threads);
-        free(threads);
-        free(ctx);
-    } while (loop);
+    size_t nget = 0;
+    size_t nset = 0;
+    for (int ii = 0; ii < no_groups && opts->populate; ++ii) {
+        nset += groups[ii].config.items;
+    }
+    if (sweep_points(&sweep) > 1) {
+        if (run_sweep(opts) != 0) {
+            return 1;
+        }
+    } else {
+        do {
+            if (run_once(no_threads, NULL) != 0) {
+                return 1;
+            }
+        } while (opts->loop);
+    }
 
     if (getrusage(RUSAGE_SELF, &rusage) == -1) {
         fprintf(stderr, "Failed to get resource usage: %s\n",
@@ -1124,23 +5739,54 @@ int main(int argc, char **argv) {
                                                       sizeof(buffer)));
         }
 
-        if (get_server_rusage(hosts, &rusage) != -1) {
-            rusage.ru_utime.tv_sec -= server_start.ru_utime.tv_sec;
-            rusage.ru_utime.tv_usec = 0;
-            rusage.ru_stime.tv_sec -= server_start.ru_stime.tv_sec;
-            rusage.ru_stime.tv_usec = 0;
+        struct server_usage usage;
+        if (get_server_usage(&usage) != -1) {
+            double user = usage.user - server_start.user;
+            double sys = usage.system - server_start.system;
+            double ops = usage.ops - server_start.ops;
+            char buffer[128];
 
             fprintf(stdout, "Server time:\n");
-            fprintf(stdout, "Usr: %s\n", timeval2text(&rusage.ru_utime,
-                                                      buffer, sizeof(buffer)));
-            fprintf(stdout, "Sys: %s\n", timeval2text(&rusage.ru_stime,
-                                                      buffer, sizeof(buffer)));
+            fprintf(stdout, "Usr: %s\n", seconds2text(user, buffer,
+                                                     sizeof(buffer)));
+            fprintf(stdout, "Sys: %s\n", seconds2text(sys, buffer,
+                                                     sizeof(buffer)));
+            if (ops > 0) {
+                fprintf(stdout, "Per op: %.1f us\n",
+                        (user + sys) * 1000000 / ops);
+            }
         }
     }
 
     fprintf(stdout,"Total gets: %zu\n", nget);
     fprintf(stdout,"Total sets: %zu\n", nset);
-    destroy_connection_pool();
+    destroy_groups();
+    sizedist_destroy(&sizedist);
+    sweep_destroy(&sweep);
+    stats_collector_destroy(&stats_collector);
+    trace_close(trace);
 
     return 0;
 }
+
+/**
+ * Program entry point
+ * @param argc argument count
+ * @param argv argument vector
+ * @return 0 on success, 1 otherwise
+ */
+int main(int argc, char **argv) {
+    struct run_options opts = { .no_threads = 1, .populate = 1, .loop = 0 };
+
+    if (parse_options(argc, argv, &opts) != 0) {
+        return 1;
+    }
+
+    if (agent_address != NULL) {
+        return agent_main(&opts);
+    } else if (agent_list != NULL) {
+        return coordinator_main(argc, argv, &opts);
+    }
+
+    return run_test(&opts);
+}
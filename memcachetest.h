@@ -33,23 +33,73 @@
 
 #include <stdbool.h>
 #include "metrics.h"
+#include "keygen.h"
+#include "rng.h"
 
 #ifdef	__cplusplus
 extern "C" {
 #endif
 
-    struct samples {
-        int current;
-        hrtime_t *set;
-    };
+    struct connection;
+    struct trace_stream;
 
     /**
      * A struct for the info on the thread
      */
+    struct client_group;
+
     struct thread_context {
+        /** The client group the thread belongs to */
+        struct client_group *group;
+        /** The thread number */
+        int id;
+        /** The total number of threads in the run */
+        int no_threads;
         int offset;
         size_t total;
-        struct samples tx[TX_CAS - TX_GET];
+        struct histogram tx[TX_MAX];
+        /** The latency of the gets that didn't find the item */
+        struct histogram get_miss;
+        /** The latency of the gets during a stampede (see --stampede) */
+        struct histogram storm;
+        /**
+         * The number of operations the server answered with not found,
+         * not stored or an error (per operation, in the measured window)
+         */
+        uint64_t failures[TX_MAX];
+        /** The number of retries the read-modify-write transactions needed */
+        uint64_t rmw_retries[RMW_RETRY_BUCKETS];
+        /** Set when the samples count (outside the warmup) */
+        bool measuring;
+        /**
+         * All operations in all phases (read by the steady state
+         * detector and the progress reporter while the thread runs)
+         */
+        struct histogram progress;
+        /** The number of gets that found / didn't find the item */
+        uint64_t hits;
+        uint64_t misses;
+        /**
+         * The misses on items that should have been in the dataset (in
+         * the measured window)
+         */
+        uint64_t lost;
+        struct rng rng;
+        /** The connections owned by this thread (shared-nothing mode) */
+        struct connection *connections;
+        size_t no_connections;
+        size_t next_connection;
+        /** The number of times we had to wait for a pooled connection */
+        uint64_t lock_waits;
+        /** The total time spent waiting for a pooled connection */
+        hrtime_t lock_wait_time;
+        /** Buffer for keys that don't live in the key arena */
+        char key[KEYGEN_MAX_KEY + 1];
+        /** Where the values are built when we verify them (see -V) */
+        void *value;
+        /** Where to record the operations (see -R) */
+        struct trace_stream *record;
+        hrtime_t last_op;
         /* struct report thr_summary; */
     };
 
@@ -33,6 +33,7 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <inttypes.h>
 #include <string.h>
 #include "metrics.h"
 #include "memcachetest.h"
@@ -42,83 +43,220 @@ bool initialize_thread_ctx(struct thread_context *ctx, int offset, size_t total)
     ctx->offset = offset;
     ctx->total = total;
 
-    for (int ii = 0; ii < TX_CAS - TX_GET; ++ii) {
-        ctx->tx[ii].set = calloc(ctx->total, sizeof(hrtime_t));
-        if (ctx->tx[ii].set == NULL) {
-            for (int jj = 0; jj < ii; ++jj) {
-                free(ctx->tx[jj].set);
-            }
-            return false;
-        }
+    for (int ii = 0; ii < TX_MAX; ++ii) {
+        memset(&ctx->tx[ii], 0, sizeof(ctx->tx[ii]));
+        ctx->failures[ii] = 0;
     }
+    memset(ctx->rmw_retries, 0, sizeof(ctx->rmw_retries));
+    memset(&ctx->progress, 0, sizeof(ctx->progress));
 
     return true;
 }
 
 /**
- * A comparison-function used by qsort.
- * @param p1 element 1 to compare
- * @param p2 element 2 to compare
- * @return -1, 0 or 1
+ * Map a value to its bucket in the histogram
+ * @param value the value to map
+ * @return the bucket index
  */
-static int compare(const void *p1, const void *p2)
+static int histogram_index(hrtime_t value)
 {
-   hrtime_t a = *((hrtime_t *)p1);
-   hrtime_t b = *((hrtime_t *)p2);
+    if (value < (1 << HISTOGRAM_SUB_BITS)) {
+        return (int)value;
+    }
 
-   if (a < b) {
-      return -1;
-   } else if (a > b) {
-      return 1;
-   } else {
-      return 0;
-   }
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - HISTOGRAM_SUB_BITS;
+    return ((shift + 1) << HISTOGRAM_SUB_BITS) +
+        (int)((value >> shift) - (1 << HISTOGRAM_SUB_BITS));
 }
 
 /**
- * External interface
+ * Get the value in the middle of a bucket
+ * @param idx the bucket index
+ * @return the value the bucket represents
  */
-void record_tx(enum TxnType tx_type, hrtime_t time, struct thread_context *ctx) {
-    assert(tx_type >= 0 && tx_type < (TX_CAS - TX_GET));
-    ctx->tx[tx_type].set[ctx->tx[tx_type].current++] = time;
+static hrtime_t histogram_value(int idx)
+{
+    if (idx < (1 << HISTOGRAM_SUB_BITS)) {
+        return idx;
+    }
+
+    int shift = (idx >> HISTOGRAM_SUB_BITS) - 1;
+    hrtime_t sub = idx & ((1 << HISTOGRAM_SUB_BITS) - 1);
+    hrtime_t lower = ((1 << HISTOGRAM_SUB_BITS) + sub) << shift;
+    return lower + (((hrtime_t)1 << shift) - 1) / 2;
 }
 
-struct ResultMetrics *calc_metrics(enum TxnType tx_type,
-                                   struct thread_context *ctx)
+void histogram_record(struct histogram *histogram, hrtime_t value)
 {
-    struct ResultMetrics *ret = calloc(1, sizeof(*ret));
-    if (ret == NULL) {
+    /*
+     * Only the owning thread updates the histogram, but the progress
+     * reporter may read it at any time so the stores must be atomic
+     */
+    if (histogram->count == 0 || value < histogram->min) {
+        __atomic_store_n(&histogram->min, value, __ATOMIC_RELAXED);
+    }
+    if (value > histogram->max) {
+        __atomic_store_n(&histogram->max, value, __ATOMIC_RELAXED);
+    }
+    uint64_t *bucket = &histogram->buckets[histogram_index(value)];
+    __atomic_store_n(bucket, *bucket + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&histogram->total, histogram->total + value,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&histogram->count, histogram->count + 1,
+                     __ATOMIC_RELAXED);
+}
+
+void histogram_merge(struct histogram *dest, const struct histogram *src)
+{
+    uint64_t count = __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    if (count == 0) {
+        return;
+    }
+
+    hrtime_t min = __atomic_load_n(&src->min, __ATOMIC_RELAXED);
+    hrtime_t max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+    if (dest->count == 0 || min < dest->min) {
+        dest->min = min;
+    }
+    if (max > dest->max) {
+        dest->max = max;
+    }
+    dest->total += __atomic_load_n(&src->total, __ATOMIC_RELAXED);
+    dest->count += count;
+    for (int ii = 0; ii < HISTOGRAM_BUCKETS; ++ii) {
+        dest->buckets[ii] += __atomic_load_n(&src->buckets[ii],
+                                             __ATOMIC_RELAXED);
+    }
+}
+
+void histogram_delta(struct histogram *dest, const struct histogram *newer,
+                     const struct histogram *older)
+{
+    /* We don't know the extremes of the interval */
+    dest->min = 0;
+    dest->max = newer->max;
+    dest->total = newer->total - older->total;
+    dest->count = 0;
+    for (int ii = 0; ii < HISTOGRAM_BUCKETS; ++ii) {
+        /* The buckets may have been read before the counter was */
+        uint64_t delta = 0;
+        if (newer->buckets[ii] > older->buckets[ii]) {
+            delta = newer->buckets[ii] - older->buckets[ii];
+        }
+        dest->buckets[ii] = delta;
+        dest->count += delta;
+    }
+}
+
+hrtime_t histogram_percentile(const struct histogram *histogram,
+                              double percentile)
+{
+    if (histogram->count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(percentile / 100.0 * histogram->count + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (int ii = 0; ii < HISTOGRAM_BUCKETS; ++ii) {
+        seen += histogram->buckets[ii];
+        if (seen >= rank) {
+            hrtime_t value = histogram_value(ii);
+            if (value < histogram->min) {
+                return histogram->min;
+            } else if (value > histogram->max) {
+                return histogram->max;
+            }
+            return value;
+        }
+    }
+
+    return histogram->max;
+}
+
+/**
+ * External interface
+ */
+const char *txn_name(int tx_type) {
+    static const char * const names[] = {
+        [TX_GET] = "get", [TX_SET] = "set", [TX_ADD] = "add",
+        [TX_REPLACE] = "replace", [TX_APPEND] = "append",
+        [TX_PREPEND] = "prepend", [TX_CAS] = "cas", [TX_DELETE] = "delete",
+        [TX_INCR] = "incr", [TX_DECR] = "decr", [TX_TOUCH] = "touch",
+        [TX_GAT] = "gat", [TX_RMW] = "rmw"
+    };
+
+    if (tx_type < 0 || tx_type >= TX_MAX) {
         return NULL;
     }
-    struct samples *sample = &ctx->tx[tx_type];
-    if (sample->current == 0) {
-        return ret;
+    return names[tx_type];
+}
+
+void record_tx(enum TxnType tx_type, hrtime_t time, struct thread_context *ctx) {
+    assert(tx_type >= 0 && tx_type < TX_MAX);
+    histogram_record(&ctx->progress, time);
+    if (ctx->measuring) {
+        histogram_record(&ctx->tx[tx_type], time);
     }
+}
 
-    // sort the result
-    qsort(sample->set, sample->current, sizeof(hrtime_t), compare);
+void record_miss(hrtime_t time, struct thread_context *ctx) {
+    histogram_record(&ctx->progress, time);
+    if (ctx->measuring) {
+        histogram_record(&ctx->get_miss, time);
+    }
+    __atomic_store_n(&ctx->misses, ctx->misses + 1, __ATOMIC_RELAXED);
+}
 
-    ret->success_count = sample->current ;
-    long percentile90 = (0.9) * (float) (ret->success_count - 1) + 1.0;
-    long percentile95 = (0.95) * (float) (ret->success_count - 1) + 1.0;
-    long percentile99 = (0.99) * (float) (ret->success_count - 1) + 1.0;
+void record_failure(enum TxnType tx_type, struct thread_context *ctx) {
+    assert(tx_type >= 0 && tx_type < TX_MAX);
+    if (ctx->measuring) {
+        ++ctx->failures[tx_type];
+    }
+}
 
-    ret->max90th_result = sample->set[percentile90];
-    ret->max95th_result = sample->set[percentile95];
-    ret->max99th_result = sample->set[percentile99];
-    ret->min_result = sample->set[0];
-    ret->max_result = sample->set[sample->current - 1];
+void record_rmw_retries(int retries, struct thread_context *ctx) {
+    if (retries >= RMW_RETRY_BUCKETS) {
+        retries = RMW_RETRY_BUCKETS - 1;
+    }
+    if (ctx->measuring) {
+        ++ctx->rmw_retries[retries];
+    }
+}
 
-    hrtime_t total = 0;
-    for (int ii = 0; ii < sample->current; ++ii) {
-        total += sample->set[ii];
+static struct ResultMetrics *calc_histogram_metrics(const struct histogram *histogram,
+                                                    long errors)
+{
+    struct ResultMetrics *ret = calloc(1, sizeof(*ret));
+    if (ret == NULL) {
+        return NULL;
+    }
+    ret->error_count = errors;
+    if (histogram->count == 0) {
+        return ret;
     }
 
-    ret->average = total / sample->current;
+    ret->success_count = histogram->count;
+    ret->max90th_result = histogram_percentile(histogram, 90.0);
+    ret->max95th_result = histogram_percentile(histogram, 95.0);
+    ret->max99th_result = histogram_percentile(histogram, 99.0);
+    ret->min_result = histogram->min;
+    ret->max_result = histogram->max;
+    ret->average = histogram->total / histogram->count;
 
     return ret;
 }
 
+struct ResultMetrics *calc_metrics(enum TxnType tx_type,
+                                   struct thread_context *ctx)
+{
+    return calc_histogram_metrics(&ctx->tx[tx_type], ctx->failures[tx_type]);
+}
+
 /**
  * Convert a time (in ns) to a human readable form...
  * @param time the time in nanoseconds
@@ -143,17 +281,22 @@ static const char* hrtime2text(hrtime_t t, char *buffer, size_t size) {
     return buffer;
 }
 
-static void print_details(enum TxnType tx_type, struct ResultMetrics *r) {
-    static const char * txt[] = { [TX_GET] = "Get",
-                                   [TX_SET] = "Set",
-                                   [TX_ADD] = "Add",
-                                   [TX_REPLACE] = "Replace",
-                                   [TX_APPEND] = "Append",
-                                   [TX_PREPEND] = "Prepend",
-                                   [TX_CAS] = "Cas" };
+static const char * const txn_labels[] = { [TX_GET] = "Get",
+                                           [TX_SET] = "Set",
+                                           [TX_ADD] = "Add",
+                                           [TX_REPLACE] = "Replace",
+                                           [TX_APPEND] = "Append",
+                                           [TX_PREPEND] = "Prepend",
+                                           [TX_CAS] = "Cas",
+                                           [TX_DELETE] = "Delete",
+                                           [TX_INCR] = "Incr",
+                                           [TX_DECR] = "Decr",
+                                           [TX_TOUCH] = "Touch",
+                                           [TX_GAT] = "Gat",
+                                           [TX_RMW] = "Read-modify-write" };
 
-
-    printf("%s operations:\n", txt[tx_type]);
+static void print_details(const char *label, struct ResultMetrics *r) {
+    printf("%s operations:\n", label);
     char tavg[80];
     char tmin[80];
     char tmax[80];
@@ -168,38 +311,78 @@ static void print_details(enum TxnType tx_type, struct ResultMetrics *r) {
            hrtime2text(r->max90th_result, tmax90, sizeof(tmax90)),
            hrtime2text(r->max95th_result, tmax95, sizeof(tmax95)),
            hrtime2text(r->max99th_result, tmax99, sizeof(tmax99)));
+    if (r->error_count > 0) {
+        printf("%13ld not found, not stored or failed\n\n", r->error_count);
+    }
+}
+
+static void print_rmw_retries(struct thread_context *ctx) {
+    uint64_t total = 0;
+    for (int ii = 0; ii < RMW_RETRY_BUCKETS; ++ii) {
+        total += ctx->rmw_retries[ii];
+    }
+    if (total == 0) {
+        return;
+    }
+
+    printf("Read-modify-write retries:\n");
+    printf("      retries   #of txns  percent\n");
+    for (int ii = 0; ii < RMW_RETRY_BUCKETS; ++ii) {
+        if (ctx->rmw_retries[ii] > 0) {
+            char retries[16];
+            snprintf(retries, sizeof(retries), "%d%s", ii,
+                     ii == RMW_RETRY_BUCKETS - 1 ? "+" : "");
+            printf("%13s%11"PRIu64"%8.2f%%\n", retries, ctx->rmw_retries[ii],
+                   ctx->rmw_retries[ii] * 100.0 / total);
+        }
+    }
+    printf("\n");
 }
 
 void print_metrics(struct thread_context *ctx) {
-    for (int ii = 0; ii < TX_CAS - TX_GET; ++ii) {
-        if (ctx->tx[ii].current > 0) {
+    for (int ii = 0; ii < TX_MAX; ++ii) {
+        if (ctx->tx[ii].count > 0 || ctx->failures[ii] > 0) {
             struct ResultMetrics *r = calc_metrics(ii, ctx);
             if (r) {
-                print_details(ii, r);
+                print_details(txn_labels[ii], r);
                 free(r);
             }
         }
     }
+    if (ctx->get_miss.count > 0) {
+        struct ResultMetrics *r = calc_histogram_metrics(&ctx->get_miss, 0);
+        if (r) {
+            print_details("Get miss", r);
+            free(r);
+        }
+        if (ctx->lost > 0) {
+            printf("%13"PRIu64" of the misses were items in the dataset\n\n",
+                   ctx->lost);
+        }
+    }
+    print_rmw_retries(ctx);
 }
 
 void print_aggregated_metrics(struct thread_context *ctx, int num)
 {
-    int total = 0;
-    for (int ii = 0; ii < num; ++ii) {
-        total += ctx[ii].total;
+    struct thread_context *context = calloc(1, sizeof(*context));
+    if (context == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return;
     }
 
-    struct thread_context context;
-    memset(&context, 0, sizeof(context));
-    initialize_thread_ctx(&context, 0, total);
-
     for (int ii = 0; ii < num; ++ii) {
-        for (int jj = 0; jj < TX_CAS - TX_GET; ++jj) {
-            memcpy(context.tx[jj].set + context.tx[jj].current,
-                   ctx[ii].tx[jj].set, ctx[ii].tx[jj].current * sizeof(hrtime_t));
-            context.tx[jj].current += ctx[ii].tx[jj].current;
+        for (int jj = 0; jj < TX_MAX; ++jj) {
+            histogram_merge(&context->tx[jj], &ctx[ii].tx[jj]);
+            context->failures[jj] += ctx[ii].failures[jj];
+        }
+        for (int jj = 0; jj < RMW_RETRY_BUCKETS; ++jj) {
+            context->rmw_retries[jj] += ctx[ii].rmw_retries[jj];
         }
+        histogram_merge(&context->get_miss, &ctx[ii].get_miss);
+        context->lost += ctx[ii].lost;
     }
 
-    print_metrics(&context);
+    print_metrics(context);
+    free(context);
 }
@@ -32,11 +32,51 @@
 extern "C" {
 #endif
 
+/* The values are stored in the traces, so only add to the end */
 enum TxnType { TX_GET, TX_SET, TX_ADD, TX_REPLACE,
-               TX_APPEND, TX_PREPEND, TX_CAS };
+               TX_APPEND, TX_PREPEND, TX_CAS, TX_DELETE,
+               TX_INCR, TX_DECR, TX_TOUCH, TX_GAT, TX_RMW, TX_MAX };
+
+/** The (lowercase) name of the operation, NULL if it isn't valid */
+const char *txn_name(int tx_type);
+
+/**
+ * The read-modify-write retry distribution has a bucket per number of
+ * retries, and the last bucket counts everything above
+ */
+#define RMW_RETRY_BUCKETS 16
+
+/**
+ * The histograms are log-linear: every power of two is split into
+ * 2^HISTOGRAM_SUB_BITS linear buckets, so the relative error of a
+ * recorded value is below 1/2^HISTOGRAM_SUB_BITS no matter how long
+ * the test runs.
+ */
+#define HISTOGRAM_SUB_BITS 6
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+struct histogram {
+    uint64_t count;
+    hrtime_t min;
+    hrtime_t max;
+    hrtime_t total;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+void histogram_record(struct histogram *, hrtime_t);
+void histogram_merge(struct histogram *dest, const struct histogram *src);
+void histogram_delta(struct histogram *dest, const struct histogram *newer,
+                     const struct histogram *older);
+hrtime_t histogram_percentile(const struct histogram *, double percentile);
 
 struct thread_context;
 void record_tx(enum TxnType, hrtime_t, struct thread_context *);
+/** Record a get that didn't find the item */
+void record_miss(hrtime_t, struct thread_context *);
+/** Count an operation that didn't succeed (in the measured window) */
+void record_failure(enum TxnType, struct thread_context *);
+/** Count a read-modify-write transaction that needed the retries */
+void record_rmw_retries(int retries, struct thread_context *);
 struct ResultMetrics *calc_metrics(enum TxnType tx_type,
                                    struct thread_context *);
 void print_metrics(struct thread_context *);
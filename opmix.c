@@ -0,0 +1,106 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "opmix.h"
+
+static bool add_op(struct opmix *mix, enum TxnType op, uint32_t weight) {
+    if (opmix_contains(mix, op)) {
+        fprintf(stderr, "%s is specified more than once\n", txn_name(op));
+        return false;
+    }
+
+    if (weight > 0) {
+        uint32_t total = mix->num > 0 ? mix->cumulative[mix->num - 1] : 0;
+        mix->ops[mix->num] = op;
+        mix->cumulative[mix->num] = total + weight;
+        ++mix->num;
+    }
+    return true;
+}
+
+bool opmix_parse(struct opmix *mix, const char *spec) {
+    const char *ptr = spec;
+
+    memset(mix, 0, sizeof(*mix));
+    while (*ptr != '\0') {
+        size_t len = strcspn(ptr, "=");
+        int op = 0;
+        while (op < TX_MAX && (strlen(txn_name(op)) != len ||
+                               strncmp(ptr, txn_name(op), len) != 0)) {
+            ++op;
+        }
+
+        char *end = NULL;
+        unsigned long weight = 0;
+        if (op < TX_MAX && ptr[len] == '=') {
+            weight = strtoul(ptr + len + 1, &end, 10);
+        }
+        if (op == TX_MAX || ptr[len] != '=' || end == ptr + len + 1 ||
+            (*end != ',' && *end != '\0') || weight > 1000000) {
+            fprintf(stderr, "Invalid operation mix: %s\n", spec);
+            return false;
+        }
+
+        if (!add_op(mix, (enum TxnType)op, (uint32_t)weight)) {
+            return false;
+        }
+        ptr = *end == ',' ? end + 1 : end;
+    }
+
+    if (mix->num == 0) {
+        fprintf(stderr, "The operation mix doesn't contain any operations\n");
+        return false;
+    }
+    return true;
+}
+
+void opmix_init(struct opmix *mix, int setprc) {
+    memset(mix, 0, sizeof(*mix));
+    /* Sets first so we draw the same numbers as -P always did */
+    (void)add_op(mix, TX_SET, (uint32_t)setprc);
+    (void)add_op(mix, TX_GET, (uint32_t)(100 - setprc));
+}
+
+enum TxnType opmix_next(const struct opmix *mix, struct rng *rng) {
+    if (mix->num == 1) {
+        return mix->ops[0];
+    }
+
+    uint32_t val = (uint32_t)rng_range(rng, mix->cumulative[mix->num - 1]);
+    int ii = 0;
+    while (val >= mix->cumulative[ii]) {
+        ++ii;
+    }
+    return mix->ops[ii];
+}
+
+bool opmix_contains(const struct opmix *mix, enum TxnType op) {
+    for (int ii = 0; ii < mix->num; ++ii) {
+        if (mix->ops[ii] == op) {
+            return true;
+        }
+    }
+    return false;
+}
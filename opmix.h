@@ -0,0 +1,70 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#ifndef OPMIX_H
+#define OPMIX_H 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "metrics.h"
+#include "rng.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+    /**
+     * The operations to run and their weights, in the order they were
+     * specified
+     */
+    struct opmix {
+        int num;
+        enum TxnType ops[TX_MAX];
+        /** The running sum of the weights */
+        uint32_t cumulative[TX_MAX];
+    };
+
+    /**
+     * Parse an operation mix: op=weight[,op=weight...] where op is one
+     * of get, set, add, replace, append, prepend, cas, delete, incr,
+     * decr, touch, gat or rmw
+     * @return true on success, false if the spec is invalid
+     */
+    bool opmix_parse(struct opmix *mix, const char *spec);
+
+    /**
+     * Initialize the mix to sets and gets
+     * @param setprc the percentage of sets
+     */
+    void opmix_init(struct opmix *mix, int setprc);
+
+    /**
+     * Pick the next operation (doesn't use the generator if the mix
+     * only contains one operation)
+     */
+    enum TxnType opmix_next(const struct opmix *mix, struct rng *rng);
+
+    bool opmix_contains(const struct opmix *mix, enum TxnType op);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
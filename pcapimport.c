@@ -0,0 +1,1076 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * memcachetest-import reads pcap files with captured memcached traffic
+ * (textual and binary protocol), reassembles the TCP streams and
+ * produces a trace memcachetest can replay (with -T) together with
+ * statistics per key.
+ */
+#include "config.h"
+
+#include <sys/types.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "libmemc.h"
+#include "metrics.h"
+#include "trace.h"
+
+/* The classic pcap file format (we don't support pcapng) */
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAPNG_MAGIC 0x0a0d0d0a
+
+#define DLT_NULL 0
+#define DLT_EN10MB 1
+#define DLT_RAW 101
+#define DLT_LOOP 108
+#define DLT_LINUX_SLL 113
+
+struct pcap_file_header {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct pcap_record_header {
+    uint32_t ts_sec;
+    uint32_t ts_frac;
+    uint32_t incl_len;
+    uint32_t orig_len;
+};
+
+/* Give up waiting for missing data when we've buffered this much */
+#define MAX_OUT_OF_ORDER (1024 * 1024)
+
+/* Don't keep track of more outstanding requests than this per connection */
+#define MAX_PENDING 4096
+
+/**
+ * A segment received out of order
+ */
+struct segment {
+    uint32_t seq;
+    size_t len;
+    struct segment *next;
+    char data[];
+};
+
+/**
+ * One direction of a TCP connection
+ */
+struct direction {
+    bool synced;
+    uint32_t next_seq;
+    char *buffer;
+    size_t len;
+    size_t capacity;
+    struct segment *ooo;
+    size_t ooo_bytes;
+};
+
+struct keystats;
+
+/**
+ * A request we haven't seen the response for
+ */
+struct pending {
+    enum Command command;
+    struct keystats *stats;
+    uint32_t opaque;
+    /** The textual get the key belongs to */
+    uint64_t batch;
+    bool quiet;
+};
+
+/**
+ * A TCP connection (client -> server is dir[0])
+ */
+struct flow {
+    struct flow *next;
+    uint8_t addr[2][16];
+    uint16_t port[2];
+    struct direction dir[2];
+    int stream;
+    uint64_t last_ts;
+    struct pending *pending;
+    size_t head;
+    size_t npending;
+    uint64_t next_batch;
+};
+
+struct keystats {
+    struct keystats *next;
+    uint64_t ops[CMD_OTHER + 1];
+    uint64_t accesses;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t size_total;
+    uint64_t sizes;
+    uint64_t max_size;
+    uint64_t first_ts;
+    uint64_t last_ts;
+    size_t keylen;
+    char key[];
+};
+
+static const char * const command_names[] = {
+    [CMD_GET] = "get", [CMD_SET] = "set", [CMD_ADD] = "add",
+    [CMD_REPLACE] = "replace", [CMD_APPEND] = "append",
+    [CMD_PREPEND] = "prepend", [CMD_CAS] = "cas", [CMD_DELETE] = "delete",
+    [CMD_INCR] = "incr", [CMD_DECR] = "decr", [CMD_TOUCH] = "touch",
+    [CMD_GAT] = "gat", [CMD_NOOP] = "noop", [CMD_OTHER] = "other"
+};
+
+static struct {
+    struct flow **flows;
+    size_t flow_buckets;
+    size_t no_flows;
+
+    struct keystats **keys;
+    size_t key_buckets;
+    size_t no_keys;
+
+    struct trace_stream *streams;
+    int no_streams;
+    int stream_capacity;
+
+    in_port_t port;
+    int verbose;
+    uint64_t start_ts;
+
+    uint64_t packets;
+    uint64_t memcached_packets;
+    uint64_t truncated;
+    uint64_t parse_errors;
+    uint64_t gaps;
+    uint64_t requests[CMD_OTHER + 1];
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t value_bytes;
+    uint64_t values;
+    /** log2 histogram of the time between requests on a connection (us) */
+    uint64_t interarrival[33];
+} importer = { .port = 11211 };
+
+static uint64_t hash_bytes(const void *data, size_t len) {
+    const uint8_t *ptr = data;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t ii = 0; ii < len; ++ii) {
+        hash ^= ptr[ii];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static void *xcalloc(size_t nmemb, size_t size) {
+    void *ret = calloc(nmemb, size);
+    if (ret == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        exit(1);
+    }
+    return ret;
+}
+
+/**
+ * Double the number of buckets in a hash table of chained entries (all
+ * of the entries we chain start with a next pointer)
+ */
+#define GROW_TABLE(table, buckets, type, hashfn)                        \
+    do {                                                                \
+        size_t nbuckets = (buckets) * 2;                                \
+        type **ntable = xcalloc(nbuckets, sizeof(type *));              \
+        for (size_t ii = 0; ii < (buckets); ++ii) {                     \
+            type *entry = (table)[ii];                                  \
+            while (entry != NULL) {                                     \
+                type *next = entry->next;                               \
+                size_t idx = hashfn(entry) & (nbuckets - 1);            \
+                entry->next = ntable[idx];                              \
+                ntable[idx] = entry;                                    \
+                entry = next;                                           \
+            }                                                           \
+        }                                                               \
+        free(table);                                                    \
+        (table) = ntable;                                               \
+        (buckets) = nbuckets;                                           \
+    } while (0)
+
+static uint64_t keystats_hash(const struct keystats *stats) {
+    return hash_bytes(stats->key, stats->keylen);
+}
+
+static struct keystats *get_keystats(const char *key, size_t keylen) {
+    size_t idx = hash_bytes(key, keylen) & (importer.key_buckets - 1);
+    for (struct keystats *ks = importer.keys[idx]; ks != NULL; ks = ks->next) {
+        if (ks->keylen == keylen && memcmp(ks->key, key, keylen) == 0) {
+            return ks;
+        }
+    }
+
+    struct keystats *ks = xcalloc(1, sizeof(*ks) + keylen + 1);
+    memcpy(ks->key, key, keylen);
+    ks->keylen = keylen;
+    ks->next = importer.keys[idx];
+    importer.keys[idx] = ks;
+
+    if (++importer.no_keys > importer.key_buckets) {
+        GROW_TABLE(importer.keys, importer.key_buckets, struct keystats,
+                   keystats_hash);
+    }
+    return ks;
+}
+
+static uint64_t flow_hash(const struct flow *flow) {
+    return hash_bytes(flow->addr, sizeof(flow->addr)) ^
+        hash_bytes(flow->port, sizeof(flow->port));
+}
+
+static int new_stream(void) {
+    if (importer.no_streams == importer.stream_capacity) {
+        int capacity = importer.stream_capacity ? importer.stream_capacity * 2 : 64;
+        struct trace_stream *streams = realloc(importer.streams,
+                                               capacity * sizeof(*streams));
+        if (streams == NULL) {
+            fprintf(stderr, "Failed to allocate memory\n");
+            exit(1);
+        }
+        memset(streams + importer.stream_capacity, 0,
+               (capacity - importer.stream_capacity) * sizeof(*streams));
+        importer.streams = streams;
+        importer.stream_capacity = capacity;
+    }
+    return importer.no_streams++;
+}
+
+/**
+ * Look up the flow for the client address / port talking to the server
+ * address / port (creating it if it doesn't exist)
+ */
+static struct flow *get_flow(const uint8_t *client, uint16_t cport,
+                             const uint8_t *server, uint16_t sport) {
+    struct flow key;
+    memset(&key, 0, sizeof(key));
+    memcpy(key.addr[0], client, 16);
+    memcpy(key.addr[1], server, 16);
+    key.port[0] = cport;
+    key.port[1] = sport;
+
+    size_t idx = flow_hash(&key) & (importer.flow_buckets - 1);
+    for (struct flow *flow = importer.flows[idx]; flow != NULL; flow = flow->next) {
+        if (memcmp(flow->addr, key.addr, sizeof(key.addr)) == 0 &&
+            memcmp(flow->port, key.port, sizeof(key.port)) == 0) {
+            return flow;
+        }
+    }
+
+    struct flow *flow = xcalloc(1, sizeof(*flow));
+    memcpy(flow->addr, key.addr, sizeof(key.addr));
+    memcpy(flow->port, key.port, sizeof(key.port));
+    flow->pending = xcalloc(MAX_PENDING, sizeof(struct pending));
+    flow->stream = -1;
+    flow->next = importer.flows[idx];
+    importer.flows[idx] = flow;
+
+    if (++importer.no_flows > importer.flow_buckets) {
+        GROW_TABLE(importer.flows, importer.flow_buckets, struct flow,
+                   flow_hash);
+    }
+    return flow;
+}
+
+static void push_pending(struct flow *flow, enum Command command,
+                         struct keystats *stats, uint32_t opaque,
+                         uint64_t batch, bool quiet) {
+    if (flow->npending == MAX_PENDING) {
+        /* We lost track of the responses.. drop the oldest */
+        flow->head = (flow->head + 1) % MAX_PENDING;
+        --flow->npending;
+    }
+    struct pending *p = &flow->pending[(flow->head + flow->npending) % MAX_PENDING];
+    p->command = command;
+    p->stats = stats;
+    p->opaque = opaque;
+    p->batch = batch;
+    p->quiet = quiet;
+    ++flow->npending;
+}
+
+static struct pending *pop_pending(struct flow *flow) {
+    if (flow->npending == 0) {
+        return NULL;
+    }
+    struct pending *ret = &flow->pending[flow->head];
+    flow->head = (flow->head + 1) % MAX_PENDING;
+    --flow->npending;
+    return ret;
+}
+
+static void record_get_result(struct keystats *stats, bool hit, size_t size) {
+    if (hit) {
+        ++importer.hits;
+        if (stats != NULL) {
+            ++stats->hits;
+            stats->size_total += size;
+            ++stats->sizes;
+            if (size > stats->max_size) {
+                stats->max_size = size;
+            }
+        }
+        importer.value_bytes += size;
+        ++importer.values;
+    } else {
+        ++importer.misses;
+        if (stats != NULL) {
+            ++stats->misses;
+        }
+    }
+}
+
+/**
+ * Map the command to the operation we store in the trace (-1 if it
+ * can't be replayed)
+ */
+static int command_to_op(enum Command command) {
+    switch (command) {
+    case CMD_GET: return TX_GET;
+    case CMD_SET: return TX_SET;
+    case CMD_ADD: return TX_ADD;
+    case CMD_REPLACE: return TX_REPLACE;
+    case CMD_APPEND: return TX_APPEND;
+    case CMD_PREPEND: return TX_PREPEND;
+    case CMD_CAS: return TX_CAS;
+    case CMD_DELETE: return TX_DELETE;
+    case CMD_INCR: return TX_INCR;
+    case CMD_DECR: return TX_DECR;
+    case CMD_TOUCH: return TX_TOUCH;
+    case CMD_GAT: return TX_GAT;
+    default:
+        return -1;
+    }
+}
+
+static void handle_key(struct flow *flow, const struct Packet *packet,
+                       const char *key, size_t keylen, uint64_t ts,
+                       uint64_t batch) {
+    struct keystats *stats = get_keystats(key, keylen);
+    ++stats->ops[packet->command];
+    if (stats->accesses++ == 0) {
+        stats->first_ts = ts;
+    }
+    stats->last_ts = ts;
+
+    switch (packet->command) {
+    case CMD_SET:
+    case CMD_ADD:
+    case CMD_REPLACE:
+    case CMD_CAS:
+        stats->size_total += packet->size;
+        ++stats->sizes;
+        if (packet->size > stats->max_size) {
+            stats->max_size = packet->size;
+        }
+        importer.value_bytes += packet->size;
+        ++importer.values;
+        break;
+    default:
+        break;
+    }
+
+    int op = command_to_op(packet->command);
+    if (op != -1) {
+        bool first = flow->stream == -1;
+        if (first) {
+            /* The first delta is the offset from the start of the capture */
+            flow->stream = new_stream();
+            flow->last_ts = importer.start_ts;
+        }
+        uint64_t delta = ts - flow->last_ts;
+        if (!first) {
+            int bucket = 0;
+            while (bucket < 32 && (1ULL << bucket) <= delta) {
+                ++bucket;
+            }
+            ++importer.interarrival[bucket];
+        }
+        flow->last_ts = ts;
+        if (!trace_stream_append(&importer.streams[flow->stream],
+                                 delta > UINT32_MAX ? UINT32_MAX : (uint32_t)delta,
+                                 (uint8_t)op, 0, key, keylen,
+                                 (uint32_t)packet->size, packet->exptime)) {
+            fprintf(stderr, "Failed to allocate memory\n");
+            exit(1);
+        }
+    }
+
+    if (!packet->quiet || packet->protocol == Binary) {
+        push_pending(flow, packet->command, stats, packet->opaque, batch,
+                     packet->quiet);
+    }
+}
+
+static void handle_request(struct flow *flow, const struct Packet *packet,
+                           uint64_t ts) {
+    ++importer.requests[packet->command];
+
+    if (packet->command == CMD_OTHER || packet->command == CMD_NOOP) {
+        if (!packet->quiet) {
+            push_pending(flow, packet->command, NULL, packet->opaque, 0, false);
+        }
+        return;
+    }
+
+    if (packet->protocol == Textual &&
+        (packet->command == CMD_GET || packet->command == CMD_GAT)) {
+        /* The textual get may contain multiple keys */
+        uint64_t batch = ++flow->next_batch;
+        const char *ptr = packet->key;
+        const char *end = packet->key + packet->keylen;
+        while (ptr < end) {
+            while (ptr < end && *ptr == ' ') {
+                ++ptr;
+            }
+            const char *start = ptr;
+            while (ptr < end && *ptr != ' ') {
+                ++ptr;
+            }
+            if (ptr > start) {
+                handle_key(flow, packet, start, ptr - start, ts, batch);
+            }
+        }
+        /* The END marker */
+        push_pending(flow, CMD_NOOP, NULL, 0, batch, false);
+    } else {
+        handle_key(flow, packet, packet->key, packet->keylen, ts, 0);
+    }
+}
+
+static void handle_response(struct flow *flow, const struct Packet *packet) {
+    struct pending *p;
+
+    if (packet->protocol == Binary) {
+        /* Quiet commands that succeeded don't send a response */
+        while ((p = pop_pending(flow)) != NULL && p->opaque != packet->opaque) {
+            if (p->quiet && (p->command == CMD_GET || p->command == CMD_GAT)) {
+                record_get_result(p->stats, false, 0);
+            }
+        }
+        if (p != NULL && (p->command == CMD_GET || p->command == CMD_GAT)) {
+            record_get_result(p->stats, packet->status == 0, packet->size);
+        }
+        return;
+    }
+
+    if (packet->command == CMD_GET && !packet->end) {
+        /* VALUE key: the keys before it in the get were misses */
+        while ((p = pop_pending(flow)) != NULL) {
+            if (p->stats != NULL && p->stats->keylen == packet->keylen &&
+                memcmp(p->stats->key, packet->key, packet->keylen) == 0) {
+                record_get_result(p->stats, true, packet->size);
+                break;
+            } else if (p->batch == 0 || p->stats == NULL) {
+                /* not part of a get (or the END marker) */
+                break;
+            }
+            record_get_result(p->stats, false, 0);
+        }
+    } else if (packet->command == CMD_GET) {
+        /* END: the rest of the keys in the get were misses */
+        while ((p = pop_pending(flow)) != NULL && p->stats != NULL &&
+               p->batch != 0) {
+            record_get_result(p->stats, false, 0);
+        }
+    } else {
+        (void)pop_pending(flow);
+    }
+}
+
+/**
+ * Parse as many packets as possible from the reassembled data
+ */
+static void parse_direction(struct flow *flow, int dir, uint64_t ts) {
+    struct direction *d = &flow->dir[dir];
+    size_t offset = 0;
+
+    while (offset < d->len) {
+        struct Packet packet;
+        ssize_t nr;
+        if (dir == 0) {
+            nr = libmemc_parse_request(d->buffer + offset, d->len - offset,
+                                       &packet);
+        } else {
+            nr = libmemc_parse_response(d->buffer + offset, d->len - offset,
+                                        &packet);
+        }
+
+        if (nr == 0) {
+            break;
+        } else if (nr < 0) {
+            /* Resynchronize at the next line */
+            ++importer.parse_errors;
+            const char *eol = memchr(d->buffer + offset, '\n', d->len - offset);
+            offset = eol ? (size_t)(eol - d->buffer) + 1 : d->len;
+            continue;
+        }
+
+        if (dir == 0) {
+            handle_request(flow, &packet, ts);
+        } else {
+            handle_response(flow, &packet);
+        }
+        offset += nr;
+    }
+
+    memmove(d->buffer, d->buffer + offset, d->len - offset);
+    d->len -= offset;
+}
+
+static void append_data(struct direction *d, const char *data, size_t len) {
+    if (d->len + len > d->capacity) {
+        size_t capacity = d->capacity ? d->capacity : 4096;
+        while (capacity < d->len + len) {
+            capacity *= 2;
+        }
+        char *buffer = realloc(d->buffer, capacity);
+        if (buffer == NULL) {
+            fprintf(stderr, "Failed to allocate memory\n");
+            exit(1);
+        }
+        d->buffer = buffer;
+        d->capacity = capacity;
+    }
+    memcpy(d->buffer + d->len, data, len);
+    d->len += len;
+    d->next_seq += (uint32_t)len;
+}
+
+static void clear_direction(struct direction *d) {
+    while (d->ooo != NULL) {
+        struct segment *next = d->ooo->next;
+        free(d->ooo);
+        d->ooo = next;
+    }
+    d->ooo_bytes = 0;
+    d->len = 0;
+}
+
+/**
+ * Add the TCP payload to the reassembly buffer
+ */
+static void reassemble(struct direction *d, uint32_t seq,
+                       const char *data, size_t len) {
+    if (!d->synced) {
+        /* We missed the handshake, start where we are */
+        d->synced = true;
+        d->next_seq = seq;
+    }
+
+    int32_t diff = (int32_t)(seq - d->next_seq);
+    if (diff < 0) {
+        /* retransmission (possibly with some new data) */
+        if ((size_t)-diff >= len) {
+            return;
+        }
+        data += -diff;
+        len -= -diff;
+        diff = 0;
+    }
+
+    if (diff > 0) {
+        struct segment *seg = malloc(sizeof(*seg) + len);
+        if (seg == NULL) {
+            fprintf(stderr, "Failed to allocate memory\n");
+            exit(1);
+        }
+        seg->seq = seq;
+        seg->len = len;
+        memcpy(seg->data, data, len);
+        struct segment **pp = &d->ooo;
+        while (*pp != NULL && (int32_t)((*pp)->seq - seq) < 0) {
+            pp = &(*pp)->next;
+        }
+        seg->next = *pp;
+        *pp = seg;
+        d->ooo_bytes += len;
+
+        if (d->ooo_bytes > MAX_OUT_OF_ORDER) {
+            /* The data is lost.. skip the gap */
+            ++importer.gaps;
+            d->len = 0;
+            d->next_seq = d->ooo->seq;
+        } else {
+            return;
+        }
+    } else {
+        append_data(d, data, len);
+    }
+
+    /* Add the segments that are now in order */
+    while (d->ooo != NULL && (int32_t)(d->ooo->seq - d->next_seq) <= 0) {
+        struct segment *seg = d->ooo;
+        d->ooo = seg->next;
+        d->ooo_bytes -= seg->len;
+        int32_t skip = (int32_t)(d->next_seq - seg->seq);
+        if ((size_t)skip < seg->len) {
+            append_data(d, seg->data + skip, seg->len - skip);
+        }
+        free(seg);
+    }
+}
+
+static void handle_tcp(const uint8_t *src, const uint8_t *dst,
+                       const uint8_t *tcp, size_t len, uint64_t ts) {
+    if (len < 20) {
+        return;
+    }
+
+    uint16_t sport = (tcp[0] << 8) | tcp[1];
+    uint16_t dport = (tcp[2] << 8) | tcp[3];
+    uint32_t seq = ((uint32_t)tcp[4] << 24) | ((uint32_t)tcp[5] << 16) |
+        ((uint32_t)tcp[6] << 8) | tcp[7];
+    size_t hdrlen = (tcp[12] >> 4) * 4;
+    uint8_t flags = tcp[13];
+
+    if (hdrlen < 20 || hdrlen > len) {
+        return;
+    }
+
+    int dir;
+    struct flow *flow;
+    if (dport == importer.port) {
+        dir = 0;
+        flow = get_flow(src, sport, dst, dport);
+    } else if (sport == importer.port) {
+        dir = 1;
+        flow = get_flow(dst, dport, src, sport);
+    } else {
+        return;
+    }
+    ++importer.memcached_packets;
+
+    struct direction *d = &flow->dir[dir];
+    if (flags & 0x02) {
+        /* SYN: a new connection (possibly reusing the addresses) */
+        clear_direction(d);
+        d->synced = true;
+        d->next_seq = seq + 1;
+        if (dir == 0) {
+            flow->stream = -1;
+            flow->head = flow->npending = 0;
+        }
+        return;
+    }
+
+    if (len > hdrlen) {
+        reassemble(d, seq, (const char *)tcp + hdrlen, len - hdrlen);
+        parse_direction(flow, dir, ts);
+    }
+}
+
+static void handle_ip(const uint8_t *data, size_t len, uint64_t ts) {
+    uint8_t src[16];
+    uint8_t dst[16];
+
+    if (len < 1) {
+        return;
+    }
+
+    memset(src, 0, sizeof(src));
+    memset(dst, 0, sizeof(dst));
+    if ((data[0] >> 4) == 4) {
+        if (len < 20) {
+            return;
+        }
+        size_t hdrlen = (data[0] & 0x0f) * 4;
+        size_t total = (data[2] << 8) | data[3];
+        uint16_t frag = ((data[6] << 8) | data[7]) & 0x3fff;
+        if (data[9] != 6 || frag != 0 || hdrlen < 20 || total > len ||
+            hdrlen > total) {
+            /* Not TCP, or fragmented */
+            return;
+        }
+        memcpy(src, data + 12, 4);
+        memcpy(dst, data + 16, 4);
+        handle_tcp(src, dst, data + hdrlen, total - hdrlen, ts);
+    } else if ((data[0] >> 4) == 6) {
+        if (len < 40) {
+            return;
+        }
+        size_t payload = (data[4] << 8) | data[5];
+        if (data[6] != 6 || payload + 40 > len) {
+            /* We don't follow the extension headers */
+            return;
+        }
+        memcpy(src, data + 8, 16);
+        memcpy(dst, data + 24, 16);
+        handle_tcp(src, dst, data + 40, payload, ts);
+    }
+}
+
+static void handle_frame(uint32_t linktype, const uint8_t *data, size_t len,
+                         uint64_t ts) {
+    switch (linktype) {
+    case DLT_EN10MB:
+        {
+            size_t offset = 12;
+            uint16_t type;
+            do {
+                if (len < offset + 2) {
+                    return;
+                }
+                type = (data[offset] << 8) | data[offset + 1];
+                offset += 2;
+                if (type == 0x8100 || type == 0x88a8) {
+                    /* skip the VLAN tag */
+                    offset += 2;
+                }
+            } while (type == 0x8100 || type == 0x88a8);
+            if (type == 0x0800 || type == 0x86dd) {
+                handle_ip(data + offset, len - offset, ts);
+            }
+        }
+        break;
+    case DLT_LINUX_SLL:
+        if (len > 16) {
+            handle_ip(data + 16, len - 16, ts);
+        }
+        break;
+    case DLT_NULL:
+    case DLT_LOOP:
+        if (len > 4) {
+            handle_ip(data + 4, len - 4, ts);
+        }
+        break;
+    case DLT_RAW:
+    default:
+        handle_ip(data, len, ts);
+    }
+}
+
+static uint32_t swap32(uint32_t val) {
+    return ((val & 0xff) << 24) | ((val & 0xff00) << 8) |
+        ((val >> 8) & 0xff00) | (val >> 24);
+}
+
+static int import_pcap(const char *fname) {
+    FILE *fp = fopen(fname, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", fname, strerror(errno));
+        return -1;
+    }
+
+    struct pcap_file_header header;
+    if (fread(&header, sizeof(header), 1, fp) != 1) {
+        fprintf(stderr, "%s: Failed to read the file header\n", fname);
+        fclose(fp);
+        return -1;
+    }
+
+    bool swap = false;
+    bool nsec = false;
+    switch (header.magic) {
+    case PCAP_MAGIC: break;
+    case PCAP_MAGIC_NSEC: nsec = true; break;
+    default:
+        if (swap32(header.magic) == PCAP_MAGIC) {
+            swap = true;
+        } else if (swap32(header.magic) == PCAP_MAGIC_NSEC) {
+            swap = nsec = true;
+        } else {
+            fprintf(stderr, "%s: %s\n", fname,
+                    header.magic == PCAPNG_MAGIC ?
+                    "pcapng isn't supported (convert it with editcap -F pcap)" :
+                    "Not a pcap file");
+            fclose(fp);
+            return -1;
+        }
+    }
+    uint32_t linktype = swap ? swap32(header.linktype) : header.linktype;
+
+    size_t capacity = 65536;
+    uint8_t *data = malloc(capacity);
+    if (data == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        fclose(fp);
+        return -1;
+    }
+
+    struct pcap_record_header rec;
+    while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+        if (swap) {
+            rec.ts_sec = swap32(rec.ts_sec);
+            rec.ts_frac = swap32(rec.ts_frac);
+            rec.incl_len = swap32(rec.incl_len);
+            rec.orig_len = swap32(rec.orig_len);
+        }
+        if (rec.incl_len > capacity) {
+            if (rec.incl_len > 256 * 1024 * 1024) {
+                fprintf(stderr, "%s: Corrupt packet length\n", fname);
+                break;
+            }
+            capacity = rec.incl_len;
+            uint8_t *ndata = realloc(data, capacity);
+            if (ndata == NULL) {
+                fprintf(stderr, "Failed to allocate memory\n");
+                break;
+            }
+            data = ndata;
+        }
+        if (rec.incl_len > 0 && fread(data, rec.incl_len, 1, fp) != 1) {
+            fprintf(stderr, "%s: Truncated file\n", fname);
+            break;
+        }
+
+        uint64_t ts = (uint64_t)rec.ts_sec * 1000000 +
+            (nsec ? rec.ts_frac / 1000 : rec.ts_frac);
+        if (importer.start_ts == 0) {
+            importer.start_ts = ts;
+        }
+        if (ts < importer.start_ts) {
+            ts = importer.start_ts;
+        }
+
+        ++importer.packets;
+        if (rec.incl_len < rec.orig_len) {
+            /* The rest of the TCP stream will look like a gap */
+            ++importer.truncated;
+        }
+        handle_frame(linktype, data, rec.incl_len, ts);
+    }
+
+    free(data);
+    fclose(fp);
+    return 0;
+}
+
+static int compare_keystats(const void *p1, const void *p2) {
+    const struct keystats *a = *(const struct keystats * const *)p1;
+    const struct keystats *b = *(const struct keystats * const *)p2;
+    if (a->accesses > b->accesses) {
+        return -1;
+    } else if (a->accesses < b->accesses) {
+        return 1;
+    }
+    /* Order the ties by key so the output doesn't depend on the hash */
+    size_t len = a->keylen < b->keylen ? a->keylen : b->keylen;
+    int ret = memcmp(a->key, b->key, len);
+    if (ret == 0) {
+        ret = (a->keylen > b->keylen) - (a->keylen < b->keylen);
+    }
+    return ret;
+}
+
+static double mean_interarrival(const struct keystats *ks) {
+    if (ks->accesses < 2) {
+        return 0;
+    }
+    return (double)(ks->last_ts - ks->first_ts) / (ks->accesses - 1);
+}
+
+static void print_key(FILE *fp, const struct keystats *ks, bool csv) {
+    if (csv) {
+        fputc('"', fp);
+        for (size_t ii = 0; ii < ks->keylen; ++ii) {
+            if (ks->key[ii] == '"') {
+                fputc('"', fp);
+            }
+            fputc(ks->key[ii], fp);
+        }
+        fputc('"', fp);
+    } else {
+        fprintf(fp, "%-30.30s", ks->key);
+    }
+}
+
+static int write_keystats(const char *fname, struct keystats **sorted) {
+    FILE *fp = fopen(fname, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to create %s: %s\n", fname, strerror(errno));
+        return -1;
+    }
+
+    fprintf(fp, "key,ops");
+    for (int ii = 0; ii <= CMD_OTHER; ++ii) {
+        fprintf(fp, ",%s", command_names[ii]);
+    }
+    fprintf(fp, ",hits,misses,avg_size,max_size,mean_interarrival_us\n");
+
+    for (size_t ii = 0; ii < importer.no_keys; ++ii) {
+        const struct keystats *ks = sorted[ii];
+        print_key(fp, ks, true);
+        fprintf(fp, ",%llu", (unsigned long long)ks->accesses);
+        for (int jj = 0; jj <= CMD_OTHER; ++jj) {
+            fprintf(fp, ",%llu", (unsigned long long)ks->ops[jj]);
+        }
+        fprintf(fp, ",%llu,%llu,%llu,%llu,%.0f\n",
+                (unsigned long long)ks->hits,
+                (unsigned long long)ks->misses,
+                (unsigned long long)(ks->sizes ? ks->size_total / ks->sizes : 0),
+                (unsigned long long)ks->max_size,
+                mean_interarrival(ks));
+    }
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Failed to write %s: %s\n", fname, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static void print_summary(struct keystats **sorted) {
+    uint64_t total = 0;
+    for (int ii = 0; ii <= CMD_OTHER; ++ii) {
+        total += importer.requests[ii];
+    }
+
+    printf("Packets:      %llu (%llu memcached, %llu truncated)\n",
+           (unsigned long long)importer.packets,
+           (unsigned long long)importer.memcached_packets,
+           (unsigned long long)importer.truncated);
+    printf("Connections:  %d\n", importer.no_streams);
+    printf("Parse errors: %llu (%llu gaps in the TCP streams)\n",
+           (unsigned long long)importer.parse_errors,
+           (unsigned long long)importer.gaps);
+    printf("Requests:     %llu\n", (unsigned long long)total);
+    for (int ii = 0; ii <= CMD_OTHER; ++ii) {
+        if (importer.requests[ii] > 0) {
+            printf("   %-10s %12llu %6.2f%%\n", command_names[ii],
+                   (unsigned long long)importer.requests[ii],
+                   importer.requests[ii] * 100.0 / total);
+        }
+    }
+    if (importer.hits + importer.misses > 0) {
+        printf("Get hit ratio: %.2f%% (%llu hits, %llu misses)\n",
+               importer.hits * 100.0 / (importer.hits + importer.misses),
+               (unsigned long long)importer.hits,
+               (unsigned long long)importer.misses);
+    }
+    if (importer.values > 0) {
+        printf("Average value size: %llu bytes\n",
+               (unsigned long long)(importer.value_bytes / importer.values));
+    }
+
+    printf("Time between requests on a connection:\n");
+    for (int ii = 0; ii < 33; ++ii) {
+        if (importer.interarrival[ii] > 0) {
+            printf("   < %10llu us %12llu\n", 1ULL << ii,
+                   (unsigned long long)importer.interarrival[ii]);
+        }
+    }
+
+    printf("Unique keys:  %zu\n", importer.no_keys);
+    if (importer.no_keys > 0) {
+        printf("Most used keys:\n");
+        printf("   %-30s %10s %10s %10s %8s %12s\n", "key", "ops", "gets",
+               "sets", "avg size", "interarrival");
+        for (size_t ii = 0; ii < importer.no_keys && ii < 10; ++ii) {
+            const struct keystats *ks = sorted[ii];
+            printf("   ");
+            print_key(stdout, ks, false);
+            printf(" %10llu %10llu %10llu %8llu %9.0f us\n",
+                   (unsigned long long)ks->accesses,
+                   (unsigned long long)ks->ops[CMD_GET],
+                   (unsigned long long)ks->ops[CMD_SET],
+                   (unsigned long long)(ks->sizes ? ks->size_total / ks->sizes : 0),
+                   mean_interarrival(ks));
+        }
+    }
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: memcachetest-import [-p port] [-o trace] [-k keystats] file...\n");
+    fprintf(stderr, "\t-p The port memcached was listening on (default: 11211)\n");
+    fprintf(stderr, "\t-o Write a trace that may be replayed with memcachetest -T\n");
+    fprintf(stderr, "\t   (one stream per TCP connection)\n");
+    fprintf(stderr, "\t-k Write the statistics for each key to the file (CSV)\n");
+    fprintf(stderr, "\nVersion: %s\n\n", VERSION);
+}
+
+int main(int argc, char **argv) {
+    const char *tracefile = NULL;
+    const char *keyfile = NULL;
+    int cmd;
+
+    while ((cmd = getopt(argc, argv, "p:o:k:")) != EOF) {
+        switch (cmd) {
+        case 'p':
+            importer.port = (in_port_t)atoi(optarg);
+            break;
+        case 'o':
+            tracefile = optarg;
+            break;
+        case 'k':
+            keyfile = optarg;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if (optind == argc) {
+        usage();
+        return 1;
+    }
+
+    importer.flow_buckets = 1024;
+    importer.flows = xcalloc(importer.flow_buckets, sizeof(struct flow *));
+    importer.key_buckets = 65536;
+    importer.keys = xcalloc(importer.key_buckets, sizeof(struct keystats *));
+
+    for (int ii = optind; ii < argc; ++ii) {
+        if (import_pcap(argv[ii]) != 0) {
+            return 1;
+        }
+    }
+
+    struct keystats **sorted = xcalloc(importer.no_keys + 1,
+                                       sizeof(struct keystats *));
+    size_t num = 0;
+    for (size_t ii = 0; ii < importer.key_buckets; ++ii) {
+        for (struct keystats *ks = importer.keys[ii]; ks != NULL; ks = ks->next) {
+            sorted[num++] = ks;
+        }
+    }
+    qsort(sorted, num, sizeof(struct keystats *), compare_keystats);
+
+    print_summary(sorted);
+
+    int ret = 0;
+    if (tracefile != NULL &&
+        trace_write(tracefile, importer.streams, importer.no_streams) != 0) {
+        ret = 1;
+    }
+    if (keyfile != NULL && write_keystats(keyfile, sorted) != 0) {
+        ret = 1;
+    }
+
+    free(sorted);
+    return ret;
+}
@@ -0,0 +1,95 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#ifndef RNG_H
+#define RNG_H 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+    /**
+     * A xoshiro256** pseudo random generator. Each thread owns its own
+     * instance so that we don't serialize on the lock inside random()
+     */
+    struct rng {
+        uint64_t s[4];
+        /** Spare variate from box_muller */
+        double spare;
+        bool has_spare;
+    };
+
+    /**
+     * Seed the generator. Every stream is a non-overlapping subsequence
+     * of the sequence given by the seed, so running with the same seed
+     * gives each thread the same numbers every time.
+     * @param rng the generator to initialize
+     * @param seed the seed (see -s)
+     * @param stream the stream number (typically the thread number)
+     */
+    void rng_seed(struct rng *rng, uint64_t seed, uint64_t stream);
+
+    static inline uint64_t rng_rotl(const uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    /**
+     * Get the next 64 bit random number
+     */
+    static inline uint64_t rng_next(struct rng *rng) {
+        uint64_t *s = rng->s;
+        const uint64_t result = rng_rotl(s[1] * 5, 7) * 9;
+        const uint64_t t = s[1] << 17;
+
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rng_rotl(s[3], 45);
+
+        return result;
+    }
+
+    /**
+     * Get a uniformly distributed number in the range [0, 1)
+     */
+    static inline double rng_double(struct rng *rng) {
+        return (double)(rng_next(rng) >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    /**
+     * Get a uniformly distributed number in the range [0, max)
+     */
+    static inline uint64_t rng_range(struct rng *rng, uint64_t max) {
+#ifdef __SIZEOF_INT128__
+        return (uint64_t)(((unsigned __int128)rng_next(rng) * max) >> 64);
+#else
+        return rng_next(rng) % max;
+#endif
+    }
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
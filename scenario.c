@@ -0,0 +1,212 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scenario.h"
+
+/**
+ * Apply a setting to the group
+ * @return true on success, false if the setting or value is invalid
+ */
+static bool apply_setting(struct scenario_group *group, const char *name,
+                          const char *value) {
+    char *end;
+
+    if (strcmp(name, "threads") == 0) {
+        group->threads = (int)strtol(value, &end, 10);
+        return *end == '\0' && group->threads > 0;
+    } else if (strcmp(name, "library") == 0) {
+        group->library = (int)strtol(value, &end, 10);
+        return *end == '\0';
+    } else if (strcmp(name, "mix") == 0) {
+        return opmix_parse(&group->opmix, value);
+    } else if (strcmp(name, "prefix") == 0) {
+        free(group->prefix);
+        return (group->prefix = strdup(value)) != NULL;
+    } else if (strcmp(name, "items") == 0) {
+        group->items = strtol(value, &end, 10);
+        return *end == '\0' && group->items > 0;
+    } else if (strcmp(name, "distribution") == 0) {
+        return keydist_parse(&group->keydist, value);
+    } else if (strcmp(name, "sizes") == 0) {
+        if (!group->own_sizedist) {
+            /* The copy shares the arrays with the command line */
+            memset(&group->sizedist, 0, sizeof(group->sizedist));
+            group->own_sizedist = true;
+        }
+        if (strcmp(value, "fixed") == 0) {
+            sizedist_destroy(&group->sizedist);
+            group->sizedist.type = SD_FIXED;
+            return true;
+        }
+        return sizedist_parse(&group->sizedist, value);
+    } else if (strcmp(name, "min-size") == 0) {
+        group->min_size = strtoul(value, &end, 10);
+        return *end == '\0';
+    } else if (strcmp(name, "max-size") == 0) {
+        group->max_size = strtoul(value, &end, 10);
+        return *end == '\0' && group->max_size > 0 &&
+            group->max_size <= 1024 * 1024 * 20;
+    } else if (strcmp(name, "rate") == 0) {
+        group->rate = strtod(value, &end);
+        return *end == '\0' && group->rate >= 0;
+    }
+
+    return false;
+}
+
+/**
+ * Add a group with the default settings
+ * @return the new group or NULL if we failed to allocate memory
+ */
+static struct scenario_group *add_group(struct scenario_group **groups,
+                                        int *num, const char *name,
+                                        const struct scenario_group *defaults) {
+    struct scenario_group *ptr = realloc(*groups, (*num + 1) * sizeof(*ptr));
+    if (ptr == NULL) {
+        return NULL;
+    }
+    *groups = ptr;
+
+    struct scenario_group *group = &ptr[*num];
+    *group = *defaults;
+    group->own_sizedist = false;
+    group->name = strdup(name);
+    /* Keep the keys of the groups apart */
+    const char *prefix = defaults->prefix ? defaults->prefix : "";
+    group->prefix = malloc(strlen(prefix) + strlen(name) + 2);
+    if (group->prefix != NULL) {
+        sprintf(group->prefix, "%s%s:", prefix, name);
+    }
+    ++*num;
+
+    if (group->name == NULL || group->prefix == NULL) {
+        return NULL;
+    }
+    return group;
+}
+
+struct scenario_group *scenario_load(const char *fname,
+                                     const struct scenario_group *defaults,
+                                     int *num) {
+    FILE *fp = fopen(fname, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open %s\n", fname);
+        return NULL;
+    }
+
+    struct scenario_group *groups = NULL;
+    struct scenario_group *group = NULL;
+    char line[1024];
+    int lineno = 0;
+    bool error = false;
+
+    *num = 0;
+    while (!error && fgets(line, sizeof(line), fp) != NULL) {
+        ++lineno;
+        char *ptr = line;
+        while (*ptr == ' ' || *ptr == '\t') {
+            ++ptr;
+        }
+        size_t len = strlen(ptr);
+        while (len > 0 && strchr(" \t\r\n", ptr[len - 1]) != NULL) {
+            ptr[--len] = '\0';
+        }
+        if (*ptr == '#' || *ptr == '\0') {
+            continue;
+        }
+
+        char *value = ptr + strcspn(ptr, " \t");
+        if (*value != '\0') {
+            *value++ = '\0';
+            value += strspn(value, " \t");
+        }
+
+        if (strcmp(ptr, "group") == 0) {
+            if (*value == '\0') {
+                fprintf(stderr, "%s:%d: The group needs a name\n",
+                        fname, lineno);
+                error = true;
+            } else if ((group = add_group(&groups, num, value,
+                                          defaults)) == NULL) {
+                fprintf(stderr, "Failed to allocate memory\n");
+                error = true;
+            }
+        } else if (group == NULL) {
+            fprintf(stderr, "%s:%d: The settings must follow a group\n",
+                    fname, lineno);
+            error = true;
+        } else if (!apply_setting(group, ptr, value)) {
+            fprintf(stderr, "%s:%d: Invalid %s: %s\n", fname, lineno,
+                    ptr, value);
+            error = true;
+        }
+    }
+    fclose(fp);
+
+    if (!error && *num == 0) {
+        fprintf(stderr, "%s doesn't contain any groups\n", fname);
+        error = true;
+    }
+    for (int ii = 0; ii < *num && !error; ++ii) {
+        if (groups[ii].min_size > groups[ii].max_size) {
+            fprintf(stderr, "%s: The minimum size of group %s is bigger "
+                    "than the maximum size\n", fname, groups[ii].name);
+            error = true;
+        }
+    }
+
+    for (int ii = 0; ii < *num && !error; ++ii) {
+        for (int jj = ii + 1; jj < *num && !error; ++jj) {
+            const char *a = groups[ii].prefix;
+            const char *b = groups[jj].prefix;
+            size_t len = strlen(a) < strlen(b) ? strlen(a) : strlen(b);
+            if (strncmp(a, b, len) == 0) {
+                fprintf(stderr, "%s: The keys of group %s and group %s "
+                        "overlap (prefix \"%s\" and \"%s\")\n", fname,
+                        groups[ii].name, groups[jj].name, a, b);
+                error = true;
+            }
+        }
+    }
+
+    if (error) {
+        for (int ii = 0; ii < *num; ++ii) {
+            scenario_destroy(&groups[ii]);
+        }
+        free(groups);
+        return NULL;
+    }
+    return groups;
+}
+
+void scenario_destroy(struct scenario_group *group) {
+    free(group->name);
+    free(group->prefix);
+    if (group->own_sizedist) {
+        sizedist_destroy(&group->sizedist);
+    }
+    group->name = group->prefix = NULL;
+    group->own_sizedist = false;
+}
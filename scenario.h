@@ -0,0 +1,89 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#ifndef SCENARIO_H
+#define SCENARIO_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "keydist.h"
+#include "opmix.h"
+#include "sizedist.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+    /**
+     * The settings of a client group: a population of clients with its
+     * own library, operation mix, keys and value sizes. All of the
+     * groups in a scenario run at the same time.
+     */
+    struct scenario_group {
+        char *name;
+        int threads;
+        /** The client library (the values of -L) */
+        int library;
+        struct opmix opmix;
+        /** The keys are the prefix followed by a number below items */
+        char *prefix;
+        long items;
+        struct keydist keydist;
+        struct sizedist sizedist;
+        size_t min_size;
+        size_t max_size;
+        /** The operations per second for the group (0 is unlimited) */
+        double rate;
+        /** Set if the group has its own size distribution */
+        bool own_sizedist;
+    };
+
+    /**
+     * Read a scenario file. A line with "group name" starts a group,
+     * followed by lines with "setting value" for the settings that
+     * differ from the command line:
+     *
+     *   threads num, library num (as -L), mix spec (as -O), prefix str,
+     *   items num, distribution spec (as -D), sizes spec (as -z or
+     *   fixed), min-size bytes, max-size bytes, rate ops/s
+     *
+     * The prefix defaults to the one from the command line followed by
+     * the group name and a colon, and the prefixes of the groups can't
+     * overlap (the groups would overwrite each other's items).
+     *
+     * Empty lines and lines starting with # are ignored.
+     * @param fname the name of the file
+     * @param defaults the settings from the command line
+     * @param num where to store the number of groups
+     * @return the groups (allocated with malloc, release the settings
+     *         of each group with scenario_destroy) or NULL on error
+     */
+    struct scenario_group *scenario_load(const char *fname,
+                                         const struct scenario_group *defaults,
+                                         int *num);
+
+    /** Release the memory used by the settings of the group */
+    void scenario_destroy(struct scenario_group *group);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
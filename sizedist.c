@@ -0,0 +1,300 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "sizedist.h"
+#include "boxmuller.h"
+
+/**
+ * Read an empirical distribution from a file. Each line contains a size
+ * and an optional weight (the default weight is 1). Lines starting with
+ * # are ignored.
+ */
+static bool load_histogram(struct sizedist *dist, const char *fname) {
+    FILE *fp = fopen(fname, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open %s\n", fname);
+        return false;
+    }
+
+    size_t capacity = 0;
+    double total = 0;
+    char line[256];
+    int lineno = 0;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        ++lineno;
+        char *ptr = line;
+        while (*ptr == ' ' || *ptr == '\t') {
+            ++ptr;
+        }
+        if (*ptr == '#' || *ptr == '\n' || *ptr == '\0') {
+            continue;
+        }
+
+        char *end;
+        unsigned long size = strtoul(ptr, &end, 10);
+        double weight = 1;
+        if (end == ptr) {
+            fprintf(stderr, "%s:%d: Invalid size\n", fname, lineno);
+            fclose(fp);
+            return false;
+        }
+        ptr = end;
+        weight = strtod(ptr, &end);
+        if (end == ptr) {
+            weight = 1;
+        }
+        if (weight < 0) {
+            fprintf(stderr, "%s:%d: Negative weight\n", fname, lineno);
+            fclose(fp);
+            return false;
+        }
+
+        if (dist->no_sizes == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            size_t *sizes = realloc(dist->sizes, capacity * sizeof(size_t));
+            double *cdf = realloc(dist->cdf, capacity * sizeof(double));
+            if (sizes != NULL) {
+                dist->sizes = sizes;
+            }
+            if (cdf != NULL) {
+                dist->cdf = cdf;
+            }
+            if (sizes == NULL || cdf == NULL) {
+                fprintf(stderr, "Failed to allocate memory\n");
+                fclose(fp);
+                return false;
+            }
+        }
+
+        total += weight;
+        dist->sizes[dist->no_sizes] = size;
+        dist->cdf[dist->no_sizes] = total;
+        ++dist->no_sizes;
+    }
+    fclose(fp);
+
+    if (dist->no_sizes == 0 || total <= 0) {
+        fprintf(stderr, "%s doesn't contain any sizes\n", fname);
+        return false;
+    }
+
+    for (size_t ii = 0; ii < dist->no_sizes; ++ii) {
+        dist->cdf[ii] /= total;
+    }
+
+    return true;
+}
+
+bool sizedist_parse(struct sizedist *dist, const char *spec) {
+    sizedist_destroy(dist);
+    memset(dist, 0, sizeof(*dist));
+
+    if (strncmp(spec, "file:", 5) == 0) {
+        dist->type = SD_EMPIRICAL;
+        return load_histogram(dist, spec + 5);
+    }
+
+    char *end;
+    const char *args = strchr(spec, ':');
+    size_t len = args ? (size_t)(args - spec) : strlen(spec);
+    if (args != NULL) {
+        dist->location = strtod(args + 1, &end);
+        if (*end == ':') {
+            dist->scale = strtod(end + 1, &end);
+        }
+        if (*end != '\0') {
+            fprintf(stderr, "Invalid size distribution: %s\n", spec);
+            return false;
+        }
+    }
+
+    if (len == 6 && strncmp(spec, "normal", len) == 0) {
+        dist->type = SD_NORMAL;
+        if (dist->scale <= 0) {
+            fprintf(stderr, "The normal stddev must be positive\n");
+            return false;
+        }
+    } else if (len == 9 && strncmp(spec, "lognormal", len) == 0) {
+        dist->type = SD_LOGNORMAL;
+        if (dist->location <= 0 || dist->scale <= 0) {
+            fprintf(stderr, "The lognormal median and sigma must be "
+                    "positive\n");
+            return false;
+        }
+        /* log-normal use the median instead of the mean */
+        dist->location = log(dist->location);
+    } else if (len == 6 && strncmp(spec, "pareto", len) == 0) {
+        dist->type = SD_PARETO;
+        if (dist->location <= 0 || dist->scale <= 0) {
+            fprintf(stderr, "The pareto minimum and shape must be positive\n");
+            return false;
+        }
+    } else if (len == 7 && strncmp(spec, "uniform", len) == 0) {
+        dist->type = SD_UNIFORM;
+    } else {
+        fprintf(stderr, "Unknown size distribution: %s\n", spec);
+        return false;
+    }
+
+    return true;
+}
+
+void sizedist_destroy(struct sizedist *dist) {
+    free(dist->sizes);
+    free(dist->cdf);
+    dist->sizes = NULL;
+    dist->cdf = NULL;
+    dist->no_sizes = 0;
+}
+
+size_t sizedist_next(const struct sizedist *dist, struct rng *rng,
+                     size_t min, size_t max) {
+    double val;
+
+    switch (dist->type) {
+    case SD_FIXED:
+        return max;
+    case SD_NORMAL:
+        val = box_muller(rng, dist->location, dist->scale);
+        break;
+    case SD_LOGNORMAL:
+        val = exp(box_muller(rng, dist->location, dist->scale));
+        break;
+    case SD_PARETO:
+        val = dist->location / pow(1.0 - rng_double(rng), 1.0 / dist->scale);
+        break;
+    case SD_EMPIRICAL:
+        {
+            double u = rng_double(rng);
+            size_t lo = 0;
+            size_t hi = dist->no_sizes - 1;
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if (dist->cdf[mid] <= u) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            val = (double)dist->sizes[lo];
+        }
+        break;
+    case SD_UNIFORM:
+    default:
+        if (max == min) {
+            return min;
+        }
+        return min + rng_range(rng, max - min);
+    }
+
+    if (val < (double)min) {
+        return min;
+    } else if (val > (double)max) {
+        return max;
+    }
+    return (size_t)val;
+}
+
+const char *sizedist_name(const struct sizedist *dist) {
+    switch (dist->type) {
+    case SD_FIXED:
+        return "fixed";
+    case SD_NORMAL:
+        return "normal";
+    case SD_LOGNORMAL:
+        return "log-normal";
+    case SD_PARETO:
+        return "pareto";
+    case SD_EMPIRICAL:
+        return "empirical";
+    case SD_UNIFORM:
+    default:
+        return "uniform";
+    }
+}
+
+/* The biggest item memcached will store with the default settings */
+#define MAX_ITEM_SIZE (1024 * 1024)
+
+void print_size_histogram(const size_t *sizes, size_t num) {
+    size_t bounds[64];
+    size_t counts[64];
+    int no_classes = 0;
+    size_t chunk = 96;
+
+    while (chunk < MAX_ITEM_SIZE / 2 && no_classes < 63) {
+        bounds[no_classes++] = chunk;
+        chunk = (size_t)(chunk * 1.25);
+        if (chunk % 8) {
+            chunk += 8 - (chunk % 8);
+        }
+    }
+    bounds[no_classes++] = (size_t)-1;
+    memset(counts, 0, sizeof(counts));
+
+    for (size_t ii = 0; ii < num; ++ii) {
+        int lo = 0;
+        int hi = no_classes - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (bounds[mid] < sizes[ii]) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        ++counts[lo];
+    }
+
+    size_t max = 0;
+    for (int ii = 0; ii < no_classes; ++ii) {
+        if (counts[ii] > max) {
+            max = counts[ii];
+        }
+    }
+
+    printf("Value size histogram:\n");
+    printf("     <= bytes      #items       %%\n");
+    for (int ii = 0; ii < no_classes; ++ii) {
+        if (counts[ii] == 0) {
+            continue;
+        }
+        char bar[41];
+        int width = (int)((counts[ii] * 40) / max);
+        memset(bar, '#', width);
+        bar[width] = '\0';
+
+        if (bounds[ii] == (size_t)-1) {
+            printf("%13s", "larger");
+        } else {
+            printf("%13zu", bounds[ii]);
+        }
+        printf("%12zu %6.2f%% %s\n", counts[ii],
+               (counts[ii] * 100.0) / num, bar);
+    }
+    printf("\n");
+}
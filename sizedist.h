@@ -0,0 +1,90 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#ifndef SIZEDIST_H
+#define SIZEDIST_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "rng.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+    /**
+     * The value size distributions we know how to generate
+     */
+    enum SizeDistribution {
+        SD_UNIFORM,
+        SD_FIXED,
+        SD_NORMAL,
+        SD_LOGNORMAL,
+        SD_PARETO,
+        SD_EMPIRICAL
+    };
+
+    struct sizedist {
+        enum SizeDistribution type;
+        /** mean / median / scale depending on the distribution */
+        double location;
+        /** standard deviation / sigma / shape depending on the distribution */
+        double scale;
+        /** The sizes and the cumulative probabilities (empirical) */
+        size_t *sizes;
+        double *cdf;
+        size_t no_sizes;
+    };
+
+    /**
+     * Parse a size distribution specification:
+     *   normal:mean:stddev, lognormal:median:sigma, pareto:min:shape or
+     *   file:name (where each line is "size [weight]")
+     * @return true on success, false if the spec is invalid
+     */
+    bool sizedist_parse(struct sizedist *dist, const char *spec);
+
+    void sizedist_destroy(struct sizedist *dist);
+
+    /**
+     * Draw the next size from the distribution
+     * @param dist the distribution to draw from
+     * @param rng the generator to use
+     * @param min the smallest size to return
+     * @param max the biggest size to return
+     */
+    size_t sizedist_next(const struct sizedist *dist, struct rng *rng,
+                         size_t min, size_t max);
+
+    const char *sizedist_name(const struct sizedist *dist);
+
+    /**
+     * Print a histogram of the sizes bucketed by the default memcached
+     * slab classes (96 bytes growing with a factor of 1.25)
+     * @param sizes the sizes
+     * @param num the number of sizes
+     */
+    void print_size_histogram(const size_t *sizes, size_t num);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,550 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_MEMCACHED_PROTOCOL_BINARY_H
+#include <memcached/protocol_binary.h>
+#endif
+
+#include "stats.h"
+
+/** Give up on a server that doesn't answer for this long (seconds) */
+#define STATS_TIMEOUT 5
+
+/** Check for the stop at least this often while waiting (ns) */
+#define STATS_MAX_WAIT 100000000
+
+/**
+ * The operations we count when we divide the server time between them
+ */
+static const char *const op_stats[] = {
+    "cmd_get", "cmd_set", "cmd_touch", "delete_hits", "delete_misses",
+    "incr_hits", "incr_misses", "decr_hits", "decr_misses"
+};
+
+/**
+ * A buffered reader for the responses
+ */
+struct reader {
+    int sock;
+    char data[8192];
+    size_t size;
+    size_t offset;
+};
+
+static bool reader_fill(struct reader *reader) {
+    if (reader->offset > 0) {
+        memmove(reader->data, reader->data + reader->offset,
+                reader->size - reader->offset);
+        reader->size -= reader->offset;
+        reader->offset = 0;
+    }
+    if (reader->size == sizeof(reader->data)) {
+        fprintf(stderr, "The stats response doesn't fit in the buffer\n");
+        return false;
+    }
+
+    ssize_t nr;
+    do {
+        nr = recv(reader->sock, reader->data + reader->size,
+                  sizeof(reader->data) - reader->size, 0);
+    } while (nr == -1 && errno == EINTR);
+
+    if (nr == -1) {
+        fprintf(stderr, "Failed to read stats: %s\n", strerror(errno));
+        return false;
+    } else if (nr == 0) {
+        fprintf(stderr, "The server closed the stats connection\n");
+        return false;
+    }
+    reader->size += nr;
+    return true;
+}
+
+/**
+ * Read the next line (without the \r\n). The line is only valid until
+ * the next read.
+ */
+static char *reader_line(struct reader *reader) {
+    char *end;
+    while ((end = memchr(reader->data + reader->offset, '\n',
+                         reader->size - reader->offset)) == NULL) {
+        if (!reader_fill(reader)) {
+            return NULL;
+        }
+    }
+
+    char *line = reader->data + reader->offset;
+    reader->offset = end - reader->data + 1;
+    *end = '\0';
+    if (end > line && end[-1] == '\r') {
+        end[-1] = '\0';
+    }
+    return line;
+}
+
+#ifdef HAVE_MEMCACHED_PROTOCOL_BINARY_H
+/**
+ * Read the next num bytes. They are only valid until the next read.
+ */
+static const char *reader_bytes(struct reader *reader, size_t num) {
+    if (num > sizeof(reader->data)) {
+        fprintf(stderr, "The stats response doesn't fit in the buffer\n");
+        return NULL;
+    }
+    while (reader->size - reader->offset < num) {
+        if (!reader_fill(reader)) {
+            return NULL;
+        }
+    }
+
+    const char *ret = reader->data + reader->offset;
+    reader->offset += num;
+    return ret;
+}
+#endif
+
+static bool send_all(int sock, const void *data, size_t len) {
+    const char *ptr = data;
+    while (len > 0) {
+        ssize_t nw = send(sock, ptr, len, 0);
+        if (nw == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Failed to send stats command: %s\n",
+                    strerror(errno));
+            return false;
+        }
+        ptr += nw;
+        len -= nw;
+    }
+    return true;
+}
+
+static bool stats_add(struct stats *stats, const char *name, size_t nname,
+                      const char *value, size_t nvalue) {
+    if (stats->num == stats->size) {
+        int size = stats->size ? stats->size * 2 : 64;
+        char **names = realloc(stats->names, size * sizeof(char *));
+        if (names == NULL) {
+            return false;
+        }
+        stats->names = names;
+        char **values = realloc(stats->values, size * sizeof(char *));
+        if (values == NULL) {
+            return false;
+        }
+        stats->values = values;
+        stats->size = size;
+    }
+
+    char *n = strndup(name, nname);
+    char *v = strndup(value, nvalue);
+    if (n == NULL || v == NULL) {
+        free(n);
+        free(v);
+        return false;
+    }
+    stats->names[stats->num] = n;
+    stats->values[stats->num] = v;
+    ++stats->num;
+    return true;
+}
+
+static void stats_clear(struct stats *stats) {
+    for (int ii = 0; ii < stats->num; ++ii) {
+        free(stats->names[ii]);
+        free(stats->values[ii]);
+    }
+    stats->num = 0;
+}
+
+void stats_destroy(struct stats *stats) {
+    stats_clear(stats);
+    free(stats->names);
+    free(stats->values);
+    memset(stats, 0, sizeof(*stats));
+}
+
+int stats_connect(const struct addrinfo *ai) {
+    struct timeval timeout = { .tv_sec = STATS_TIMEOUT };
+    int sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (sock == -1) {
+        fprintf(stderr, "Failed to create socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (connect(sock, ai->ai_addr, ai->ai_addrlen) == -1) {
+        fprintf(stderr, "Failed to connect socket: %s\n", strerror(errno));
+        close(sock);
+        return -1;
+    }
+    (void)setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return sock;
+}
+
+static bool fetch_textual(struct reader *reader, const char *group,
+                          struct stats *stats) {
+    char cmd[128];
+    int len;
+    if (group != NULL) {
+        len = snprintf(cmd, sizeof(cmd), "stats %s\r\n", group);
+    } else {
+        len = snprintf(cmd, sizeof(cmd), "stats\r\n");
+    }
+    if (len < 0 || (size_t)len >= sizeof(cmd) ||
+        !send_all(reader->sock, cmd, len)) {
+        return false;
+    }
+
+    char *line;
+    while ((line = reader_line(reader)) != NULL) {
+        if (strcmp(line, "END") == 0) {
+            return true;
+        }
+        if (strncmp(line, "STAT ", 5) != 0) {
+            fprintf(stderr, "Unexpected response to stats: %s\n", line);
+            return false;
+        }
+
+        char *name = line + 5;
+        char *value = strchr(name, ' ');
+        if (value == NULL) {
+            value = name + strlen(name);
+        }
+        if (!stats_add(stats, name, value - name,
+                       *value ? value + 1 : value,
+                       strlen(*value ? value + 1 : value))) {
+            fprintf(stderr, "Failed to allocate memory\n");
+            return false;
+        }
+    }
+    return false;
+}
+
+static bool fetch_binary(struct reader *reader, const char *group,
+                         struct stats *stats) {
+#ifdef HAVE_MEMCACHED_PROTOCOL_BINARY_H
+    size_t nkey = group ? strlen(group) : 0;
+    protocol_binary_request_header request = {
+        .request = {
+            .magic = PROTOCOL_BINARY_REQ,
+            .opcode = PROTOCOL_BINARY_CMD_STAT,
+            .keylen = htons((uint16_t)nkey),
+            .datatype = PROTOCOL_BINARY_RAW_BYTES,
+            .bodylen = htonl((uint32_t)nkey)
+        }
+    };
+    if (!send_all(reader->sock, request.bytes, sizeof(request.bytes)) ||
+        (nkey > 0 && !send_all(reader->sock, group, nkey))) {
+        return false;
+    }
+
+    /* Every stat is a response of its own, and an empty one ends them */
+    while (true) {
+        protocol_binary_response_header response;
+        const char *data = reader_bytes(reader, sizeof(response.bytes));
+        if (data == NULL) {
+            return false;
+        }
+        memcpy(response.bytes, data, sizeof(response.bytes));
+
+        uint16_t keylen = ntohs(response.response.keylen);
+        uint8_t extlen = response.response.extlen;
+        uint32_t bodylen = ntohl(response.response.bodylen);
+        if (extlen + keylen > bodylen ||
+            (data = reader_bytes(reader, bodylen)) == NULL) {
+            return false;
+        }
+
+        if (ntohs(response.response.status) != PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+            fprintf(stderr, "The server refused stats %s\n",
+                    group ? group : "");
+            return false;
+        }
+        if (keylen == 0) {
+            return true;
+        }
+        if (!stats_add(stats, data + extlen, keylen, data + extlen + keylen,
+                       bodylen - extlen - keylen)) {
+            fprintf(stderr, "Failed to allocate memory\n");
+            return false;
+        }
+    }
+#else
+    (void)reader; (void)group; (void)stats;
+    fprintf(stderr, "Compiled without support for binary protocol\n");
+    return false;
+#endif
+}
+
+bool stats_fetch(int sock, enum Protocol protocol, const char *group,
+                 struct stats *stats) {
+    struct reader *reader = malloc(sizeof(*reader));
+    if (reader == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return false;
+    }
+    reader->sock = sock;
+    reader->size = reader->offset = 0;
+
+    stats_clear(stats);
+    bool ret;
+    if (protocol == Binary) {
+        ret = fetch_binary(reader, group, stats);
+    } else {
+        ret = fetch_textual(reader, group, stats);
+    }
+    free(reader);
+    return ret;
+}
+
+const char *stats_get(const struct stats *stats, const char *name) {
+    for (int ii = 0; ii < stats->num; ++ii) {
+        if (strcmp(stats->names[ii], name) == 0) {
+            return stats->values[ii];
+        }
+    }
+    return NULL;
+}
+
+double stats_number(const struct stats *stats, const char *name) {
+    const char *value = stats_get(stats, name);
+    /* The rusage is seconds.microseconds */
+    return value ? strtod(value, NULL) : 0;
+}
+
+double stats_ops(const struct stats *stats) {
+    double ops = 0;
+    for (size_t ii = 0; ii < sizeof(op_stats) / sizeof(op_stats[0]); ++ii) {
+        ops += stats_number(stats, op_stats[ii]);
+    }
+    return ops;
+}
+
+bool stats_collector_add(struct stats_collector *collector,
+                         const char *name, struct addrinfo *ai) {
+    struct stats_server *servers;
+    servers = realloc(collector->servers,
+                      (collector->no_servers + 1) * sizeof(*servers));
+    if (servers == NULL) {
+        return false;
+    }
+    collector->servers = servers;
+
+    struct stats_server *server = &servers[collector->no_servers];
+    memset(server, 0, sizeof(*server));
+    if ((server->name = strdup(name)) == NULL) {
+        return false;
+    }
+    server->ai = ai;
+    server->sock = -1;
+    ++collector->no_servers;
+    return true;
+}
+
+static double delta(const struct stats *now, const struct stats *last,
+                    const char *name) {
+    return stats_number(now, name) - stats_number(last, name);
+}
+
+/**
+ * Print the slab classes in use: their chunk size, items, pages and
+ * evictions in the interval
+ */
+static void report_slabs(const struct stats *slabs, const struct stats *items,
+                         const struct stats *last_items, double elapsed) {
+    for (int ii = 0; ii < slabs->num; ++ii) {
+        const char *suffix = strchr(slabs->names[ii], ':');
+        if (suffix == NULL || strcmp(suffix, ":chunk_size") != 0) {
+            continue;
+        }
+
+        int id = atoi(slabs->names[ii]);
+        char name[64];
+        snprintf(name, sizeof(name), "%d:total_pages", id);
+        double pages = stats_number(slabs, name);
+        snprintf(name, sizeof(name), "items:%d:number", id);
+        double number = stats_number(items, name);
+        snprintf(name, sizeof(name), "items:%d:evicted", id);
+        double evicted = delta(items, last_items, name);
+
+        fprintf(stdout, "             slab class %3d: %7s B chunks"
+                "  %10.0f items  %6.0f pages  %8.0f evictions/s\n",
+                id, slabs->values[ii], number, pages,
+                elapsed > 0 ? evicted / elapsed : 0);
+    }
+}
+
+/**
+ * Sample the server and print what changed since the last sample
+ */
+static void report_server(struct stats_collector *collector,
+                          struct stats_server *server, hrtime_t now,
+                          double elapsed) {
+    struct stats stats = { .num = 0 };
+    struct stats items = { .num = 0 };
+    struct stats slabs = { .num = 0 };
+
+    if (server->sock == -1 && (server->sock = stats_connect(server->ai)) == -1) {
+        return;
+    }
+    if (!stats_fetch(server->sock, collector->protocol, NULL, &stats) ||
+        (collector->slabs &&
+         (!stats_fetch(server->sock, collector->protocol, "items", &items) ||
+          !stats_fetch(server->sock, collector->protocol, "slabs", &slabs)))) {
+        fprintf(stderr, "Failed to get the stats from %s\n", server->name);
+        /* Start over with a new connection next time */
+        close(server->sock);
+        server->sock = -1;
+        stats_destroy(&stats);
+        stats_destroy(&items);
+        stats_destroy(&slabs);
+        return;
+    }
+
+    if (server->last.num > 0 && elapsed > 0) {
+        double ops = stats_ops(&stats) - stats_ops(&server->last);
+        double cpu = delta(&stats, &server->last, "rusage_user") +
+            delta(&stats, &server->last, "rusage_system");
+
+        fprintf(stdout, "[%8.1f s] %s  %8.0f gets/s  %8.0f sets/s"
+                "  %6.0f evictions/s  %5.0f conns  %8.1f MB  %2.0f threads"
+                "  cpu %5.1f%%",
+                (now - collector->begin) / 1000000000.0, server->name,
+                delta(&stats, &server->last, "cmd_get") / elapsed,
+                delta(&stats, &server->last, "cmd_set") / elapsed,
+                delta(&stats, &server->last, "evictions") / elapsed,
+                stats_number(&stats, "curr_connections"),
+                stats_number(&stats, "bytes") / (1024 * 1024),
+                stats_number(&stats, "threads"),
+                cpu * 100 / elapsed);
+        if (ops > 0) {
+            fprintf(stdout, "  %6.1f us/op", cpu * 1000000 / ops);
+        }
+        fprintf(stdout, "\n");
+        if (collector->slabs) {
+            report_slabs(&slabs, &items, &server->last_items, elapsed);
+        }
+        fflush(stdout);
+    }
+
+    stats_destroy(&server->last);
+    stats_destroy(&server->last_items);
+    stats_destroy(&slabs);
+    server->last = stats;
+    server->last_items = items;
+}
+
+static void report_all(struct stats_collector *collector) {
+    hrtime_t now = gethrtime();
+    double elapsed = (now - collector->last) / 1000000000.0;
+    for (int ii = 0; ii < collector->no_servers; ++ii) {
+        report_server(collector, &collector->servers[ii], now, elapsed);
+    }
+    collector->last = now;
+}
+
+static void *collector_main(void *arg) {
+    struct stats_collector *collector = arg;
+    hrtime_t period = (hrtime_t)(collector->interval * 1000000000);
+
+    while (!__atomic_load_n(&collector->stop, __ATOMIC_ACQUIRE)) {
+        hrtime_t now = gethrtime();
+        if (now < collector->last + period) {
+            hrtime_t wait = collector->last + period - now;
+            usleep((useconds_t)((wait < STATS_MAX_WAIT ?
+                                 wait : STATS_MAX_WAIT) / 1000));
+            continue;
+        }
+        report_all(collector);
+    }
+    return NULL;
+}
+
+/**
+ * Close the connections to the servers and drop the last samples
+ */
+static void close_servers(struct stats_collector *collector) {
+    for (int ii = 0; ii < collector->no_servers; ++ii) {
+        struct stats_server *server = &collector->servers[ii];
+        if (server->sock != -1) {
+            close(server->sock);
+            server->sock = -1;
+        }
+        stats_destroy(&server->last);
+        stats_destroy(&server->last_items);
+    }
+}
+
+bool stats_collector_start(struct stats_collector *collector,
+                           hrtime_t begin) {
+    collector->begin = begin;
+    collector->stop = false;
+
+    /* The first sample is the baseline for the first interval */
+    report_all(collector);
+    for (int ii = 0; ii < collector->no_servers; ++ii) {
+        if (collector->servers[ii].sock == -1) {
+            close_servers(collector);
+            return false;
+        }
+    }
+
+    if (pthread_create(&collector->thread, NULL, collector_main,
+                       collector) != 0) {
+        fprintf(stderr, "Failed to create the stats collector thread\n");
+        close_servers(collector);
+        return false;
+    }
+    return true;
+}
+
+void stats_collector_stop(struct stats_collector *collector) {
+    __atomic_store_n(&collector->stop, true, __ATOMIC_RELEASE);
+    pthread_join(collector->thread, NULL);
+    /* A sliver of an interval only adds noise */
+    hrtime_t period = (hrtime_t)(collector->interval * 1000000000);
+    if (gethrtime() - collector->last >= period / 10) {
+        report_all(collector);
+    }
+    close_servers(collector);
+}
+
+void stats_collector_destroy(struct stats_collector *collector) {
+    for (int ii = 0; ii < collector->no_servers; ++ii) {
+        free(collector->servers[ii].name);
+        freeaddrinfo(collector->servers[ii].ai);
+    }
+    free(collector->servers);
+    collector->servers = NULL;
+    collector->no_servers = 0;
+}
@@ -0,0 +1,139 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#ifndef STATS_H
+#define STATS_H 1
+
+#include <sys/types.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "libmemc.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+    /*
+     * The statistics of the servers. The collector is a thread that pulls
+     * the stats from every server at an interval over its own connections
+     * (in either protocol) and prints what changed since the last sample,
+     * so the server side can be lined up with the progress reports.
+     */
+
+    /**
+     * The result of a stats command: the names and values in the order
+     * the server sent them
+     */
+    struct stats {
+        char **names;
+        char **values;
+        int num;
+        int size;
+    };
+
+    /**
+     * Connect to a server to run stats commands on
+     * @return the socket or -1 on error
+     */
+    int stats_connect(const struct addrinfo *ai);
+
+    /**
+     * Run "stats [group]" on the server
+     * @param sock the connection to the server
+     * @param protocol the protocol to speak
+     * @param group the group of stats ("slabs", "items", ...), or NULL
+     *              for the general stats
+     * @param stats where to store the stats (replaces the contents)
+     * @return true on success
+     */
+    bool stats_fetch(int sock, enum Protocol protocol, const char *group,
+                     struct stats *stats);
+
+    /** The value of a stat, NULL if the server didn't send it */
+    const char *stats_get(const struct stats *stats, const char *name);
+
+    /** The value of a stat as a number, 0 if the server didn't send it */
+    double stats_number(const struct stats *stats, const char *name);
+
+    /**
+     * The number of operations the server ran (gets, sets, touches,
+     * deletes, incrs and decrs), to divide the server time between them
+     */
+    double stats_ops(const struct stats *stats);
+
+    void stats_destroy(struct stats *stats);
+
+    struct stats_server {
+        /** host:port (used in the reports) */
+        char *name;
+        struct addrinfo *ai;
+        int sock;
+        /** The previous sample */
+        struct stats last;
+        struct stats last_items;
+    };
+
+    struct stats_collector {
+        struct stats_server *servers;
+        int no_servers;
+        enum Protocol protocol;
+        /** The number of seconds between the samples */
+        double interval;
+        /** Also report the slab classes (stats slabs and stats items) */
+        bool slabs;
+        /** When the run started (the reports are relative to it) */
+        hrtime_t begin;
+        hrtime_t last;
+        pthread_t thread;
+        bool stop;
+    };
+
+    /**
+     * Add a server to the collector (before it starts)
+     * @param name host:port
+     * @param ai the address of the server (owned by the collector)
+     * @return true on success
+     */
+    bool stats_collector_add(struct stats_collector *collector,
+                             const char *name, struct addrinfo *ai);
+
+    /**
+     * Connect to the servers, take the first sample and start the
+     * thread
+     * @param begin when the run started
+     * @return true on success
+     */
+    bool stats_collector_start(struct stats_collector *collector,
+                               hrtime_t begin);
+
+    /**
+     * Report the last interval, stop the thread and disconnect
+     */
+    void stats_collector_stop(struct stats_collector *collector);
+
+    void stats_collector_destroy(struct stats_collector *collector);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,191 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#include "config.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sweep.h"
+
+static const char * const param_names[SWEEP_PARAMS] = {
+    [SWEEP_THREADS] = "threads",
+    [SWEEP_MAX_SIZE] = "max_size",
+    [SWEEP_SETPRC] = "set_percent",
+    [SWEEP_LIBRARY] = "library"
+};
+
+/** The order the parameters change in, from the least often */
+static const enum SweepParam param_order[SWEEP_PARAMS] = {
+    SWEEP_MAX_SIZE, SWEEP_LIBRARY, SWEEP_THREADS, SWEEP_SETPRC
+};
+
+bool sweep_parse(struct sweep *sweep, const char *spec) {
+    enum SweepParam param;
+
+    switch (spec[0]) {
+    case 't': param = SWEEP_THREADS; break;
+    case 'M': param = SWEEP_MAX_SIZE; break;
+    case 'P': param = SWEEP_SETPRC; break;
+    case 'L': param = SWEEP_LIBRARY; break;
+    default:
+        fprintf(stderr, "Invalid sweep: %s (use t, M, P or L)\n", spec);
+        return false;
+    }
+    if (spec[1] != '=' || spec[2] == '\0') {
+        fprintf(stderr, "Invalid sweep: %s\n", spec);
+        return false;
+    }
+
+    int num = 1;
+    for (const char *ptr = spec + 2; *ptr != '\0'; ++ptr) {
+        if (*ptr == ',') {
+            ++num;
+        }
+    }
+
+    long *values = calloc(num, sizeof(long));
+    if (values == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return false;
+    }
+
+    const char *ptr = spec + 2;
+    for (int ii = 0; ii < num; ++ii) {
+        char *end;
+        values[ii] = strtol(ptr, &end, 10);
+        if (end == ptr || (*end != ',' && *end != '\0') || values[ii] < 0 ||
+            (param != SWEEP_SETPRC && values[ii] == 0) ||
+            (param == SWEEP_SETPRC && values[ii] > 100)) {
+            fprintf(stderr, "Invalid sweep value in %s\n", spec);
+            free(values);
+            return false;
+        }
+        ptr = end + 1;
+    }
+
+    free(sweep->values[param]);
+    sweep->values[param] = values;
+    sweep->num[param] = num;
+    return true;
+}
+
+int sweep_points(const struct sweep *sweep) {
+    int num = 1;
+    for (int ii = 0; ii < SWEEP_PARAMS; ++ii) {
+        if (sweep->values[ii] != NULL) {
+            num *= sweep->num[ii];
+        }
+    }
+    return num;
+}
+
+void sweep_point(const struct sweep *sweep, int n,
+                 const long defaults[SWEEP_PARAMS],
+                 struct sweep_point *point) {
+    memset(point, 0, sizeof(*point));
+    /* The last parameter in the order changes with every point */
+    for (int ii = SWEEP_PARAMS - 1; ii >= 0; --ii) {
+        enum SweepParam param = param_order[ii];
+        if (sweep->values[param] == NULL) {
+            point->params[param] = defaults[param];
+        } else {
+            point->params[param] = sweep->values[param][n % sweep->num[param]];
+            n /= sweep->num[param];
+        }
+    }
+}
+
+static void write_csv(FILE *fp, const struct sweep_point *points, int num) {
+    for (int ii = 0; ii < SWEEP_PARAMS; ++ii) {
+        fprintf(fp, "%s,", param_names[ii]);
+    }
+    fprintf(fp, "ops,ops_per_sec,get_p50_us,get_p99_us,get_p999_us,"
+            "set_p50_us,set_p99_us,set_p999_us\n");
+
+    for (int ii = 0; ii < num; ++ii) {
+        const struct sweep_point *point = &points[ii];
+        for (int jj = 0; jj < SWEEP_PARAMS; ++jj) {
+            fprintf(fp, "%ld,", point->params[jj]);
+        }
+        fprintf(fp, "%"PRIu64",%.0f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n",
+                point->ops, point->throughput,
+                point->get_p50 / 1000.0, point->get_p99 / 1000.0,
+                point->get_p999 / 1000.0, point->set_p50 / 1000.0,
+                point->set_p99 / 1000.0, point->set_p999 / 1000.0);
+    }
+}
+
+static void write_json(FILE *fp, const struct sweep_point *points, int num) {
+    fprintf(fp, "[\n");
+    for (int ii = 0; ii < num; ++ii) {
+        const struct sweep_point *point = &points[ii];
+        fprintf(fp, "  {");
+        for (int jj = 0; jj < SWEEP_PARAMS; ++jj) {
+            fprintf(fp, "\"%s\": %ld, ", param_names[jj], point->params[jj]);
+        }
+        fprintf(fp, "\"ops\": %"PRIu64", \"ops_per_sec\": %.0f, "
+                "\"get_p50_us\": %.1f, \"get_p99_us\": %.1f, "
+                "\"get_p999_us\": %.1f, \"set_p50_us\": %.1f, "
+                "\"set_p99_us\": %.1f, \"set_p999_us\": %.1f}%s\n",
+                point->ops, point->throughput,
+                point->get_p50 / 1000.0, point->get_p99 / 1000.0,
+                point->get_p999 / 1000.0, point->set_p50 / 1000.0,
+                point->set_p99 / 1000.0, point->set_p999 / 1000.0,
+                ii + 1 < num ? "," : "");
+    }
+    fprintf(fp, "]\n");
+}
+
+bool sweep_write(const char *fname, const struct sweep_point *points,
+                 int num) {
+    FILE *fp = stdout;
+    size_t len = strlen(fname);
+
+    if (strcmp(fname, "-") != 0 && (fp = fopen(fname, "w")) == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", fname, strerror(errno));
+        return false;
+    }
+
+    if (len > 5 && strcmp(fname + len - 5, ".json") == 0) {
+        write_json(fp, points, num);
+    } else {
+        write_csv(fp, points, num);
+    }
+
+    bool ret = true;
+    if (fp == stdout) {
+        fflush(fp);
+    } else if (fclose(fp) != 0) {
+        fprintf(stderr, "Failed to write %s: %s\n", fname, strerror(errno));
+        ret = false;
+    }
+    return ret;
+}
+
+void sweep_destroy(struct sweep *sweep) {
+    for (int ii = 0; ii < SWEEP_PARAMS; ++ii) {
+        free(sweep->values[ii]);
+        sweep->values[ii] = NULL;
+        sweep->num[ii] = 0;
+    }
+}
@@ -0,0 +1,100 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#ifndef SWEEP_H
+#define SWEEP_H 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+    /*
+     * A sweep runs the test once for every combination of the values of
+     * the parameters (see --sweep) and collects the throughput and
+     * latency of every point in one table.
+     */
+    enum SweepParam {
+        /** -t */
+        SWEEP_THREADS,
+        /** -M */
+        SWEEP_MAX_SIZE,
+        /** -P */
+        SWEEP_SETPRC,
+        /** -L */
+        SWEEP_LIBRARY,
+        SWEEP_PARAMS
+    };
+
+    struct sweep {
+        /** The values of every parameter (NULL if it isn't swept) */
+        long *values[SWEEP_PARAMS];
+        int num[SWEEP_PARAMS];
+    };
+
+    struct sweep_point {
+        long params[SWEEP_PARAMS];
+        uint64_t ops;
+        double throughput;
+        /** The latency percentiles in ns (0 if there were no gets / sets) */
+        uint64_t get_p50;
+        uint64_t get_p99;
+        uint64_t get_p999;
+        uint64_t set_p50;
+        uint64_t set_p99;
+        uint64_t set_p999;
+    };
+
+    /**
+     * Parse the values of a parameter: t, M, P or L followed by = and a
+     * comma separated list of values, for example t=1,2,4
+     * @return true on success
+     */
+    bool sweep_parse(struct sweep *sweep, const char *spec);
+
+    /** The number of points in the sweep (1 if nothing is swept) */
+    int sweep_points(const struct sweep *sweep);
+
+    /**
+     * Get the parameters of a point. The points are ordered so that the
+     * max size changes the least often (it needs the data loaded again),
+     * followed by the library (it needs new connections).
+     * @param defaults the values of the parameters that aren't swept
+     */
+    void sweep_point(const struct sweep *sweep, int n,
+                     const long defaults[SWEEP_PARAMS],
+                     struct sweep_point *point);
+
+    /**
+     * Write the table of points as JSON if the file name ends in .json,
+     * and as CSV otherwise ("-" is stdout)
+     * @return true on success
+     */
+    bool sweep_write(const char *fname, const struct sweep_point *points,
+                     int num);
+
+    void sweep_destroy(struct sweep *sweep);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
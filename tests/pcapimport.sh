@@ -0,0 +1,19 @@
+#!/bin/sh
+# Import a small capture (a textual connection with a segment out of
+# order and a binary connection that started before the capture) and
+# compare the summary and the key statistics with the expected output.
+srcdir=${srcdir:-.}
+
+# Without memcached/protocol_binary.h the importer only parses the
+# textual protocol (77 tells automake we skipped the test)
+if ! grep -q "define HAVE_MEMCACHED_PROTOCOL_BINARY_H 1" config.h; then
+    echo "memcachetest-import was built without the binary protocol"
+    exit 77
+fi
+
+rm -f pcapimport.out pcapimport.keys pcapimport.trace
+./memcachetest-import -k pcapimport.keys -o pcapimport.trace \
+    "$srcdir/tests/memcached.pcap" > pcapimport.out || exit 1
+cat pcapimport.keys >> pcapimport.out
+test -s pcapimport.trace || exit 1
+diff -u "$srcdir/tests/pcapimport.expected" pcapimport.out
@@ -0,0 +1,214 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metrics.h"
+#include "trace.h"
+
+bool trace_stream_append(struct trace_stream *stream, uint32_t delta,
+                         uint8_t op, uint64_t keyid,
+                         const char *key, size_t nkey,
+                         uint32_t size, uint32_t ttl) {
+    size_t keybytes = key ? (nkey + 7) & ~(size_t)7 : 0;
+    size_t needed = sizeof(struct trace_record) + keybytes;
+
+    if (stream->size + needed > stream->capacity) {
+        size_t capacity = stream->capacity ? stream->capacity * 2 : 64 * 1024;
+        while (capacity < stream->size + needed) {
+            capacity *= 2;
+        }
+        char *data = realloc(stream->data, capacity);
+        if (data == NULL) {
+            return false;
+        }
+        stream->data = data;
+        stream->capacity = capacity;
+    }
+
+    struct trace_record *rec = (void*)(stream->data + stream->size);
+    rec->delta = delta;
+    rec->op = op;
+    rec->flags = key ? TRACE_KEY_BYTES : 0;
+    rec->keylen = key ? (uint16_t)nkey : 0;
+    rec->size = size;
+    rec->ttl = ttl;
+    rec->key = keyid;
+    if (key) {
+        memset((char*)(rec + 1), 0, keybytes);
+        memcpy((char*)(rec + 1), key, nkey);
+    }
+
+    stream->size += needed;
+    ++stream->no_records;
+    return true;
+}
+
+void trace_stream_destroy(struct trace_stream *stream) {
+    free(stream->data);
+    memset(stream, 0, sizeof(*stream));
+}
+
+int trace_write(const char *fname, struct trace_stream *streams, int num) {
+    FILE *fp = fopen(fname, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to create %s: %s\n", fname, strerror(errno));
+        return -1;
+    }
+
+    struct trace_header header = { .version = TRACE_VERSION,
+                                   .no_streams = num };
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    for (int ii = 0; ii < num; ++ii) {
+        header.no_records += streams[ii].no_records;
+    }
+
+    uint64_t offset = sizeof(header) + num * sizeof(struct trace_stream_entry);
+    bool error = fwrite(&header, sizeof(header), 1, fp) != 1;
+    for (int ii = 0; ii < num && !error; ++ii) {
+        struct trace_stream_entry entry = {
+            .offset = offset,
+            .no_records = streams[ii].no_records
+        };
+        error = fwrite(&entry, sizeof(entry), 1, fp) != 1;
+        offset += streams[ii].size;
+    }
+
+    for (int ii = 0; ii < num && !error; ++ii) {
+        if (streams[ii].size > 0) {
+            error = fwrite(streams[ii].data, streams[ii].size, 1, fp) != 1;
+        }
+    }
+
+    if (fclose(fp) != 0 || error) {
+        fprintf(stderr, "Failed to write %s: %s\n", fname, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Walk all of the records in all of the streams to verify that they
+ * are within the file and hold operations we can replay (so that we
+ * don't need any checks during replay)
+ * @return NULL if the trace is valid, what is wrong with it otherwise
+ */
+static const char *trace_validate(const struct trace *trace) {
+    const char *end = trace->base + trace->size;
+
+    for (uint32_t ii = 0; ii < trace->header->no_streams; ++ii) {
+        const struct trace_stream_entry *entry = &trace->streams[ii];
+        if (entry->offset > trace->size || (entry->offset & 7) != 0) {
+            return "is corrupt";
+        }
+
+        const struct trace_record *rec = trace_first(trace, ii);
+        for (uint64_t jj = 0; jj < entry->no_records; ++jj) {
+            if ((const char*)(rec + 1) > end) {
+                return "is corrupt";
+            }
+            /* The rmw loops run on the hot keys, they aren't recorded */
+            if (rec->op >= TX_RMW) {
+                return "holds an operation that can't be replayed";
+            }
+            rec = trace_next(rec);
+            if ((const char*)rec > end) {
+                return "is corrupt";
+            }
+        }
+    }
+
+    return NULL;
+}
+
+struct trace *trace_open(const char *fname) {
+    struct trace *ret = calloc(1, sizeof(*ret));
+    struct stat st;
+    int fd = open(fname, O_RDONLY);
+
+    if (ret == NULL || fd == -1 || fstat(fd, &st) == -1) {
+        fprintf(stderr, "Failed to open %s: %s\n", fname, strerror(errno));
+        if (fd != -1) {
+            close(fd);
+        }
+        free(ret);
+        return NULL;
+    }
+
+    if ((size_t)st.st_size < sizeof(struct trace_header)) {
+        fprintf(stderr, "%s is not a trace file\n", fname);
+        close(fd);
+        free(ret);
+        return NULL;
+    }
+
+    ret->size = st.st_size;
+    void *base = mmap(NULL, ret->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s: %s\n", fname, strerror(errno));
+        free(ret);
+        return NULL;
+    }
+#ifdef MADV_SEQUENTIAL
+    (void)madvise(base, ret->size, MADV_SEQUENTIAL);
+#endif
+
+    ret->base = base;
+    ret->header = base;
+    ret->streams = (const void*)(ret->base + sizeof(struct trace_header));
+
+    const char *error = NULL;
+    if (memcmp(ret->header->magic, TRACE_MAGIC, sizeof(ret->header->magic)) != 0) {
+        error = "is not a trace file";
+    } else if (ret->header->version != TRACE_VERSION) {
+        error = "has an unsupported version (or was written on another endian)";
+    } else if (ret->header->no_streams > (ret->size - sizeof(struct trace_header)) /
+               sizeof(struct trace_stream_entry)) {
+        error = "is truncated";
+    } else {
+        error = trace_validate(ret);
+    }
+
+    if (error != NULL) {
+        fprintf(stderr, "%s %s\n", fname, error);
+        trace_close(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+void trace_close(struct trace *trace) {
+    if (trace != NULL) {
+        munmap((void*)trace->base, trace->size);
+        free(trace);
+    }
+}
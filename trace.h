@@ -0,0 +1,133 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#ifndef TRACE_H
+#define TRACE_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A trace file contains a header, a table with one entry per stream and
+ * then the streams. A stream is the sequence of operations issued by a
+ * single client (a thread in memcachetest, a connection in a captured
+ * workload), and is replayed in order by a single thread.
+ *
+ * Everything is stored in the byte order of the machine that wrote the
+ * file (we detect and refuse to replay traces from the other endian).
+ */
+#define TRACE_MAGIC "MCTRACE\0"
+#define TRACE_VERSION 1
+
+    struct trace_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t no_streams;
+        uint64_t no_records;
+    };
+
+    struct trace_stream_entry {
+        /** Offset of the first record from the beginning of the file */
+        uint64_t offset;
+        uint64_t no_records;
+    };
+
+    /** The record is followed by keylen bytes of key (padded to 8) */
+#define TRACE_KEY_BYTES 0x01
+
+    struct trace_record {
+        /** Microseconds since the previous op in the stream */
+        uint32_t delta;
+        /** enum TxnType */
+        uint8_t op;
+        uint8_t flags;
+        uint16_t keylen;
+        uint32_t size;
+        uint32_t ttl;
+        /** The key index (unless TRACE_KEY_BYTES is set) */
+        uint64_t key;
+    };
+
+    /**
+     * A stream of records being recorded (in memory)
+     */
+    struct trace_stream {
+        char *data;
+        size_t size;
+        size_t capacity;
+        uint64_t no_records;
+    };
+
+    /**
+     * Add a record to the stream
+     * @param key the key bytes, or NULL to store the key index
+     * @return true on success, false if we failed to allocate memory
+     */
+    bool trace_stream_append(struct trace_stream *stream, uint32_t delta,
+                             uint8_t op, uint64_t keyid,
+                             const char *key, size_t nkey,
+                             uint32_t size, uint32_t ttl);
+
+    void trace_stream_destroy(struct trace_stream *stream);
+
+    /**
+     * Write the streams to a trace file
+     * @return 0 on success, -1 otherwise
+     */
+    int trace_write(const char *fname, struct trace_stream *streams, int num);
+
+    /**
+     * A trace file mapped into memory for replay
+     */
+    struct trace {
+        const char *base;
+        size_t size;
+        const struct trace_header *header;
+        const struct trace_stream_entry *streams;
+    };
+
+    struct trace *trace_open(const char *fname);
+    void trace_close(struct trace *trace);
+
+    static inline const struct trace_record *trace_first(const struct trace *trace,
+                                                         uint32_t stream) {
+        return (const struct trace_record *)(trace->base +
+                                             trace->streams[stream].offset);
+    }
+
+    static inline const char *trace_key(const struct trace_record *rec) {
+        return (const char *)(rec + 1);
+    }
+
+    static inline const struct trace_record *trace_next(const struct trace_record *rec) {
+        size_t keybytes = (rec->flags & TRACE_KEY_BYTES) ?
+            ((size_t)rec->keylen + 7) & ~(size_t)7 : 0;
+        return (const struct trace_record *)((const char *)(rec + 1) + keybytes);
+    }
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
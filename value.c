@@ -0,0 +1,157 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#include "config.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#define HAVE_CRC32C_SSE42 1
+#endif
+
+#include "rng.h"
+#include "value.h"
+
+/** The reflected Castagnoli polynomial */
+#define CRC32C_POLY 0x82f63b78
+
+static uint32_t crc32c_table[256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init_table(void) {
+    for (uint32_t ii = 0; ii < 256; ++ii) {
+        uint32_t crc = ii;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+        }
+        crc32c_table[ii] = crc;
+    }
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const void *data, size_t len) {
+    const unsigned char *ptr = data;
+
+    pthread_once(&crc32c_once, crc32c_init_table);
+    crc = ~crc;
+    while (len-- > 0) {
+        crc = (crc >> 8) ^ crc32c_table[(crc ^ *ptr++) & 0xff];
+    }
+    return ~crc;
+}
+
+#ifdef HAVE_CRC32C_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const void *data, size_t len) {
+    const unsigned char *ptr = data;
+    uint64_t crc64 = ~crc;
+
+    while (len >= sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, ptr, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        ptr += sizeof(word);
+        len -= sizeof(word);
+    }
+
+    uint32_t crc32 = (uint32_t)crc64;
+    while (len-- > 0) {
+        crc32 = _mm_crc32_u8(crc32, *ptr++);
+    }
+    return ~crc32;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+#ifdef HAVE_CRC32C_SSE42
+    if (__builtin_cpu_supports("sse4.2")) {
+        return crc32c_sse42(crc, data, len);
+    }
+#endif
+    return crc32c_sw(crc, data, len);
+}
+
+void value_fill_pattern(void *pattern, size_t size, uint64_t seed) {
+    struct rng rng;
+    unsigned char *ptr = pattern;
+
+    rng_seed(&rng, seed, 0);
+    while (size > 0) {
+        uint64_t word = rng_next(&rng);
+        size_t len = size < sizeof(word) ? size : sizeof(word);
+        memcpy(ptr, &word, len);
+        ptr += len;
+        size -= len;
+    }
+}
+
+/**
+ * Where the rest of the value starts in the pattern
+ */
+static size_t pattern_offset(uint64_t key, uint32_t version) {
+    uint64_t hash = key * 0x9e3779b97f4a7c15ULL;
+    hash ^= version * 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 31;
+    return (size_t)(hash % VALUE_PATTERN_SLACK);
+}
+
+void value_build(void *dest, size_t size, const void *pattern,
+                 uint64_t key, uint32_t version) {
+    unsigned char header[VALUE_HEADER_SIZE];
+    uint32_t crc = 0;
+
+    if (size > VALUE_HEADER_SIZE) {
+        size_t len = size - VALUE_HEADER_SIZE;
+        const char *body = (const char *)pattern +
+            pattern_offset(key, version);
+        memcpy((char *)dest + VALUE_HEADER_SIZE, body, len);
+        crc = crc32c(0, body, len);
+    }
+
+    memcpy(header, &key, sizeof(key));
+    memcpy(header + 8, &version, sizeof(version));
+    memcpy(header + 12, &crc, sizeof(crc));
+    memcpy(dest, header, size < sizeof(header) ? size : sizeof(header));
+}
+
+enum ValueCheck value_verify(const void *data, size_t size, uint64_t key,
+                             uint32_t *version) {
+    unsigned char header[VALUE_HEADER_SIZE];
+    size_t nkey = size < sizeof(key) ? size : sizeof(key);
+    uint32_t crc;
+
+    *version = 0;
+    if (memcmp(data, &key, nkey) != 0) {
+        return VALUE_WRONG_KEY;
+    }
+    if (size < VALUE_HEADER_SIZE) {
+        /* There is no room for the checksum */
+        return VALUE_OK;
+    }
+
+    memcpy(header, data, sizeof(header));
+    memcpy(version, header + 8, sizeof(*version));
+    memcpy(&crc, header + 12, sizeof(crc));
+    if (crc32c(0, (const char *)data + VALUE_HEADER_SIZE,
+               size - VALUE_HEADER_SIZE) != crc) {
+        return VALUE_CORRUPT;
+    }
+    return VALUE_OK;
+}
@@ -0,0 +1,93 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#ifndef VALUE_H
+#define VALUE_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+    /*
+     * Values with contents that depend on the key and a version, so a
+     * get can tell that the server returned the value of another key
+     * or a corrupted value. A value starts with a header:
+     *
+     *   uint64_t key (the key index, and the group in the top 16 bits)
+     *   uint32_t version
+     *   uint32_t crc32c of the rest of the value
+     *
+     * The rest is a slice of a random pattern at an offset picked by the
+     * key and the version. Values shorter than the header only hold the
+     * start of it.
+     *
+     * The version counts the stores of the key, so the caller can tell
+     * that a get returned a value older than one the server had already
+     * acknowledged.
+     */
+#define VALUE_HEADER_SIZE 16
+
+    /**
+     * The pattern must be this much bigger than the biggest value, so
+     * every offset has enough data
+     */
+#define VALUE_PATTERN_SLACK 4096
+
+    enum ValueCheck { VALUE_OK, VALUE_WRONG_KEY, VALUE_CORRUPT };
+
+    /**
+     * Compute the crc32c (Castagnoli) of the data, with the SSE 4.2
+     * instruction if the CPU has it
+     * @param crc the crc of the data before (0 to start)
+     */
+    uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+    /**
+     * Fill the pattern the values are sliced from
+     * @param size the size of the biggest value plus VALUE_PATTERN_SLACK
+     */
+    void value_fill_pattern(void *pattern, size_t size, uint64_t seed);
+
+    /**
+     * Build the value of a key
+     * @param dest where to store the value
+     * @param size the size of the value
+     * @param pattern the pattern from value_fill_pattern
+     * @param key the key (see above)
+     * @param version the version of the value
+     */
+    void value_build(void *dest, size_t size, const void *pattern,
+                     uint64_t key, uint32_t version);
+
+    /**
+     * Check that the value belongs to the key and is intact
+     * @param version where to store the version of the value
+     */
+    enum ValueCheck value_verify(const void *data, size_t size, uint64_t key,
+                                 uint32_t *version);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,860 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+#ifdef HAVE_MEMCACHED_PROTOCOL_BINARY_H
+#include <memcached/protocol_binary.h>
+#endif
+
+#include "vclient.h"
+#include "memcachetest.h"
+#include "vbucket.h"
+
+/** Release receive buffers bigger than this between the operations */
+#define VCLIENT_MAX_IDLE_BUFFER (64 * 1024)
+
+/** Never sleep longer than this so we notice when the run ends (ms) */
+#define VCLIENT_MAX_WAIT 100
+
+/** Give up on the outstanding operations this long after the end (ns) */
+#define VCLIENT_DRAIN_TIMEOUT 1000000000
+
+enum VClientState {
+    VC_CONNECTING, VC_THINKING, VC_SENDING, VC_RECEIVING, VC_DEAD
+};
+
+#define WANT_READ 0x1
+#define WANT_WRITE 0x2
+
+struct vclient;
+
+/**
+ * A connection of a client to one of the servers
+ */
+struct vconn {
+    struct vclient *client;
+    int sock;
+    /** The events we're waiting for (WANT_READ / WANT_WRITE) */
+    int interest;
+    bool connected;
+};
+
+struct vclient {
+    int id;
+    /** A connection to every server, so an operation goes to the server
+     * of its key (like libmemc does) */
+    struct vconn *conns;
+    /** The connection of the current operation */
+    struct vconn *conn;
+    /** The number of connections that aren't established yet */
+    int connecting;
+    enum VClientState state;
+    /** The request header (and the key) */
+    char header[KEYGEN_MAX_KEY + 64];
+    /** The request (header, value, trailer) */
+    struct iovec iov[3];
+    int iovcnt;
+    int iovidx;
+    /** The data received from the server */
+    char *buffer;
+    size_t offset;
+    size_t capacity;
+    enum TxnType op;
+    bool hit;
+    hrtime_t start;
+    hrtime_t wakeup;
+};
+
+/**
+ * The event loop of a thread
+ */
+struct vclient_loop {
+    struct thread_context *ctx;
+    const struct vclient_config *config;
+    struct vclient *clients;
+    struct vconn *conns;
+    int num;
+    int active;
+    bool stopping;
+    hrtime_t stopped;
+    size_t issued;
+    uint64_t errors;
+    /** The thinking clients (a min heap on the wakeup time) */
+    struct vclient **heap;
+    int heapsize;
+#ifdef HAVE_SYS_EPOLL_H
+    int epfd;
+    struct epoll_event *events;
+#else
+    struct pollfd *pollfds;
+    struct vconn **owners;
+#endif
+};
+
+bool thinktime_parse(struct thinktime *think, const char *spec) {
+    char *end;
+    double mean = strtod(spec, &end);
+
+    if (end == spec || mean < 0) {
+        fprintf(stderr, "Invalid think time: %s\n", spec);
+        return false;
+    }
+
+    think->type = TT_EXPONENTIAL;
+    think->mean = mean * 1000000;
+    if (*end == ':') {
+        ++end;
+        if (strcmp(end, "exponential") == 0) {
+            think->type = TT_EXPONENTIAL;
+        } else if (strcmp(end, "fixed") == 0) {
+            think->type = TT_FIXED;
+        } else if (strcmp(end, "uniform") == 0) {
+            think->type = TT_UNIFORM;
+        } else {
+            fprintf(stderr, "Unknown think time distribution: %s\n", end);
+            return false;
+        }
+    } else if (*end != '\0') {
+        fprintf(stderr, "Invalid think time: %s\n", spec);
+        return false;
+    }
+
+    return true;
+}
+
+static hrtime_t thinktime_next(const struct thinktime *think, struct rng *rng) {
+    switch (think->type) {
+    case TT_FIXED:
+        return (hrtime_t)think->mean;
+    case TT_UNIFORM:
+        return (hrtime_t)(2 * think->mean * rng_double(rng));
+    case TT_EXPONENTIAL:
+    default:
+        return (hrtime_t)(-think->mean * log(1.0 - rng_double(rng)));
+    }
+}
+
+static void heap_push(struct vclient_loop *loop, struct vclient *client) {
+    int idx = loop->heapsize++;
+    while (idx > 0) {
+        int parent = (idx - 1) / 2;
+        if (loop->heap[parent]->wakeup <= client->wakeup) {
+            break;
+        }
+        loop->heap[idx] = loop->heap[parent];
+        idx = parent;
+    }
+    loop->heap[idx] = client;
+}
+
+static struct vclient *heap_pop(struct vclient_loop *loop) {
+    struct vclient *ret = loop->heap[0];
+    struct vclient *last = loop->heap[--loop->heapsize];
+    int idx = 0;
+
+    for (;;) {
+        int child = idx * 2 + 1;
+        if (child >= loop->heapsize) {
+            break;
+        }
+        if (child + 1 < loop->heapsize &&
+            loop->heap[child + 1]->wakeup < loop->heap[child]->wakeup) {
+            ++child;
+        }
+        if (last->wakeup <= loop->heap[child]->wakeup) {
+            break;
+        }
+        loop->heap[idx] = loop->heap[child];
+        idx = child;
+    }
+    if (loop->heapsize > 0) {
+        loop->heap[idx] = last;
+    }
+    return ret;
+}
+
+/**
+ * Update the events we want to be notified about for the client
+ */
+static void watch(struct vclient_loop *loop, struct vconn *conn,
+                  int interest) {
+    if (conn->interest == interest) {
+        return;
+    }
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event ev = { .data.ptr = conn };
+    if (interest & WANT_READ) {
+        ev.events |= EPOLLIN;
+    }
+    if (interest & WANT_WRITE) {
+        ev.events |= EPOLLOUT;
+    }
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, conn->sock, &ev) == -1) {
+        fprintf(stderr, "epoll_ctl() failed: %s\n", strerror(errno));
+    }
+#else
+    (void)loop;
+#endif
+    conn->interest = interest;
+}
+
+static void close_conns(struct vclient_loop *loop, struct vclient *client) {
+    for (int ii = 0; ii < loop->config->no_servers; ++ii) {
+        struct vconn *conn = &client->conns[ii];
+        if (conn->sock != -1) {
+#ifdef HAVE_SYS_EPOLL_H
+            (void)epoll_ctl(loop->epfd, EPOLL_CTL_DEL, conn->sock, NULL);
+#endif
+            close(conn->sock);
+            conn->sock = -1;
+        }
+        conn->interest = 0;
+        conn->connected = false;
+    }
+}
+
+static void client_close(struct vclient_loop *loop, struct vclient *client) {
+    close_conns(loop, client);
+    free(client->buffer);
+    client->buffer = NULL;
+    client->capacity = client->offset = 0;
+    client->state = VC_DEAD;
+    --loop->active;
+}
+
+static void client_fail(struct vclient_loop *loop, struct vclient *client,
+                        const char *msg) {
+    /* Don't flood the terminal if the server is gone */
+    if (loop->errors++ == 0) {
+        fprintf(stderr, "Virtual client %d: %s\n", client->id, msg);
+    }
+    client_close(loop, client);
+}
+
+static bool conn_connect(struct vclient_loop *loop, struct vconn *conn,
+                         const struct addrinfo *ai) {
+    int flag = 1;
+
+    conn->sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (conn->sock == -1) {
+        fprintf(stderr, "Failed to create socket: %s\n", strerror(errno));
+        return false;
+    }
+
+    if (setsockopt(conn->sock, IPPROTO_TCP, TCP_NODELAY,
+                   &flag, sizeof(flag)) == -1) {
+        perror("Failed to set TCP_NODELAY");
+    }
+
+    int flags = fcntl(conn->sock, F_GETFL, 0);
+    if (flags == -1 || fcntl(conn->sock, F_SETFL, flags | O_NONBLOCK) == -1) {
+        fprintf(stderr, "Failed to make socket non-blocking: %s\n",
+                strerror(errno));
+        close(conn->sock);
+        conn->sock = -1;
+        return false;
+    }
+
+    if (connect(conn->sock, ai->ai_addr, ai->ai_addrlen) == -1 &&
+        errno != EINPROGRESS) {
+        fprintf(stderr, "Failed to connect socket: %s\n", strerror(errno));
+        close(conn->sock);
+        conn->sock = -1;
+        return false;
+    }
+
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = conn };
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, conn->sock, &ev) == -1) {
+        fprintf(stderr, "epoll_ctl() failed: %s\n", strerror(errno));
+        close(conn->sock);
+        conn->sock = -1;
+        return false;
+    }
+#else
+    (void)loop;
+#endif
+    conn->interest = WANT_WRITE;
+    return true;
+}
+
+static bool client_connect(struct vclient_loop *loop, struct vclient *client) {
+    for (int ii = 0; ii < loop->config->no_servers; ++ii) {
+        if (!conn_connect(loop, &client->conns[ii],
+                          loop->config->servers[ii])) {
+            close_conns(loop, client);
+            return false;
+        }
+    }
+    client->conn = &client->conns[0];
+    client->connecting = loop->config->no_servers;
+    client->state = VC_CONNECTING;
+    return true;
+}
+
+/**
+ * Encode the request in the protocol we're using
+ */
+static bool encode_request(struct vclient_loop *loop, struct vclient *client,
+                           const struct vclient_op *op) {
+    /* check_opmix keeps cas (and rmw) away from the virtual clients */
+    bool store = op->op >= TX_SET && op->op <= TX_PREPEND;
+
+    client->iov[1].iov_base = (void*)op->data;
+    client->iov[1].iov_len = store ? op->size : 0;
+    client->iov[2].iov_len = 0;
+    client->iovcnt = 3;
+    client->iovidx = 0;
+
+    if (loop->config->protocol == Textual) {
+        static const char * const commands[] = {
+            [TX_GET] = "get", [TX_SET] = "set", [TX_ADD] = "add",
+            [TX_REPLACE] = "replace", [TX_APPEND] = "append",
+            [TX_PREPEND] = "prepend",
+            [TX_DELETE] = "delete", [TX_INCR] = "incr", [TX_DECR] = "decr",
+            [TX_TOUCH] = "touch", [TX_GAT] = "gat"
+        };
+        int len;
+        switch (op->op) {
+        case TX_GET:
+        case TX_DELETE:
+            len = snprintf(client->header, sizeof(client->header),
+                           "%s %.*s\r\n", commands[op->op],
+                           (int)op->nkey, op->key);
+            break;
+        case TX_INCR:
+        case TX_DECR:
+            len = snprintf(client->header, sizeof(client->header),
+                           "%s %.*s 1\r\n", commands[op->op],
+                           (int)op->nkey, op->key);
+            break;
+        case TX_TOUCH:
+            len = snprintf(client->header, sizeof(client->header),
+                           "touch %.*s %u\r\n", (int)op->nkey, op->key,
+                           op->exptime);
+            break;
+        case TX_GAT:
+            len = snprintf(client->header, sizeof(client->header),
+                           "gat %u %.*s\r\n", op->exptime,
+                           (int)op->nkey, op->key);
+            break;
+        default:
+            len = snprintf(client->header, sizeof(client->header),
+                           "%s %.*s 0 %u %lu\r\n", commands[op->op],
+                           (int)op->nkey, op->key, op->exptime,
+                           (unsigned long)op->size);
+            client->iov[2].iov_base = (void*)"\r\n";
+            client->iov[2].iov_len = 2;
+        }
+        client->iov[0].iov_base = client->header;
+        client->iov[0].iov_len = len;
+        return true;
+    }
+
+#ifdef HAVE_MEMCACHED_PROTOCOL_BINARY_H
+    static const uint8_t opcodes[] = {
+        [TX_GET] = PROTOCOL_BINARY_CMD_GET, [TX_SET] = PROTOCOL_BINARY_CMD_SET,
+        [TX_ADD] = PROTOCOL_BINARY_CMD_ADD,
+        [TX_REPLACE] = PROTOCOL_BINARY_CMD_REPLACE,
+        [TX_APPEND] = PROTOCOL_BINARY_CMD_APPEND,
+        [TX_PREPEND] = PROTOCOL_BINARY_CMD_PREPEND,
+        [TX_DELETE] = PROTOCOL_BINARY_CMD_DELETE,
+        [TX_INCR] = PROTOCOL_BINARY_CMD_INCREMENT,
+        [TX_DECR] = PROTOCOL_BINARY_CMD_DECREMENT,
+        [TX_TOUCH] = PROTOCOL_BINARY_CMD_TOUCH,
+        [TX_GAT] = PROTOCOL_BINARY_CMD_GAT
+    };
+    protocol_binary_request_header header = {
+        .request = {
+            .magic = PROTOCOL_BINARY_REQ,
+            .opcode = opcodes[op->op],
+            .keylen = htons((uint16_t)op->nkey),
+            .datatype = PROTOCOL_BINARY_RAW_BYTES,
+            .vbucket = htons(get_vbucket(op->key, op->nkey)),
+            .opaque = client->id
+        }
+    };
+    /* flags and expiration, expiration or delta, initial and expiration */
+    uint32_t extras[5] = { 0 };
+    uint8_t extlen = 0;
+    switch (op->op) {
+    case TX_GET:
+    case TX_DELETE:
+    case TX_APPEND:
+    case TX_PREPEND:
+        break;
+    case TX_TOUCH:
+    case TX_GAT:
+        extras[0] = htonl(op->exptime);
+        extlen = 4;
+        break;
+    case TX_INCR:
+    case TX_DECR:
+        extras[1] = htonl(1);
+        /* Fail if the counter doesn't exist */
+        extras[4] = 0xffffffff;
+        extlen = 20;
+        break;
+    default:
+        extras[1] = htonl(op->exptime);
+        extlen = 8;
+    }
+    header.request.extlen = extlen;
+    header.request.bodylen = htonl((uint32_t)(extlen + op->nkey +
+                                              client->iov[1].iov_len));
+
+    size_t len = sizeof(header.bytes);
+    memcpy(client->header, header.bytes, len);
+    memcpy(client->header + len, extras, extlen);
+    len += extlen;
+    memcpy(client->header + len, op->key, op->nkey);
+    client->iov[0].iov_base = client->header;
+    client->iov[0].iov_len = len + op->nkey;
+    return true;
+#else
+    (void)client;
+    fprintf(stderr, "Compiled without support for binary protocol\n");
+    return false;
+#endif
+}
+
+/**
+ * Send as much of the request as the socket accepts
+ */
+static void send_request(struct vclient_loop *loop, struct vclient *client) {
+    while (client->iovidx < client->iovcnt) {
+        ssize_t nw = writev(client->conn->sock, client->iov + client->iovidx,
+                            client->iovcnt - client->iovidx);
+        if (nw == -1) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                watch(loop, client->conn, WANT_WRITE);
+                return;
+            }
+            client_fail(loop, client, strerror(errno));
+            return;
+        }
+
+        while (client->iovidx < client->iovcnt && nw >= 0) {
+            struct iovec *iov = &client->iov[client->iovidx];
+            if ((size_t)nw >= iov->iov_len) {
+                nw -= iov->iov_len;
+                iov->iov_len = 0;
+                ++client->iovidx;
+            } else {
+                iov->iov_base = (char*)iov->iov_base + nw;
+                iov->iov_len -= nw;
+                nw = -1;
+            }
+        }
+    }
+
+    client->state = VC_RECEIVING;
+    client->hit = false;
+    watch(loop, client->conn, WANT_READ);
+}
+
+static void start_op(struct vclient_loop *loop, struct vclient *client);
+
+/**
+ * Put the client to sleep for its think time
+ */
+static void think(struct vclient_loop *loop, struct vclient *client,
+                  hrtime_t now, hrtime_t delay) {
+    if (delay == 0) {
+        start_op(loop, client);
+        return;
+    }
+    client->state = VC_THINKING;
+    client->wakeup = now + delay;
+    watch(loop, client->conn, 0);
+    heap_push(loop, client);
+}
+
+/**
+ * Check if the clients should start more operations
+ */
+static bool keep_running(struct vclient_loop *loop) {
+    if (!loop->stopping && !loop->config->running(loop->ctx, loop->issued)) {
+        loop->stopping = true;
+        loop->stopped = gethrtime();
+    }
+    return !loop->stopping;
+}
+
+static void start_op(struct vclient_loop *loop, struct vclient *client) {
+    if (!keep_running(loop)) {
+        client_close(loop, client);
+        return;
+    }
+
+    struct vclient_op op;
+    memset(&op, 0, sizeof(op));
+    loop->config->next_op(loop->ctx, &op);
+    ++loop->issued;
+
+    client->conn = &client->conns[libmemc_server(op.key, op.nkey,
+                                                 loop->config->no_servers)];
+    if (!encode_request(loop, client, &op)) {
+        client_fail(loop, client, "Failed to encode request");
+        return;
+    }
+    client->op = op.op;
+    client->state = VC_SENDING;
+    client->start = gethrtime();
+    send_request(loop, client);
+}
+
+static void complete_op(struct vclient_loop *loop, struct vclient *client) {
+    struct thread_context *ctx = loop->ctx;
+    hrtime_t now = gethrtime();
+
+    /* Like run_op, a gat that misses is a failed gat, not a get miss */
+    if (client->op == TX_GET) {
+        if (client->hit) {
+            record_tx(client->op, now - client->start, ctx);
+            __atomic_store_n(&ctx->hits, ctx->hits + 1, __ATOMIC_RELAXED);
+        } else {
+            record_miss(now - client->start, ctx);
+        }
+    } else {
+        record_tx(client->op, now - client->start, ctx);
+        if (!client->hit) {
+            record_failure(client->op, ctx);
+        }
+    }
+
+    if (client->capacity > VCLIENT_MAX_IDLE_BUFFER) {
+        free(client->buffer);
+        client->buffer = NULL;
+        client->capacity = 0;
+    }
+    think(loop, client, now, thinktime_next(&loop->config->think, &ctx->rng));
+}
+
+/**
+ * Read the response from the server
+ */
+static void receive_response(struct vclient_loop *loop, struct vclient *client) {
+    for (;;) {
+        if (client->offset == client->capacity) {
+            size_t capacity = client->capacity ? client->capacity * 2 : 4096;
+            char *buffer = realloc(client->buffer, capacity);
+            if (buffer == NULL) {
+                client_fail(loop, client, "Failed to allocate memory");
+                return;
+            }
+            client->buffer = buffer;
+            client->capacity = capacity;
+        }
+
+        ssize_t nr = recv(client->conn->sock, client->buffer + client->offset,
+                          client->capacity - client->offset, 0);
+        if (nr == -1) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            client_fail(loop, client, strerror(errno));
+            return;
+        } else if (nr == 0) {
+            client_fail(loop, client, "Lost contact with server");
+            return;
+        }
+        client->offset += nr;
+
+        bool done = false;
+        size_t used = 0;
+        while (!done && used < client->offset) {
+            struct Packet packet;
+            ssize_t len = libmemc_parse_response(client->buffer + used,
+                                                 client->offset - used,
+                                                 &packet);
+            if (len == 0) {
+                break;
+            } else if (len < 0) {
+                client_fail(loop, client, "Protocol error");
+                return;
+            }
+            used += len;
+
+            if (packet.protocol == Textual &&
+                (client->op == TX_GET || client->op == TX_GAT)) {
+                /* VALUE is followed by END */
+                if (packet.end) {
+                    done = true;
+                } else if (packet.command == CMD_GET) {
+                    client->hit = true;
+                } else {
+                    done = true;
+                }
+            } else {
+                client->hit = packet.status == 0;
+                done = true;
+            }
+        }
+
+        memmove(client->buffer, client->buffer + used, client->offset - used);
+        client->offset -= used;
+        if (done) {
+            complete_op(loop, client);
+            return;
+        }
+    }
+}
+
+static void handle_event(struct vclient_loop *loop, struct vconn *conn,
+                         bool readable, bool writable, bool error) {
+    struct vclient *client = conn->client;
+
+    if (client->state != VC_CONNECTING && conn != client->conn) {
+        /* The connections we don't use right now only report errors */
+        if (error) {
+            client_fail(loop, client, "Lost contact with server");
+        }
+        return;
+    }
+
+    switch (client->state) {
+    case VC_CONNECTING:
+        if (!conn->connected && (writable || error)) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if (getsockopt(conn->sock, SOL_SOCKET, SO_ERROR,
+                           &err, &len) == -1) {
+                err = errno;
+            }
+            if (err != 0) {
+                client_fail(loop, client, strerror(err));
+                return;
+            }
+            conn->connected = true;
+            watch(loop, conn, 0);
+            if (--client->connecting > 0) {
+                return;
+            }
+            /* Spread the first operations over the think time */
+            struct thinktime spread = {
+                .type = TT_UNIFORM, .mean = loop->config->think.mean / 2
+            };
+            think(loop, client, gethrtime(),
+                  thinktime_next(&spread, &loop->ctx->rng));
+        }
+        break;
+    case VC_SENDING:
+        if (writable || error) {
+            send_request(loop, client);
+        }
+        break;
+    case VC_RECEIVING:
+        if (readable || error) {
+            receive_response(loop, client);
+        }
+        break;
+    case VC_THINKING:
+        if (error) {
+            client_fail(loop, client, "Lost contact with server");
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * Wait for the sockets to become ready and run the clients
+ */
+static int wait_events(struct vclient_loop *loop, int timeout) {
+#ifdef HAVE_SYS_EPOLL_H
+    int nev = epoll_wait(loop->epfd, loop->events, loop->num, timeout);
+    if (nev == -1) {
+        return errno == EINTR ? 0 : -1;
+    }
+    for (int ii = 0; ii < nev; ++ii) {
+        struct vconn *conn = loop->events[ii].data.ptr;
+        uint32_t events = loop->events[ii].events;
+        /* An earlier event may have closed the client */
+        if (conn->client->state != VC_DEAD) {
+            handle_event(loop, conn, events & EPOLLIN, events & EPOLLOUT,
+                         events & (EPOLLERR | EPOLLHUP));
+        }
+    }
+#else
+    nfds_t nfds = 0;
+    for (int ii = 0; ii < loop->num * loop->config->no_servers; ++ii) {
+        struct vconn *conn = &loop->conns[ii];
+        if (conn->client->state == VC_DEAD) {
+            continue;
+        }
+        loop->pollfds[nfds].fd = conn->sock;
+        loop->pollfds[nfds].events = 0;
+        loop->pollfds[nfds].revents = 0;
+        if (conn->interest & WANT_READ) {
+            loop->pollfds[nfds].events |= POLLIN;
+        }
+        if (conn->interest & WANT_WRITE) {
+            loop->pollfds[nfds].events |= POLLOUT;
+        }
+        loop->owners[nfds++] = conn;
+    }
+
+    int nev = poll(loop->pollfds, nfds, timeout);
+    if (nev == -1) {
+        return errno == EINTR ? 0 : -1;
+    }
+    for (nfds_t ii = 0; ii < nfds && nev > 0; ++ii) {
+        short revents = loop->pollfds[ii].revents;
+        if (revents != 0) {
+            --nev;
+            if (loop->owners[ii]->client->state != VC_DEAD) {
+                handle_event(loop, loop->owners[ii], revents & POLLIN,
+                             revents & POLLOUT,
+                             revents & (POLLERR | POLLHUP | POLLNVAL));
+            }
+        }
+    }
+#endif
+    return 0;
+}
+
+int vclient_run(struct thread_context *ctx,
+                const struct vclient_config *config,
+                int first, int num) {
+    struct vclient_loop loop = {
+        .ctx = ctx, .config = config, .num = num
+    };
+    int ret = 0;
+    bool ok;
+    size_t no_conns = (size_t)num * config->no_servers;
+
+    loop.clients = calloc(num, sizeof(struct vclient));
+    loop.conns = calloc(no_conns, sizeof(struct vconn));
+    loop.heap = calloc(num, sizeof(struct vclient *));
+#ifdef HAVE_SYS_EPOLL_H
+    loop.epfd = epoll_create(no_conns > 0 ? (int)no_conns : 1);
+    loop.events = calloc(num, sizeof(struct epoll_event));
+    ok = loop.epfd != -1 && loop.events != NULL;
+#else
+    loop.pollfds = calloc(no_conns, sizeof(struct pollfd));
+    loop.owners = calloc(no_conns, sizeof(struct vconn *));
+    ok = loop.pollfds != NULL && loop.owners != NULL;
+#endif
+
+    if (!ok || loop.clients == NULL || loop.conns == NULL ||
+        loop.heap == NULL) {
+        fprintf(stderr, "Failed to create the virtual clients\n");
+        ret = -1;
+        num = 0;
+    }
+
+    for (int ii = 0; ii < num; ++ii) {
+        struct vclient *client = &loop.clients[ii];
+        client->id = first + ii;
+        client->conns = &loop.conns[ii * config->no_servers];
+        for (int jj = 0; jj < config->no_servers; ++jj) {
+            client->conns[jj].client = client;
+            client->conns[jj].sock = -1;
+        }
+        client->state = VC_DEAD;
+        if (client_connect(&loop, client)) {
+            ++loop.active;
+        } else {
+            ret = -1;
+        }
+    }
+
+    while (loop.active > 0) {
+        hrtime_t now = gethrtime();
+
+        if (!keep_running(&loop) && now - loop.stopped > VCLIENT_DRAIN_TIMEOUT) {
+            /* The server is too slow, don't keep the test running */
+            break;
+        }
+
+        /* Wake up the clients that are done thinking */
+        while (loop.heapsize > 0 &&
+               (loop.stopping || loop.heap[0]->wakeup <= now)) {
+            struct vclient *client = heap_pop(&loop);
+            if (client->state == VC_THINKING) {
+                start_op(&loop, client);
+            }
+        }
+
+        int timeout = VCLIENT_MAX_WAIT;
+        if (loop.heapsize > 0) {
+            hrtime_t wait = (loop.heap[0]->wakeup - now + 999999) / 1000000;
+            if (wait < (hrtime_t)timeout) {
+                timeout = (int)wait;
+            }
+        }
+
+        if (loop.active > 0 && wait_events(&loop, timeout) == -1) {
+            fprintf(stderr, "Failed to wait for events: %s\n", strerror(errno));
+            ret = -1;
+            break;
+        }
+    }
+
+    if (loop.errors > 1) {
+        fprintf(stderr, "%"PRIu64" virtual clients failed in thread %d\n",
+                loop.errors, ctx->id);
+    }
+
+    for (int ii = 0; ii < num; ++ii) {
+        if (loop.clients[ii].state != VC_DEAD) {
+            client_close(&loop, &loop.clients[ii]);
+        }
+    }
+
+#ifdef HAVE_SYS_EPOLL_H
+    if (loop.epfd != -1) {
+        close(loop.epfd);
+    }
+    free(loop.events);
+#else
+    free(loop.pollfds);
+    free(loop.owners);
+#endif
+    free(loop.heap);
+    free(loop.conns);
+    free(loop.clients);
+    return ret;
+}
@@ -0,0 +1,106 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * See LICENSE.txt included in this distribution for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at LICENSE.txt.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#ifndef VCLIENT_H
+#define VCLIENT_H
+
+#include <sys/types.h>
+#include <netdb.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "libmemc.h"
+#include "metrics.h"
+
+#ifdef __cplusplus
+extern "C"  {
+#endif
+
+    /*
+     * Virtual clients are non-blocking state machines that each own a
+     * connection to every server, and send an operation to the server
+     * libmemc would pick for the key. A worker thread runs thousands
+     * of them from a single event loop: a client thinks (sleeps), sends
+     * a request, waits for the response and thinks again. They speak
+     * the protocol directly (without libmemc) so they never block the
+     * thread.
+     */
+
+    enum ThinkTime { TT_EXPONENTIAL, TT_FIXED, TT_UNIFORM };
+
+    struct thinktime {
+        enum ThinkTime type;
+        /** The mean think time in ns */
+        double mean;
+    };
+
+    /**
+     * The next operation a virtual client should do
+     */
+    struct vclient_op {
+        enum TxnType op;
+        const char *key;
+        size_t nkey;
+        const void *data;
+        size_t size;
+        uint32_t exptime;
+    };
+
+    struct thread_context;
+
+    struct vclient_config {
+        enum Protocol protocol;
+        /** The servers, in the order libmemc got them */
+        struct addrinfo **servers;
+        int no_servers;
+        struct thinktime think;
+        /**
+         * Check if the thread should start more operations
+         * @param issued the number of operations the thread started
+         */
+        bool (*running)(struct thread_context *ctx, size_t issued);
+        /** Pick the next operation for a client */
+        void (*next_op)(struct thread_context *ctx, struct vclient_op *op);
+    };
+
+    /**
+     * Parse a think time specification: mean in ms, optionally followed
+     * by :exponential (default), :fixed or :uniform
+     * @return true on success
+     */
+    bool thinktime_parse(struct thinktime *think, const char *spec);
+
+    /**
+     * Run the virtual clients of a thread until running tells them to
+     * stop
+     * @param ctx the thread running the clients
+     * @param config the configuration shared by all the clients
+     * @param first the id of the first client
+     * @param num the number of clients to run
+     * @return 0 on success, -1 otherwise
+     */
+    int vclient_run(struct thread_context *ctx,
+                    const struct vclient_config *config,
+                    int first, int num);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif